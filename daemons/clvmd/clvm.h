@@ -74,6 +74,7 @@ struct clvm_header {
 #define CLVMD_CMD_VG_BACKUP	    43
 #define CLVMD_CMD_RESTART	    44
 #define CLVMD_CMD_SYNC_NAMES	    45
+#define CLVMD_CMD_GET_STATS	    46	/* Request queue and timing statistics */
 
 /* Used internally by some callers, but not part of the protocol.*/
 #ifndef NODE_ALL
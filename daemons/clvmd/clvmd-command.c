@@ -156,6 +156,12 @@ int do_command(struct local_client *client, struct clvm_header *msg, int msglen,
 			*retlen = strlen(*buf)+1;
 		break;
 
+	case CLVMD_CMD_GET_STATS:
+		status = clvmd_get_stats(*buf, buflen);
+		if (!status)
+			*retlen = strlen(*buf)+1;
+		break;
+
 	case CLVMD_CMD_VG_BACKUP:
 		/*
 		 * Do not run backup on local node, caller should do that.
@@ -275,6 +281,7 @@ int do_pre_command(struct local_client *client)
 	case CLVMD_CMD_SYNC_NAMES:
 	case CLVMD_CMD_LOCK_QUERY:
 	case CLVMD_CMD_RESTART:
+	case CLVMD_CMD_GET_STATS:
 		break;
 
 	default:
@@ -349,6 +356,7 @@ static int restart_clvmd(void)
 	int argc = 0, max_locks = 0;
 	struct dm_hash_node *hn = NULL;
 	char debug_arg[16];
+	char threads_arg[16];
 	const char *clvmd = getenv("LVM_CLVMD_BINARY") ? : CLVMD_PATH;
 
 	DEBUGLOG("clvmd restart requested\n");
@@ -363,8 +371,8 @@ static int restart_clvmd(void)
 		}
 	} while (hn);
 
-	/* clvmd + locks (-E uuid) + debug (-d X) + NULL */
-	if (!(argv = malloc((max_locks * 2 + 6) * sizeof(*argv))))
+	/* clvmd + locks (-E uuid) + debug (-d X) + threads (-p X) + NULL */
+	if (!(argv = malloc((max_locks * 2 + 7) * sizeof(*argv))))
 		goto_out;
 
 	/*
@@ -379,6 +387,13 @@ static int restart_clvmd(void)
 		argv[argc++] = debug_arg;
 	}
 
+	/* Propagate the number of LVM threads */
+	if (clvmd_get_lvm_threads() != DEFAULT_LVM_THREADS) {
+		if (dm_snprintf(threads_arg, sizeof(threads_arg), "-p%d", clvmd_get_lvm_threads()) < 0)
+			goto_out;
+		argv[argc++] = threads_arg;
+	}
+
 	/* Propagate foreground options */
 	if (clvmd_get_foreground())
 		argv[argc++] = "-f";
@@ -110,6 +110,25 @@ struct lvm_thread_cmd {
 	int remote;		/* Flag */
 	int msglen;
 	unsigned short xid;
+	const char *resource;	/* NULL if it must run alone */
+	uint64_t queued;	/* Times in microseconds */
+	uint64_t started;
+};
+
+/* Queue and execution times of the requests run by the LVM threads */
+enum {
+	LVM_STATS_LOCK_LV,
+	LVM_STATS_LOCK_VG,
+	LVM_STATS_OTHER,
+	LVM_STATS_COUNT
+};
+
+struct lvm_cmd_stats {
+	uint64_t requests;
+	uint64_t queue_us;
+	uint64_t queue_max_us;
+	uint64_t exec_us;
+	uint64_t exec_max_us;
 };
 
 struct lvm_startup_params {
@@ -119,6 +138,7 @@ struct lvm_startup_params {
 static debug_t debug = DEBUG_OFF;
 static int foreground_mode = 0;
 static pthread_t lvm_thread;
+static int lvm_threads = DEFAULT_LVM_THREADS;
 /* Stack size 128KiB for thread, must be bigger then DEFAULT_RESERVED_STACK */
 static const size_t STACK_SIZE = 128 * 1024;
 static pthread_attr_t stack_attr;
@@ -128,6 +148,9 @@ static pthread_mutex_t _debuglog_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t lvm_thread_cond;
 static pthread_barrier_t lvm_start_barrier;
 static struct dm_list lvm_cmd_head;
+static struct dm_list lvm_cmd_running;
+static struct lvm_cmd_stats lvm_stats[LVM_STATS_COUNT];
+static unsigned lvm_cmd_running_max;
 static volatile sig_atomic_t quit = 0;
 static volatile sig_atomic_t reread_config = 0;
 static int child_pipe[2];
@@ -206,12 +229,14 @@ static void usage(const char *prog, FILE *file)
 		"singlenode "
 #endif
 		"\n"
+		"   -M       Show request statistics of the running clvmd\n"
+		"   -p<n>    Number of threads running LVM commands (default: %d)\n"
 		"   -R       Tell all running clvmds in the cluster to reload their device cache\n"
 		"   -S       Restart clvmd, preserving exclusive locks\n"
 		"   -t<secs> Command timeout (default: 60 seconds)\n"
 		"   -T<secs> Startup timeout (default:  0 seconds)\n"
 		"   -V       Show version of clvmd\n"
-		"\n", prog);
+		"\n", prog, DEFAULT_LVM_THREADS);
 }
 
 /* Called to signal the parent how well we got on during initialisation */
@@ -298,9 +323,14 @@ int clvmd_get_foreground(void)
 	return foreground_mode;
 }
 
+int clvmd_get_lvm_threads(void)
+{
+	return lvm_threads;
+}
+
 static const char *decode_cmd(unsigned char cmdl)
 {
-	static char buf[128];
+	static __thread char buf[128];
 	const char *command;
 
 	switch (cmdl) {
@@ -349,6 +379,9 @@ static const char *decode_cmd(unsigned char cmdl)
 	case CLVMD_CMD_SYNC_NAMES:
 		command = "SYNC_NAMES";
 		break;
+	case CLVMD_CMD_GET_STATS:
+		command = "GET_STATS";
+		break;
 	default:
 		command = "unknown";
 		break;
@@ -411,7 +444,7 @@ int main(int argc, char *argv[])
 	/* Deal with command-line arguments */
 	opterr = 0;
 	optind = 0;
-	while ((opt = getopt_long(argc, argv, "Vhfd:t:RST:CI:E:",
+	while ((opt = getopt_long(argc, argv, "Vhfd:t:RST:CI:E:Mp:",
 				  longopts, NULL)) != -1) {
 		switch (opt) {
 		case 'h':
@@ -428,10 +461,24 @@ int main(int argc, char *argv[])
 			ret = (restart_clvmd(clusterwide_opt) == 1) ? 0 : 1;
 			goto out;
 
+		case 'M':
+			check_permissions();
+			ret = (stats_clvmd() == 1) ? 0 : 1;
+			goto out;
+
 		case 'C':
 			clusterwide_opt = 1;
 			break;
 
+		case 'p':
+			lvm_threads = atoi(optarg);
+			if (lvm_threads < 1) {
+				fprintf(stderr, "number of LVM threads is invalid\n");
+				usage(argv[0], stderr);
+				exit(1);
+			}
+			break;
+
 		case 'd':
 			debug_opt = DEBUG_STDERR;
 			debug_arg = (debug_t) atoi(optarg);
@@ -553,6 +600,7 @@ int main(int argc, char *argv[])
 
 	/* Initialise the LVM thread variables */
 	dm_list_init(&lvm_cmd_head);
+	dm_list_init(&lvm_cmd_running);
 	if (pthread_attr_init(&stack_attr) ||
 	    pthread_attr_setstacksize(&stack_attr, STACK_SIZE + getpagesize())) {
 		log_sys_error("pthread_attr_init", "");
@@ -666,7 +714,7 @@ int main(int argc, char *argv[])
 
 	pthread_mutex_lock(&lvm_thread_mutex);
 	lvm_thread_exit = 1;
-	pthread_cond_signal(&lvm_thread_cond);
+	pthread_cond_broadcast(&lvm_thread_cond);
 	pthread_mutex_unlock(&lvm_thread_mutex);
 	if ((errno = pthread_join(lvm_thread, NULL)))
 		log_sys_error("pthread_join", "");
@@ -1157,6 +1205,7 @@ static int verify_message(char *buf, int len)
 	case CLVMD_CMD_VG_BACKUP:
 	case CLVMD_CMD_RESTART:
 	case CLVMD_CMD_SYNC_NAMES:
+	case CLVMD_CMD_GET_STATS:
 		break;
 	default:
 		log_error("verify_message bad cmd %x.", h->cmd);
@@ -2048,48 +2097,194 @@ static int process_work_item(struct lvm_thread_cmd *cmd)
 	return 0;
 }
 
+static uint64_t _now_us(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		return 0;
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 /*
- * Routine that runs in the "LVM thread".
+ * Name of the resource a request works on.  LV requests use the LV uuid,
+ * VG requests the VG name (shared by its V_ and P_ locks).  Requests not
+ * touching LVM share a name of their own.  Anything else, including the
+ * cleanup of a client, returns NULL and has to run alone.
  */
-static void *lvm_thread_fn(void *arg)
+static const char *_cmd_resource(const struct clvm_header *msg, int msglen)
 {
-	sigset_t ss;
-	struct lvm_startup_params *lvm_params = arg;
-	struct lvm_thread_cmd *cmd;
+	const char *resource, *end;
 
-	DEBUGLOG("LVM thread function started\n");
+	if (!msg || msglen <= (int) offsetof(struct clvm_header, node))
+		return NULL;
 
-	/* Ignore SIGUSR1 & 2 */
-	sigemptyset(&ss);
-	sigaddset(&ss, SIGUSR1);
-	sigaddset(&ss, SIGUSR2);
-	pthread_sigmask(SIG_BLOCK, &ss, NULL);
+	switch (msg->cmd) {
+	case CLVMD_CMD_LOCK_LV:
+	case CLVMD_CMD_LOCK_VG:
+	case CLVMD_CMD_LOCK_QUERY:
+		break;
+	case CLVMD_CMD_GET_CLUSTERNAME:
+	case CLVMD_CMD_SET_DEBUG:
+	case CLVMD_CMD_GET_STATS:
+		return "#clvmd";
+	default:
+		return NULL;
+	}
 
-	/* Initialise the interface to liblvm */
-	init_clvm(lvm_params->excl_uuid);
+	/* Same layout as do_command(): two bytes of flags then the name */
+	resource = (const char *) msg + offsetof(struct clvm_header, node);
+	end = (const char *) msg + msglen;
+	if (!(resource = memchr(resource, 0, end - resource)) ||
+	    (resource += 3) >= end || !memchr(resource, 0, end - resource))
+		return NULL;
 
-	/* Allow others to get moving */
-	pthread_barrier_wait(&lvm_start_barrier);
-	DEBUGLOG("LVM thread ready for work.\n");
+	/* Skip the V_ or P_ prefix */
+	if (msg->cmd == CLVMD_CMD_LOCK_VG && resource[0] && resource[1])
+		resource += 2;
+
+	return resource;
+}
+
+/* Requests for the same resource, or without one, must not overlap */
+static int _cmd_conflict(const struct lvm_thread_cmd *a, const struct lvm_thread_cmd *b)
+{
+	return !a->resource || !b->resource || !strcmp(a->resource, b->resource);
+}
+
+/*
+ * Return the first queued request that can run now: one that does not
+ * conflict with any running request or with any request queued before it.
+ * Requests for the same resource thus run in the order they arrived and
+ * a request without a resource waits for everything before it, and
+ * everything after it waits for it.  Called with lvm_thread_mutex held.
+ */
+static struct lvm_thread_cmd *_next_lvm_cmd(void)
+{
+	struct lvm_thread_cmd *cmd, *other;
+
+	dm_list_iterate_items(cmd, &lvm_cmd_head) {
+		dm_list_iterate_items(other, &lvm_cmd_running)
+			if (_cmd_conflict(cmd, other))
+				goto next;
+
+		dm_list_iterate_items(other, &lvm_cmd_head) {
+			if (other == cmd)
+				return cmd;
+			if (_cmd_conflict(cmd, other))
+				break;
+		}
+next:
+		if (!cmd->resource)
+			break;
+	}
+
+	return NULL;
+}
+
+/* Account a finished request.  Called with lvm_thread_mutex held. */
+static void _update_lvm_stats(const struct lvm_thread_cmd *cmd)
+{
+	struct lvm_cmd_stats *stats;
+	uint64_t queue_us, exec_us;
+
+	if (!cmd->msg)
+		return;	/* Client cleanup */
+
+	switch (cmd->msg->cmd) {
+	case CLVMD_CMD_LOCK_LV:
+		stats = &lvm_stats[LVM_STATS_LOCK_LV];
+		break;
+	case CLVMD_CMD_LOCK_VG:
+		stats = &lvm_stats[LVM_STATS_LOCK_VG];
+		break;
+	default:
+		stats = &lvm_stats[LVM_STATS_OTHER];
+	}
+
+	queue_us = cmd->started - cmd->queued;
+	exec_us = _now_us() - cmd->started;
+
+	stats->requests++;
+	stats->queue_us += queue_us;
+	stats->exec_us += exec_us;
+	if (queue_us > stats->queue_max_us)
+		stats->queue_max_us = queue_us;
+	if (exec_us > stats->exec_max_us)
+		stats->exec_max_us = exec_us;
+
+	DEBUGLOG("(%p) %s queued for %" PRIu64 " us, ran for %" PRIu64 " us\n",
+		 cmd->client, decode_cmd(cmd->msg->cmd), queue_us, exec_us);
+}
+
+int clvmd_get_stats(char *buf, int buflen)
+{
+	static const char *_names[LVM_STATS_COUNT] = { "lock_lv", "lock_vg", "other" };
+	struct lvm_cmd_stats stats[LVM_STATS_COUNT];
+	unsigned queued, running, running_max;
+	int i, len, r;
+
+	pthread_mutex_lock(&lvm_thread_mutex);
+	memcpy(stats, lvm_stats, sizeof(stats));
+	queued = dm_list_size(&lvm_cmd_head);
+	running = dm_list_size(&lvm_cmd_running);
+	running_max = lvm_cmd_running_max;
+	pthread_mutex_unlock(&lvm_thread_mutex);
+
+	/* The request asking for this is counted as running */
+	if ((len = dm_snprintf(buf, buflen, "threads %d queued %u running %u running_max %u\n",
+			       lvm_threads, queued, running, running_max)) < 0)
+		return ENOSPC;
+
+	for (i = 0; i < LVM_STATS_COUNT; i++) {
+		if (!stats[i].requests)
+			continue;
+		if ((r = dm_snprintf(buf + len, buflen - len,
+				     "%s requests %" PRIu64
+				     " queue_us avg %" PRIu64 " max %" PRIu64
+				     " exec_us avg %" PRIu64 " max %" PRIu64 "\n",
+				     _names[i], stats[i].requests,
+				     stats[i].queue_us / stats[i].requests,
+				     stats[i].queue_max_us,
+				     stats[i].exec_us / stats[i].requests,
+				     stats[i].exec_max_us)) < 0)
+			return ENOSPC;
+		len += r;
+	}
+
+	return 0;
+}
+
+/* Run requests from the queue until clvmd exits */
+static void lvm_thread_work(void)
+{
+	struct lvm_thread_cmd *cmd;
+	unsigned running;
 
-	/* Now wait for some actual work */
 	pthread_mutex_lock(&lvm_thread_mutex);
 
 	for (;;) {
-		while (!dm_list_empty(&lvm_cmd_head)) {
-			cmd = dm_list_item(dm_list_first(&lvm_cmd_head),
-					   struct lvm_thread_cmd);
-			dm_list_del(&cmd->list);
+		while ((cmd = _next_lvm_cmd())) {
+			dm_list_move(&lvm_cmd_running, &cmd->list);
+			cmd->started = _now_us();
+			if ((running = dm_list_size(&lvm_cmd_running)) > lvm_cmd_running_max)
+				lvm_cmd_running_max = running;
 			pthread_mutex_unlock(&lvm_thread_mutex);
 
 			process_work_item(cmd);
+
+			pthread_mutex_lock(&lvm_thread_mutex);
+			dm_list_del(&cmd->list);
+			_update_lvm_stats(cmd);
 			dm_free(cmd->msg);
 			dm_free(cmd);
 
-			pthread_mutex_lock(&lvm_thread_mutex);
+			/* Requests waiting for this one may run now */
+			pthread_cond_broadcast(&lvm_thread_cond);
 		}
 
-		if  (lvm_thread_exit)
+		if (lvm_thread_exit && dm_list_empty(&lvm_cmd_head))
 			break;
 
 		DEBUGLOG("LVM thread waiting for work\n");
@@ -2097,6 +2292,63 @@ static void *lvm_thread_fn(void *arg)
 	}
 
 	pthread_mutex_unlock(&lvm_thread_mutex);
+}
+
+/*
+ * Routine that runs in the other LVM threads.
+ */
+static void *lvm_worker_fn(void *arg __attribute__((unused)))
+{
+	lvm_thread_work();
+
+	return NULL;
+}
+
+/*
+ * Routine that runs in the "LVM thread".  It sets up liblvm, starts the
+ * other LVM threads sharing it and tears it down when they are all done.
+ * Everything done through liblvm is serialised by lvm-functions.c, the
+ * threads let requests for different resources wait for cluster locks
+ * and replies at the same time.
+ */
+static void *lvm_thread_fn(void *arg)
+{
+	sigset_t ss;
+	struct lvm_startup_params *lvm_params = arg;
+	pthread_t *workers;
+	int i, started = 0;
+
+	DEBUGLOG("LVM thread function started\n");
+
+	/* Ignore SIGUSR1 & 2 */
+	sigemptyset(&ss);
+	sigaddset(&ss, SIGUSR1);
+	sigaddset(&ss, SIGUSR2);
+	pthread_sigmask(SIG_BLOCK, &ss, NULL);
+
+	/* Initialise the interface to liblvm */
+	init_clvm(lvm_params->excl_uuid);
+
+	if ((workers = dm_malloc(sizeof(*workers) * lvm_threads)))
+		for (started = 1; started < lvm_threads; started++)
+			if (pthread_create(&workers[started], &stack_attr, lvm_worker_fn, NULL)) {
+				log_sys_error("pthread_create", "");
+				break;
+			}
+	DEBUGLOG("Started %d LVM threads\n", started ? : 1);
+
+	/* Allow others to get moving */
+	pthread_barrier_wait(&lvm_start_barrier);
+	DEBUGLOG("LVM thread ready for work.\n");
+
+	/* Now wait for some actual work */
+	lvm_thread_work();
+
+	for (i = 1; i < started; i++)
+		if ((errno = pthread_join(workers[i], NULL)))
+			log_sys_error("pthread_join", "");
+	dm_free(workers);
+
 	DEBUGLOG("LVM thread exits\n");
 
 	destroy_lvm();
@@ -2127,6 +2379,8 @@ static int add_to_lvmqueue(struct local_client *client, struct clvm_header *msg,
 	cmd->client = client;
 	cmd->msglen = msglen;
 	cmd->xid = client->xid;
+	cmd->resource = _cmd_resource(cmd->msg, msglen);
+	cmd->queued = _now_us();
 
 	if (csid) {
 		memcpy(cmd->csid, csid, max_csid_len);
@@ -2134,8 +2388,8 @@ static int add_to_lvmqueue(struct local_client *client, struct clvm_header *msg,
 	} else
 		cmd->remote = 0;
 
-	DEBUGLOG("(%p) add_to_lvmqueue: cmd=%p, msg=%p, len=%d, csid=%p, xid=%d\n",
-		 client, cmd, msg, msglen, csid, cmd->xid);
+	DEBUGLOG("(%p) add_to_lvmqueue: cmd=%p, msg=%p, len=%d, csid=%p, xid=%d, resource=%s\n",
+		 client, cmd, msg, msglen, csid, cmd->xid, cmd->resource ? : "-");
 	pthread_mutex_lock(&lvm_thread_mutex);
 	if (lvm_thread_exit) {
 		pthread_mutex_unlock(&lvm_thread_mutex);
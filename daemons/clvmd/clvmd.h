@@ -24,6 +24,9 @@
    before declaring them dead */
 #define DEFAULT_CMD_TIMEOUT 60
 
+/* Default number of threads running LVM commands */
+#define DEFAULT_LVM_THREADS 4
+
 /* One of these for each reply we get from command execution on a node */
 struct node_reply {
 	char node[MAX_CLUSTER_MEMBER_NAME_LEN];
@@ -119,6 +122,8 @@ extern void debuglog(const char *fmt, ... )
 void clvmd_set_debug(debug_t new_de);
 debug_t clvmd_get_debug(void);
 int clvmd_get_foreground(void);
+int clvmd_get_lvm_threads(void);
+int clvmd_get_stats(char *buf, int buflen);
 
 int sync_lock(const char *resource, int mode, int flags, int *lockid);
 int sync_unlock(const char *resource, int lockid);
@@ -36,7 +36,8 @@ static struct cmd_context *cmd = NULL;
 static struct dm_hash_table *lv_hash = NULL;
 static pthread_mutex_t lv_hash_lock;
 static pthread_mutex_t lvm_lock;
-static char last_error[1024];
+/* Each LVM thread returns the errors of its own command */
+static __thread char last_error[1024];
 
 struct lv_info {
 	int lock_id;
@@ -335,6 +336,44 @@ static int hold_unlock(char *resource)
 	return status;
 }
 
+/*
+ * Take lvm_lock and set up the global liblvm state for a LOCK_LV command.
+ * Other LVM threads may run their own commands whenever it is released.
+ */
+static void _lock_lvm(unsigned char lock_flags)
+{
+	pthread_mutex_lock(&lvm_lock);
+	init_test((lock_flags & LCK_TEST_MODE) ? 1 : 0);
+
+	if (lock_flags & LCK_MIRROR_NOSYNC_MODE)
+		init_mirror_in_sync(1);
+
+	if (lock_flags & LCK_DMEVENTD_MONITOR_IGNORE)
+		init_dmeventd_monitor(DMEVENTD_MONITOR_IGNORE);
+	else {
+		if (lock_flags & LCK_DMEVENTD_MONITOR_MODE)
+			init_dmeventd_monitor(1);
+		else
+			init_dmeventd_monitor(0);
+	}
+
+	cmd->partial_activation = (lock_flags & LCK_PARTIAL_MODE) ? 1 : 0;
+
+	/* clvmd should never try to read suspended device */
+	init_ignore_suspended_devices(1);
+}
+
+static void _unlock_lvm(unsigned char lock_flags)
+{
+	if (lock_flags & LCK_MIRROR_NOSYNC_MODE)
+		init_mirror_in_sync(0);
+
+	cmd->partial_activation = 0;
+
+	init_test(0);
+	pthread_mutex_unlock(&lvm_lock);
+}
+
 /* Watch the return codes here.
    liblvm API functions return 1(true) for success, 0(false) for failure and don't set errno.
    libdlm API functions return 0 for success, -1 for failure and do set errno.
@@ -346,6 +385,7 @@ static int do_activate_lv(char *resource, unsigned char command, unsigned char l
 {
 	int oldmode;
 	int status;
+	int saved_errno;
 	int activate_lv;
 	int exclusive = 0;
 	struct lvinfo lvi;
@@ -374,9 +414,15 @@ static int do_activate_lv(char *resource, unsigned char command, unsigned char l
 	 * Try to get the lock if it's a clustered volume group.
 	 * Use lock conversion only if requested, to prevent implicit conversion
 	 * of exclusive lock to shared one during activation.
+	 * Nothing from liblvm is needed while the cluster answers, so let
+	 * the other LVM threads use it meanwhile.
 	 */
 	if (!test_mode() && command & LCK_CLUSTER_VG) {
+		_unlock_lvm(lock_flags);
 		status = hold_lock(resource, mode, LCKF_NOQUEUE | ((lock_flags & LCK_CONVERT_MODE) ? LCKF_CONVERT:0));
+		saved_errno = errno;
+		_lock_lvm(lock_flags);
+		errno = saved_errno;
 		if (status) {
 			/* Return an LVM-sensible error for this.
 			 * Forcing EIO makes the upper level return this text
@@ -519,25 +565,7 @@ int do_lock_lv(unsigned char command, unsigned char lock_flags, char *resource)
 		}
 	}
 
-	pthread_mutex_lock(&lvm_lock);
-	init_test((lock_flags & LCK_TEST_MODE) ? 1 : 0);
-
-	if (lock_flags & LCK_MIRROR_NOSYNC_MODE)
-		init_mirror_in_sync(1);
-
-	if (lock_flags & LCK_DMEVENTD_MONITOR_IGNORE)
-		init_dmeventd_monitor(DMEVENTD_MONITOR_IGNORE);
-	else {
-		if (lock_flags & LCK_DMEVENTD_MONITOR_MODE)
-			init_dmeventd_monitor(1);
-		else
-			init_dmeventd_monitor(0);
-	}
-
-	cmd->partial_activation = (lock_flags & LCK_PARTIAL_MODE) ? 1 : 0;
-
-	/* clvmd should never try to read suspended device */
-	init_ignore_suspended_devices(1);
+	_lock_lvm(lock_flags);
 
 	switch (command & LCK_MASK) {
 	case LCK_LV_EXCLUSIVE:
@@ -567,15 +595,9 @@ int do_lock_lv(unsigned char command, unsigned char lock_flags, char *resource)
 		break;
 	}
 
-	if (lock_flags & LCK_MIRROR_NOSYNC_MODE)
-		init_mirror_in_sync(0);
-
-	cmd->partial_activation = 0;
-
 	/* clean the pool for another command */
 	dm_pool_empty(cmd->mem);
-	init_test(0);
-	pthread_mutex_unlock(&lvm_lock);
+	_unlock_lvm(lock_flags);
 
 	DEBUGLOG("Command return is %d, critical_section is %d\n", status, critical_section());
 	return status;
@@ -380,3 +380,43 @@ int debug_clvmd(int level, int clusterwide)
 
 	return status;
 }
+
+/*
+ * Only asks the local clvmd, older clvmds on other nodes would reject
+ * the command and the request would wait for their replies to time out.
+ */
+int stats_clvmd(void)
+{
+	int num_responses;
+	char args[1]; // No args really.
+	lvm_response_t *response = NULL;
+	int saved_errno;
+	int status;
+	int i;
+
+	status = _cluster_request(CLVMD_CMD_GET_STATS, NODE_LOCAL, args, 0, &response, &num_responses, 0);
+
+	for (i = 0; i < num_responses; i++) {
+		if (response[i].status == EHOSTDOWN) {
+			fprintf(stderr, "clvmd not running on node %s",
+				  response[i].node);
+			status = 0;
+			errno = response[i].status;
+		} else if (response[i].status) {
+			fprintf(stderr, "Error getting statistics of node %s: %s",
+				  response[i].node,
+				  response[i].response[0] ?
+				  	response[i].response :
+				  	strerror(response[i].status));
+			status = 0;
+			errno = response[i].status;
+		} else
+			printf("%s", response[i].response);
+	}
+
+	saved_errno = errno;
+	_cluster_free_request(response, num_responses);
+	errno = saved_errno;
+
+	return status;
+}
@@ -16,4 +16,5 @@
 int refresh_clvmd(int all_nodes);
 int restart_clvmd(int all_nodes);
 int debug_clvmd(int level, int clusterwide);
+int stats_clvmd(void);
 
@@ -33,31 +33,73 @@ static void daemonize(void);
 static void init_all(void);
 static void cleanup_all(void);
 
+static int single_node = 0;
+static unsigned batch_size = 1024;	/* capped by the request size */
+static unsigned batch_window = 10;
+
 static void usage (FILE *dest)
 {
 	fprintf (dest, "Usage: cmirrord [options]\n"
-		 "   -f, --foreground    stay in the foreground, log to the terminal\n"
-		 "   -h, --help          print this help\n");
+		 "   -b, --batch-size N    send up to N queued mark or clear regions\n"
+		 "                         of a log together, 0 disables queueing\n"
+		 "   -f, --foreground      stay in the foreground, log to the terminal\n"
+		 "   -h, --help            print this help\n"
+		 "   -s, --single-node     run without corosync as the only node\n"
+		 "   -w, --batch-window MS queue mark and clear requests for up to MS ms\n");
+}
+
+static int parse_unsigned(const char *arg, unsigned *value)
+{
+	char *end;
+	unsigned long v;
+
+	errno = 0;
+	v = strtoul(arg, &end, 10);
+	if (errno || !*arg || *end || (v > UINT32_MAX))
+		return 0;
+
+	*value = (unsigned)v;
+
+	return 1;
 }
 
 int main(int argc, char *argv[])
 {
 	int foreground_mode = 0;
 	struct option longopts[] = {
-		{ "foreground", no_argument, NULL, 'f' },
-		{ "help"      , no_argument, NULL, 'h' },
+		{ "batch-size"  , required_argument, NULL, 'b' },
+		{ "foreground"  , no_argument, NULL, 'f' },
+		{ "help"        , no_argument, NULL, 'h' },
+		{ "single-node" , no_argument, NULL, 's' },
+		{ "batch-window", required_argument, NULL, 'w' },
 		{ 0, 0, 0, 0 }
 	};
 	int opt;
 
-	while ((opt = getopt_long (argc, argv, "fh", longopts, NULL)) != -1) {
+	while ((opt = getopt_long (argc, argv, "b:fhsw:", longopts, NULL)) != -1) {
 		switch (opt) {
+		case 'b':
+			if (!parse_unsigned(optarg, &batch_size)) {
+				usage (stderr);
+				exit (2);
+			}
+			break;
 		case 'f':
 			foreground_mode = 1;
 			break;
 		case 'h':
 			usage (stdout);
 			exit (0);
+		case 's':
+			single_node = 1;
+			break;
+		case 'w':
+			if (!parse_unsigned(optarg, &batch_window) ||
+			    (batch_window > 1000)) {
+				usage (stderr);
+				exit (2);
+			}
+			break;
 		default:
 			usage (stderr);
 			exit (2);
@@ -82,10 +124,12 @@ int main(int argc, char *argv[])
 	LOG_DBG(" Compiled with debugging.");
 
 	while (!exit_now) {
-		links_monitor();
+		links_monitor(cluster_batch_timeout());
 
 		links_issue_callbacks();
 
+		cluster_batch_expire();
+
 		process_signals();
 	}
 	exit(EXIT_SUCCESS);
@@ -275,7 +319,7 @@ static void init_all(void)
 	signal_received = 0;
 
 	if ((r = init_local()) ||
-	    (r = init_cluster())) {
+	    (r = init_cluster(single_node, batch_size, batch_window))) {
 		exit(r);
 	}
 }
@@ -20,7 +20,9 @@
 
 #include <corosync/cpg.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
+#include <time.h>
 #include <unistd.h>
 #if CMIRROR_HAS_CHECKPOINT
 #include <openais/saAis.h>
@@ -152,35 +154,192 @@ struct clog_cpg {
 	struct checkpoint_data *checkpoint_list;
 	int idx;
 	char debugging[DEBUGGING_HISTORY][DEBUGGING_BUFLEN];
+
+	/* Mark and clear requests not sent yet, see cluster_queue() */
+	struct clog_request *clear_batch;
+	struct clog_request *mark_batch;
+	uint64_t batch_start;
+	struct dm_list mark_batches;	/* mark batches awaiting response */
+	int batch_error;		/* reported with the next flush */
+
+	/* Loopback replacing the CPG in single node mode */
+	int loop_fd[2];
+	struct dm_list loop_events;
+};
+
+struct mark_batch {
+	struct dm_list list;
+	uint32_t seq;
+};
+
+#define LOOP_JOIN    1
+#define LOOP_LEAVE   2
+#define LOOP_MESSAGE 3
+struct loop_event {
+	struct dm_list list;
+	int type;
+	size_t len;
+	char msg[0];
 };
 
 static struct dm_list clog_cpg_list;
 
+/*
+ * The regions of coalesced requests must fit in a request buffer
+ * of every node.
+ */
+#define MAX_BATCH_REGIONS \
+	((DM_ULOG_REQUEST_SIZE - sizeof(struct clog_request)) / sizeof(uint64_t))
+
+static unsigned batch_size = MAX_BATCH_REGIONS;
+static unsigned batch_window = 10; /* ms */
+
+/*
+ * In single node mode this node is the only member of every CPG and
+ * no corosync is needed.  Messages are queued to ourselves and
+ * delivered on the next dispatch, as the CPG would do.
+ */
+static int single_node = 0;
+static cpg_handle_t loop_handles = 0;
+#define LOOP_NODEID 1
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		return 0;
+
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int loop_queue(struct clog_cpg *entry, int type,
+		      const void *msg, size_t len)
+{
+	struct loop_event *ev;
+
+	if (entry->loop_fd[1] < 0)
+		return CS_ERR_BAD_HANDLE;
+
+	if (!(ev = malloc(sizeof(*ev) + len)))
+		return CS_ERR_NO_MEMORY;
+
+	ev->type = type;
+	ev->len = len;
+	if (len)
+		memcpy(ev->msg, msg, len);
+	dm_list_add(&entry->loop_events, &ev->list);
+
+	/* Wake up the dispatch, a full pipe already does */
+	if ((write(entry->loop_fd[1], "", 1) < 0) && (errno != EAGAIN))
+		LOG_ERROR("[%s] Failed to wake up loopback: %s",
+			  SHORT_UUID(entry->name.value), strerror(errno));
+
+	return CS_OK;
+}
+
+static int loop_init(struct clog_cpg *entry)
+{
+	if (pipe(entry->loop_fd))
+		return CS_ERR_LIBRARY;
+
+	if ((fcntl(entry->loop_fd[0], F_SETFL, O_NONBLOCK) < 0) ||
+	    (fcntl(entry->loop_fd[1], F_SETFL, O_NONBLOCK) < 0)) {
+		(void) close(entry->loop_fd[0]);
+		(void) close(entry->loop_fd[1]);
+		entry->loop_fd[0] = entry->loop_fd[1] = -1;
+		return CS_ERR_LIBRARY;
+	}
+
+	entry->handle = ++loop_handles;
+
+	return CS_OK;
+}
+
+static void loop_finalize(struct clog_cpg *entry)
+{
+	struct loop_event *ev, *tmp;
+
+	dm_list_iterate_items_safe(ev, tmp, &entry->loop_events) {
+		dm_list_del(&ev->list);
+		free(ev);
+	}
+
+	if (entry->loop_fd[0] >= 0) {
+		(void) close(entry->loop_fd[0]);
+		(void) close(entry->loop_fd[1]);
+		entry->loop_fd[0] = entry->loop_fd[1] = -1;
+	}
+}
+
+static int _cpg_mcast(struct clog_cpg *entry, struct iovec *iov)
+{
+	if (single_node)
+		return loop_queue(entry, LOOP_MESSAGE, iov->iov_base, iov->iov_len);
+
+	return cpg_mcast_joined(entry->handle, CPG_TYPE_AGREED, iov, 1);
+}
+
+static int _cpg_fd(struct clog_cpg *entry)
+{
+	int fd = -1;
+
+	if (single_node)
+		return entry->loop_fd[0];
+
+	cpg_fd_get(entry->handle, &fd);
+
+	return fd;
+}
+
+static void _cpg_finalize(struct clog_cpg *entry)
+{
+	if (single_node)
+		loop_finalize(entry);
+	else
+		cpg_finalize(entry->handle);
+}
+
+static struct clog_cpg *get_clog_cpg(const char *uuid)
+{
+	struct clog_cpg *entry;
+
+	dm_list_iterate_items(entry, &clog_cpg_list)
+		if (!strncmp(entry->name.value, uuid, CPG_MAX_NAME_LENGTH))
+			return entry;
+
+	return NULL;
+}
+
 /*
  * cluster_send
  * @rq
  *
  * Returns: 0 on success, -Exxx on error
  */
+static int send_batches(struct clog_cpg *entry);
+static int _cluster_send(struct clog_cpg *entry, struct clog_request *rq);
+
 int cluster_send(struct clog_request *rq)
 {
-	int r;
-	int found = 0;
-	struct iovec iov;
 	struct clog_cpg *entry;
 
-	dm_list_iterate_items(entry, &clog_cpg_list)
-		if (!strncmp(entry->name.value, rq->u_rq.uuid,
-			     CPG_MAX_NAME_LENGTH)) {
-			found = 1;
-			break;
-		}
-
-	if (!found) {
+	if (!(entry = get_clog_cpg(rq->u_rq.uuid))) {
 		rq->u_rq.error = -ENOENT;
 		return -ENOENT;
 	}
 
+	/* Anything queued before this request goes out first */
+	send_batches(entry);
+
+	return _cluster_send(entry, rq);
+}
+
+static int _cluster_send(struct clog_cpg *entry, struct clog_request *rq)
+{
+	int r;
+	struct iovec iov;
+
 	/*
 	 * Once the request heads for the cluster, the luid loses
 	 * all its meaning.
@@ -205,7 +364,7 @@ int cluster_send(struct clog_request *rq)
 	do {
 		int count = 0;
 
-		r = cpg_mcast_joined(entry->handle, CPG_TYPE_AGREED, &iov, 1);
+		r = _cpg_mcast(entry, &iov);
 		if (r != SA_AIS_ERR_TRY_AGAIN)
 			break;
 		count++;
@@ -229,7 +388,7 @@ int cluster_send(struct clog_request *rq)
 		usleep(1000);
 	} while (1);
 #else
-	r = cpg_mcast_joined(entry->handle, CPG_TYPE_AGREED, &iov, 1);
+	r = _cpg_mcast(entry, &iov);
 #endif
 	if (r == CS_OK)
 		return 0;
@@ -241,6 +400,197 @@ int cluster_send(struct clog_request *rq)
 	return -EBADE;
 }
 
+/*
+ * send_batches
+ * @entry
+ *
+ * Sends the queued clear and mark requests of the log, clears first
+ * like the kernel does.  Both have been acknowledged to the kernel
+ * already, so a failure is kept for the next flush, which covers
+ * every request queued before it.
+ *
+ * Returns: 0 on success, -Exxx on error
+ */
+static int send_batches(struct clog_cpg *entry)
+{
+	int r = 0, mr = 0;
+	struct mark_batch *mb;
+	struct clog_request *rq;
+
+	if ((rq = entry->clear_batch)) {
+		entry->clear_batch = NULL;
+		if ((r = _cluster_send(entry, rq)) && !entry->batch_error)
+			entry->batch_error = r;
+		free(rq);
+	}
+
+	if ((rq = entry->mark_batch)) {
+		entry->mark_batch = NULL;
+
+		if (!(mb = malloc(sizeof(*mb))))
+			mr = -ENOMEM;
+		else {
+			mb->seq = rq->u_rq.seq;
+			dm_list_add(&entry->mark_batches, &mb->list);
+			if ((mr = _cluster_send(entry, rq))) {
+				dm_list_del(&mb->list);
+				free(mb);
+			}
+		}
+
+		if (mr) {
+			r = mr;
+			if (!entry->batch_error)
+				entry->batch_error = mr;
+		}
+		free(rq);
+	}
+
+	return r;
+}
+
+static void free_batches(struct clog_cpg *entry)
+{
+	struct mark_batch *mb, *tmp;
+
+	free(entry->clear_batch);
+	entry->clear_batch = NULL;
+	free(entry->mark_batch);
+	entry->mark_batch = NULL;
+
+	dm_list_iterate_items_safe(mb, tmp, &entry->mark_batches) {
+		dm_list_del(&mb->list);
+		free(mb);
+	}
+}
+
+/*
+ * Is the response for a mark batch?  Its requests were answered
+ * when they were queued, so only a failure is kept.
+ */
+static int mark_batch_response(struct clog_cpg *entry, struct clog_request *rq)
+{
+	struct mark_batch *mb;
+
+	dm_list_iterate_items(mb, &entry->mark_batches)
+		if (mb->seq == rq->u_rq.seq) {
+			dm_list_del(&mb->list);
+			free(mb);
+			if (rq->u_rq.error && !entry->batch_error)
+				entry->batch_error = rq->u_rq.error;
+			return 1;
+		}
+
+	return 0;
+}
+
+/*
+ * cluster_queue
+ * @rq: a mark or clear request from the kernel
+ *
+ * Mark and clear requests of a log are gathered into one request
+ * with all their regions.  The kernel follows them with a flush and
+ * only relies on the marks after the flush completed.  Since every
+ * other request of the log sends the queue first, the server has
+ * processed them by then.  A queue is also sent when it is full or
+ * older than the batch window.
+ *
+ * If the request is queued, the caller acknowledges it to the kernel.
+ * Otherwise it is sent with cluster_send() as usual.
+ *
+ * Returns: 0 if queued, 1 if not queued, -Exxx on error
+ */
+int cluster_queue(struct clog_request *rq)
+{
+	struct clog_cpg *entry;
+	struct clog_request **batch;
+	unsigned count = rq->u_rq.data_size / sizeof(uint64_t);
+	unsigned queued;
+
+	if (!batch_size || !(entry = get_clog_cpg(rq->u_rq.uuid)) ||
+	    (entry->cpg_state != VALID) ||
+	    (rq->u_rq.data_size % sizeof(uint64_t)) ||
+	    (count > MAX_BATCH_REGIONS))
+		return 1;
+
+	/* Keep a clear of a region after its queued mark */
+	if ((rq->u_rq.request_type == DM_ULOG_CLEAR_REGION) && entry->mark_batch)
+		send_batches(entry);
+
+	batch = (rq->u_rq.request_type == DM_ULOG_MARK_REGION) ?
+		&entry->mark_batch : &entry->clear_batch;
+
+	queued = *batch ? (*batch)->u_rq.data_size / sizeof(uint64_t) : 0;
+	if (queued && (queued + count > MAX_BATCH_REGIONS)) {
+		send_batches(entry);
+		queued = 0;
+	}
+
+	if (!*batch) {
+		if (!entry->clear_batch && !entry->mark_batch)
+			entry->batch_start = now_ms();
+
+		if (!(*batch = malloc(DM_ULOG_REQUEST_SIZE)))
+			return -ENOMEM;
+
+		memcpy(*batch, rq, sizeof(*rq));
+		(*batch)->u_rq.data_size = 0;
+	}
+
+	memcpy((*batch)->u_rq.data + (*batch)->u_rq.data_size,
+	       rq->u_rq.data, rq->u_rq.data_size);
+	(*batch)->u_rq.data_size += rq->u_rq.data_size;
+	/* The response to a batch is matched by the last seq */
+	(*batch)->u_rq.seq = rq->u_rq.seq;
+
+	/* Any failure is reported like that of a queued request */
+	if (queued + count >= batch_size)
+		(void) send_batches(entry);
+
+	return 0;
+}
+
+/*
+ * cluster_batch_timeout
+ *
+ * Returns: ms until the oldest queue is due, -1 if nothing is queued
+ */
+int cluster_batch_timeout(void)
+{
+	struct clog_cpg *entry;
+	uint64_t now = now_ms(), due;
+	int timeout = -1;
+
+	dm_list_iterate_items(entry, &clog_cpg_list) {
+		if (!entry->clear_batch && !entry->mark_batch)
+			continue;
+
+		due = entry->batch_start + batch_window;
+		if (due <= now)
+			return 0;
+		if ((timeout < 0) || (due - now < (uint64_t)timeout))
+			timeout = (int)(due - now);
+	}
+
+	return timeout;
+}
+
+/*
+ * cluster_batch_expire
+ *
+ * Sends the queues older than the batch window.
+ */
+void cluster_batch_expire(void)
+{
+	struct clog_cpg *entry;
+	uint64_t now = now_ms();
+
+	dm_list_iterate_items(entry, &clog_cpg_list)
+		if ((entry->clear_batch || entry->mark_batch) &&
+		    (entry->batch_start + batch_window <= now))
+			send_batches(entry);
+}
+
 static struct clog_request *get_matching_rq(struct clog_request *rq,
 					    struct dm_list *l)
 {
@@ -342,6 +692,18 @@ static int handle_cluster_response(struct clog_cpg *entry,
 		return -EINVAL;
 	}
 
+	if (mark_batch_response(entry, rq)) {
+		free(orig_rq);
+		return 0;
+	}
+
+	/* Report failed marks and clears that were already acknowledged */
+	if ((rq->u_rq.request_type == DM_ULOG_FLUSH) && entry->batch_error) {
+		if (!rq->u_rq.error)
+			rq->u_rq.error = entry->batch_error;
+		entry->batch_error = 0;
+	}
+
 	if (log_resp_rec > 0) {
 		LOG_COND(log_resend_requests,
 			 "[%s] Response received to %s/#%u",
@@ -978,13 +1340,76 @@ static int resend_requests(struct clog_cpg *entry)
 	return r;
 }
 
+static void cpg_message_callback(cpg_handle_t handle, const struct cpg_name *gname,
+				 uint32_t nodeid, uint32_t pid,
+				 void *msg, size_t msg_len);
+static void cpg_config_callback(cpg_handle_t handle, const struct cpg_name *gname,
+				const struct cpg_address *member_list,
+				size_t member_list_entries,
+				const struct cpg_address *left_list,
+				size_t left_list_entries,
+				const struct cpg_address *joined_list,
+				size_t joined_list_entries);
+
+/*
+ * loop_dispatch
+ * @entry
+ *
+ * Delivers the queued events of a single node CPG, including any
+ * queued while delivering.  Leaving finalizes the loopback.
+ */
+static int loop_dispatch(struct clog_cpg *entry)
+{
+	char buf[64];
+	struct loop_event *ev;
+	struct cpg_address me = {
+		.nodeid = LOOP_NODEID,
+		.pid = (uint32_t)getpid(),
+	};
+
+	if (entry->loop_fd[0] < 0)
+		return CS_ERR_BAD_HANDLE;
+
+	while (read(entry->loop_fd[0], buf, sizeof(buf)) > 0)
+		;
+
+	while ((entry->loop_fd[0] >= 0) && !dm_list_empty(&entry->loop_events)) {
+		ev = dm_list_item(dm_list_first(&entry->loop_events), struct loop_event);
+		dm_list_del(&ev->list);
+
+		switch (ev->type) {
+		case LOOP_JOIN:
+			me.reason = CPG_REASON_JOIN;
+			cpg_config_callback(entry->handle, &entry->name,
+					    &me, 1, NULL, 0, &me, 1);
+			break;
+		case LOOP_LEAVE:
+			me.reason = CPG_REASON_LEAVE;
+			cpg_config_callback(entry->handle, &entry->name,
+					    NULL, 0, &me, 1, NULL, 0);
+			break;
+		default:
+			cpg_message_callback(entry->handle, &entry->name,
+					     me.nodeid, me.pid,
+					     ev->msg, ev->len);
+		}
+
+		free(ev);
+	}
+
+	return CS_OK;
+}
+
 static int do_cluster_work(void *data __attribute__((unused)))
 {
 	int r = CS_OK;
 	struct clog_cpg *entry, *tmp;
 
 	dm_list_iterate_items_safe(entry, tmp, &clog_cpg_list) {
-		r = cpg_dispatch(entry->handle, CS_DISPATCH_ALL);
+		if (single_node)
+			r = loop_dispatch(entry);
+		else
+			r = cpg_dispatch(entry->handle, CS_DISPATCH_ALL);
 		if (r != CS_OK) {
 			if ((r == CS_ERR_BAD_HANDLE) &&
 			    ((entry->state == INVALID) ||
@@ -1380,7 +1805,7 @@ static void cpg_leave_callback(struct clog_cpg *match,
 			       size_t member_list_entries)
 {
 	unsigned i;
-	int j, fd;
+	int j;
 	uint32_t lowest = match->lowest_id;
 	struct clog_request *rq, *n;
 	struct checkpoint_data *p_cp, *c_cp;
@@ -1393,8 +1818,7 @@ static void cpg_leave_callback(struct clog_cpg *match,
 		LOG_DBG("Finalizing leave...");
 		dm_list_del(&match->list);
 
-		cpg_fd_get(match->handle, &fd);
-		links_unregister(fd);
+		links_unregister(_cpg_fd(match));
 
 		cluster_postsuspend(match->name.value, match->luid);
 
@@ -1408,7 +1832,8 @@ static void cpg_leave_callback(struct clog_cpg *match,
 			free(rq);
 		}
 
-		cpg_finalize(match->handle);
+		free_batches(match);
+		_cpg_finalize(match);
 
 		match->free_me = 1;
 		match->lowest_id = 0xDEAD;
@@ -1564,6 +1989,9 @@ static int remove_checkpoint(struct clog_cpg *entry)
 	SaAisErrorT rv;
 	SaCkptCheckpointHandleT h;
 
+	if (single_node)
+		return 0;
+
 	len = snprintf((char *)(name.value), SA_MAX_NAME_LENGTH, "bitmaps_%s_%u",
                        SHORT_UUID(entry->name.value), my_cluster_id);
 	name.length = len;
@@ -1627,6 +2055,9 @@ int create_cluster_cpg(char *uuid, uint64_t luid)
 	new->lowest_id = 0xDEAD;
 	dm_list_init(&new->startup_list);
 	dm_list_init(&new->working_list);
+	dm_list_init(&new->mark_batches);
+	dm_list_init(&new->loop_events);
+	new->loop_fd[0] = new->loop_fd[1] = -1;
 
 	size = ((strlen(uuid) + 1) > CPG_MAX_NAME_LENGTH) ?
 		CPG_MAX_NAME_LENGTH : (strlen(uuid) + 1);
@@ -1642,16 +2073,23 @@ int create_cluster_cpg(char *uuid, uint64_t luid)
 			 "[%s]  Removing checkpoints left from previous session",
 			 SHORT_UUID(new->name.value));
 
-	r = cpg_initialize(&new->handle, &cpg_callbacks);
+	if (single_node)
+		r = loop_init(new);
+	else
+		r = cpg_initialize(&new->handle, &cpg_callbacks);
 	if (r != CS_OK) {
 		LOG_ERROR("cpg_initialize failed:  Cannot join cluster");
 		free(new);
 		return -EPERM;
 	}
 
-	r = cpg_join(new->handle, &new->name);
+	if (single_node)
+		r = loop_queue(new, LOOP_JOIN, NULL, 0);
+	else
+		r = cpg_join(new->handle, &new->name);
 	if (r != CS_OK) {
 		LOG_ERROR("cpg_join failed:  Cannot join cluster");
+		_cpg_finalize(new);
 		free(new);
 		return -EPERM;
 	}
@@ -1661,9 +2099,7 @@ int create_cluster_cpg(char *uuid, uint64_t luid)
 	LOG_DBG("New   handle: %llu", (unsigned long long)new->handle);
 	LOG_DBG("New   name: %s", new->name.value);
 
-	/* FIXME: better variable */
-	cpg_fd_get(new->handle, &r);
-	links_register(r, "cluster", do_cluster_work, NULL);
+	links_register(_cpg_fd(new), "cluster", do_cluster_work, NULL);
 
 	return 0;
 }
@@ -1709,6 +2145,9 @@ static int _destroy_cluster_cpg(struct clog_cpg *del)
 	*/
 	do_checkpoints(del, 1);
 
+	/* Requests still queued go out before we leave */
+	send_batches(del);
+
 	state = del->state;
 
 	del->cpg_state = INVALID;
@@ -1722,7 +2161,10 @@ static int _destroy_cluster_cpg(struct clog_cpg *del)
 	if (!dm_list_empty(&del->startup_list) && (state != VALID))
 		abort_startup(del);
 
-	r = cpg_leave(del->handle, &del->name);
+	if (single_node)
+		r = loop_queue(del, LOOP_LEAVE, NULL, 0);
+	else
+		r = cpg_leave(del->handle, &del->name);
 	if (r != CS_OK)
 		LOG_ERROR("Error leaving CPG!");
 	return 0;
@@ -1739,15 +2181,28 @@ int destroy_cluster_cpg(char *uuid)
 	return 0;
 }
 
-int init_cluster(void)
+/*
+ * init_cluster
+ * @single: no corosync, this node is the only member of every CPG
+ * @size: max number of regions sent in one mark or clear request,
+ *	  0 sends every request on its own
+ * @window: max ms a mark or clear request is queued
+ */
+int init_cluster(int single, unsigned size, unsigned window)
 {
+	single_node = single;
+	batch_size = (size > MAX_BATCH_REGIONS) ? MAX_BATCH_REGIONS : size;
+	batch_window = window;
+
 #if CMIRROR_HAS_CHECKPOINT
-	SaAisErrorT rv;
+	if (!single_node) {
+		SaAisErrorT rv;
 
-	rv = saCkptInitialize(&ckpt_handle, &callbacks, &version);
+		rv = saCkptInitialize(&ckpt_handle, &callbacks, &version);
 
-	if (rv != SA_AIS_OK)
-		return EXIT_CLUSTER_CKPT_INIT;
+		if (rv != SA_AIS_OK)
+			return EXIT_CLUSTER_CKPT_INIT;
+	}
 #endif
 	dm_list_init(&clog_cpg_list);
 	return 0;
@@ -1758,6 +2213,9 @@ void cleanup_cluster(void)
 #if CMIRROR_HAS_CHECKPOINT
 	SaAisErrorT err;
 
+	if (single_node)
+		return;
+
 	err = saCkptFinalize(ckpt_handle);
 	if (err != SA_AIS_OK)
 		LOG_ERROR("Failed to finalize checkpoint handle");
@@ -64,7 +64,7 @@ struct clog_request {
 	struct dm_ulog_request u_rq;
 };
 
-int init_cluster(void);
+int init_cluster(int single, unsigned size, unsigned window);
 void cleanup_cluster(void);
 void cluster_debug(void);
 
@@ -72,5 +72,8 @@ int create_cluster_cpg(char *uuid, uint64_t luid);
 int destroy_cluster_cpg(char *uuid);
 
 int cluster_send(struct clog_request *rq);
+int cluster_queue(struct clog_request *rq);
+int cluster_batch_timeout(void);
+void cluster_batch_expire(void);
 
 #endif /* _LVM_CLOG_CLUSTER_H */
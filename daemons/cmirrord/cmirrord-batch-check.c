@@ -0,0 +1,349 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU Lesser General Public License v.2.1.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Check the queueing of mark and clear requests, see cluster_queue(),
+ * in single node mode where the CPG messages are looped back to this
+ * process.  Kernel requests are passed on like local.c does and the
+ * responses to the kernel are recorded by kernel_send() here.
+ *
+ * A failing server and failing sends are injected by wrapping
+ * do_request() and clog_request_to_network() at link time, so the
+ * result of every queued request must show up in the next flush.
+ *
+ * Also checks find_next_zero_bit() on sets whose size is not a multiple
+ * of 32, where the bits past the end must be ignored.  functions.c is
+ * compiled in here for it, so the calls from this file to do_request()
+ * are not wrapped.
+ *
+ * Exits with 0 when all checks pass, e.g.
+ *   make cmirrord-batch-check && ./cmirrord-batch-check
+ */
+
+#include "common.h"
+#include "functions.c"
+#include "link_mon.h"
+#include "local.h"
+#include "cluster.h"
+#include "compat.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+#define CHECK_UUID "LVM-cmirrord-batch-check"
+#define CHECK_LUID 1
+#define CHECK_BATCH_SIZE 4
+#define CHECK_BATCH_WINDOW 10 /* ms */
+#define CHECK_ODD_REGIONS 1000
+
+#define CHECK(x) \
+	do { \
+		if (!(x)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", \
+				__FILE__, __LINE__, #x); \
+			_failed++; \
+		} \
+	} while (0)
+
+static int _failed;
+
+static uint32_t _seq;
+static int _acks;
+static int _responses;
+static uint32_t _response_seq;
+static int _response_error;
+
+static int _fail_marks;		/* the server fails mark requests */
+static uint32_t _fail_send;	/* request type that fails to be sent */
+
+int __real_do_request(struct clog_request *rq, int server);
+int __wrap_do_request(struct clog_request *rq, int server);
+int __real_clog_request_to_network(struct clog_request *rq);
+int __wrap_clog_request_to_network(struct clog_request *rq);
+
+int __wrap_do_request(struct clog_request *rq, int server)
+{
+	int r = __real_do_request(rq, server);
+
+	if (server && _fail_marks &&
+	    (rq->u_rq.request_type == DM_ULOG_MARK_REGION))
+		rq->u_rq.error = -EIO;
+
+	return r;
+}
+
+int __wrap_clog_request_to_network(struct clog_request *rq)
+{
+	if (_fail_send && (rq->u_rq.request_type == _fail_send))
+		return -EINVAL;
+
+	return __real_clog_request_to_network(rq);
+}
+
+/* Replaces local.c, the responses are only recorded */
+int kernel_send(struct dm_ulog_request *u_rq)
+{
+	_responses++;
+	_response_seq = u_rq->seq;
+	_response_error = u_rq->error;
+
+	return 0;
+}
+
+static struct clog_request *_request(struct clog_request *rq, uint32_t type)
+{
+	memset(rq, 0, sizeof(*rq));
+	rq->u_rq.request_type = type;
+	rq->u_rq.seq = ++_seq;
+	rq->u_rq.luid = CHECK_LUID;
+	strcpy(rq->u_rq.uuid, CHECK_UUID);
+
+	return rq;
+}
+
+static void _dispatch(void)
+{
+	while (links_monitor(0) > 0)
+		(void) links_issue_callbacks();
+
+	cluster_batch_expire();
+
+	while (links_monitor(0) > 0)
+		(void) links_issue_callbacks();
+}
+
+/* Pass a request from the kernel on like do_local_work() */
+static uint32_t _kernel_request(struct clog_request *rq, uint32_t type,
+				uint64_t region)
+{
+	_request(rq, type);
+
+	if ((type == DM_ULOG_MARK_REGION) || (type == DM_ULOG_CLEAR_REGION)) {
+		memcpy(rq->u_rq.data, &region, sizeof(region));
+		rq->u_rq.data_size = sizeof(region);
+
+		if (!cluster_queue(rq)) {
+			_acks++;
+			return rq->u_rq.seq;
+		}
+	}
+
+	if (type == DM_ULOG_CLEAR_REGION) {
+		_acks++;
+		(void) cluster_send(rq);
+	} else if ((rq->u_rq.error = cluster_send(rq)))
+		(void) kernel_send(&rq->u_rq);
+
+	return rq->u_rq.seq;
+}
+
+/* Returns the result of a flush sent to the cluster */
+static int _flush(struct clog_request *rq)
+{
+	uint32_t seq = _kernel_request(rq, DM_ULOG_FLUSH, 0);
+
+	_responses = 0;
+	_dispatch();
+
+	CHECK(_responses == 1);
+	CHECK(_response_seq == seq);
+
+	return _response_error;
+}
+
+static int64_t _is_clean(struct clog_request *rq, uint64_t region)
+{
+	int64_t is_clean;
+
+	_request(rq, DM_ULOG_IS_CLEAN);
+	memcpy(rq->u_rq.data, &region, sizeof(region));
+	rq->u_rq.data_size = sizeof(region);
+
+	if (do_request(rq, 0) || rq->u_rq.error)
+		return -1;
+
+	memcpy(&is_clean, rq->u_rq.data, sizeof(is_clean));
+
+	return is_clean;
+}
+
+/* Returns 1 and the region with resync work, 0 without work or -1 */
+static int _resync_work(struct clog_request *rq, uint64_t *region)
+{
+	struct {
+		int64_t i;
+		uint64_t r;
+	} pkg;
+
+	_request(rq, DM_ULOG_GET_RESYNC_WORK);
+
+	if (do_request(rq, 0) || rq->u_rq.error)
+		return -1;
+
+	memcpy(&pkg, rq->u_rq.data, sizeof(pkg));
+	*region = pkg.r;
+
+	return pkg.i ? 1 : 0;
+}
+
+/* Core log with one sector regions, all of them in sync with nosync */
+static int _log_setup(struct clog_request *rq, unsigned regions, int nosync)
+{
+	_request(rq, DM_ULOG_CTR);
+	rq->u_rq.data_size = sprintf(rq->u_rq.data, "%u clustered-core 1%s",
+				     regions, nosync ? " nosync" : "") + 1;
+	if (do_request(rq, 0) || rq->u_rq.error)
+		return 0;
+
+	_request(rq, DM_ULOG_RESUME);
+	if (local_resume(&rq->u_rq) || cluster_send(rq))
+		return 0;
+
+	_responses = 0;
+	_dispatch();
+
+	return (_responses == 1) && !_response_error;
+}
+
+static void _check_next_zero_bit(unsigned size)
+{
+	dm_bitset_t bs;
+
+	if (!(bs = dm_bitset_create(NULL, size))) {
+		CHECK(bs);
+		return;
+	}
+
+	/* All set, including the bits past the end of the last word */
+	dm_bit_set_all(bs);
+	CHECK(find_next_zero_bit(bs, 0) == size);
+	CHECK(find_next_zero_bit(bs, size - 1) == size);
+	CHECK(find_next_zero_bit(bs, size) == size);
+
+	dm_bit_clear(bs, size - 1);
+	CHECK(find_next_zero_bit(bs, 0) == size - 1);
+	CHECK(find_next_zero_bit(bs, size - 1) == size - 1);
+
+	dm_bit_clear(bs, 33);
+	CHECK(find_next_zero_bit(bs, 0) == 33);
+	CHECK(find_next_zero_bit(bs, 34) == size - 1);
+
+	dm_bitset_destroy(bs);
+}
+
+static void _log_cleanup(struct clog_request *rq)
+{
+	_request(rq, DM_ULOG_PRESUSPEND);
+	(void) do_request(rq, 0);
+
+	_request(rq, DM_ULOG_POSTSUSPEND);
+	(void) cluster_send(rq);
+	_dispatch();
+
+	_request(rq, DM_ULOG_DTR);
+	(void) do_request(rq, 0);
+}
+
+int main(int argc __attribute__((unused)), char **argv __attribute__((unused)))
+{
+	struct clog_request *rq;
+	uint64_t region;
+	int timeout;
+
+	/* Room for the data of any request, like local.c */
+	if (!(rq = dm_zalloc(DM_ULOG_REQUEST_SIZE))) {
+		fprintf(stderr, "Failed to allocate memory.\n");
+		return 1;
+	}
+
+	_check_next_zero_bit(CHECK_ODD_REGIONS);
+	_check_next_zero_bit(1024);
+
+	if (init_cluster(1, CHECK_BATCH_SIZE, CHECK_BATCH_WINDOW) ||
+	    !_log_setup(rq, 1024, 1)) {
+		fprintf(stderr, "Failed to set up the log.\n");
+		dm_free(rq);
+		return 1;
+	}
+
+	/* Queued marks are acknowledged, the server failure comes with the flush */
+	_fail_marks = 1;
+	_acks = _responses = 0;
+	for (region = 0; region < 10; region++)
+		(void) _kernel_request(rq, DM_ULOG_MARK_REGION, region);
+	_dispatch();
+	CHECK(_acks == 10);
+	CHECK(_responses == 0);
+	CHECK(_flush(rq) == -EIO);
+	_fail_marks = 0;
+
+	/* Reported once */
+	CHECK(_flush(rq) == 0);
+
+	(void) _kernel_request(rq, DM_ULOG_MARK_REGION, 20);
+	CHECK(_flush(rq) == 0);
+	CHECK(_is_clean(rq, 20) == 0);
+
+	/* A clear that could not be sent is reported with the flush too */
+	_fail_send = DM_ULOG_CLEAR_REGION;
+	_acks = 0;
+	(void) _kernel_request(rq, DM_ULOG_CLEAR_REGION, 20);
+	CHECK(_acks == 1);
+	CHECK(_flush(rq) == -EINVAL);
+	CHECK(_is_clean(rq, 20) == 0);
+	_fail_send = 0;
+
+	(void) _kernel_request(rq, DM_ULOG_CLEAR_REGION, 20);
+	CHECK(_flush(rq) == 0);
+	CHECK(_is_clean(rq, 20) == 1);
+
+	/* A queue older than the batch window is sent without a flush */
+	(void) _kernel_request(rq, DM_ULOG_MARK_REGION, 5);
+	timeout = cluster_batch_timeout();
+	CHECK((timeout >= 0) && (timeout <= CHECK_BATCH_WINDOW));
+	(void) usleep((CHECK_BATCH_WINDOW + 5) * 1000);
+	CHECK(cluster_batch_timeout() == 0);
+	_dispatch();
+	CHECK(cluster_batch_timeout() == -1);
+	CHECK(_is_clean(rq, 5) == 0);
+
+	/* Like the kernel, clear all marks before suspending */
+	for (region = 0; region < 10; region++)
+		(void) _kernel_request(rq, DM_ULOG_CLEAR_REGION, region);
+	CHECK(_flush(rq) == 0);
+	CHECK(_is_clean(rq, 5) == 1);
+
+	_log_cleanup(rq);
+
+	/* All regions in sync, the set bits past the last one are not work */
+	CHECK(_log_setup(rq, CHECK_ODD_REGIONS, 1));
+	CHECK(_resync_work(rq, &region) == 0);
+	_log_cleanup(rq);
+
+	/* Nothing in sync, the work starts at the first region */
+	CHECK(_log_setup(rq, CHECK_ODD_REGIONS, 0));
+	CHECK(_resync_work(rq, &region) == 1);
+	CHECK(region == 0);
+	_log_cleanup(rq);
+
+	cleanup_cluster();
+	dm_free(rq);
+
+	if (_failed) {
+		fprintf(stderr, "%d checks failed.\n", _failed);
+		return 1;
+	}
+
+	printf("All checks passed.\n");
+
+	return 0;
+}
@@ -0,0 +1,372 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU Lesser General Public License v.2.1.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Replay a trace of kernel log requests through do_request() and
+ * report the time spent per request type.  The logs are core logs of
+ * this node only, so nothing goes to the cluster and the numbers only
+ * cover the lookup of the log and the bitmap work.
+ *
+ * The trace is either generated (writes marking and clearing random
+ * regions, reads checking in_sync and resync walking each log) or read
+ * from a file with one request per line:
+ *   <mark|clear|flush|in_sync|resync|recovering> <log> <region>
+ *
+ * e.g.
+ *   cmirrord-bench -l 1000 -r 1048576 -n 1000000
+ */
+
+#include "logging.h"
+#include "common.h"
+#include "functions.h"
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_UUID "LVM-cmirrord-bench-%08d"
+
+enum {
+	OP_MARK,
+	OP_CLEAR,
+	OP_FLUSH,
+	OP_IN_SYNC,
+	OP_RESYNC,
+	OP_RECOVERING,
+	OP_COUNT
+};
+
+static const struct {
+	const char *name;
+	uint32_t request_type;
+} _ops[OP_COUNT] = {
+	{ "mark", DM_ULOG_MARK_REGION },
+	{ "clear", DM_ULOG_CLEAR_REGION },
+	{ "flush", DM_ULOG_FLUSH },
+	{ "in_sync", DM_ULOG_IN_SYNC },
+	{ "resync", DM_ULOG_GET_RESYNC_WORK },
+	{ "recovering", DM_ULOG_IS_REMOTE_RECOVERING },
+};
+
+struct trace_entry {
+	int op;
+	int log;
+	uint64_t region;
+};
+
+struct op_stats {
+	uint64_t count;
+	uint64_t errors;
+	uint64_t total_ns;
+};
+
+static int _logs = 100;
+static uint64_t _regions = 65536;
+static int _requests = 1000000;
+static unsigned _seed = 1;
+
+/* Only the local node is simulated, no CPG is ever joined. */
+int create_cluster_cpg(char *uuid __attribute__((unused)),
+		       uint64_t luid __attribute__((unused)))
+{
+	return 0;
+}
+
+int destroy_cluster_cpg(char *uuid __attribute__((unused)))
+{
+	return 0;
+}
+
+static uint64_t _now_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		return 0;
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static struct clog_request *_request(struct clog_request *rq, uint32_t type, int log)
+{
+	memset(rq, 0, sizeof(*rq));
+	rq->u_rq.request_type = type;
+	rq->u_rq.luid = (uint64_t) log + 1;
+	rq->originator = 1;
+	(void) dm_snprintf(rq->u_rq.uuid, sizeof(rq->u_rq.uuid), BENCH_UUID, log);
+
+	return rq;
+}
+
+static int _log_setup(struct clog_request *rq, int log)
+{
+	/* The region size is 1 so the device size is the region count */
+	_request(rq, DM_ULOG_CTR, log);
+	rq->u_rq.data_size = sprintf(rq->u_rq.data, "%" PRIu64 " clustered-core 1",
+				     _regions) + 1;
+	if (do_request(rq, 1) || rq->u_rq.error)
+		return 0;
+
+	_request(rq, DM_ULOG_RESUME, log);
+	if (local_resume(&rq->u_rq) || do_request(rq, 1) || rq->u_rq.error)
+		return 0;
+
+	return 1;
+}
+
+static void _log_cleanup(struct clog_request *rq, int log)
+{
+	_request(rq, DM_ULOG_POSTSUSPEND, log);
+	(void) do_request(rq, 1);
+	(void) cluster_postsuspend(rq->u_rq.uuid, rq->u_rq.luid);
+
+	_request(rq, DM_ULOG_DTR, log);
+	(void) do_request(rq, 1);
+}
+
+/*
+ * Writes mark a region, flush, and clear it again some requests
+ * later.  Reads check in_sync and resync advances one region.
+ */
+static struct trace_entry *_generate(int *count)
+{
+	struct trace_entry *trace, *te;
+	uint64_t *marked;
+	unsigned seed = _seed;
+	int i, log;
+
+	if (!(trace = dm_malloc(sizeof(*trace) * _requests)) ||
+	    !(marked = dm_zalloc(sizeof(*marked) * _logs))) {
+		dm_free(trace);
+		return NULL;
+	}
+
+	for (i = 0; i < _requests; i++) {
+		te = trace + i;
+		te->log = log = rand_r(&seed) % _logs;
+
+		switch (rand_r(&seed) % 8) {
+		case 0:
+		case 1:
+			te->op = marked[log] ? OP_CLEAR : OP_MARK;
+			te->region = marked[log] ? marked[log] - 1 :
+				(uint64_t) rand_r(&seed) % _regions;
+			marked[log] = marked[log] ? 0 : te->region + 1;
+			break;
+		case 2:
+			te->op = OP_FLUSH;
+			break;
+		case 3:
+		case 4:
+			te->op = OP_IN_SYNC;
+			te->region = (uint64_t) rand_r(&seed) % _regions;
+			break;
+		case 5:
+			te->op = OP_RECOVERING;
+			te->region = (uint64_t) rand_r(&seed) % _regions;
+			break;
+		default:
+			te->op = OP_RESYNC;
+		}
+	}
+
+	dm_free(marked);
+	*count = _requests;
+
+	return trace;
+}
+
+static struct trace_entry *_read_trace(const char *file, int *count)
+{
+	struct trace_entry *trace = NULL, *tmp;
+	char line[256], op[32];
+	unsigned long long region;
+	int size = 0, lineno = 0, log, i;
+	FILE *fp;
+
+	if (!(fp = fopen(file, "r"))) {
+		fprintf(stderr, "Failed to open %s: %s\n", file, strerror(errno));
+		return NULL;
+	}
+
+	*count = 0;
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		region = 0;
+		if (sscanf(line, "%31s %d %llu", op, &log, &region) < 2 ||
+		    log < 0 || log >= _logs || region >= _regions) {
+			fprintf(stderr, "%s:%d: invalid request.\n", file, lineno);
+			goto bad;
+		}
+
+		for (i = 0; i < OP_COUNT; i++)
+			if (!strcmp(op, _ops[i].name))
+				break;
+		if (i == OP_COUNT) {
+			fprintf(stderr, "%s:%d: unknown request %s.\n", file, lineno, op);
+			goto bad;
+		}
+
+		if (*count == size) {
+			size = size ? size * 2 : 1024;
+			if (!(tmp = dm_realloc(trace, sizeof(*trace) * size)))
+				goto bad;
+			trace = tmp;
+		}
+
+		trace[*count].op = i;
+		trace[*count].log = log;
+		trace[*count].region = region;
+		(*count)++;
+	}
+
+	(void) fclose(fp);
+
+	return trace;
+bad:
+	(void) fclose(fp);
+	dm_free(trace);
+
+	return NULL;
+}
+
+static void _replay(struct clog_request *rq, struct trace_entry *trace,
+		    int count, struct op_stats *stats)
+{
+	struct {
+		int64_t i;
+		uint64_t r;
+	} work;
+	struct {
+		uint64_t region;
+		int64_t in_sync;
+	} *pkg;
+	uint64_t start;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		_request(rq, _ops[trace[i].op].request_type, trace[i].log);
+		if (trace[i].op != OP_FLUSH && trace[i].op != OP_RESYNC) {
+			memcpy(rq->u_rq.data, &trace[i].region, sizeof(uint64_t));
+			rq->u_rq.data_size = sizeof(uint64_t);
+		}
+
+		start = _now_ns();
+		(void) do_request(rq, 1);
+
+		/* Like the kernel, report any resync work as done */
+		if (trace[i].op == OP_RESYNC && !rq->u_rq.error) {
+			memcpy(&work, rq->u_rq.data, sizeof(work));
+			if (work.i) {
+				_request(rq, DM_ULOG_SET_REGION_SYNC, trace[i].log);
+				pkg = (void *)rq->u_rq.data;
+				pkg->region = work.r;
+				pkg->in_sync = 1;
+				rq->u_rq.data_size = sizeof(*pkg);
+				(void) do_request(rq, 1);
+			}
+		}
+
+		stats[trace[i].op].total_ns += _now_ns() - start;
+		stats[trace[i].op].count++;
+		if (rq->u_rq.error)
+			stats[trace[i].op].errors++;
+	}
+}
+
+static void _usage(const char *prog)
+{
+	printf("Usage: %s [-l logs] [-r regions] [-n requests] [-s seed] [-f trace]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct op_stats stats[OP_COUNT] = { { 0 } };
+	struct trace_entry *trace;
+	struct clog_request *rq;
+	const char *trace_file = NULL;
+	uint64_t start, total_ns;
+	int opt, i, log, count = 0, r = 1;
+
+	while ((opt = getopt(argc, argv, "hl:r:n:s:f:")) != -1) {
+		switch (opt) {
+		case 'l':
+			_logs = atoi(optarg);
+			break;
+		case 'r':
+			_regions = strtoull(optarg, NULL, 0);
+			break;
+		case 'n':
+			_requests = atoi(optarg);
+			break;
+		case 's':
+			_seed = (unsigned) atoi(optarg);
+			break;
+		case 'f':
+			trace_file = optarg;
+			break;
+		default:
+			_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if ((_logs < 1) || (_regions < 1) || (_requests < 1)) {
+		_usage(argv[0]);
+		return 1;
+	}
+
+	/* Room for the data of any request, like local.c */
+	if (!(rq = dm_zalloc(DM_ULOG_REQUEST_SIZE))) {
+		fprintf(stderr, "Failed to allocate memory.\n");
+		return 1;
+	}
+
+	if (!(trace = trace_file ? _read_trace(trace_file, &count) : _generate(&count))) {
+		fprintf(stderr, "Failed to prepare the request trace.\n");
+		goto out;
+	}
+
+	for (log = 0; log < _logs; log++)
+		if (!_log_setup(rq, log)) {
+			fprintf(stderr, "Failed to create log %d.\n", log);
+			goto out_cleanup;
+		}
+
+	start = _now_ns();
+	_replay(rq, trace, count, stats);
+	total_ns = _now_ns() - start;
+
+	for (i = 0; i < OP_COUNT; i++)
+		if (stats[i].count)
+			printf("%-10s requests %10" PRIu64 " errors %8" PRIu64
+			       " avg %8.1f ns\n", _ops[i].name, stats[i].count,
+			       stats[i].errors,
+			       (double) stats[i].total_ns / stats[i].count);
+
+	printf("%-10s requests %10d logs %d regions %" PRIu64
+	       " requests/s %.0f\n", "total", count, _logs, _regions,
+	       total_ns ? (double) count * 1000000000 / total_ns : 0.0);
+	r = 0;
+
+out_cleanup:
+	while (log--)
+		_log_cleanup(rq, log);
+	dm_free(trace);
+out:
+	dm_free(rq);
+
+	return r;
+}
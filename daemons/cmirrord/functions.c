@@ -50,6 +50,7 @@ struct log_header {
 
 struct log_c {
 	struct dm_list list;
+	struct log_c *hash_next;
 
 	char uuid[DM_UUID_LEN];
 	uint64_t luid;
@@ -107,6 +108,16 @@ struct recovery_request {
 static DM_LIST_INIT(log_list);
 static DM_LIST_INIT(log_pending_list);
 
+/*
+ * Every request looks up its log, so both lists are also indexed by
+ * UUID.  Requests arriving through the cluster carry no luid, so the
+ * luid is not part of the key and is checked on the hash chain.
+ */
+#define LOG_HASH_SIZE 256
+
+static struct log_c *log_hash[LOG_HASH_SIZE];
+static struct log_c *log_pending_hash[LOG_HASH_SIZE];
+
 static int log_test_bit(dm_bitset_t bs, int bit)
 {
 	return dm_bit(bs, bit) ? 1 : 0;
@@ -124,13 +135,34 @@ static void log_clear_bit(struct log_c *lc, dm_bitset_t bs, int bit)
 	lc->touched = 1;
 }
 
+/*
+ * Returns the first clear bit at or after 'start', testing a word at
+ * a time.  The bits of the final word past the end of the set may be
+ * set (dm_bit_set_all sets them), so they are masked to count as clear
+ * and a set with all bits set returns its size.
+ */
 static uint64_t find_next_zero_bit(dm_bitset_t bs, unsigned start)
 {
-	for (; dm_bit(bs, start); start++)
-		if (start >= *bs)
-			return (uint64_t)-1;
+	unsigned word, last_word = *bs / DM_BITS_PER_INT;
+	uint32_t past_end = ~0U << (*bs % DM_BITS_PER_INT);
+	uint32_t test;
+
+	if (start >= *bs)
+		return start;
+
+	word = start / DM_BITS_PER_INT;
+	/* Bits below 'start' count as set */
+	test = ~bs[word + 1] & (~0U << (start % DM_BITS_PER_INT));
+
+	for (;;) {
+		if (word == last_word)
+			test |= past_end;
+		if (test)
+			break;
+		test = ~bs[++word + 1];
+	}
 
-	return start;
+	return (uint64_t)word * DM_BITS_PER_INT + ffs((int)test) - 1;
 }
 
 static uint64_t count_bits32(dm_bitset_t bs)
@@ -144,16 +176,24 @@ static uint64_t count_bits32(dm_bitset_t bs)
 	return (uint64_t)count;
 }
 
-/*
- * get_log
- *
- * Returns: log if found, NULL otherwise
- */
-static struct log_c *get_log(const char *uuid, uint64_t luid)
+static unsigned log_hash_key(const char *uuid)
+{
+	/* FNV-1a, the UUIDs of one VG share a long prefix */
+	uint32_t h = 2166136261U;
+	int i;
+
+	for (i = 0; (i < DM_UUID_LEN) && uuid[i]; i++)
+		h = (h ^ (unsigned char)uuid[i]) * 16777619U;
+
+	return h % LOG_HASH_SIZE;
+}
+
+static struct log_c *log_hash_lookup(struct log_c **hash,
+				     const char *uuid, uint64_t luid)
 {
 	struct log_c *lc;
 
-	dm_list_iterate_items(lc, &log_list)
+	for (lc = hash[log_hash_key(uuid)]; lc; lc = lc->hash_next)
 		if (!strcmp(lc->uuid, uuid) &&
 		    (!luid || (luid == lc->luid)))
 			return lc;
@@ -161,6 +201,52 @@ static struct log_c *get_log(const char *uuid, uint64_t luid)
 	return NULL;
 }
 
+/*
+ * add_log
+ * @lc
+ * @pending: add to the pending list instead of the official one
+ *
+ * Logs are appended to the end of their hash chain, so a lookup
+ * without luid finds the same log a walk of the list would.
+ */
+static void add_log(struct log_c *lc, int pending)
+{
+	struct log_c **p = (pending ? log_pending_hash : log_hash) +
+		log_hash_key(lc->uuid);
+
+	while (*p)
+		p = &(*p)->hash_next;
+
+	*p = lc;
+	lc->hash_next = NULL;
+	dm_list_add(pending ? &log_pending_list : &log_list, &lc->list);
+}
+
+static void del_log(struct log_c *lc, int pending)
+{
+	struct log_c **p = (pending ? log_pending_hash : log_hash) +
+		log_hash_key(lc->uuid);
+
+	for (; *p; p = &(*p)->hash_next)
+		if (*p == lc) {
+			*p = lc->hash_next;
+			break;
+		}
+
+	lc->hash_next = NULL;
+	dm_list_del(&lc->list);
+}
+
+/*
+ * get_log
+ *
+ * Returns: log if found, NULL otherwise
+ */
+static struct log_c *get_log(const char *uuid, uint64_t luid)
+{
+	return log_hash_lookup(log_hash, uuid, luid);
+}
+
 /*
  * get_pending_log
  *
@@ -171,14 +257,7 @@ static struct log_c *get_log(const char *uuid, uint64_t luid)
  */
 static struct log_c *get_pending_log(const char *uuid, uint64_t luid)
 {
-	struct log_c *lc;
-
-	dm_list_iterate_items(lc, &log_pending_list)
-		if (!strcmp(lc->uuid, uuid) &&
-		    (!luid || (luid == lc->luid)))
-			return lc;
-
-	return NULL;
+	return log_hash_lookup(log_pending_hash, uuid, luid);
 }
 
 static void header_to_disk(struct log_header *mem, struct log_header *disk)
@@ -519,7 +598,7 @@ static int _clog_ctr(char *uuid, uint64_t luid,
 		LOG_DBG("Disk log ready");
 	}
 
-	dm_list_add(&log_pending_list, &lc->list);
+	add_log(lc, 1);
 
 	return 0;
 fail:
@@ -632,6 +711,7 @@ static int clog_ctr(struct dm_ulog_request *rq)
  */
 static int clog_dtr(struct dm_ulog_request *rq)
 {
+	int pending = 0;
 	struct log_c *lc = get_log(rq->uuid, rq->luid);
 
 	if (lc) {
@@ -645,11 +725,12 @@ static int clog_dtr(struct dm_ulog_request *rq)
 	} else if (!(lc = get_pending_log(rq->uuid, rq->luid))) {
 		LOG_ERROR("clog_dtr called on log that is not official or pending");
 		return -EINVAL;
-	}
+	} else
+		pending = 1;
 
 	LOG_DBG("[%s] Cluster log removed", SHORT_UUID(lc->uuid));
 
-	dm_list_del(&lc->list);
+	del_log(lc, pending);
 	if (lc->disk_fd != -1 && close(lc->disk_fd))
 		LOG_ERROR("Failed to close disk log: %s",
 			  strerror(errno));
@@ -721,8 +802,8 @@ int cluster_postsuspend(char *uuid, uint64_t luid)
 	lc->resume_override = 0;
 
 	/* move log to pending list */
-	dm_list_del(&lc->list);
-	dm_list_add(&log_pending_list, &lc->list);
+	del_log(lc, 0);
+	add_log(lc, 1);
 
 	return 0;
 }
@@ -910,8 +991,8 @@ int local_resume(struct dm_ulog_request *rq)
 		}
 
 		/* move log to official list */
-		dm_list_del(&lc->list);
-		dm_list_add(&log_list, &lc->list);
+		del_log(lc, 1);
+		add_log(lc, 0);
 	}
 
 	return 0;
@@ -14,7 +14,7 @@
 
 int links_register(int fd, const char *name, int (*callback)(void *data), void *data);
 int links_unregister(int fd);
-int links_monitor(void);
+int links_monitor(int timeout);
 int links_issue_callbacks(void);
 
 #endif /* _LVM_CLOG_LINK_MON_H */
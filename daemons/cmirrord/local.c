@@ -231,6 +231,18 @@ static int do_local_work(void *data __attribute__((unused)))
 	LOG_DBG("[%s]  Request from kernel received: [%s/%u]",
 		SHORT_UUID(u_rq->uuid), RQ_TYPE(u_rq->request_type),
 		u_rq->seq);
+
+	/*
+	 * Marks and clears queued for the cluster are acknowledged right
+	 * away.  The kernel relies on the marks only after the flush
+	 * following them, which also reports any failure of the queued
+	 * marks and clears.
+	 */
+	if (((u_rq->request_type == DM_ULOG_MARK_REGION) ||
+	     (u_rq->request_type == DM_ULOG_CLEAR_REGION)) &&
+	    !cluster_queue(rq))
+		return kernel_ack(u_rq->seq, 0);
+
 	switch (u_rq->request_type) {
 	case DM_ULOG_CTR:
 	case DM_ULOG_DTR:
@@ -35,6 +35,18 @@
 #include <fcntl.h>		/* for musl libc */
 
 #ifdef __linux__
+#  include "dm-ioctl.h"
+
+#  include <sys/epoll.h>
+#  include <sys/ioctl.h>
+#  include <sys/signalfd.h>
+#  include <sys/timerfd.h>
+
+/* Kernel can notify about device events through /dev/mapper/control. */
+#  ifdef DM_DEV_ARM_POLL
+#    define DMEVENTD_EVENT_LOOP
+#  endif
+
 /*
  * Kernel version 2.6.36 and higher has
  * new OOM killer adjustment interface.
@@ -97,6 +109,7 @@ static int _use_syslog = 1;
 static int _systemd_activation = 0;
 static int _foreground = 0;
 static int _restart = 0;
+static int _thread_per_device = 0;
 static time_t _idle_since = 0;
 static char **_initial_registrations = 0;
 
@@ -142,6 +155,7 @@ static const char *decode_cmd(uint32_t cmd)
 	case DM_EVENT_CMD_DIE:				return "DIE";
 	case DM_EVENT_CMD_GET_STATUS:			return "GET_STATUS";
 	case DM_EVENT_CMD_GET_PARAMETERS:		return "GET_PARAMETERS";
+	case DM_EVENT_CMD_BATCH:			return "BATCH";
 	default:					return "unknown";
 	}
 }
@@ -246,8 +260,23 @@ struct thread_status {
 	struct dm_list timeout_list;
 	void *dso_private; /* dso per-thread status variable */
 	/* TODO per-thread mutex */
+
+	/* Event loop mode, there is no thread per device then. */
+	uint32_t event_nr;	/* Last event number seen */
+	unsigned rounds;	/* Timer wheel turns left until timeout */
+	int new_events;		/* Events waiting for a worker */
+	int work;		/* DM_WORK_* waiting for a worker */
+	int queued;		/* On the work queue or with a worker */
+	int seen;		/* Found by the current device scan */
+	int checking;		/* Checked by the device scan without mutex */
+	struct dm_list work_list;
 };
 
+/* Work for the worker threads in event loop mode. */
+#define DM_WORK_REGISTER	0x01
+#define DM_WORK_PROCESS		0x02
+#define DM_WORK_UNREGISTER	0x04
+
 static DM_LIST_INIT(_thread_registry);
 static DM_LIST_INIT(_thread_registry_unused);
 
@@ -256,6 +285,27 @@ static DM_LIST_INIT(_timeout_registry);
 static pthread_mutex_t _timeout_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t _timeout_cond = PTHREAD_COND_INITIALIZER;
 
+/*
+ * Event loop mode
+ *
+ * With kernels supporting DM_DEV_ARM_POLL one thread polls a private
+ * /dev/mapper/control descriptor and finds the devices whose event number
+ * changed.  Timeouts are kept in a timer wheel ticked by one timerfd and
+ * the DSO callbacks run in a fixed number of worker threads, so the number
+ * of threads no longer grows with the number of monitored devices.
+ * Older kernels keep using a monitoring thread per device.
+ */
+#define DMEVENTD_WORKER_THREADS 8
+#define DMEVENTD_WHEEL_SLOTS 64		/* One second each */
+
+static int _event_loop = 0;
+static DM_LIST_INIT(_work_queue);
+static pthread_cond_t _work_cond = PTHREAD_COND_INITIALIZER;
+static struct dm_list _timer_wheel[DMEVENTD_WHEEL_SLOTS];
+static unsigned _wheel_tick;
+static unsigned _wheel_entries;
+static int _timer_fd = -1;
+
 
 /**********
  *   DSO
@@ -416,11 +466,13 @@ static struct thread_status *_alloc_thread_status(const struct message_data *dat
 	_lib_get(dso_data);
 	thread->dso_data = dso_data;
 
-	if (!(thread->wait_task = dm_task_create(DM_DEVICE_WAITEVENT)))
-		goto_out;
+	if (!_event_loop) {
+		if (!(thread->wait_task = dm_task_create(DM_DEVICE_WAITEVENT)))
+			goto_out;
 
-	if (!dm_task_set_uuid(thread->wait_task, data->device_uuid))
-		goto_out;
+		if (!dm_task_set_uuid(thread->wait_task, data->device_uuid))
+			goto_out;
+	}
 
 	if (!(thread->device.uuid = dm_strdup(data->device_uuid)))
 		goto_out;
@@ -437,6 +489,7 @@ static struct thread_status *_alloc_thread_status(const struct message_data *dat
 	thread->pending = DM_EVENT_REGISTRATION_PENDING;
 	thread->timeout = data->timeout_secs;
 	dm_list_init(&thread->timeout_list);
+	dm_list_init(&thread->work_list);
 
 	return thread;
 
@@ -545,6 +598,26 @@ static void _free_message(struct message_data *message_data)
 	dm_free(message_data->timeout_str);
 }
 
+/* Parse the dso, device, events and timeout fields of a message. */
+static int _parse_device_fields(struct message_data *message_data, char **p)
+{
+	if (!_fetch_string(&message_data->dso_name, p, ' ') ||
+	    !_fetch_string(&message_data->device_uuid, p, ' ') ||
+	    !_fetch_string(&message_data->events_str, p, ' ') ||
+	    !_fetch_string(&message_data->timeout_str, p, ' '))
+		return 0;
+
+	if (message_data->events_str)
+		message_data->events_field =
+			atoi(message_data->events_str);
+	if (message_data->timeout_str)
+		message_data->timeout_secs =
+			atoi(message_data->timeout_str)
+			? : DM_EVENT_DEFAULT_TIMEOUT;
+
+	return 1;
+}
+
 /* Parse a register message from the client. */
 static int _parse_message(struct message_data *message_data)
 {
@@ -560,19 +633,8 @@ static int _parse_message(struct message_data *message_data)
 	 * path and events # string from message.
 	 */
 	if (_fetch_string(&message_data->id, &p, ' ') &&
-	    _fetch_string(&message_data->dso_name, &p, ' ') &&
-	    _fetch_string(&message_data->device_uuid, &p, ' ') &&
-	    _fetch_string(&message_data->events_str, &p, ' ') &&
-	    _fetch_string(&message_data->timeout_str, &p, ' ')) {
-		if (message_data->events_str)
-			message_data->events_field =
-				atoi(message_data->events_str);
-		if (message_data->timeout_str)
-			message_data->timeout_secs =
-				atoi(message_data->timeout_str)
-				? : DM_EVENT_DEFAULT_TIMEOUT;
+	    _parse_device_fields(message_data, &p))
 		ret = 1;
-	}
 
 	dm_free(msg->data);
 	msg->data = NULL;
@@ -617,7 +679,9 @@ static int _fill_device_data(struct thread_status *ts)
 
 	ts->device.major = dmi.major;
 	ts->device.minor = dmi.minor;
-	dm_task_set_event_nr(ts->wait_task, dmi.event_nr);
+	ts->event_nr = dmi.event_nr;
+	if (ts->wait_task)
+		dm_task_set_event_nr(ts->wait_task, dmi.event_nr);
 
 	ret = 1;
 fail:
@@ -798,12 +862,96 @@ static void *_timeout_thread(void *unused __attribute__((unused)))
 	return NULL;
 }
 
+/* Tick the timer wheel every second while it has entries. */
+static void _wheel_timer(int enable)
+{
+#ifdef DMEVENTD_EVENT_LOOP
+	struct itimerspec its = { { 0 } };
+
+	if (enable)
+		its.it_interval.tv_sec = its.it_value.tv_sec = 1;
+
+	if (timerfd_settime(_timer_fd, 0, &its, NULL))
+		log_sys_error("timerfd_settime", "");
+#endif
+}
+
+/* Timeout mutex must be held when calling this. */
+static void _wheel_add(struct thread_status *thread)
+{
+	unsigned ticks = thread->timeout ? : 1;
+
+	thread->rounds = (ticks - 1) / DMEVENTD_WHEEL_SLOTS;
+	dm_list_add(&_timer_wheel[(_wheel_tick + ticks) % DMEVENTD_WHEEL_SLOTS],
+		    &thread->timeout_list);
+
+	if (!_wheel_entries++)
+		_wheel_timer(1);
+}
+
+/* Timeout mutex must be held when calling this. */
+static void _wheel_del(struct thread_status *thread)
+{
+	dm_list_del(&thread->timeout_list);
+	dm_list_init(&thread->timeout_list);
+
+	if (!--_wheel_entries)
+		_wheel_timer(0);
+}
+
+static void _device_event(struct thread_status *thread, int events);
+
+/*
+ * Turn the wheel by the number of seconds passed and hand the devices
+ * whose timeout expired to the workers.
+ */
+static void _wheel_advance(uint64_t ticks)
+{
+	struct thread_status *thread, *tmp;
+	struct dm_list *slot, expired;
+
+	dm_list_init(&expired);
+
+	pthread_mutex_lock(&_timeout_mutex);
+
+	while (ticks-- && _wheel_entries) {
+		slot = &_timer_wheel[++_wheel_tick % DMEVENTD_WHEEL_SLOTS];
+		dm_list_iterate_items_gen_safe(thread, tmp, slot, timeout_list) {
+			if (thread->rounds) {
+				thread->rounds--;
+				continue;
+			}
+			dm_list_del(&thread->timeout_list);
+			dm_list_add(&expired, &thread->timeout_list);
+		}
+
+		/* Rescheduled from the next tick on. */
+		dm_list_iterate_items_gen_safe(thread, tmp, &expired, timeout_list) {
+			dm_list_del(&thread->timeout_list);
+			_wheel_entries--;
+			_wheel_add(thread);
+			_lock_mutex();
+			_device_event(thread, DM_EVENT_TIMEOUT);
+			_unlock_mutex();
+		}
+	}
+
+	pthread_mutex_unlock(&_timeout_mutex);
+}
+
 static int _register_for_timeout(struct thread_status *thread)
 {
 	int ret = 0;
 
 	pthread_mutex_lock(&_timeout_mutex);
 
+	if (_event_loop) {
+		if (dm_list_empty(&thread->timeout_list))
+			_wheel_add(thread);
+		pthread_mutex_unlock(&_timeout_mutex);
+		return 0;
+	}
+
 	if (dm_list_empty(&thread->timeout_list)) {
 		thread->next_time = time(NULL) + thread->timeout;
 		dm_list_add(&_timeout_registry, &thread->timeout_list);
@@ -823,7 +971,10 @@ static int _register_for_timeout(struct thread_status *thread)
 static void _unregister_for_timeout(struct thread_status *thread)
 {
 	pthread_mutex_lock(&_timeout_mutex);
-	if (!dm_list_empty(&thread->timeout_list)) {
+	if (_event_loop) {
+		if (!dm_list_empty(&thread->timeout_list))
+			_wheel_del(thread);
+	} else if (!dm_list_empty(&thread->timeout_list)) {
 		dm_list_del(&thread->timeout_list);
 		dm_list_init(&thread->timeout_list);
 		if (dm_list_empty(&_timeout_registry))
@@ -935,8 +1086,8 @@ static void _do_process_event(struct thread_status *thread)
 {
 	struct dm_task *task;
 
-	/* NOTE: timeout event gets status */
-	task = (thread->current_events & DM_EVENT_TIMEOUT)
+	/* NOTE: timeout event gets status, so does any event without waitevent */
+	task = ((thread->current_events & DM_EVENT_TIMEOUT) || !thread->wait_task)
 		? _get_device_status(thread) : thread->wait_task;
 
 	if (!task)
@@ -1074,6 +1225,481 @@ static int _create_thread(struct thread_status *thread)
 	return _pthread_create_smallstack(&thread->thread, _monitor_thread, thread);
 }
 
+/*
+ * Hand work for a device to the workers.  A device is only ever with
+ * one worker, work arriving meanwhile is picked up when it is done.
+ *
+ * Mutex must be held when calling this.
+ */
+static void _queue_work(struct thread_status *thread, int work)
+{
+	thread->work |= work;
+
+	if (!thread->queued) {
+		thread->queued = 1;
+		dm_list_add(&_work_queue, &thread->work_list);
+		pthread_cond_signal(&_work_cond);
+	}
+}
+
+/*
+ * Record events for a device registered for them.
+ *
+ * Mutex must be held when calling this.
+ */
+static void _device_event(struct thread_status *thread, int events)
+{
+	if (!(thread->events & events))
+		return;
+
+	thread->new_events |= events;
+	_queue_work(thread, DM_WORK_PROCESS);
+}
+
+/*
+ * Stop monitoring a device, e.g. when it disappeared.
+ *
+ * Mutex must be held when calling this.
+ */
+static void _device_detach(struct thread_status *thread)
+{
+	struct thread_status *thread_iter;
+
+	dm_list_iterate_items(thread_iter, &_thread_registry)
+		if (thread_iter == thread) {
+			_thread_unused(thread);
+			break;
+		}
+
+	thread->events = 0;
+	thread->pending = 0;
+	_queue_work(thread, DM_WORK_UNREGISTER);
+}
+
+#ifdef DMEVENTD_EVENT_LOOP
+/* The DSO asked to drop the device by signalling itself SIGALRM. */
+static int _alarm_pending(void)
+{
+	sigset_t pendmask, alarm;
+	struct timespec zero = { 0 };
+
+	if (sigpending(&pendmask) < 0) {
+		log_sys_error("sigpending", "");
+		return 0;
+	}
+
+	if (!sigismember(&pendmask, SIGALRM))
+		return 0;
+
+	sigemptyset(&alarm);
+	sigaddset(&alarm, SIGALRM);
+	(void) sigtimedwait(&alarm, NULL, &zero);
+
+	return 1;
+}
+
+static void _do_work(struct thread_status *thread, int work)
+{
+	if (work & DM_WORK_REGISTER) {
+		if (!_fill_device_data(thread)) {
+			log_error("Failed to fill device data for %s.", thread->device.uuid);
+			goto failed;
+		}
+
+		if (!_do_register_device(thread)) {
+			log_error("Failed to register device %s.", thread->device.name);
+			goto failed;
+		}
+
+		_lock_mutex();
+		thread->status = DM_THREAD_RUNNING;
+		thread->pending = 0;
+		_unlock_mutex();
+	}
+
+	if ((work & DM_WORK_PROCESS) && (thread->status == DM_THREAD_RUNNING) &&
+	    (thread->events & thread->current_events)) {
+		_do_process_event(thread);
+
+		if (_alarm_pending()) {
+			_lock_mutex();
+			_device_detach(thread);
+			work |= thread->work;
+			thread->work = 0;
+			_unlock_mutex();
+		}
+	}
+
+	if (work & DM_WORK_UNREGISTER) {
+		DEBUGLOG("Unregistering monitor for %s.", thread->device.name);
+		_unregister_for_timeout(thread);
+
+		if ((thread->status == DM_THREAD_RUNNING) &&
+		    !_do_unregister_device(thread))
+			log_error("%s: %s unregister failed.", __func__,
+				  thread->device.name);
+
+		_lock_mutex();
+		thread->status = DM_THREAD_DONE;
+		_unlock_mutex();
+	}
+
+	return;
+
+failed:
+	_lock_mutex();
+	_device_detach(thread);
+	thread->work = 0;
+	thread->status = DM_THREAD_DONE;
+	_unlock_mutex();
+}
+
+/* Worker thread running DSO callbacks in event loop mode. */
+static void *_worker_thread(void *unused __attribute__((unused)))
+{
+	struct thread_status *thread;
+	sigset_t sigmask;
+	int work;
+
+	/* DSOs may change the signal mask, e.g. to unblock SIGCHLD. */
+	if (pthread_sigmask(SIG_SETMASK, NULL, &sigmask))
+		log_sys_error("pthread_sigmask", "get");
+
+	_lock_mutex();
+
+	for (;;) {
+		while (dm_list_empty(&_work_queue))
+			pthread_cond_wait(&_work_cond, &_global_mutex);
+
+		thread = dm_list_struct_base(dm_list_first(&_work_queue),
+					     struct thread_status, work_list);
+		dm_list_del(&thread->work_list);
+
+		work = thread->work;
+		thread->work = 0;
+		thread->current_events = thread->new_events;
+		thread->new_events = 0;
+		thread->processing = 1;
+		_unlock_mutex();
+
+		_do_work(thread, work);
+
+		if (pthread_sigmask(SIG_SETMASK, &sigmask, NULL))
+			log_sys_error("pthread_sigmask", "restore");
+
+		_lock_mutex();
+		thread->processing = 0;
+		thread->current_events = 0;
+
+		if (thread->work)
+			dm_list_add(&_work_queue, &thread->work_list);
+		else
+			thread->queued = 0;
+	}
+
+	return NULL;
+}
+
+static int _control_fd = -1;
+static int _signal_fd = -1;
+static int _epoll_fd = -1;
+static int _list_event_nr = 0;	/* DM_LIST_DEVICES reports event numbers */
+
+/* Ask for POLLIN on the next device event after this one. */
+static int _arm_poll(void)
+{
+	struct dm_ioctl dmi = {
+		.version = { DM_VERSION_MAJOR, 0, 0 },
+		.data_size = sizeof(dmi),
+		.data_start = sizeof(dmi),
+	};
+
+	if (ioctl(_control_fd, DM_DEV_ARM_POLL, &dmi)) {
+		log_sys_error("ioctl", "DM_DEV_ARM_POLL");
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Since dm-ioctl 4.37 every name in DM_LIST_DEVICES is followed by the
+ * event number of the device, aligned to 8 bytes.
+ */
+static uint32_t _names_event_nr(struct dm_names *names)
+{
+	return *(uint32_t *)(((uintptr_t) names->name + strlen(names->name) + 1 + 7) & ~(uintptr_t) 7);
+}
+
+/*
+ * Compare the event number of the device with the last one seen.
+ *
+ * Mutex must be held when calling this.
+ */
+static void _check_event_nr(struct thread_status *thread, uint32_t event_nr)
+{
+	if (thread->event_nr == event_nr)
+		return;
+
+	DEBUGLOG("Event %u for %s.", event_nr, thread->device.name);
+	thread->event_nr = event_nr;
+	_device_event(thread, DM_EVENT_DEVICE_ERROR);
+}
+
+/*
+ * Check one device by its UUID and clear its checking flag.  The ioctl
+ * runs without the mutex, the checking flag set by the caller keeps the
+ * device from being destroyed meanwhile.
+ *
+ * Mutex must be held when calling this.
+ */
+static void _check_device(struct thread_status *thread)
+{
+	struct dm_task *dmt;
+	struct dm_info info;
+	int r;
+
+	/* Unregistered while another device was checked */
+	if (thread->status != DM_THREAD_RUNNING) {
+		thread->checking = 0;
+		return;
+	}
+
+	_unlock_mutex();
+
+	if ((dmt = dm_task_create(DM_DEVICE_INFO))) {
+		r = dm_task_set_uuid(dmt, thread->device.uuid) &&
+			dm_task_run(dmt) && dm_task_get_info(dmt, &info);
+		dm_task_destroy(dmt);
+	} else
+		r = 0;
+
+	_lock_mutex();
+	thread->checking = 0;
+
+	/* Unregistered meanwhile */
+	if (!r || (thread->status != DM_THREAD_RUNNING))
+		return;
+
+	if (!info.exists) {
+		log_error("%s disappeared, detaching.", thread->device.name);
+		_device_detach(thread);
+	} else
+		_check_event_nr(thread, info.event_nr);
+}
+
+/*
+ * Find the monitored devices with new events.  With event numbers in the
+ * device list this is one ioctl, only devices missing in it (renamed or
+ * removed) are checked one by one.
+ */
+static void _scan_devices(void)
+{
+	struct dm_task *dmt = NULL;
+	struct dm_names *names = NULL;
+	struct dm_hash_table *by_name = NULL;
+	struct thread_status *thread, **check;
+	unsigned next = 0, nr_check, i;
+
+	if (_list_event_nr &&
+	    (!(dmt = dm_task_create(DM_DEVICE_LIST)) || !dm_task_run(dmt) ||
+	     !(names = dm_task_get_names(dmt))))
+		stack;
+
+	_lock_mutex();
+
+	if (names && (by_name = dm_hash_create(dm_list_size(&_thread_registry) + 1))) {
+		dm_list_iterate_items(thread, &_thread_registry) {
+			thread->seen = 0;
+			if ((thread->status == DM_THREAD_RUNNING) &&
+			    !dm_hash_insert(by_name, thread->device.name, thread)) {
+				dm_hash_destroy(by_name);
+				by_name = NULL;
+				break;
+			}
+		}
+	}
+
+	if (by_name && names->dev)
+		do {
+			names = (struct dm_names *)((char *) names + next);
+			if ((thread = dm_hash_lookup(by_name, names->name))) {
+				thread->seen = 1;
+				_check_event_nr(thread, _names_event_nr(names));
+			}
+			next = names->next;
+		} while (next);
+
+	/*
+	 * The registry may change while a device is checked without the
+	 * mutex, so take the devices to check off it first and flag them
+	 * all as checking until each one is done.
+	 */
+	nr_check = 0;
+	dm_list_iterate_items(thread, &_thread_registry)
+		if ((thread->status == DM_THREAD_RUNNING) && (!by_name || !thread->seen))
+			nr_check++;
+
+	if (nr_check && (check = dm_malloc(sizeof(*check) * nr_check))) {
+		nr_check = 0;
+		dm_list_iterate_items(thread, &_thread_registry)
+			if ((thread->status == DM_THREAD_RUNNING) && (!by_name || !thread->seen)) {
+				thread->checking = 1;
+				check[nr_check++] = thread;
+			}
+
+		for (i = 0; i < nr_check; i++)
+			_check_device(check[i]);
+
+		dm_free(check);
+	}
+
+	_unlock_mutex();
+
+	if (by_name)
+		dm_hash_destroy(by_name);
+	if (dmt)
+		dm_task_destroy(dmt);
+}
+
+/*
+ * A DSO command finished.  Monitoring threads were woken up by SIGCHLD
+ * like by a timeout, so do the same for devices registered for timeouts.
+ */
+static void _child_exited(void)
+{
+	struct signalfd_siginfo si;
+	struct thread_status *thread;
+
+	while (read(_signal_fd, &si, sizeof(si)) == sizeof(si))
+		;
+
+	_lock_mutex();
+	dm_list_iterate_items(thread, &_thread_registry)
+		if (thread->status == DM_THREAD_RUNNING)
+			_device_event(thread, DM_EVENT_TIMEOUT);
+	_unlock_mutex();
+}
+
+static void *_event_loop_thread(void *unused __attribute__((unused)))
+{
+	struct epoll_event events[4];
+	uint64_t ticks;
+	int i, n;
+
+	DEBUGLOG("Event loop thread starting.");
+
+	for (;;) {
+		if ((n = epoll_wait(_epoll_fd, events, DM_ARRAY_SIZE(events), -1)) < 0) {
+			if (errno != EINTR)
+				log_sys_error("epoll_wait", "");
+			continue;
+		}
+
+		for (i = 0; i < n; i++)
+			if (events[i].data.fd == _control_fd) {
+				/* Rearm first so no event gets lost during the scan. */
+				(void) _arm_poll();
+				_scan_devices();
+			} else if (events[i].data.fd == _timer_fd) {
+				if (read(_timer_fd, &ticks, sizeof(ticks)) == sizeof(ticks))
+					_wheel_advance(ticks);
+			} else if (events[i].data.fd == _signal_fd)
+				_child_exited();
+	}
+
+	return NULL;
+}
+
+static int _epoll_add(int fd)
+{
+	struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+
+	if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
+		log_sys_error("epoll_ctl", "");
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Use the event loop if the kernel supports polling for device events. */
+static int _event_loop_init(void)
+{
+	char version[80], control[PATH_MAX];
+	unsigned major = 0, minor = 0;
+	sigset_t sigchld;
+	int i;
+
+	if (_thread_per_device)
+		return 0;
+
+	if (!dm_driver_version(version, sizeof(version)) ||
+	    (sscanf(version, "%u.%u", &major, &minor) != 2) ||
+	    (major != DM_VERSION_MAJOR) || (minor < 36)) {
+		log_debug("Kernel cannot poll for device events, using a thread per device.");
+		return 0;
+	}
+
+	_list_event_nr = (minor >= 37);
+
+	if (dm_snprintf(control, sizeof(control), "%s/%s", dm_dir(), DM_CONTROL_NODE) < 0)
+		return_0;
+
+	if ((_control_fd = open(control, O_RDWR | O_CLOEXEC)) < 0) {
+		log_sys_error("open", control);
+		return 0;
+	}
+
+	sigemptyset(&sigchld);
+	sigaddset(&sigchld, SIGCHLD);
+
+	if (!_arm_poll() ||
+	    ((_epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) ||
+	    ((_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0) ||
+	    ((_signal_fd = signalfd(-1, &sigchld, SFD_NONBLOCK | SFD_CLOEXEC)) < 0) ||
+	    !_epoll_add(_control_fd) || !_epoll_add(_timer_fd) || !_epoll_add(_signal_fd))
+		goto bad;
+
+	for (i = 0; i < DMEVENTD_WHEEL_SLOTS; i++)
+		dm_list_init(&_timer_wheel[i]);
+
+	/* Workers which fail to start only reduce the parallelism. */
+	for (i = 0; i < DMEVENTD_WORKER_THREADS; i++)
+		if (_pthread_create_smallstack(NULL, _worker_thread, NULL) && !i)
+			goto bad;
+
+	if (_pthread_create_smallstack(NULL, _event_loop_thread, NULL))
+		goto bad;
+
+	_event_loop = 1;
+
+	log_info("Monitoring devices from event loop with %d workers.",
+		 DMEVENTD_WORKER_THREADS);
+
+	return 1;
+
+bad:
+	log_debug("Failed to set up event loop, using a thread per device.");
+	if ((_signal_fd >= 0) && close(_signal_fd))
+		log_sys_error("close", "signalfd");
+	if ((_timer_fd >= 0) && close(_timer_fd))
+		log_sys_error("close", "timerfd");
+	if ((_epoll_fd >= 0) && close(_epoll_fd))
+		log_sys_error("close", "epoll");
+	if (close(_control_fd))
+		log_sys_error("close", control);
+	_signal_fd = _timer_fd = _epoll_fd = _control_fd = -1;
+
+	return 0;
+}
+#else
+static int _event_loop_init(void)
+{
+	return 0;
+}
+#endif
+
 /* Update events - needs to be locked */
 static int _update_events(struct thread_status *thread, int events)
 {
@@ -1083,6 +1709,14 @@ static int _update_events(struct thread_status *thread, int events)
 		return 0; /* Nothing has changed */
 
 	thread->events = events;
+
+	if (_event_loop) {
+		/* The event filter applies to the next event right away. */
+		if (!thread->events)
+			_device_detach(thread);
+		return 0;
+	}
+
 	thread->pending = DM_EVENT_REGISTRATION_PENDING;
 
 	/* Only non-processing threads can be notified */
@@ -1186,7 +1820,7 @@ static int _register_for_event(struct message_data *message_data)
 			return -ENOMEM;
 		}
 
-		if ((ret = _create_thread(thread))) {
+		if (!_event_loop && (ret = _create_thread(thread))) {
 			stack;
 			_free_thread_status(thread);
 			return -ret;
@@ -1195,6 +1829,9 @@ static int _register_for_event(struct message_data *message_data)
 		_lock_mutex();
 		/* Note: same uuid can't be added in parallel */
 		LINK_THREAD(thread);
+
+		if (_event_loop)
+			_queue_work(thread, DM_WORK_REGISTER);
 	}
 
 	_unlock_mutex();
@@ -1347,7 +1984,12 @@ static int _set_timeout(struct message_data *message_data)
 	pthread_mutex_lock(&_timeout_mutex);
 	thread->timeout = message_data->timeout_secs;
 	thread->next_time = 0;
-	pthread_cond_signal(&_timeout_cond);
+	if (!_event_loop)
+		pthread_cond_signal(&_timeout_cond);
+	else if (!dm_list_empty(&thread->timeout_list)) {
+		_wheel_del(thread);
+		_wheel_add(thread);
+	}
 	pthread_mutex_unlock(&_timeout_mutex);
 
 	return 0;
@@ -1372,6 +2014,208 @@ static int _get_timeout(struct message_data *message_data)
 	return (msg->data && msg->size) ? 0 : -ENOMEM;
 }
 
+/* One device of a DM_EVENT_CMD_BATCH message. */
+struct batch_entry {
+	int cmd;		/* DM_EVENT_CMD_(UN)REGISTER_FOR_EVENT */
+	int ret;
+	struct message_data data;
+	struct dm_event_daemon_message msg;	/* Error text of _load_dso() */
+	struct dso_data *dso_data;
+	struct thread_status *thread;
+};
+
+/* Parse one '<cmd> <dso> <uuid> <events> <timeout>' line. */
+static int _parse_batch_entry(struct batch_entry *entry, char *line)
+{
+	char *p;
+
+	entry->data.msg = &entry->msg;
+	entry->cmd = (int) strtol(line, &p, 10);
+
+	if ((p == line) || (*p++ != ' ') ||
+	    !_parse_device_fields(&entry->data, &p))
+		return 0;
+
+	if (!entry->data.device_uuid)
+		return 0;
+
+	switch (entry->cmd) {
+	case DM_EVENT_CMD_REGISTER_FOR_EVENT:
+		return entry->data.dso_name && entry->data.events_field;
+	case DM_EVENT_CMD_UNREGISTER_FOR_EVENT:
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Register or unregister a parsed entry.  Mutex must be held. */
+static int _batch_entry_update(struct batch_entry *entry,
+			       struct dm_hash_table *threads)
+{
+	struct thread_status *thread;
+	int ret;
+
+	thread = dm_hash_lookup(threads, entry->data.device_uuid);
+
+	if (entry->cmd == DM_EVENT_CMD_UNREGISTER_FOR_EVENT) {
+		if (!(entry->thread = thread))
+			return -ENODEV;
+		return _update_events(thread, (thread->events & ~entry->data.events_field));
+	}
+
+	if (thread) {
+		entry->thread = thread;
+		return _update_events(thread, (thread->events | entry->data.events_field));
+	}
+
+	if (!(thread = _alloc_thread_status(&entry->data, entry->dso_data))) {
+		stack;
+		return -ENOMEM;
+	}
+
+	if (!_event_loop && (ret = _create_thread(thread))) {
+		stack;
+		_free_thread_status(thread);
+		return -ret;
+	}
+
+	LINK_THREAD(thread);
+
+	if (_event_loop)
+		_queue_work(thread, DM_WORK_REGISTER);
+
+	/* Later entries of the batch may refer to it. */
+	if (!dm_hash_insert(threads, thread->device.uuid, thread))
+		log_error("Failed to hash %s.", thread->device.uuid);
+
+	entry->thread = thread;
+
+	return 0;
+}
+
+/*
+ * (Un)register many devices at once.
+ *
+ * The message id is followed by the number of devices and a line
+ * '<cmd> <dso> <uuid> <events> <timeout>' for each of them.  All of
+ * them are updated under one acquisition of the global mutex and the
+ * reply lists the result of each device in the same order.
+ */
+static int _batch(struct message_data *message_data)
+{
+	struct dm_event_daemon_message *msg = message_data->msg;
+	struct dm_hash_table *threads = NULL;
+	struct batch_entry *entries = NULL;
+	struct thread_status *thread;
+	unsigned long count = 0, i;
+	char *p = msg->data, *eol, *reply;
+	int ret = -EINVAL, r;
+
+	if (!p || !_fetch_string(&message_data->id, &p, ' '))
+		goto out;
+
+	count = strtoul(p, &eol, 10);
+	if ((eol == p) || (*eol != '\n') || !count || (count > DM_EVENT_BATCH_MAX))
+		goto out;
+
+	if (!(entries = dm_zalloc(count * sizeof(*entries)))) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < count; i++) {
+		p = eol + 1;
+		if (!(eol = strchr(p, '\n')))
+			goto out;
+		*eol = '\0';
+		if (!_parse_batch_entry(&entries[i], p))
+			goto out;
+	}
+
+	/* DSOs are loaded without holding the mutex as in _register_for_event(). */
+	for (i = 0; i < count; i++)
+		if ((entries[i].cmd == DM_EVENT_CMD_REGISTER_FOR_EVENT) &&
+		    !(entries[i].dso_data = _lookup_dso(&entries[i].data)) &&
+		    !(entries[i].dso_data = _load_dso(&entries[i].data))) {
+			stack;
+#ifdef ELIBACC
+			entries[i].ret = -ELIBACC;
+#else
+			entries[i].ret = -ENODEV;
+#endif
+		}
+
+	_lock_mutex();
+
+	if (!(threads = dm_hash_create(dm_list_size(&_thread_registry) + count))) {
+		_unlock_mutex();
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	dm_list_iterate_items(thread, &_thread_registry)
+		if (!dm_hash_insert(threads, thread->device.uuid, thread)) {
+			_unlock_mutex();
+			ret = -ENOMEM;
+			goto out;
+		}
+
+	for (i = 0; i < count; i++)
+		if (!entries[i].ret)
+			entries[i].ret = _batch_entry_update(&entries[i], threads);
+
+	_unlock_mutex();
+
+	/* Timeout registry has its own lock, see _register_for_event(). */
+	for (i = 0; i < count; i++) {
+		if (entries[i].ret || !(entries[i].data.events_field & DM_EVENT_TIMEOUT))
+			continue;
+
+		if (entries[i].cmd == DM_EVENT_CMD_UNREGISTER_FOR_EVENT)
+			_unregister_for_timeout(entries[i].thread);
+		else if ((r = _register_for_timeout(entries[i].thread))) {
+			stack;
+			_unregister_for_event(&entries[i].data);
+			entries[i].ret = -r;
+		}
+	}
+
+	DEBUGLOG("Batch of %lu devices processed.", count);
+
+	/* Message id and a result of up to 11 characters per device. */
+	if (!(reply = dm_malloc(strlen(message_data->id) + count * 12 + 1))) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	p = reply + sprintf(reply, "%s", message_data->id);
+	for (i = 0; i < count; i++)
+		p += sprintf(p, " %d", entries[i].ret);
+
+	dm_free(msg->data);
+	msg->data = reply;
+	msg->size = (uint32_t) (p - reply);
+	ret = 0;
+out:
+	if (threads)
+		dm_hash_destroy(threads);
+
+	if (entries)
+		for (i = 0; i < count; i++) {
+			_free_message(&entries[i].data);
+			dm_free(entries[i].msg.data);
+		}
+	dm_free(entries);
+
+	if (ret) {
+		dm_free(msg->data);
+		msg->data = NULL;
+	}
+
+	return ret;
+}
+
 static int _open_fifo(const char *path)
 {
 	struct stat st;
@@ -1624,7 +2468,10 @@ static int _do_process_request(struct dm_event_daemon_message *msg)
 						DM_EVENT_PROTOCOL_VERSION);
 			dm_free(answer);
 		}
-	} else if (msg->cmd != DM_EVENT_CMD_ACTIVE && !_parse_message(&message_data)) {
+	} else if (msg->cmd == DM_EVENT_CMD_BATCH)
+		/* Parses the message itself */
+		ret = _batch(&message_data);
+	else if (msg->cmd != DM_EVENT_CMD_ACTIVE && !_parse_message(&message_data)) {
 		stack;
 		ret = -EINVAL;
 	} else
@@ -1691,11 +2538,32 @@ static void _process_initial_registrations(void)
 static void _cleanup_unused_threads(void)
 {
 	struct dm_list *l;
-	struct thread_status *thread;
+	struct thread_status *thread, *tmp;
+	struct dm_list done;
 	int ret;
 
+	dm_list_init(&done);
 	_lock_mutex();
 
+	if (_event_loop) {
+		/* Devices are done once the workers unregistered them. */
+		dm_list_iterate_items_safe(thread, tmp, &_thread_registry_unused)
+			if ((thread->status == DM_THREAD_DONE) && !thread->queued &&
+			    !thread->checking) {
+				UNLINK_THREAD(thread);
+				LINK(thread, &done);
+			}
+		_unlock_mutex();
+
+		dm_list_iterate_items_safe(thread, tmp, &done) {
+			DEBUGLOG("Destroying monitor for %s.", thread->device.name);
+			/* Registration may have failed before its timeout was set. */
+			_unregister_for_timeout(thread);
+			_free_thread_status(thread);
+		}
+		return;
+	}
+
 	while ((l = dm_list_first(&_thread_registry_unused))) {
 		thread = dm_list_item(l, struct thread_status);
 		if (thread->status != DM_THREAD_DONE) {
@@ -2138,13 +3006,14 @@ bad:
 static void _usage(char *prog, FILE *file)
 {
 	fprintf(file, "Usage:\n"
-		"%s [-d [-d [-d]]] [-f] [-h] [-l] [-R] [-V] [-?]\n\n"
+		"%s [-d [-d [-d]]] [-f] [-h] [-l] [-R] [-t] [-V] [-?]\n\n"
 		"   -d       Log debug messages to syslog (-d, -dd, -ddd)\n"
 		"   -f       Don't fork, run in the foreground\n"
 		"   -h       Show this help information\n"
 		"   -l       Log to stdout,stderr instead of syslog\n"
 		"   -?       Show this help information on stderr\n"
 		"   -R       Restart dmeventd\n"
+		"   -t       Use a monitoring thread per device\n"
 		"   -V       Show version of dmeventd\n\n", prog);
 }
 
@@ -2161,7 +3030,7 @@ int main(int argc, char *argv[])
 	opterr = 0;
 	optind = 0;
 
-	while ((opt = getopt(argc, argv, "?fhVdlR")) != EOF) {
+	while ((opt = getopt(argc, argv, "?fhVdlRt")) != EOF) {
 		switch (opt) {
 		case 'h':
 			_usage(argv[0], stdout);
@@ -2181,6 +3050,9 @@ int main(int argc, char *argv[])
 		case 'l':
 			_use_syslog = 0;
 			break;
+		case 't':
+			_thread_per_device++;
+			break;
 		case 'V':
 			printf("dmeventd version: %s\n", DM_LIB_VERSION);
 			exit(EXIT_SUCCESS);
@@ -2249,6 +3121,8 @@ int main(int argc, char *argv[])
 
 	_idle_since = time(NULL);
 
+	(void) _event_loop_init();
+
 	if (_initial_registrations)
 		_process_initial_registrations();
 
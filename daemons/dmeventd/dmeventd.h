@@ -35,8 +35,12 @@ enum dm_event_command {
 	DM_EVENT_CMD_DIE,
 	DM_EVENT_CMD_GET_STATUS,
 	DM_EVENT_CMD_GET_PARAMETERS,
+	DM_EVENT_CMD_BATCH,
 };
 
+/* Most devices (un)registered by one DM_EVENT_CMD_BATCH message. */
+#define DM_EVENT_BATCH_MAX 1024
+
 /* Message passed between client and daemon. */
 struct dm_event_daemon_message {
 	uint32_t cmd;
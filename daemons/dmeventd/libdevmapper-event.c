@@ -281,10 +281,17 @@ static int _daemon_write(struct dm_event_fifos *fifos,
 	fd_set fds;
 	size_t bytes = 0;
 	size_t size = 2 * sizeof(uint32_t) + msg->size;
-	uint32_t *header = alloca(size);
-	char *buf = (char *)header;
+	uint32_t *header;
+	char *buf;
 	char drainbuf[128];
 
+	/* Batch messages are too large for the stack. */
+	if (!(header = dm_malloc(size))) {
+		log_error("Unable to allocate message for event daemon.");
+		return 0;
+	}
+
+	buf = (char *)header;
 	header[0] = htonl(msg->cmd);
 	header[1] = htonl(msg->size);
 	memcpy(buf + 2 * sizeof(uint32_t), msg->data, msg->size);
@@ -299,7 +306,7 @@ static int _daemon_write(struct dm_event_fifos *fifos,
 			if (errno == EINTR)
 				continue;
 			log_error("Unable to talk to event daemon.");
-			return 0;
+			goto out;
 		}
 		if (ret == 0)
 			break;
@@ -308,7 +315,7 @@ static int _daemon_write(struct dm_event_fifos *fifos,
 			if ((errno == EINTR) || (errno == EAGAIN))
 				continue;
 			log_error("Unable to talk to event daemon.");
-			return 0;
+			goto out;
 		}
 	}
 
@@ -320,7 +327,7 @@ static int _daemon_write(struct dm_event_fifos *fifos,
 			ret = select(fifos->client + 1, NULL, &fds, NULL, NULL);
 			if ((ret < 0) && (errno != EINTR)) {
 				log_error("Unable to talk to event daemon.");
-				return 0;
+				goto out;
 			}
 		} while (ret < 1);
 
@@ -330,15 +337,46 @@ static int _daemon_write(struct dm_event_fifos *fifos,
 				continue;
 
 			log_error("Unable to talk to event daemon.");
-			return 0;
+			goto out;
 		}
 
 		bytes += ret;
 	}
+out:
+	dm_free(header);
 
 	return bytes == size;
 }
 
+/*
+ * Write command and message to and
+ * read status return code from daemon.
+ */
+static int _daemon_send(struct dm_event_fifos *fifos,
+			struct dm_event_daemon_message *msg)
+{
+	if (!_daemon_write(fifos, msg)) {
+		stack;
+		dm_free(msg->data);
+		msg->data = NULL;
+		return -EIO;
+	}
+
+	do {
+		dm_free(msg->data);
+		msg->data = NULL;
+
+		if (!_daemon_read(fifos, msg)) {
+			stack;
+			return -EIO;
+		}
+	} while (!_check_message_id(msg));
+
+	_sequence_nr++;
+
+	return (int32_t) msg->cmd;
+}
+
 int daemon_talk(struct dm_event_fifos *fifos,
 		struct dm_event_daemon_message *msg, int cmd,
 		const char *dso_name, const char *dev_name,
@@ -364,30 +402,7 @@ int daemon_talk(struct dm_event_fifos *fifos,
 	msg->cmd = cmd;
 	msg->size = msg_size;
 
-	/*
-	 * Write command and message to and
-	 * read status return code from daemon.
-	 */
-	if (!_daemon_write(fifos, msg)) {
-		stack;
-		dm_free(msg->data);
-		msg->data = NULL;
-		return -EIO;
-	}
-
-	do {
-		dm_free(msg->data);
-		msg->data = NULL;
-
-		if (!_daemon_read(fifos, msg)) {
-			stack;
-			return -EIO;
-		}
-	} while (!_check_message_id(msg));
-
-	_sequence_nr++;
-
-	return (int32_t) msg->cmd;
+	return _daemon_send(fifos, msg);
 }
 
 /*
@@ -693,6 +708,236 @@ int dm_event_unregister_handler(const struct dm_event_handler *dmevh)
 	return ret;
 }
 
+/* A device queued for (un)registration in a batch. */
+struct dm_event_batch_entry {
+	struct dm_list list;
+	int cmd;		/* DM_EVENT_CMD_(UN)REGISTER_FOR_EVENT */
+	const char *dso;
+	const char *uuid;
+	const char *dev_name;	/* For error messages */
+	enum dm_event_mask mask;
+	uint32_t timeout;
+};
+
+struct dm_event_batch {
+	struct dm_pool *mem;
+	char *dmeventd_path;
+	struct dm_list entries;
+	unsigned count;
+};
+
+struct dm_event_batch *dm_event_batch_create(void)
+{
+	struct dm_event_batch *batch;
+
+	if (!(batch = dm_zalloc(sizeof(*batch)))) {
+		log_error("Failed to allocate event batch.");
+		return NULL;
+	}
+
+	if (!(batch->mem = dm_pool_create("dm_event_batch", 4096))) {
+		dm_free(batch);
+		return_NULL;
+	}
+
+	dm_list_init(&batch->entries);
+
+	return batch;
+}
+
+void dm_event_batch_destroy(struct dm_event_batch *batch)
+{
+	if (!batch)
+		return;
+
+	dm_pool_destroy(batch->mem);
+	dm_free(batch);
+}
+
+unsigned dm_event_batch_get_count(const struct dm_event_batch *batch)
+{
+	return batch->count;
+}
+
+int dm_event_batch_add(struct dm_event_batch *batch,
+		       const struct dm_event_handler *dmevh, int set)
+{
+	struct dm_event_batch_entry *entry;
+	struct dm_task *dmt;
+	int r = 0;
+
+	if (!dmevh->dso) {
+		log_error(INTERNAL_ERROR "Event batch handler without dso.");
+		return 0;
+	}
+
+	if (!(dmt = _get_device_info(dmevh)))
+		return_0;
+
+	if (set && !strstr(dmevh->dso, "libdevmapper-event-lvm2thin.so") &&
+	    !strstr(dmevh->dso, "libdevmapper-event-lvm2snapshot.so") &&
+	    !strstr(dmevh->dso, "libdevmapper-event-lvm2mirror.so") &&
+	    !strstr(dmevh->dso, "libdevmapper-event-lvm2raid.so"))
+		log_warn("WARNING: %s: dmeventd plugins are deprecated.", dmevh->dso);
+
+	/* All handlers of a batch talk to the same daemon. */
+	if (!batch->dmeventd_path && dmevh->dmeventd_path &&
+	    !(batch->dmeventd_path = dm_pool_strdup(batch->mem, dmevh->dmeventd_path)))
+		goto_out;
+
+	if (!(entry = dm_pool_zalloc(batch->mem, sizeof(*entry))) ||
+	    !(entry->dso = dm_pool_strdup(batch->mem, dmevh->dso)) ||
+	    !(entry->uuid = dm_pool_strdup(batch->mem, dm_task_get_uuid(dmt))) ||
+	    !(entry->dev_name = dm_pool_strdup(batch->mem, dm_task_get_name(dmt)))) {
+		log_error("Failed to allocate event batch entry.");
+		goto out;
+	}
+
+	entry->cmd = set ? DM_EVENT_CMD_REGISTER_FOR_EVENT : DM_EVENT_CMD_UNREGISTER_FOR_EVENT;
+	entry->mask = dmevh->mask;
+	entry->timeout = dmevh->timeout;
+	dm_list_add(&batch->entries, &entry->list);
+	batch->count++;
+	r = 1;
+out:
+	dm_task_destroy(dmt);
+
+	return r;
+}
+
+static void _batch_entry_failed(const struct dm_event_batch_entry *entry,
+				const char *reason)
+{
+	log_error("%s: event %sregistration failed: %s.", entry->dev_name,
+		  (entry->cmd == DM_EVENT_CMD_REGISTER_FOR_EVENT) ? "" : "de",
+		  reason);
+}
+
+/*
+ * Send up to DM_EVENT_BATCH_MAX entries starting with *next in one
+ * message and advance *next past them.  Returns the number of entries
+ * which failed.
+ */
+static int _batch_talk(struct dm_event_fifos *fifos,
+		       struct dm_event_batch *batch, struct dm_list **next)
+{
+	struct dm_event_daemon_message msg = { 0 };
+	struct dm_event_batch_entry *entry;
+	struct dm_list *l, *first = *next;
+	size_t size = 64;
+	unsigned count = 0;
+	char *p, *end;
+	long ret;
+	int failed = 0;
+
+	for (l = first; (l != &batch->entries) && (count < DM_EVENT_BATCH_MAX); l = l->n, count++) {
+		entry = dm_list_item(l, struct dm_event_batch_entry);
+		size += strlen(entry->dso) + strlen(entry->uuid) + 48;
+	}
+	*next = l;
+
+	if (!(msg.data = p = dm_malloc(size))) {
+		log_error("Failed to allocate event batch message.");
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	p += sprintf(p, "%d:%d %u\n", getpid(), _sequence_nr, count);
+	for (l = first; l != *next; l = l->n) {
+		entry = dm_list_item(l, struct dm_event_batch_entry);
+		p += sprintf(p, "%d %s %s %u %" PRIu32 "\n", entry->cmd,
+			     entry->dso, entry->uuid, entry->mask, entry->timeout);
+	}
+
+	msg.cmd = DM_EVENT_CMD_BATCH;
+	msg.size = p - msg.data;
+
+	if ((ret = _daemon_send(fifos, &msg)) < 0)
+		goto fail;
+
+	/* Reply lists the result of each entry after the message id. */
+	p = msg.data ? strchr(msg.data, ' ') : NULL;
+	for (l = first; l != *next; l = l->n) {
+		entry = dm_list_item(l, struct dm_event_batch_entry);
+		if (!p || ((ret = strtol(p, &end, 10)), (end == p))) {
+			_batch_entry_failed(entry, "malformed reply from dmeventd");
+			failed++;
+			continue;
+		}
+		p = end;
+		if (ret < 0) {
+			_batch_entry_failed(entry, strerror(-ret));
+			failed++;
+		}
+	}
+
+	dm_free(msg.data);
+
+	return failed;
+
+fail:
+	for (l = first; l != *next; l = l->n, failed++)
+		_batch_entry_failed(dm_list_item(l, struct dm_event_batch_entry),
+				    msg.data ? msg.data : strerror(-ret));
+	dm_free(msg.data);
+
+	return failed;
+}
+
+int dm_event_batch_submit(struct dm_event_batch *batch)
+{
+	struct dm_event_batch_entry *entry;
+	struct dm_event_daemon_message msg = { 0 };
+	struct dm_list *next;
+	int version, failed = 0, err;
+	struct dm_event_fifos fifos = {
+		.server = -1,
+		.client = -1,
+		/* FIXME Make these either configurable or depend directly on dmeventd_path */
+		.client_path = DM_EVENT_FIFO_CLIENT,
+		.server_path = DM_EVENT_FIFO_SERVER
+	};
+
+	if (!batch->count)
+		return 1;
+
+	if (!_init_client(batch->dmeventd_path, &fifos) ||
+	    !dm_event_get_version(&fifos, &version)) {
+		dm_list_iterate_items(entry, &batch->entries)
+			_batch_entry_failed(entry, strerror(ESRCH));
+		failed = batch->count;
+		goto out;
+	}
+
+	if (version >= 3)
+		for (next = batch->entries.n; next != &batch->entries;)
+			failed += _batch_talk(&fifos, batch, &next);
+	else
+		/* Daemon predates batches, send them one by one. */
+		dm_list_iterate_items(entry, &batch->entries) {
+			if ((err = daemon_talk(&fifos, &msg, entry->cmd, entry->dso,
+					       entry->uuid, entry->mask, entry->timeout)) < 0) {
+				_batch_entry_failed(entry, msg.data ? msg.data : strerror(-err));
+				failed++;
+			}
+			dm_free(msg.data);
+			msg.data = NULL;
+		}
+
+	log_debug("Submitted event batch of %u devices, %d failed.",
+		  batch->count, failed);
+out:
+	fini_fifos(&fifos);
+
+	/* Ready for the next batch. */
+	dm_pool_empty(batch->mem);
+	dm_list_init(&batch->entries);
+	batch->dmeventd_path = NULL;
+	batch->count = 0;
+
+	return !failed;
+}
+
 /* Fetch a string off src and duplicate it into *dest. */
 /* FIXME: move to separate module to share with the daemon. */
 static char *_fetch_string(char **src, const int delimiter)
@@ -851,6 +1096,8 @@ int dm_event_get_version(struct dm_event_fifos *fifos, int *version) {
 	if ((p = strchr(p + 1, ' '))) /* HELLO, once more */
 		*version = atoi(p);
 
+	dm_free(msg.data);
+
 	return 1;
 }
 
@@ -46,7 +46,7 @@ enum dm_event_mask {
 };
 
 #define DM_EVENT_ALL_ERRORS DM_EVENT_ERROR_MASK
-#define DM_EVENT_PROTOCOL_VERSION 2
+#define DM_EVENT_PROTOCOL_VERSION 3
 
 struct dm_task;
 struct dm_event_handler;
@@ -105,6 +105,27 @@ int dm_event_get_registered_device(struct dm_event_handler *dmevh, int next);
 int dm_event_register_handler(const struct dm_event_handler *dmevh);
 int dm_event_unregister_handler(const struct dm_event_handler *dmevh);
 
+/*
+ * Batch (un)registration of many devices with dmeventd.
+ *
+ * Handlers added to a batch are sent to dmeventd together by
+ * dm_event_batch_submit(), which handles them in one request instead of
+ * a round trip for each device.  The device of a handler is looked up
+ * when it is added, so the handler may be destroyed right away.
+ * Failures of individual devices are logged and make submit return 0.
+ * The batch is empty again after submit.
+ */
+struct dm_event_batch;
+
+struct dm_event_batch *dm_event_batch_create(void);
+void dm_event_batch_destroy(struct dm_event_batch *batch);
+
+/* Queue a registration when set is non-zero, unregistration otherwise. */
+int dm_event_batch_add(struct dm_event_batch *batch,
+		       const struct dm_event_handler *dmevh, int set);
+unsigned dm_event_batch_get_count(const struct dm_event_batch *batch);
+int dm_event_batch_submit(struct dm_event_batch *batch);
+
 /* Set debug level for logging, and whether to log on stdout/stderr or syslog */
 void dm_event_log_set(int debug_log_level, int use_syslog);
 
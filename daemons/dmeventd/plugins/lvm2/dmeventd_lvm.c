@@ -16,8 +16,10 @@
 #include "dmeventd_lvm.h"
 #include "libdevmapper-event.h"
 #include "lvm2cmd.h"
+#include "lvm-string.h"
 
 #include <pthread.h>
+#include <time.h>
 
 /*
  * register_device() is called first and performs initialisation.
@@ -32,6 +34,58 @@ static int _register_count = 0;
 static struct dm_pool *_mem_pool = NULL;
 static void *_lvm_handle = NULL;
 
+/*
+ * Queued policy actions.
+ * A single executor runs them as liblvm2cmd keeps process wide state
+ * (device cache, lvmcache, memlock) which cannot be shared by parallel
+ * commands.  Per-VG queues keep the actions of a VG ordered and
+ * let one busy VG not delay the actions of the others.
+ */
+#define EXECUTOR_STACK_SIZE	(300 * 1024)
+
+enum {
+	ACTION_QUEUED,
+	ACTION_RUNNING,
+	ACTION_DONE
+};
+
+struct action_vg {
+	struct dm_list list;		/* in _ready_vgs */
+	struct dm_list actions;
+	int ready;
+	int busy;
+};
+
+struct dmeventd_lvm2_action {
+	struct dm_list list;		/* in action_vg */
+	struct action_vg *vg;
+	char *cmdline;
+	char *env[DMEVENTD_LVM2_ACTION_ENV_MAX + 1];
+	unsigned users;
+	int status;
+	int result;
+	uint64_t queued_ms;
+	uint64_t started_ms;
+};
+
+static pthread_mutex_t _action_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _action_cond = PTHREAD_COND_INITIALIZER;
+static struct dm_hash_table *_action_vgs = NULL;
+static DM_LIST_INIT(_ready_vgs);
+static pthread_t _executor;
+static int _executor_running = 0;
+static int _executor_exit = 0;
+
+static struct {
+	unsigned count;
+	unsigned failed;
+	unsigned merged;
+	uint64_t wait_ms;
+	uint64_t max_wait_ms;
+	uint64_t run_ms;
+	uint64_t max_run_ms;
+} _action_stats;
+
 DM_EVENT_LOG_FN("#lvm")
 
 static void _lvm2_print_log(int level, const char *file, int line,
@@ -55,6 +109,323 @@ void dmeventd_lvm2_unlock(void)
 	pthread_mutex_unlock(&_event_mutex);
 }
 
+static uint64_t _now_ms(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		return 0;
+
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void _action_free(struct dmeventd_lvm2_action *action)
+{
+	char **env;
+
+	for (env = action->env; *env; env++)
+		dm_free(*env);
+
+	dm_free(action->cmdline);
+	dm_free(action);
+}
+
+/* Let the executor pick the VG once it has a queued action and none running. */
+static void _action_vg_ready(struct action_vg *vg)
+{
+	if (vg->ready || vg->busy || dm_list_empty(&vg->actions))
+		return;
+
+	dm_list_add(&_ready_vgs, &vg->list);
+	vg->ready = 1;
+	pthread_cond_signal(&_action_cond);
+}
+
+static void _action_set_env(struct dmeventd_lvm2_action *action, int set)
+{
+	char **env, *eq;
+
+	for (env = action->env; *env; env++) {
+		if (!(eq = strchr(*env, '=')))
+			continue;
+		*eq = '\0';
+		if (set)
+			(void) setenv(*env, eq + 1, 1);
+		else
+			(void) unsetenv(*env);
+		*eq = '=';
+	}
+}
+
+static void _action_done(struct dmeventd_lvm2_action *action, int result)
+{
+	uint64_t wait_ms = action->started_ms - action->queued_ms;
+	uint64_t run_ms = _now_ms() - action->started_ms;
+
+	_action_stats.count++;
+	_action_stats.wait_ms += wait_ms;
+	_action_stats.run_ms += run_ms;
+	if (wait_ms > _action_stats.max_wait_ms)
+		_action_stats.max_wait_ms = wait_ms;
+	if (run_ms > _action_stats.max_run_ms)
+		_action_stats.max_run_ms = run_ms;
+	if (!result)
+		_action_stats.failed++;
+
+	log_info("%s %s after " FMTu64 " ms (queued " FMTu64 " ms).",
+		 action->cmdline, result ? "finished" : "failed", run_ms, wait_ms);
+
+	action->status = ACTION_DONE;
+	action->result = result;
+	action->vg->busy = 0;
+	_action_vg_ready(action->vg);
+
+	if (!action->users)
+		_action_free(action);
+}
+
+static void *_executor_thread(void *arg __attribute__((unused)))
+{
+	struct dmeventd_lvm2_action *action;
+	struct action_vg *vg;
+	int r;
+
+	pthread_mutex_lock(&_action_mutex);
+
+	for (;;) {
+		while (!_executor_exit && dm_list_empty(&_ready_vgs))
+			pthread_cond_wait(&_action_cond, &_action_mutex);
+
+		if (dm_list_empty(&_ready_vgs))
+			break;
+
+		vg = dm_list_item(dm_list_first(&_ready_vgs), struct action_vg);
+		dm_list_del(&vg->list);
+		vg->ready = 0;
+		vg->busy = 1;
+
+		action = dm_list_item(dm_list_first(&vg->actions), struct dmeventd_lvm2_action);
+		dm_list_del(&action->list);
+		action->status = ACTION_RUNNING;
+		action->started_ms = _now_ms();
+
+		pthread_mutex_unlock(&_action_mutex);
+
+		dmeventd_lvm2_lock();
+		_action_set_env(action, 1);
+		r = dmeventd_lvm2_run(action->cmdline);
+		_action_set_env(action, 0);
+		dmeventd_lvm2_unlock();
+
+		pthread_mutex_lock(&_action_mutex);
+		_action_done(action, r);
+	}
+
+	pthread_mutex_unlock(&_action_mutex);
+
+	return NULL;
+}
+
+static int _executor_start(void)
+{
+	pthread_attr_t attr;
+	int r;
+
+	if (!(_action_vgs = dm_hash_create(32))) {
+		log_error("Failed to allocate action queues.");
+		return 0;
+	}
+
+	if (pthread_attr_init(&attr)) {
+		log_sys_error("pthread_attr_init", "");
+		goto bad;
+	}
+
+	/* Stack gets preallocated in its entirety with memory locked */
+	pthread_attr_setstacksize(&attr, EXECUTOR_STACK_SIZE + getpagesize());
+	_executor_exit = 0;
+	r = pthread_create(&_executor, &attr, _executor_thread, NULL);
+	pthread_attr_destroy(&attr);
+
+	if (r) {
+		log_sys_error("pthread_create", "");
+		goto bad;
+	}
+
+	_executor_running = 1;
+	memset(&_action_stats, 0, sizeof(_action_stats));
+
+	return 1;
+bad:
+	dm_hash_destroy(_action_vgs);
+	_action_vgs = NULL;
+
+	return 0;
+}
+
+static void _executor_stop(void)
+{
+	struct dm_hash_node *n;
+
+	if (!_executor_running)
+		return;
+
+	pthread_mutex_lock(&_action_mutex);
+	_executor_exit = 1;
+	pthread_cond_signal(&_action_cond);
+	pthread_mutex_unlock(&_action_mutex);
+
+	if (pthread_join(_executor, NULL))
+		log_sys_error("pthread_join", "");
+
+	_executor_running = 0;
+
+	if (_action_stats.count)
+		log_info("Ran %u policy actions (%u failed, %u merged), queued avg "
+			 FMTu64 " max " FMTu64 " ms, run avg " FMTu64 " max " FMTu64 " ms.",
+			 _action_stats.count, _action_stats.failed, _action_stats.merged,
+			 _action_stats.wait_ms / _action_stats.count, _action_stats.max_wait_ms,
+			 _action_stats.run_ms / _action_stats.count, _action_stats.max_run_ms);
+
+	/* All users are gone, so their queued actions got cancelled. */
+	dm_hash_iterate(n, _action_vgs)
+		dm_free(dm_hash_get_data(_action_vgs, n));
+	dm_hash_destroy(_action_vgs);
+	_action_vgs = NULL;
+}
+
+static struct action_vg *_action_vg_get(const char *cmdline)
+{
+	struct action_vg *vg;
+	const char *name, *slash;
+	char vgname[NAME_LEN];
+
+	/* cmdline ends with ' vg/lv' */
+	if (!(name = strrchr(cmdline, ' ')) || !(slash = strchr(++name, '/')) ||
+	    ((size_t) (slash - name) >= sizeof(vgname))) {
+		log_error("Unable to determine VG name from %s.", cmdline);
+		return NULL;
+	}
+
+	memcpy(vgname, name, slash - name);
+	vgname[slash - name] = '\0';
+
+	if ((vg = dm_hash_lookup(_action_vgs, vgname)))
+		return vg;
+
+	if (!(vg = dm_zalloc(sizeof(*vg)))) {
+		log_error("Failed to allocate action queue for %s.", vgname);
+		return NULL;
+	}
+
+	dm_list_init(&vg->actions);
+
+	if (!dm_hash_insert(_action_vgs, vgname, vg)) {
+		log_error("Failed to add action queue for %s.", vgname);
+		dm_free(vg);
+		return NULL;
+	}
+
+	return vg;
+}
+
+struct dmeventd_lvm2_action *dmeventd_lvm2_action_queue(const char *cmdline,
+							const char *const *env)
+{
+	struct dmeventd_lvm2_action *action = NULL;
+	struct action_vg *vg;
+	char *copy[DMEVENTD_LVM2_ACTION_ENV_MAX + 1] = { NULL };
+	int i;
+
+	for (i = 0; env && env[i]; i++)
+		if ((i == DMEVENTD_LVM2_ACTION_ENV_MAX) ||
+		    !(copy[i] = dm_strdup(env[i]))) {
+			log_error("Failed to copy environment for %s.", cmdline);
+			goto bad;
+		}
+
+	pthread_mutex_lock(&_action_mutex);
+
+	if (!_executor_running || !(vg = _action_vg_get(cmdline)))
+		goto_out;
+
+	/* Same command still waiting for its turn - take it over */
+	dm_list_iterate_items(action, &vg->actions)
+		if (!strcmp(action->cmdline, cmdline)) {
+			for (i = 0; action->env[i]; i++)
+				dm_free(action->env[i]);
+			memcpy(action->env, copy, sizeof(copy));
+			action->users++;
+			_action_stats.merged++;
+			log_debug("Merged %s with queued action.", cmdline);
+			pthread_mutex_unlock(&_action_mutex);
+			return action;
+		}
+
+	if (!(action = dm_zalloc(sizeof(*action))) ||
+	    !(action->cmdline = dm_strdup(cmdline))) {
+		log_error("Failed to allocate action for %s.", cmdline);
+		dm_free(action);
+		action = NULL;
+		goto out;
+	}
+
+	memcpy(action->env, copy, sizeof(copy));
+	action->vg = vg;
+	action->users = 1;
+	action->status = ACTION_QUEUED;
+	action->queued_ms = _now_ms();
+	dm_list_add(&vg->actions, &action->list);
+	_action_vg_ready(vg);
+
+	log_debug("Queued %s.", cmdline);
+out:
+	pthread_mutex_unlock(&_action_mutex);
+
+	if (action)
+		return action;
+bad:
+	for (i = 0; copy[i]; i++)
+		dm_free(copy[i]);
+
+	return NULL;
+}
+
+int dmeventd_lvm2_action_result(struct dmeventd_lvm2_action *action)
+{
+	int r;
+
+	pthread_mutex_lock(&_action_mutex);
+	r = (action->status == ACTION_DONE) ? action->result : DMEVENTD_LVM2_ACTION_PENDING;
+	pthread_mutex_unlock(&_action_mutex);
+
+	return r;
+}
+
+void dmeventd_lvm2_action_release(struct dmeventd_lvm2_action *action)
+{
+	pthread_mutex_lock(&_action_mutex);
+
+	if (!--action->users)
+		switch (action->status) {
+		case ACTION_QUEUED:
+			log_debug("Cancelled queued %s.", action->cmdline);
+			dm_list_del(&action->list);
+			if (action->vg->ready && dm_list_empty(&action->vg->actions)) {
+				dm_list_del(&action->vg->list);
+				action->vg->ready = 0;
+			}
+			/* fall through */
+		case ACTION_DONE:
+			_action_free(action);
+			break;
+		default:
+			break; /* Executor frees it when finished */
+		}
+
+	pthread_mutex_unlock(&_action_mutex);
+}
+
 int dmeventd_lvm2_init(void)
 {
 	int r = 0;
@@ -77,6 +448,14 @@ int dmeventd_lvm2_init(void)
 			goto out;
 		}
 
+		if (!_executor_start()) {
+			dm_pool_destroy(_mem_pool);
+			_mem_pool = NULL;
+			lvm2_exit(_lvm_handle);
+			_lvm_handle = NULL;
+			goto out;
+		}
+
 		lvm2_disable_dmeventd_monitoring(_lvm_handle);
 		/* FIXME Temporary: move to dmeventd core */
 		lvm2_run(_lvm_handle, "_memlock_inc");
@@ -97,6 +476,7 @@ void dmeventd_lvm2_exit(void)
 
 	if (!--_register_count) {
 		log_debug("lvm plugin shuting down.");
+		_executor_stop();
 		lvm2_run(_lvm_handle, "_memlock_dec");
 		dm_pool_destroy(_mem_pool);
 		_mem_pool = NULL;
@@ -39,6 +39,26 @@ struct dm_pool *dmeventd_lvm2_pool(void);
 int dmeventd_lvm2_command(struct dm_pool *mem, char *buffer, size_t size,
 			  const char *cmd, const char *device);
 
+/*
+ * Policy actions are queued for an executor thread running them on the
+ * shared lvm2 instance, so event processing does not wait for the lock.
+ * 'cmdline' ends with the vg/lv built by dmeventd_lvm2_command().
+ * Actions of one VG run in the order queued and VGs with queued actions
+ * take turns.  Queuing a command which still waits in its VG queue merges
+ * with it, the newer 'env' ("NAME=value", NULL terminated) is used.
+ */
+#define DMEVENTD_LVM2_ACTION_ENV_MAX	4
+#define DMEVENTD_LVM2_ACTION_PENDING	(-1)
+
+struct dmeventd_lvm2_action;
+
+struct dmeventd_lvm2_action *dmeventd_lvm2_action_queue(const char *cmdline,
+							const char *const *env);
+/* Returns DMEVENTD_LVM2_ACTION_PENDING, 0 when the command failed or 1. */
+int dmeventd_lvm2_action_result(struct dmeventd_lvm2_action *action);
+/* Not yet started action is cancelled when released by all its users. */
+void dmeventd_lvm2_action_release(struct dmeventd_lvm2_action *action);
+
 #define dmeventd_lvm2_run_with_lock(cmdline) \
 	({\
 		int rc;\
@@ -25,6 +25,7 @@
 
 struct dso_state {
 	struct dm_pool *mem;
+	struct dmeventd_lvm2_action *repair;
 	char cmd_lvconvert[512];
 };
 
@@ -98,15 +99,34 @@ static int _get_mirror_event(struct dso_state *state, char *params)
 	return r;
 }
 
-static int _remove_failed_devices(const char *cmd_lvconvert, const char *device)
+/* Report the result of a finished repair */
+static void _check_repair(struct dso_state *state, const char *device)
 {
+	int r;
+
+	if (!state->repair ||
+	    ((r = dmeventd_lvm2_action_result(state->repair)) == DMEVENTD_LVM2_ACTION_PENDING))
+		return;
+
 	/* if repair goes OK, report success even if lvscan has failed */
-	if (!dmeventd_lvm2_run_with_lock(cmd_lvconvert)) {
+	if (r)
+		log_info("Repair of mirrored device %s finished successfully.", device);
+	else
 		log_error("Repair of mirrored device %s failed.", device);
-		return 0;
+
+	dmeventd_lvm2_action_release(state->repair);
+	state->repair = NULL;
+}
+
+static int _remove_failed_devices(struct dso_state *state, const char *device)
+{
+	if (state->repair) {
+		log_info("Repair of mirrored device %s is already in progress.", device);
+		return 1;
 	}
 
-	log_info("Repair of mirrored device %s finished successfully.", device);
+	if (!(state->repair = dmeventd_lvm2_action_queue(state->cmd_lvconvert, NULL)))
+		return_0;
 
 	return 1;
 }
@@ -122,6 +142,8 @@ void process_event(struct dm_task *dmt,
 	char *params;
 	const char *device = dm_task_get_name(dmt);
 
+	_check_repair(state, device);
+
 	do {
 		next = dm_get_next_target(dmt, next, &start, &length,
 					  &target_type, &params);
@@ -146,7 +168,7 @@ void process_event(struct dm_task *dmt,
 			break;
 		case ME_FAILURE:
 			log_error("Device failure in %s.", device);
-			if (!_remove_failed_devices(state->cmd_lvconvert, device))
+			if (!_remove_failed_devices(state, device))
 				/* FIXME Why are all the error return codes unused? Get rid of them? */
 				log_error("Failed to remove faulty devices in %s.",
 					  device);
@@ -203,6 +225,9 @@ int unregister_device(const char *device,
 {
 	struct dso_state *state = *user;
 
+	if (state->repair)
+		dmeventd_lvm2_action_release(state->repair);
+
 	dmeventd_lvm2_exit_with_pool(state);
 	log_info("No longer monitoring mirror device %s for events.",
 		 device);
@@ -22,6 +22,7 @@
 
 struct dso_state {
 	struct dm_pool *mem;
+	struct dmeventd_lvm2_action *repair;
 	char cmd_lvconvert[512];
 	uint64_t raid_devs[RAID_DEVS_ELEMS];
 	int failed;
@@ -32,6 +33,23 @@ DM_EVENT_LOG_FN("raid")
 
 /* FIXME Reformat to 80 char lines. */
 
+/* Report the result of a finished repair */
+static void _check_repair(struct dso_state *state, const char *device)
+{
+	int r;
+
+	if (!state->repair ||
+	    ((r = dmeventd_lvm2_action_result(state->repair)) == DMEVENTD_LVM2_ACTION_PENDING))
+		return;
+
+	/* if repair goes OK, report success even if lvscan has failed */
+	if (!r)
+		log_error("Repair of RAID device %s failed.", device);
+
+	dmeventd_lvm2_action_release(state->repair);
+	state->repair = NULL;
+}
+
 static int _process_raid_event(struct dso_state *state, char *params, const char *device)
 {
 	struct dm_status_raid *status;
@@ -91,8 +109,8 @@ static int _process_raid_event(struct dso_state *state, char *params, const char
 
 		state->failed = 1;
 
-		/* if repair goes OK, report success even if lvscan has failed */
-		if (!dmeventd_lvm2_run_with_lock(state->cmd_lvconvert)) {
+		if (!state->repair &&
+		    !(state->repair = dmeventd_lvm2_action_queue(state->cmd_lvconvert, NULL))) {
 			log_error("Repair of RAID device %s failed.", device);
 			r = 0;
 		}
@@ -121,6 +139,8 @@ void process_event(struct dm_task *dmt,
 	char *params;
 	const char *device = dm_task_get_name(dmt);
 
+	_check_repair(state, device);
+
 	do {
 		next = dm_get_next_target(dmt, next, &start, &length,
 					  &target_type, &params);
@@ -178,6 +198,9 @@ int unregister_device(const char *device,
 {
 	struct dso_state *state = *user;
 
+	if (state->repair)
+		dmeventd_lvm2_action_release(state->repair);
+
 	dmeventd_lvm2_exit_with_pool(state);
 	log_info("No longer monitoring RAID device %s for events.",
 		 device);
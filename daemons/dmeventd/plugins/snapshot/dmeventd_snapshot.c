@@ -34,6 +34,7 @@ struct dso_state {
 	struct dm_pool *mem;
 	dm_percent_t percent_check;
 	uint64_t known_size;
+	struct dmeventd_lvm2_action *extend;
 	char cmd_lvextend[512];
 };
 
@@ -80,10 +81,30 @@ static int _run(const char *cmd, ...)
         return 1; /* all good */
 }
 
-static int _extend(const char *cmd)
+static int _extend(struct dso_state *state)
 {
-	log_debug("Extending snapshot via %s.", cmd);
-	return dmeventd_lvm2_run_with_lock(cmd);
+	if (state->extend)
+		return 1; /* Still queued or running */
+
+	log_debug("Extending snapshot via %s.", state->cmd_lvextend);
+
+	return (state->extend = dmeventd_lvm2_action_queue(state->cmd_lvextend, NULL)) ? 1 : 0;
+}
+
+/* Report the result of a finished extension */
+static void _check_extend(struct dso_state *state, const char *device)
+{
+	int r;
+
+	if (!state->extend ||
+	    ((r = dmeventd_lvm2_action_result(state->extend)) == DMEVENTD_LVM2_ACTION_PENDING))
+		return;
+
+	if (!r)
+		log_error("Failed to extend snapshot %s.", device);
+
+	dmeventd_lvm2_action_release(state->extend);
+	state->extend = NULL;
 }
 
 #ifdef SNAPSHOT_REMOVE
@@ -176,6 +197,8 @@ void process_event(struct dm_task *dmt,
 	int percent;
 	struct dm_info info;
 
+	_check_extend(state, device);
+
 	/* No longer monitoring, waiting for remove */
 	if (!state->percent_check)
 		return;
@@ -234,7 +257,7 @@ void process_event(struct dm_task *dmt,
 				 device, dm_percent_to_round_float(percent, 2));
 
 		/* Try to extend the snapshot, in accord with user-set policies */
-		if (!_extend(state->cmd_lvextend))
+		if (!_extend(state))
 			log_error("Failed to extend snapshot %s.", device);
 	}
 out:
@@ -280,6 +303,9 @@ int unregister_device(const char *device,
 {
 	struct dso_state *state = *user;
 
+	if (state->extend)
+		dmeventd_lvm2_action_release(state->extend);
+
 	dmeventd_lvm2_exit_with_pool(state);
 	log_info("No longer monitoring snapshot %s.", device);
 
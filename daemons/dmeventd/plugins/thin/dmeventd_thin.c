@@ -15,9 +15,11 @@
 #include "lib.h"	/* using here lvm log */
 #include "dmeventd_lvm.h"
 #include "libdevmapper-event.h"
+#include "defaults.h"
 
 #include <sys/wait.h>
 #include <stdarg.h>
+#include <time.h>
 
 /* TODO - move this mountinfo code into library to be reusable */
 #ifdef __linux__
@@ -41,8 +43,17 @@
 
 #define MAX_FAILS	(256)  /* ~42 mins between cmd call retry with 10s delay */
 
+/* Usage samples kept for the fill rate, one per 10s timeout. */
+#define FILL_SAMPLES	(32)
+
 #define THIN_DEBUG 0
 
+struct fill_sample {
+	uint64_t time_ms;
+	uint64_t used_data;
+	uint64_t used_metadata;
+};
+
 struct dso_state {
 	struct dm_pool *mem;
 	int metadata_percent_check;
@@ -56,17 +67,41 @@ struct dso_state {
 	int restore_sigset;
 	sigset_t old_sigset;
 	pid_t pid;
+	struct dmeventd_lvm2_action *action;
 	char *argv[3];
 	char *cmd_str;
+	int lead_time;			/* seconds, 0 disables prediction */
+	int history;			/* seconds of samples for the fill rate */
+	int threshold;			/* autoextend threshold, 100 disables it */
+	struct fill_sample samples[FILL_SAMPLES];
+	unsigned sample_count;
+	unsigned sample_next;
+	int64_t data_time_to_full;	/* seconds, -1 when not filling */
+	int64_t metadata_time_to_full;
+	int predicted;			/* policy was run ahead of thresholds */
+	uint64_t predicted_ms;
+	uint64_t policy_start_ms;
+	uint64_t policy_duration_ms;	/* how long the last extension took */
+	char *fill_file;
 };
 
 DM_EVENT_LOG_FN("thin")
 
+static uint64_t _now_ms(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		return 0;
+
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 static int _run_command(struct dso_state *state)
 {
-	char val[3][36];
-	char *env[] = { val[0], val[1], val[2], NULL };
-	int i;
+	char val[5][64];
+	char *env[] = { val[0], val[1], val[2], NULL, NULL, NULL };
+	int i, e = 3;
 
 	/* Mark for possible lvm2 command we are running from dmeventd
 	 * lvm2 will not try to talk back to dmeventd while processing it */
@@ -78,6 +113,17 @@ static int _run_command(struct dso_state *state)
 				   state->data_percent / DM_PERCENT_1);
 		(void) dm_snprintf(val[2], sizeof(val[2]), "DMEVENTD_THIN_POOL_METADATA=%d",
 				   state->metadata_percent / DM_PERCENT_1);
+		if (state->predicted && (state->data_time_to_full >= 0)) {
+			(void) dm_snprintf(val[e], sizeof(val[e]), "DMEVENTD_THIN_POOL_DATA_TIME_TO_FULL=" FMTd64,
+					   state->data_time_to_full);
+			env[e] = val[e];
+			e++;
+		}
+		if (state->predicted && (state->metadata_time_to_full >= 0)) {
+			(void) dm_snprintf(val[e], sizeof(val[e]), "DMEVENTD_THIN_POOL_METADATA_TIME_TO_FULL=" FMTd64,
+					   state->metadata_time_to_full);
+			env[e] = val[e];
+		}
 	} else {
 		/* For an error event it's for a user to check status and decide */
 		env[1] = NULL;
@@ -86,6 +132,8 @@ static int _run_command(struct dso_state *state)
 
 	log_verbose("Executing command: %s", state->cmd_str);
 
+	state->policy_start_ms = _now_ms();
+
 	/* TODO:
 	 *   Support parallel run of 'task' and it's waitpid maintainence
 	 *   ATM we can't handle signaling of  SIGALRM
@@ -108,19 +156,56 @@ static int _run_command(struct dso_state *state)
 
 static int _use_policy(struct dm_task *dmt, struct dso_state *state)
 {
+	char val[2][64];
+	const char *env[] = { NULL, NULL, NULL };
+	int e = 0;
+
 #if THIN_DEBUG
 	log_debug("dmeventd executes: %s.", state->cmd_str);
 #endif
 	if (state->argv[0])
 		return _run_command(state);
 
-	if (!dmeventd_lvm2_run_with_lock(state->cmd_str)) {
-		log_error("Failed command for %s.", dm_task_get_name(dmt));
+	/* lvm2 command run in-process reads the projection from env vars */
+	if (state->predicted && (state->data_time_to_full >= 0)) {
+		(void) dm_snprintf(val[e], sizeof(val[e]), "DMEVENTD_THIN_POOL_DATA_TIME_TO_FULL=" FMTd64,
+				   state->data_time_to_full);
+		env[e] = val[e];
+		e++;
+	}
+	if (state->predicted && (state->metadata_time_to_full >= 0)) {
+		(void) dm_snprintf(val[e], sizeof(val[e]), "DMEVENTD_THIN_POOL_METADATA_TIME_TO_FULL=" FMTd64,
+				   state->metadata_time_to_full);
+		env[e] = val[e];
+	}
+
+	state->policy_start_ms = _now_ms();
+
+	if (!(state->action = dmeventd_lvm2_action_queue(state->cmd_str, env))) {
+		log_error("Failed to queue command for %s.", dm_task_get_name(dmt));
 		state->fails = 1;
 		return 0;
 	}
 
-	state->fails = 0;
+	return 1;
+}
+
+/* Check if queued command has finished */
+static int _wait_for_action(struct dso_state *state)
+{
+	int r;
+
+	if (!state->action)
+		return 1;
+
+	if ((r = dmeventd_lvm2_action_result(state->action)) == DMEVENTD_LVM2_ACTION_PENDING)
+		return 0;
+
+	state->fails = r ? 0 : 1;
+	state->policy_duration_ms = _now_ms() - state->policy_start_ms;
+
+	dmeventd_lvm2_action_release(state->action);
+	state->action = NULL;
 
 	return 1;
 }
@@ -150,6 +235,125 @@ static int _wait_for_pid(struct dso_state *state)
 	}
 
 	state->pid = -1;
+	state->policy_duration_ms = _now_ms() - state->policy_start_ms;
+
+	return 1;
+}
+
+/*
+ * Seconds until 'used' reaches 'total' at the highest fill rate seen within
+ * the history window, -1 when the usage is not growing.
+ * Taking the maximum keeps a recent burst of writes from being averaged
+ * away by an idle period before it.
+ */
+static int64_t _time_to_full(const struct dso_state *state, uint64_t now_ms,
+			     uint64_t used, uint64_t total, int metadata)
+{
+	const struct fill_sample *s;
+	uint64_t history_ms = (uint64_t) state->history * 1000;
+	uint64_t used_then;
+	double rate, max_rate = 0.;	/* blocks per ms */
+	unsigned i;
+
+	if (used >= total)
+		return 0;
+
+	for (i = 0; i < state->sample_count; ++i) {
+		s = &state->samples[i];
+		if ((s->time_ms >= now_ms) || (now_ms - s->time_ms > history_ms))
+			continue;
+		used_then = metadata ? s->used_metadata : s->used_data;
+		if (used_then >= used)
+			continue;
+		rate = (double) (used - used_then) / (double) (now_ms - s->time_ms);
+		if (rate > max_rate)
+			max_rate = rate;
+	}
+
+	if (max_rate <= 0.)
+		return -1;
+
+	return (int64_t) ((double) (total - used) / max_rate / 1000.);
+}
+
+static void _add_sample(struct dso_state *state, uint64_t now_ms,
+			const struct dm_status_thin_pool *tps)
+{
+	struct fill_sample *s = &state->samples[state->sample_next];
+
+	s->time_ms = now_ms;
+	s->used_data = tps->used_data_blocks;
+	s->used_metadata = tps->used_metadata_blocks;
+
+	state->sample_next = (state->sample_next + 1) % FILL_SAMPLES;
+	if (state->sample_count < FILL_SAMPLES)
+		state->sample_count++;
+}
+
+/* Publish the projection for 'lvs -o time_to_full'. */
+static void _write_fill_file(const struct dso_state *state)
+{
+	char tmp[PATH_MAX];
+	FILE *fp;
+
+	if (dm_snprintf(tmp, sizeof(tmp), "%s.tmp", state->fill_file) < 0)
+		return;
+
+	if (!(fp = fopen(tmp, "w"))) {
+		log_sys_debug("fopen", tmp);
+		return;
+	}
+
+	fprintf(fp, FMTd64 " " FMTd64 " " FMTd64 "\n", (int64_t) time(NULL),
+		state->data_time_to_full, state->metadata_time_to_full);
+
+	if (fclose(fp)) {
+		log_sys_debug("fclose", tmp);
+		(void) unlink(tmp);
+		return;
+	}
+
+	if (rename(tmp, state->fill_file)) {
+		log_sys_debug("rename", state->fill_file);
+		(void) unlink(tmp);
+	}
+}
+
+/*
+ * Returns 1 when the pool would fill within the lead time, extended by the
+ * time the previous extension needed to complete.
+ * Only one early run is made until the pool gets resized or the lead time
+ * passes, so the policy is not retriggered every sample when it does not
+ * extend the pool.
+ */
+static int _predict_full(struct dso_state *state, uint64_t now_ms,
+			 const struct dm_status_thin_pool *tps)
+{
+	int64_t lead;
+
+	state->data_time_to_full =
+		_time_to_full(state, now_ms, tps->used_data_blocks,
+			      tps->total_data_blocks, 0);
+	state->metadata_time_to_full =
+		_time_to_full(state, now_ms, tps->used_metadata_blocks,
+			      tps->total_metadata_blocks, 1);
+
+	_add_sample(state, now_ms, tps);
+
+	if (state->fill_file)
+		_write_fill_file(state);
+
+	if (state->predicted &&
+	    (now_ms - state->predicted_ms < (uint64_t) state->lead_time * 1000))
+		return 0;
+
+	state->predicted = 0;
+
+	lead = state->lead_time + (int64_t) (state->policy_duration_ms / 1000);
+
+	if (((state->data_time_to_full < 0) || (state->data_time_to_full > lead)) &&
+	    ((state->metadata_time_to_full < 0) || (state->metadata_time_to_full > lead)))
+		return 0;
 
 	return 1;
 }
@@ -166,6 +370,8 @@ void process_event(struct dm_task *dmt,
 	char *target_type = NULL;
 	char *params;
 	int needs_policy = 0;
+	int predicted = 0;
+	uint64_t now_ms = _now_ms();
 	struct dm_task *new_dmt = NULL;
 
 #if THIN_DEBUG
@@ -179,6 +385,12 @@ void process_event(struct dm_task *dmt,
 		return;
 	}
 
+	if (!_wait_for_action(state)) {
+		log_debug("Skipping event, %s is still queued or running.",
+			  state->cmd_str);
+		return;
+	}
+
 	if (event & DM_EVENT_DEVICE_ERROR) {
 		/* Error -> no need to check and do instant resize */
 		state->data_percent = state->metadata_percent = 0;
@@ -234,12 +446,26 @@ void process_event(struct dm_task *dmt,
 		state->metadata_percent_check = CHECK_MINIMUM;
 		state->known_metadata_size = tps->total_metadata_blocks;
 		state->fails = 0;
+		state->predicted = 0;
 	}
 
 	if (state->known_data_size != tps->total_data_blocks) {
 		state->data_percent_check = CHECK_MINIMUM;
 		state->known_data_size = tps->total_data_blocks;
 		state->fails = 0;
+		state->predicted = 0;
+	}
+
+	/*
+	 * Error events are not periodic, keep them out of the fill rate.
+	 * The projection is still reported with autoextension disabled.
+	 */
+	if (state->lead_time && !(event & DM_EVENT_DEVICE_ERROR) &&
+	    _predict_full(state, now_ms, tps) && (state->threshold < 100)) {
+		log_info("Thin pool %s is projected to fill in " FMTd64 "s data, "
+			 FMTd64 "s metadata, extending ahead of threshold.",
+			 device, state->data_time_to_full, state->metadata_time_to_full);
+		predicted = needs_policy = 1;
 	}
 
 	/*
@@ -294,8 +520,13 @@ void process_event(struct dm_task *dmt,
 	} else
 		state->max_fails = 1; /* Reset on success */
 
-	if (needs_policy)
+	if (needs_policy) {
+		if (predicted) {
+			state->predicted = 1;
+			state->predicted_ms = now_ms;
+		}
 		_use_policy(dmt, state);
+	}
 out:
 	if (tps)
 		dm_pool_free(state->mem, tps);
@@ -339,8 +570,38 @@ static void _restore_thread_signals(struct dso_state *state)
 		log_warn("WARNING: Failed to block SIGCHLD.");
 }
 
+/* Read activation/thin_pool_autoextend_lead_time, _history and _threshold. */
+static void _init_prediction(struct dso_state *state, const char *uuid)
+{
+	static const char _cmd[] = "_dmeventd_thin_autoextend";
+	const char *str;
+	char path[PATH_MAX];
+
+	state->data_time_to_full = state->metadata_time_to_full = -1;
+
+	dmeventd_lvm2_lock();
+	if (!dmeventd_lvm2_run(_cmd) || !(str = getenv(_cmd)) ||
+	    (sscanf(str, "%d %d %d", &state->lead_time, &state->history,
+		    &state->threshold) != 3))
+		state->lead_time = 0;
+	dmeventd_lvm2_unlock();
+
+	if (state->lead_time <= 0 || state->history <= 0) {
+		state->lead_time = 0;
+		return;
+	}
+
+	if (!uuid || !*uuid ||
+	    (dm_snprintf(path, sizeof(path), DEFAULT_THIN_FILL_DIR "/%s", uuid) < 0))
+		return;
+
+	if (dm_create_dir(DEFAULT_THIN_FILL_DIR) &&
+	    !(state->fill_file = dm_pool_strdup(state->mem, path)))
+		log_error("Failed to copy fill file path.");
+}
+
 int register_device(const char *device,
-		    const char *uuid __attribute__((unused)),
+		    const char *uuid,
 		    int major __attribute__((unused)),
 		    int minor __attribute__((unused)),
 		    void **user)
@@ -382,6 +643,8 @@ int register_device(const char *device,
 	} else /* Unuspported command format */
 		goto inval;
 
+	_init_prediction(state, uuid);
+
 	state->pid = -1;
 	*user = state;
 
@@ -427,8 +690,14 @@ int unregister_device(const char *device,
 	if (state->pid != -1)
 		log_warn("WARNING: Cannot kill child %d!", state->pid);
 
+	if (state->action)
+		dmeventd_lvm2_action_release(state->action);
+
 	_restore_thread_signals(state);
 
+	if (state->fill_file && unlink(state->fill_file) && (errno != ENOENT))
+		log_sys_debug("unlink", state->fill_file);
+
 	dmeventd_lvm2_exit_with_pool(state);
 	log_info("No longer monitoring thin pool %s.", device);
 
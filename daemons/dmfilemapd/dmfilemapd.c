@@ -39,6 +39,12 @@
 /* limit to two updates/sec */
 #define FILEMAPD_WAIT_USECS 500000
 
+/*
+ * While the allocation of the file keeps changing, defer updates until
+ * it is stable for one check interval, or for at most this long.
+ */
+#define FILEMAPD_MAX_DEFER_USECS 5000000
+
 /* how long to wait for unlinked files */
 #define FILEMAPD_NOFILE_WAIT_USECS 100000
 #define FILEMAPD_NOFILE_WAIT_TRIES 10
@@ -56,6 +62,8 @@ struct filemap_monitor {
 	/* monitoring heuristics */
 	int64_t blocks; /* allocated blocks, from stat.st_blocks */
 	uint64_t nr_regions;
+	uint64_t deferred_usecs; /* time a pending update has waited */
+	unsigned nr_changes; /* allocation changes seen since last update */
 	int deleted;
 };
 
@@ -681,6 +689,10 @@ static int _update_regions(struct dm_stats *dms, struct filemap_monitor *fm)
 {
 	uint64_t *regions = NULL, *region, nr_regions = 0;
 
+	log_verbose("Updating group_id=" FMTu64 " after %u allocation "
+		    "change(s) in " FMTu64 " msecs.", fm->group_id,
+		    fm->nr_changes, fm->deferred_usecs / 1000);
+
 	regions = dm_stats_update_regions_from_fd(dms, fm->fd, fm->group_id);
 	if (!regions) {
 		log_error("Failed to update filemap regions for group_id="
@@ -756,15 +768,31 @@ static int _dmfilemapd(struct filemap_monitor *fm)
 		if ((check = _filemap_monitor_get_events(fm)) < 0)
 			goto bad;
 
-		if (!check)
+		if (check && ((check = _filemap_fd_check_changed(fm)) < 0))
+			goto bad;
+
+		/*
+		 * Rate limit updates under bursts of writes: wait for the
+		 * allocation to settle, unless the update has already been
+		 * deferred for FILEMAPD_MAX_DEFER_USECS.
+		 */
+		if (check)
+			fm->nr_changes++;
+
+		if (!fm->nr_changes)
 			goto wait;
 
-		if ((check = _filemap_fd_check_changed(fm)) < 0)
-			goto bad;
+		if (check && (fm->deferred_usecs < FILEMAPD_MAX_DEFER_USECS)) {
+			fm->deferred_usecs += FILEMAPD_WAIT_USECS;
+			goto wait;
+		}
 
-		if (check && !_update_regions(dms, fm))
+		if (!_update_regions(dms, fm))
 			goto bad;
 
+		fm->nr_changes = 0;
+		fm->deferred_usecs = 0;
+
 		running = !!fm->nr_regions;
 		if (!running)
 			continue;
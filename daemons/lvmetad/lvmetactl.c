@@ -38,6 +38,7 @@ int main(int argc, char **argv)
 		printf("lvmetactl pv_list\n");
 		printf("lvmetactl vg_list\n");
 		printf("lvmetactl get_global_info\n");
+		printf("lvmetactl daemon_stats\n");
 		printf("lvmetactl vg_lookup_name <name>\n");
 		printf("lvmetactl vg_lookup_uuid <uuid>\n");
 		printf("lvmetactl pv_lookup_uuid <uuid>\n");
@@ -84,6 +85,10 @@ int main(int argc, char **argv)
 					   NULL);
 		printf("%s\n", reply.buffer.mem);
 
+	} else if (!strcmp(cmd, "daemon_stats")) {
+		reply = daemon_send_simple(h, "daemon_stats", NULL);
+		printf("%s\n", reply.buffer.mem);
+
 	} else if (!strcmp(cmd, "set_global_invalid")) {
 		if (argc < 3) {
 			printf("set_global_invalid 0|1\n");
@@ -0,0 +1,357 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU Lesser General Public License v.2.1.
+ */
+
+/*
+ * Drive lvmetad with parallel readers (vg_lookup) and writers (vg_update)
+ * and report throughput and latency of both.  Every writer owns a distinct
+ * set of VGs, so with per-VG locking in lvmetad the writers only contend
+ * with readers of the same VG.
+ *
+ * Run it against a private instance, e.g.
+ *   lvmetad -f -s /tmp/bench.socket &
+ *   lvmetad-bench -s /tmp/bench.socket -r 8 -w 2 -v 32 -t 10
+ */
+
+#include "tool.h"
+
+#include "lvmetad-client.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#define BENCH_PREFIX "lvmetad_bench"
+
+struct bench_stats {
+	uint64_t ops;
+	uint64_t errors;
+	uint64_t total_ns;
+	uint64_t max_ns;
+};
+
+struct bench_thread {
+	pthread_t thread;
+	int index;
+	int writer;
+	struct bench_stats stats;
+};
+
+static const char *_socket;
+static int _readers = 4;
+static int _writers = 1;
+static int _vgs = 16;
+static int _seconds = 5;
+static int *_seqno;
+static volatile int _stop;
+
+static uint64_t _now_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		return 0;
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int _reply_ok(daemon_reply reply)
+{
+	const char *response;
+
+	if (reply.error)
+		return 0;
+
+	response = daemon_reply_str(reply, "response", "");
+
+	return !strcmp(response, "OK");
+}
+
+/* A made up device number for the PV of each VG */
+static int _device(int vg)
+{
+	return 0x7f0000 + vg;
+}
+
+static void _metadata(char *buf, size_t size, int vg, int seqno)
+{
+	(void) dm_snprintf(buf, size,
+			   "{\n"
+			   "id = \"" BENCH_PREFIX "-vg-%d\"\n"
+			   "seqno = %d\n"
+			   "format = \"lvm2\"\n"
+			   "status = [\"READ\", \"WRITE\"]\n"
+			   "flags = []\n"
+			   "extent_size = 8192\n"
+			   "max_lv = 0\n"
+			   "max_pv = 0\n"
+			   "physical_volumes {\n"
+			   "pv0 {\n"
+			   "id = \"" BENCH_PREFIX "-pv-%d\"\n"
+			   "status = [\"ALLOCATABLE\"]\n"
+			   "pe_start = 2048\n"
+			   "pe_count = 1000\n"
+			   "}\n"
+			   "}\n"
+			   "}\n", vg, seqno, vg);
+}
+
+static int _vg_setup(daemon_handle h, int vg)
+{
+	char metadata[1024];
+	char pvmeta[256];
+	char vgname[64];
+	char pvid[64];
+	daemon_reply reply;
+	int r;
+
+	_metadata(metadata, sizeof(metadata), vg, 1);
+	(void) dm_snprintf(vgname, sizeof(vgname), BENCH_PREFIX "_vg%d", vg);
+	(void) dm_snprintf(pvid, sizeof(pvid), BENCH_PREFIX "-pv-%d", vg);
+	(void) dm_snprintf(pvmeta, sizeof(pvmeta),
+			   "{\n"
+			   "id = \"%s\"\n"
+			   "device = %d\n"
+			   "format = \"lvm2\"\n"
+			   "}\n", pvid, _device(vg));
+
+	reply = daemon_send_simple(h, "pv_found",
+				   "token = %s", "skip",
+				   "pid = " FMTd64, (int64_t) getpid(),
+				   "cmd = %s", "lvmetad-bench",
+				   "pvmeta = %b", pvmeta,
+				   "vgname = %s", vgname,
+				   "metadata = %b", metadata,
+				   NULL);
+	if (!(r = _reply_ok(reply)))
+		fprintf(stderr, "pv_found for %s failed: %s\n", vgname,
+			reply.error ? strerror(reply.error) :
+			daemon_reply_str(reply, "reason", "unknown"));
+	daemon_reply_destroy(reply);
+
+	_seqno[vg] = 1;
+
+	return r;
+}
+
+static void _vg_cleanup(daemon_handle h, int vg)
+{
+	char vgid[64];
+	char pvid[64];
+
+	(void) dm_snprintf(vgid, sizeof(vgid), BENCH_PREFIX "-vg-%d", vg);
+	(void) dm_snprintf(pvid, sizeof(pvid), BENCH_PREFIX "-pv-%d", vg);
+
+	daemon_reply_destroy(daemon_send_simple(h, "vg_remove",
+						"token = %s", "skip",
+						"pid = " FMTd64, (int64_t) getpid(),
+						"cmd = %s", "lvmetad-bench",
+						"uuid = %s", vgid,
+						NULL));
+	daemon_reply_destroy(daemon_send_simple(h, "pv_gone",
+						"token = %s", "skip",
+						"pid = " FMTd64, (int64_t) getpid(),
+						"cmd = %s", "lvmetad-bench",
+						"uuid = %s", pvid,
+						"device = " FMTd64, (int64_t) _device(vg),
+						NULL));
+}
+
+static int _vg_lookup(daemon_handle h, int vg)
+{
+	char vgname[64];
+	daemon_reply reply;
+	int r;
+
+	(void) dm_snprintf(vgname, sizeof(vgname), BENCH_PREFIX "_vg%d", vg);
+
+	reply = daemon_send_simple(h, "vg_lookup",
+				   "token = %s", "skip",
+				   "pid = " FMTd64, (int64_t) getpid(),
+				   "cmd = %s", "lvmetad-bench",
+				   "name = %s", vgname,
+				   NULL);
+	r = _reply_ok(reply);
+	daemon_reply_destroy(reply);
+
+	return r;
+}
+
+static int _vg_update(daemon_handle h, int vg)
+{
+	char metadata[1024];
+	char vgname[64];
+	daemon_reply reply;
+	int r;
+
+	/* Each VG is only ever updated by the one writer owning it. */
+	_metadata(metadata, sizeof(metadata), vg, ++_seqno[vg]);
+	(void) dm_snprintf(vgname, sizeof(vgname), BENCH_PREFIX "_vg%d", vg);
+
+	reply = daemon_send_simple(h, "vg_update",
+				   "token = %s", "skip",
+				   "pid = " FMTd64, (int64_t) getpid(),
+				   "cmd = %s", "lvmetad-bench",
+				   "vgname = %s", vgname,
+				   "metadata = %b", metadata,
+				   NULL);
+	r = _reply_ok(reply);
+	daemon_reply_destroy(reply);
+
+	return r;
+}
+
+static void *_bench_thread(void *arg)
+{
+	struct bench_thread *bt = arg;
+	daemon_handle h = lvmetad_open(_socket);
+	uint64_t start, ns;
+	unsigned seed = (unsigned) bt->index;
+	/* Writer n owns VGs n, n + writers, ... */
+	int owned = bt->writer ? (_vgs - bt->index + _writers - 1) / _writers : 0;
+	int vg, r;
+
+	if (!h.error && h.socket_fd >= 0)
+		while (!_stop) {
+			if (bt->writer) {
+				vg = bt->index + _writers * (int) (bt->stats.ops % owned);
+				start = _now_ns();
+				r = _vg_update(h, vg);
+			} else {
+				vg = rand_r(&seed) % _vgs;
+				start = _now_ns();
+				r = _vg_lookup(h, vg);
+			}
+
+			ns = _now_ns() - start;
+			bt->stats.ops++;
+			bt->stats.total_ns += ns;
+			if (ns > bt->stats.max_ns)
+				bt->stats.max_ns = ns;
+			if (!r)
+				bt->stats.errors++;
+		}
+	else
+		bt->stats.errors++;
+
+	daemon_close(h);
+
+	return NULL;
+}
+
+static void _report(const char *name, struct bench_thread *threads, int count)
+{
+	struct bench_stats sum = { 0 };
+	int i;
+
+	for (i = 0; i < count; i++) {
+		sum.ops += threads[i].stats.ops;
+		sum.errors += threads[i].stats.errors;
+		sum.total_ns += threads[i].stats.total_ns;
+		if (threads[i].stats.max_ns > sum.max_ns)
+			sum.max_ns = threads[i].stats.max_ns;
+	}
+
+	printf("%-8s threads %3d ops " FMTu64 " errors " FMTu64
+	       " ops/s %.0f avg %.1f us max %.1f us\n",
+	       name, count, sum.ops, sum.errors,
+	       (double) sum.ops / _seconds,
+	       sum.ops ? (double) sum.total_ns / sum.ops / 1000 : 0.0,
+	       (double) sum.max_ns / 1000);
+}
+
+static void _usage(const char *prog)
+{
+	printf("Usage: %s [-s socket] [-r readers] [-w writers] [-v vgs] [-t seconds]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_thread *threads = NULL;
+	daemon_handle h;
+	int opt, i, r = 1;
+
+	_socket = getenv("LVM_LVMETAD_SOCKET");
+
+	while ((opt = getopt(argc, argv, "hs:r:w:v:t:")) != -1) {
+		switch (opt) {
+		case 's':
+			_socket = optarg;
+			break;
+		case 'r':
+			_readers = atoi(optarg);
+			break;
+		case 'w':
+			_writers = atoi(optarg);
+			break;
+		case 'v':
+			_vgs = atoi(optarg);
+			break;
+		case 't':
+			_seconds = atoi(optarg);
+			break;
+		default:
+			_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if ((_readers < 0) || (_writers < 0) || (_readers + _writers < 1) ||
+	    (_vgs < 1) || (_writers > _vgs) || (_seconds < 1)) {
+		_usage(argv[0]);
+		return 1;
+	}
+
+	h = lvmetad_open(_socket);
+	if (h.error || h.socket_fd < 0) {
+		fprintf(stderr, "Failed to connect to lvmetad.\n");
+		return 1;
+	}
+
+	if (!(_seqno = dm_zalloc(sizeof(*_seqno) * _vgs)) ||
+	    !(threads = dm_zalloc(sizeof(*threads) * (_readers + _writers)))) {
+		fprintf(stderr, "Failed to allocate memory.\n");
+		goto out;
+	}
+
+	for (i = 0; i < _vgs; i++)
+		if (!_vg_setup(h, i))
+			goto out_cleanup;
+
+	for (i = 0; i < _readers + _writers; i++) {
+		threads[i].writer = (i >= _readers);
+		threads[i].index = threads[i].writer ? i - _readers : i;
+		if (pthread_create(&threads[i].thread, NULL, _bench_thread, &threads[i])) {
+			fprintf(stderr, "Failed to create thread.\n");
+			_stop = 1;
+			while (i--)
+				pthread_join(threads[i].thread, NULL);
+			goto out_cleanup;
+		}
+	}
+
+	sleep(_seconds);
+	_stop = 1;
+
+	for (i = 0; i < _readers + _writers; i++)
+		pthread_join(threads[i].thread, NULL);
+
+	_report("readers", threads, _readers);
+	_report("writers", threads + _readers, _writers);
+	r = 0;
+
+out_cleanup:
+	for (i = 0; i < _vgs; i++)
+		_vg_cleanup(h, i);
+	dm_free(threads);
+out:
+	dm_free(_seqno);
+	daemon_close(h);
+
+	return r;
+}
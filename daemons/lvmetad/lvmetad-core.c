@@ -195,6 +195,7 @@
 struct vg_info {
 	int64_t external_version;
 	uint32_t flags; /* VGFL_ */
+	unsigned deltas; /* vg_update_delta applied since the metadata was copied */
 };
 
 #define GLFL_INVALID                   0x00000001
@@ -211,6 +212,24 @@ struct vg_info {
 
 #define CMD_NAME_SIZE 32
 
+/*
+ * Locking
+ *
+ * token_lock is taken for write only by token_update, every other request
+ * just reads the token and takes it shared.
+ *
+ * cache_lock protects the structure of the hash tables.  Requests that
+ * only read the cache, or that only replace the data of one existing VG,
+ * take it shared.  Requests that add or remove hash table entries take it
+ * exclusive, which also excludes every user of the VG shards below.
+ *
+ * The metadata and info of a VG are additionally protected by the lock of
+ * the shard selected by the vgid.  While holding cache_lock shared, the
+ * shard lock has to be held to read or replace them, so lookups and
+ * updates of VGs in other shards can proceed in parallel.
+ */
+#define LVMETAD_VG_SHARDS 64
+
 typedef struct {
 	daemon_idle *idle;
 	log_state *log; /* convenience */
@@ -231,9 +250,10 @@ typedef struct {
 	int update_timeout;
 	uint64_t update_begin;
 	uint32_t flags; /* GLFL_ */
-	pthread_mutex_t token_lock;
+	pthread_rwlock_t token_lock;
 	pthread_mutex_t info_lock;
 	pthread_rwlock_t cache_lock;
+	pthread_rwlock_t vg_lock[LVMETAD_VG_SHARDS];
 } lvmetad_state;
 
 static uint64_t _monotonic_seconds(void)
@@ -245,6 +265,16 @@ static uint64_t _monotonic_seconds(void)
 	return ts.tv_sec;
 }
 
+static pthread_rwlock_t *_vg_shard_lock(lvmetad_state *s, const char *vgid)
+{
+	unsigned h = 0;
+
+	while (*vgid)
+		h = h * 31 + (unsigned char) *vgid++;
+
+	return &s->vg_lock[h % LVMETAD_VG_SHARDS];
+}
+
 static void destroy_metadata_hashes(lvmetad_state *s)
 {
 	struct dm_hash_node *n = NULL;
@@ -314,8 +344,8 @@ static struct dm_config_node *pvs(struct dm_config_node *vg)
 	return pv;
 }
 
-static void filter_metadata(struct dm_config_node *vg) {
-	struct dm_config_node *pv = pvs(vg);
+static void filter_pvs(struct dm_config_node *pv)
+{
 	while (pv) {
 		struct dm_config_node *item = pv->child;
 		while (item) {
@@ -326,6 +356,10 @@ static void filter_metadata(struct dm_config_node *vg) {
 		}
 		pv = pv->sib;
 	}
+}
+
+static void filter_metadata(struct dm_config_node *vg) {
+	filter_pvs(pvs(vg));
 	vg->sib = NULL; /* Drop any trailing garbage. */
 }
 
@@ -669,6 +703,7 @@ static response vg_lookup(lvmetad_state *s, request r)
 	struct dm_config_tree *cft;
 	struct dm_config_node *metadata, *n;
 	struct vg_info *info;
+	pthread_rwlock_t *shard;
 	response res = { 0 };
 	const char *uuid = daemon_request_str(r, "uuid", NULL);
 	const char *name = daemon_request_str(r, "name", NULL);
@@ -717,8 +752,12 @@ static response vg_lookup(lvmetad_state *s, request r)
 
 	DEBUGLOG(s, "vg_lookup vgid %s name %s", uuid ?: "none", name ?: "none");
 
+	shard = _vg_shard_lock(s, uuid);
+	pthread_rwlock_rdlock(shard);
+
 	cft = dm_hash_lookup(s->vgid_to_metadata, uuid);
 	if (!cft || !cft->root) {
+		pthread_rwlock_unlock(shard);
 		return reply_unknown("UUID not found");
 	}
 
@@ -730,7 +769,7 @@ static response vg_lookup(lvmetad_state *s, request r)
 	if (!(res.cft->root = n = dm_config_create_node(res.cft, "response")))
 		goto nomem_un;
 
-	if (!(n->v = dm_config_create_value(cft)))
+	if (!(n->v = dm_config_create_value(res.cft)))
 		goto nomem_un;
 
 	n->parent = res.cft->root;
@@ -765,6 +804,8 @@ static response vg_lookup(lvmetad_state *s, request r)
 			goto nomem;
 	}
 
+	pthread_rwlock_unlock(shard);
+
 	return res;
 
 nomem_un:
@@ -1909,12 +1950,22 @@ static int _vg_is_complete(lvmetad_state *s, struct dm_config_tree *vgmeta)
  * . arg_device_lookup != arg_device
  * . arg_pvid was used to look up a PV, and found that the PV
  *   has a different device than arg_device.
+ *
+ * When found is set, the VG completeness check is left out, pv_found_batch
+ * does it once per VG, and the VG of the PV is returned in found.
  */
 
-static response pv_found(lvmetad_state *s, request r)
+struct pv_found_vg {
+	const char *vgid;
+	const char *name;
+	int changed;
+	int seqno_before;
+};
+
+static response _pv_found(lvmetad_state *s, struct dm_config_node *arg_pvmeta,
+			  const char *arg_name, struct dm_config_node *arg_vgmeta,
+			  struct pv_found_vg *found)
 {
-	struct dm_config_node *arg_vgmeta = NULL;
-	struct dm_config_node *arg_pvmeta = NULL;
 	struct dm_config_tree *old_pvmeta = NULL;
 	struct dm_config_tree *new_pvmeta = NULL;
 	struct dm_config_tree *prev_pvmeta_on_dev = NULL;
@@ -1923,7 +1974,6 @@ static response pv_found(lvmetad_state *s, request r)
 	const char *arg_pvid_lookup = NULL;
 	const char *new_pvid = NULL;
 	char *new_pvid_dup = NULL;
-	const char *arg_name = NULL;
 	const char *arg_vgid = NULL;
 	const char *arg_vgid_lookup = NULL;
 	const char *prev_pvid_on_dev = NULL;
@@ -1942,12 +1992,12 @@ static response pv_found(lvmetad_state *s, request r)
 	 * New input values.
 	 */
 
-	if (!(arg_pvmeta = dm_config_find_node(r.cft->root, "pvmeta"))) {
+	if (!arg_pvmeta) {
 		ERROR(s, "Ignore PV without PV metadata");
 		return reply_fail("Ignore PV without PV metadata");
 	}
 
-	if (!(arg_pvid = daemon_request_str(r, "pvmeta/id", NULL))) {
+	if (!(arg_pvid = dm_config_find_str(arg_pvmeta, "pvmeta/id", NULL))) {
 		ERROR(s, "Ignore PV without PV UUID");
 		return reply_fail("Ignore PV without PV UUID");
 	}
@@ -1957,10 +2007,9 @@ static response pv_found(lvmetad_state *s, request r)
 		return reply_fail("Ignore PV without device");
 	}
 
-	if ((arg_vgmeta = dm_config_find_node(r.cft->root, "metadata"))) {
-		arg_name = daemon_request_str(r, "vgname", NULL);
-		arg_vgid = daemon_request_str(r, "metadata/id", NULL);
-		arg_seqno = daemon_request_int(r, "metadata/seqno", -1);
+	if (arg_vgmeta) {
+		arg_vgid = dm_config_find_str(arg_vgmeta, "metadata/id", NULL);
+		arg_seqno = dm_config_find_int(arg_vgmeta, "metadata/seqno", -1);
 
 		if (!arg_name || !arg_vgid || (arg_seqno < 0))
 			ERROR(s, "Ignore VG metadata from PV %s", arg_pvid);
@@ -1970,7 +2019,8 @@ static response pv_found(lvmetad_state *s, request r)
 			return reply_fail("Ignore VG metadata from PV without VG vgid");
 		if (arg_seqno < 0)
 			return reply_fail("Ignore VG metadata from PV without VG seqno");
-	}
+	} else
+		arg_name = NULL;
 
 	/* Make a copy of the new pvmeta that can be inserted into cache. */
 	if (!(new_pvmeta = dm_config_create()) ||
@@ -2190,6 +2240,9 @@ static response pv_found(lvmetad_state *s, request r)
 		goto prev_vals;
 	}
 
+	if (found)
+		goto prev_vals;
+
 	if (!(vgmeta = dm_hash_lookup(s->vgid_to_metadata, arg_vgid))) {
 		ERROR(s, "pv_found %s on %" PRIu64 " vgid %s no VG metadata found",
 		      arg_pvid, arg_device, arg_vgid);
@@ -2235,6 +2288,13 @@ static response pv_found(lvmetad_state *s, request r)
 	/* This was unhashed from device_to_pvid above. */
 	dm_free((void *)prev_pvid_on_dev);
 
+	if (found) {
+		found->vgid = arg_vgid ? arg_vgid : "#orphan";
+		found->name = arg_name ? arg_name : "#orphan";
+		found->changed = changed;
+		found->seqno_before = old_seqno;
+	}
+
 	return daemon_reply_simple("OK",
 				   "status = %s", vg_status,
 				   "changed = " FMTd64, (int64_t) changed,
@@ -2255,6 +2315,146 @@ static response pv_found(lvmetad_state *s, request r)
 	exit(EXIT_FAILURE);
 }
 
+static void _destroy_response(response res)
+{
+	if (res.cft)
+		dm_config_destroy(res.cft);
+	buffer_destroy(&res.buffer);
+}
+
+static response pv_found(lvmetad_state *s, request r)
+{
+	return _pv_found(s, dm_config_find_node(r.cft->root, "pvmeta"),
+			 daemon_request_str(r, "vgname", NULL),
+			 dm_config_find_node(r.cft->root, "metadata"), NULL);
+}
+
+/*
+ * pv_found_batch: a number of PVs have appeared and been scanned, e.g. by
+ * one pvscan handling a burst of udev events.
+ *
+ * pvs {
+ *	pv0 { pvmeta { ... } vg = "vg0" }
+ *	pv1 { pvmeta { ... } }
+ * }
+ * vgs {
+ *	vg0 { vgname = "..." metadata { ... } }
+ * }
+ *
+ * Each PV is handled like pv_found, but VG metadata shared by several PVs
+ * is sent once and applied with the first PV referencing it; the others
+ * are mapped to the VG by that update.  Whether a VG is complete is
+ * checked once per VG after all PVs are processed, and the reply lists
+ * each VG touched with the fields pv_found returns.  PVs which could not
+ * be stored are listed by their key in failed_pvs, the others are not
+ * affected by them.
+ */
+static response pv_found_batch(lvmetad_state *s, request r)
+{
+	struct dm_config_node *arg_pvs, *arg_vgs, *pv, *vg, *cn, *cn_vgs;
+	struct dm_config_node *cn_last = NULL, *cn_failed = NULL, *failed_last = NULL, *field;
+	struct dm_config_tree *vgmeta;
+	struct dm_hash_table *vg_nodes = NULL;
+	struct dm_hash_table *applied = NULL;
+	struct pv_found_vg found;
+	const char *ref, *status;
+	response res = { 0 };
+	int failed = 0, count = 0;
+
+	buffer_init(&res.buffer);
+
+	if (!(arg_pvs = dm_config_find_node(r.cft->root, "pvs")))
+		return reply_fail("Ignore batch without PVs");
+	arg_vgs = dm_config_find_node(r.cft->root, "vgs");
+
+	if (!(res.cft = dm_config_create()) ||
+	    !(res.cft->root = make_text_node(res.cft, "response", "OK", NULL, NULL)) ||
+	    !(cn_vgs = make_config_node(res.cft, "volume_groups", NULL, res.cft->root)) ||
+	    !(vg_nodes = dm_hash_create(32)) ||
+	    !(applied = dm_hash_create(32)))
+		goto nomem;
+
+	for (pv = arg_pvs->child; pv; pv = pv->sib) {
+		count++;
+		vg = NULL;
+		if ((ref = dm_config_find_str(pv->child, "vg", NULL)) && arg_vgs &&
+		    !dm_hash_lookup(applied, ref)) {
+			if (!(vg = dm_config_find_node(arg_vgs->child, ref)))
+				ERROR(s, "pv_found_batch %s references missing VG %s", pv->key, ref);
+			else if (!dm_hash_insert(applied, ref, (void *) 1))
+				goto nomem;
+		}
+
+		found.vgid = NULL;
+		_destroy_response(_pv_found(s, dm_config_find_node(pv->child, "pvmeta"),
+					    vg ? dm_config_find_str(vg->child, "vgname", NULL) : NULL,
+					    vg ? dm_config_find_node(vg->child, "metadata") : NULL,
+					    &found));
+
+		if (!found.vgid) {
+			failed++;
+			if ((!cn_failed &&
+			     !(cn_failed = make_config_node(res.cft, "failed_pvs", NULL, cn_vgs))) ||
+			    !(failed_last = make_int_node(res.cft, dm_pool_strdup(res.cft->mem, pv->key),
+							  1, cn_failed, failed_last)))
+				goto nomem;
+			continue;
+		}
+
+		if (!strcmp(found.vgid, "#orphan"))
+			continue;
+
+		if ((cn = dm_hash_lookup(vg_nodes, found.vgid))) {
+			/* A later PV of the VG, collect its changes. */
+			if (found.changed && (field = dm_config_find_node(cn->child, "changed")))
+				field->v->v.i = 1;
+			/* Before the first metadata of the VG is applied. */
+			if (vg && (field = dm_config_find_node(cn->child, "seqno_before")) &&
+			    (field->v->v.i < 0))
+				field->v->v.i = found.seqno_before;
+		} else {
+			/* Fields are looked up again, so the keys must be exact. */
+			if (!(cn = make_config_node(res.cft, found.vgid, cn_vgs, cn_last)) ||
+			    !(field = make_text_node(res.cft, "vgname",
+						     dm_pool_strdup(res.cft->mem, found.name), cn, NULL)) ||
+			    !(field = make_int_node(res.cft, "changed", found.changed, cn, field)) ||
+			    !make_int_node(res.cft, "seqno_before", found.seqno_before, cn, field) ||
+			    !dm_hash_insert(vg_nodes, found.vgid, cn))
+				goto nomem;
+			cn_last = cn;
+		}
+	}
+
+	/* The VGs only need to be checked now that all PVs are known. */
+	for (cn = cn_vgs->child; cn; cn = cn->sib) {
+		status = NULL;
+		if (!(vgmeta = dm_hash_lookup(s->vgid_to_metadata, cn->key)))
+			ERROR(s, "pv_found_batch vgid %s no VG metadata found", cn->key);
+		else
+			status = _vg_is_complete(s, vgmeta) ? "complete" : "partial";
+
+		if (!make_text_node(res.cft, "status", status ?: "unknown", cn, NULL) ||
+		    !make_int_node(res.cft, "seqno_after", vgmeta ?
+				   dm_config_find_int(vgmeta->root, "metadata/seqno", -1) : -1, cn, NULL))
+			goto nomem;
+	}
+
+	DEBUGLOG(s, "pv_found_batch %d PVs %d failed", count, failed);
+
+	if (!make_int_node(res.cft, "pvs_failed", failed, NULL, cn_vgs))
+		goto nomem;
+
+	dm_hash_destroy(vg_nodes);
+	dm_hash_destroy(applied);
+
+	return res;
+
+ nomem:
+	ERROR(s, "pv_found_batch is out of memory.");
+	ERROR(s, "lvmetad could not be updated is aborting.");
+	exit(EXIT_FAILURE);
+}
+
 static response vg_clear_outdated_pvs(lvmetad_state *s, request r)
 {
 	struct dm_config_tree *outdated_pvs;
@@ -2290,6 +2490,117 @@ static void vg_info_update(lvmetad_state *s, const char *uuid,
 		info->flags &= ~VGFL_INVALID;
 }
 
+/*
+ * Both lists of physical_volumes contain the same PVs and all of them are
+ * already mapped to vgid, so replacing the metadata leaves pvid_to_vgid
+ * as is.
+ */
+static int _same_pvs(lvmetad_state *s, struct dm_config_node *old_pvs,
+		     struct dm_config_node *new_pvs, const char *vgid)
+{
+	struct dm_config_node *pv, *old_pv;
+	const char *pvid, *old_pvid, *pvid_vgid;
+	int count = 0, old_count = 0;
+
+	for (old_pv = old_pvs; old_pv; old_pv = old_pv->sib)
+		old_count++;
+
+	for (pv = new_pvs; pv; pv = pv->sib) {
+		if (!(pvid = dm_config_find_str(pv->child, "id", NULL)))
+			return 0;
+
+		if (!(pvid_vgid = dm_hash_lookup(s->pvid_to_vgid, pvid)) ||
+		    strcmp(pvid_vgid, vgid))
+			return 0;
+
+		for (old_pv = old_pvs; old_pv; old_pv = old_pv->sib)
+			if ((old_pvid = dm_config_find_str(old_pv->child, "id", NULL)) &&
+			    !strcmp(old_pvid, pvid))
+				break;
+
+		if (!old_pv)
+			return 0;
+
+		count++;
+	}
+
+	return count == old_count;
+}
+
+/*
+ * Replace the metadata of an existing VG whose name, vgid and PVs do not
+ * change, which is what nearly every command updating a VG sends.
+ * Only cache_lock shared is held, the VG shard lock is taken here.
+ * Returns 0 when the update needs the full _update_metadata() path
+ * under the exclusive cache_lock.
+ */
+static int _vg_update_shared(lvmetad_state *s, request r)
+{
+	struct dm_config_node *metadata = dm_config_find_node(r.cft->root, "metadata");
+	const char *vgid = daemon_request_str(r, "metadata/id", NULL);
+	const char *vgname = daemon_request_str(r, "vgname", NULL);
+	int new_seq = daemon_request_int(r, "metadata/seqno", -1);
+	struct dm_config_tree *old_meta, *new_meta;
+	pthread_rwlock_t *shard;
+	const char *name_lookup, *vgid_lookup;
+	int old_seq;
+	int count = 0;
+	int ret = 0;
+
+	if (!metadata || !vgid || !vgname || (new_seq <= 0))
+		return 0;
+
+	if (!(name_lookup = dm_hash_lookup(s->vgid_to_vgname, vgid)) ||
+	    strcmp(name_lookup, vgname))
+		return 0;
+
+	if (!(vgid_lookup = dm_hash_lookup_with_count(s->vgname_to_vgid, vgname, &count)) ||
+	    (count != 1) || strcmp(vgid_lookup, vgid))
+		return 0;
+
+	filter_metadata(metadata); /* sanitize */
+
+	/* Copy the new metadata before taking the shard lock. */
+	if (!(new_meta = dm_config_create()))
+		return 0;
+
+	if (!(new_meta->root = dm_config_clone_node(new_meta, metadata, 0)))
+		goto out;
+
+	shard = _vg_shard_lock(s, vgid);
+	pthread_rwlock_wrlock(shard);
+
+	if (!(old_meta = dm_hash_lookup(s->vgid_to_metadata, vgid)))
+		goto out_unlock;
+
+	old_seq = dm_config_find_int(old_meta->root, "metadata/seqno", -1);
+
+	if ((old_seq <= 0) || (new_seq <= old_seq) ||
+	    !_same_pvs(s, pvs(old_meta->root), pvs(new_meta->root), vgid))
+		goto out_unlock;
+
+	DEBUGLOG(s, "vg_update in place for %s %s from %d to %d",
+		 vgname, vgid, old_seq, new_seq);
+
+	/* The entry exists, so this just replaces its data. */
+	if (!dm_hash_insert(s->vgid_to_metadata, vgid, new_meta))
+		goto out_unlock;
+
+	dm_config_destroy(old_meta);
+	new_meta = NULL;
+
+	vg_info_update(s, vgid, metadata);
+	ret = 1;
+
+out_unlock:
+	pthread_rwlock_unlock(shard);
+out:
+	if (new_meta)
+		dm_config_destroy(new_meta);
+
+	return ret;
+}
+
 static response vg_update(lvmetad_state *s, request r)
 {
 	struct dm_config_node *metadata = dm_config_find_node(r.cft->root, "metadata");
@@ -2333,6 +2644,242 @@ fail:
 	exit(EXIT_FAILURE);
 }
 
+/*
+ * Replaced nodes stay allocated in the pool of the cached metadata until
+ * it is copied into a new tree, which is done every this many deltas.
+ */
+#define LVMETAD_DELTA_COMPACT 16
+
+struct delta_op {
+	struct dm_config_node *parent;
+	const char *key;		/* node removed or replaced */
+	const char *after;		/* sibling a new node is added after */
+	struct dm_config_node *node;	/* NULL to remove */
+};
+
+static struct dm_config_node *_delta_child(struct dm_config_node *parent, const char *key,
+					   struct dm_config_node **prev)
+{
+	struct dm_config_node *cn;
+
+	*prev = NULL;
+	for (cn = parent->child; cn; *prev = cn, cn = cn->sib)
+		if (!strcmp(cn->key, key))
+			return cn;
+
+	return NULL;
+}
+
+static void _delta_apply(struct delta_op *op)
+{
+	struct dm_config_node *old, *prev, *after;
+
+	old = _delta_child(op->parent, op->key, &prev);
+
+	if (!op->node) {
+		if (!old)
+			return;
+		if (prev)
+			prev->sib = old->sib;
+		else
+			op->parent->child = old->sib;
+		return;
+	}
+
+	op->node->parent = op->parent;
+
+	if (old) {
+		op->node->sib = old->sib;
+	} else if (op->after && (after = _delta_child(op->parent, op->after, &prev))) {
+		prev = after;
+		op->node->sib = after->sib;
+	} else if (op->after) {
+		/* Add to the end. */
+		for (prev = op->parent->child; prev && prev->sib; prev = prev->sib)
+			;
+		op->node->sib = NULL;
+	} else {
+		prev = NULL;
+		op->node->sib = op->parent->child;
+	}
+
+	if (prev)
+		prev->sib = op->node;
+	else
+		op->parent->child = op->node;
+}
+
+/*
+ * vg_update_delta: the metadata of an existing VG changed from base_seqno
+ * to seqno, and only the nodes that differ are sent.
+ *
+ * delta {
+ *	op0 { parent = "" set { seqno = 5 } }
+ *	op1 { parent = "logical_volumes" after = "lvol0" set { lvol1 { ... } } }
+ *	op2 { parent = "logical_volumes/lvol2" remove = "segment2" }
+ * }
+ *
+ * parent is the path of an existing section relative to the metadata
+ * node, "" being the metadata node itself.  A set node replaces the child
+ * with the same key or is added after the child named by after (at the
+ * start without after).  physical_volumes can only be replaced as a whole
+ * and must list the same PVs; VG id and name cannot change.
+ *
+ * The delta is applied to the cached metadata in place, under the shared
+ * cache_lock and the VG shard lock.  The reply is "mismatch" when the
+ * cached metadata is not at base_seqno or the delta cannot be applied,
+ * and the client then sends the whole metadata with vg_update.
+ */
+static response vg_update_delta(lvmetad_state *s, request r)
+{
+	struct dm_config_node *delta = dm_config_find_node(r.cft->root, "delta");
+	const char *vgid = daemon_request_str(r, "uuid", NULL);
+	const char *vgname = daemon_request_str(r, "vgname", NULL);
+	const int64_t base_seq = daemon_request_int(r, "base_seqno", -1);
+	const int64_t new_seq = daemon_request_int(r, "seqno", -1);
+	struct dm_config_tree *meta, *new_meta;
+	struct dm_config_node *op_cn, *set, *metadata;
+	struct delta_op *ops = NULL, *op;
+	struct dm_pool *mem = NULL;
+	void *mark = NULL;
+	struct vg_info *info;
+	pthread_rwlock_t *shard = NULL;
+	const char *name_lookup, *vgid_lookup, *parent, *reason;
+	int64_t old_seq;
+	int count = 0, op_count = 0, seqno_set = 0;
+	int i;
+
+	if (!delta || !vgid || !vgname || (base_seq <= 0) || (new_seq <= base_seq))
+		return reply_fail("vg_update_delta: need VG UUID, name and seqnos");
+
+	reason = "VG name or UUID changed";
+	if (!(name_lookup = dm_hash_lookup(s->vgid_to_vgname, vgid)) ||
+	    strcmp(name_lookup, vgname))
+		goto mismatch;
+
+	if (!(vgid_lookup = dm_hash_lookup_with_count(s->vgname_to_vgid, vgname, &count)) ||
+	    (count != 1) || strcmp(vgid_lookup, vgid))
+		goto mismatch;
+
+	for (op_cn = delta->child; op_cn; op_cn = op_cn->sib)
+		op_count++;
+
+	reason = "out of memory";
+	if (!op_count || !(ops = dm_zalloc(sizeof(*ops) * op_count)))
+		goto mismatch;
+
+	shard = _vg_shard_lock(s, vgid);
+	pthread_rwlock_wrlock(shard);
+
+	reason = "VG seqno changed";
+	if (!(meta = dm_hash_lookup(s->vgid_to_metadata, vgid)) ||
+	    !(metadata = meta->root) ||
+	    ((old_seq = dm_config_find_int64(metadata, "metadata/seqno", -1)) != base_seq))
+		goto mismatch;
+
+	/*
+	 * Check every op and copy the new nodes into the pool of the cached
+	 * metadata before changing anything, so a rejected delta leaves the
+	 * cache as it was.  The copies of a rejected delta are freed back to
+	 * the mark.
+	 */
+	mem = dm_config_memory(meta);
+	reason = "out of memory";
+	if (!(mark = dm_pool_alloc(mem, 1)))
+		goto mismatch;
+
+	reason = "invalid delta";
+	for (op_cn = delta->child, op = ops; op_cn; op_cn = op_cn->sib, op++) {
+		if (!(parent = dm_config_find_str_allow_empty(op_cn->child, "parent", NULL)))
+			goto mismatch;
+
+		if (!*parent)
+			op->parent = metadata;
+		else if (!(op->parent = dm_config_find_node(metadata->child, parent)) ||
+			 op->parent->v || !strncmp(parent, "physical_volumes", 16))
+			goto mismatch;
+
+		op->after = dm_config_find_str(op_cn->child, "after", NULL);
+
+		if ((set = dm_config_find_node(op_cn->child, "set"))) {
+			if (!(set = set->child) || set->sib)
+				goto mismatch;
+			op->key = set->key;
+		} else if (!(op->key = dm_config_find_str(op_cn->child, "remove", NULL)))
+			goto mismatch;
+
+		if (op->parent == metadata) {
+			if (!strcmp(op->key, "id"))
+				goto mismatch;
+
+			if (!strcmp(op->key, "physical_volumes")) {
+				if (!set || set->v)
+					goto mismatch;
+				filter_pvs(set->child);
+				if (!_same_pvs(s, pvs(metadata), set->child, vgid)) {
+					reason = "VG PVs changed";
+					goto mismatch;
+				}
+			}
+
+			if (!strcmp(op->key, "seqno")) {
+				if (!set || !set->v || (set->v->type != DM_CFG_INT) ||
+				    (set->v->v.i != new_seq))
+					goto mismatch;
+				seqno_set = 1;
+			}
+		}
+
+		if (set && !(op->node = dm_config_clone_node(meta, set, 0))) {
+			reason = "out of memory";
+			goto mismatch;
+		}
+	}
+
+	if (!seqno_set)
+		goto mismatch;
+
+	DEBUGLOG(s, "vg_update_delta for %s %s from %d to %d with %d ops",
+		 vgname, vgid, (int)old_seq, (int)new_seq, op_count);
+
+	for (i = 0; i < op_count; i++)
+		_delta_apply(&ops[i]);
+
+	dm_free(ops);
+	ops = NULL;
+
+	info = dm_hash_lookup(s->vgid_to_info, vgid);
+	if (!info || (++info->deltas >= LVMETAD_DELTA_COMPACT)) {
+		if ((new_meta = dm_config_create()) &&
+		    (new_meta->root = dm_config_clone_node(new_meta, metadata, 0)) &&
+		    dm_hash_insert(s->vgid_to_metadata, vgid, new_meta)) {
+			dm_config_destroy(meta);
+			meta = new_meta;
+			if (info)
+				info->deltas = 0;
+		} else if (new_meta)
+			dm_config_destroy(new_meta);
+	}
+
+	vg_info_update(s, vgid, meta->root);
+
+	pthread_rwlock_unlock(shard);
+
+	return daemon_reply_simple("OK", NULL);
+
+mismatch:
+	if (mark)
+		dm_pool_free(mem, mark);
+	if (shard)
+		pthread_rwlock_unlock(shard);
+	dm_free(ops);
+
+	DEBUGLOG(s, "vg_update_delta for %s %s needs full update: %s",
+		 vgname, vgid, reason);
+
+	return daemon_reply_simple("mismatch", "reason = %s", reason, NULL);
+}
+
 static response vg_remove(lvmetad_state *s, request r)
 {
 	const char *vgid = daemon_request_str(r, "uuid", NULL);
@@ -2486,10 +3033,17 @@ static response get_global_info(lvmetad_state *s, request r)
 					 NULL);
 }
 
-static response set_vg_info(lvmetad_state *s, request r)
+/*
+ * With shared set, only cache_lock shared is held and a missing info
+ * entry cannot be added, *exclusive is set to request a retry under
+ * the exclusive cache_lock instead.
+ */
+static response set_vg_info(lvmetad_state *s, request r, int shared, int *exclusive)
 {
 	struct dm_config_tree *vg;
 	struct vg_info *info;
+	pthread_rwlock_t *shard = NULL;
+	response res = { 0 };
 	const char *name = NULL;
 	const char *uuid = NULL;
 	const int64_t new_version = daemon_request_int(r, "version", -1);
@@ -2501,8 +3055,14 @@ static response set_vg_info(lvmetad_state *s, request r)
 	if (!(uuid = daemon_request_str(r, "uuid", NULL)))
 		goto use_name;
 
+	shard = _vg_shard_lock(s, uuid);
+	pthread_rwlock_wrlock(shard);
+
 	if ((vg = dm_hash_lookup(s->vgid_to_metadata, uuid)))
 		goto vers;
+
+	pthread_rwlock_unlock(shard);
+	shard = NULL;
 use_name:
 	if (!(name = daemon_request_str(r, "name", NULL)))
 		goto out;
@@ -2515,6 +3075,9 @@ use_name:
 	 * then invalidate each of them.
 	 */
 
+	shard = _vg_shard_lock(s, uuid);
+	pthread_rwlock_wrlock(shard);
+
 	if (!(vg = dm_hash_lookup(s->vgid_to_metadata, uuid)))
 		goto out;
 vers:
@@ -2530,22 +3093,35 @@ inval:
 		 name ?: "none", uuid ?: "none", (int)cache_version, (int)new_version);
 
 	info = dm_hash_lookup(s->vgid_to_info, uuid);
+	if (!info && shared) {
+		*exclusive = 1;
+		goto out_unlock;
+	}
+
 	if (!info) {
 		info = malloc(sizeof(struct vg_info));
 		if (!info)
 			goto bad;
 		memset(info, 0, sizeof(struct vg_info));
-		if (!dm_hash_insert(s->vgid_to_info, uuid, (void*)info))
+		if (!dm_hash_insert(s->vgid_to_info, uuid, (void*)info)) {
+			free(info);
 			goto bad;
+		}
 	}
 
 	info->external_version = new_version;
 	info->flags |= VGFL_INVALID;
 
 out:
-	return daemon_reply_simple("OK", NULL);
+	res = daemon_reply_simple("OK", NULL);
+	goto out_unlock;
 bad:
-	return reply_fail("out of memory");
+	res = reply_fail("out of memory");
+out_unlock:
+	if (shard)
+		pthread_rwlock_unlock(shard);
+
+	return res;
 }
 
 static void _dump_cft(struct buffer *buf, struct dm_hash_table *ht, const char *key_addr)
@@ -2677,6 +3253,8 @@ static response handler(daemon_state s, client_handle h, request r)
 	int pid;
 	int cache_lock = 0;
 	int info_lock = 0;
+	int shared;
+	int exclusive = 0;
 
 	rq = daemon_request_str(r, "request", "NONE");
 	token = daemon_request_str(r, "token", "NONE");
@@ -2684,7 +3262,10 @@ static response handler(daemon_state s, client_handle h, request r)
 	cmd = daemon_request_str(r, "cmd", "NONE");
 	update_timeout = (int)daemon_request_int(r, "update_timeout", 0);
 
-	pthread_mutex_lock(&state->token_lock);
+	if (!strcmp(rq, "token_update"))
+		pthread_rwlock_wrlock(&state->token_lock);
+	else
+		pthread_rwlock_rdlock(&state->token_lock);
 
 	/*
 	 * token_update: start populating the cache, i.e. a full update.
@@ -2748,7 +3329,7 @@ static response handler(daemon_state s, client_handle h, request r)
 			if (state->update_pid != pid) {
 				/* If a pid doing update was cancelled, ignore its token update at the end. */
 				DEBUGLOG(state, "token_update ignored from cancelled update pid %d", pid);
-				pthread_mutex_unlock(&state->token_lock);
+				pthread_rwlock_unlock(&state->token_lock);
 
 				return daemon_reply_simple("token_mismatch",
 							   "expected = %s", state->token,
@@ -2770,7 +3351,7 @@ static response handler(daemon_state s, client_handle h, request r)
 			state->update_pid = 0;
 			memset(state->update_cmd, 0, CMD_NAME_SIZE);
 		}
-		pthread_mutex_unlock(&state->token_lock);
+		pthread_rwlock_unlock(&state->token_lock);
 
 		return daemon_reply_simple("OK",
 					   "prev_token = %s", prev_token,
@@ -2779,7 +3360,7 @@ static response handler(daemon_state s, client_handle h, request r)
 	}
 
 	if (strcmp(token, state->token) && strcmp(rq, "dump") && strcmp(token, "skip")) {
-		pthread_mutex_unlock(&state->token_lock);
+		pthread_rwlock_unlock(&state->token_lock);
 
 		DEBUGLOG(state, "token_mismatch current \"%s\" got \"%s\" from pid %d cmd %s",
 			 state->token, token, pid, cmd ?: "none");
@@ -2795,7 +3376,7 @@ static response handler(daemon_state s, client_handle h, request r)
 	/* If a pid doing update was cancelled, ignore its update messages. */
 	if (!strcmp(token, LVMETAD_TOKEN_UPDATE_IN_PROGRESS) &&
 	    state->update_pid && pid && (state->update_pid != pid)) {
-		pthread_mutex_unlock(&state->token_lock);
+		pthread_rwlock_unlock(&state->token_lock);
 
 		DEBUGLOG(state, "token_mismatch ignore update from pid %d current update pid %d",
 			 pid, state->update_pid);
@@ -2808,16 +3389,45 @@ static response handler(daemon_state s, client_handle h, request r)
 					   NULL);
 	}
 
-	pthread_mutex_unlock(&state->token_lock);
+	pthread_rwlock_unlock(&state->token_lock);
 
+	/*
+	 * Updates that only replace data of an existing VG are done under
+	 * the shared cache_lock and the VG shard lock, anything else falls
+	 * back to the exclusive cache_lock below.
+	 */
+	if (!strcmp(rq, "vg_update")) {
+		pthread_rwlock_rdlock(&state->cache_lock);
+		shared = _vg_update_shared(state, r);
+		pthread_rwlock_unlock(&state->cache_lock);
+		if (shared)
+			return daemon_reply_simple("OK", NULL);
+	}
+
+	if (!strcmp(rq, "vg_update_delta")) {
+		pthread_rwlock_rdlock(&state->cache_lock);
+		res = vg_update_delta(state, r);
+		pthread_rwlock_unlock(&state->cache_lock);
+		return res;
+	}
+
+	if (!strcmp(rq, "set_vg_info")) {
+		pthread_rwlock_rdlock(&state->cache_lock);
+		res = set_vg_info(state, r, 1, &exclusive);
+		pthread_rwlock_unlock(&state->cache_lock);
+		if (!exclusive)
+			return res;
+	}
 
 	if (!strcmp(rq, "pv_found") ||
+	    !strcmp(rq, "pv_found_batch") ||
 	    !strcmp(rq, "pv_gone") ||
 	    !strcmp(rq, "vg_update") ||
 	    !strcmp(rq, "vg_remove") ||
 	    !strcmp(rq, "set_vg_info") ||
 	    !strcmp(rq, "pv_clear_all") ||
-	    !strcmp(rq, "vg_clear_outdated_pvs")) {
+	    !strcmp(rq, "vg_clear_outdated_pvs") ||
+	    !strcmp(rq, "dump")) {
 		pthread_rwlock_wrlock(&state->cache_lock);
 		cache_lock = 1;
 		goto do_rq;
@@ -2826,8 +3436,7 @@ static response handler(daemon_state s, client_handle h, request r)
 	if (!strcmp(rq, "pv_lookup") ||
 	    !strcmp(rq, "vg_lookup") ||
 	    !strcmp(rq, "pv_list") ||
-	    !strcmp(rq, "vg_list") ||
-	    !strcmp(rq, "dump")) {
+	    !strcmp(rq, "vg_list")) {
 		pthread_rwlock_rdlock(&state->cache_lock);
 		cache_lock = 1;
 		goto do_rq;
@@ -2845,6 +3454,9 @@ static response handler(daemon_state s, client_handle h, request r)
 	if (!strcmp(rq, "pv_found"))
 		res = pv_found(state, r);
 
+	else if (!strcmp(rq, "pv_found_batch"))
+		res = pv_found_batch(state, r);
+
 	else if (!strcmp(rq, "pv_gone"))
 		res = pv_gone(state, r);
 
@@ -2879,7 +3491,7 @@ static response handler(daemon_state s, client_handle h, request r)
 		res = get_global_info(state, r);
 
 	else if (!strcmp(rq, "set_vg_info"))
-		res = set_vg_info(state, r);
+		res = set_vg_info(state, r, 0, NULL);
 
 	else if (!strcmp(rq, "dump"))
 		res = dump(state);
@@ -2898,11 +3510,15 @@ static response handler(daemon_state s, client_handle h, request r)
 static int init(daemon_state *s)
 {
 	lvmetad_state *ls = s->private;
+	int i;
+
 	ls->log = s->log;
 
-	pthread_mutex_init(&ls->token_lock, NULL);
+	pthread_rwlock_init(&ls->token_lock, NULL);
 	pthread_mutex_init(&ls->info_lock, NULL);
 	pthread_rwlock_init(&ls->cache_lock, NULL);
+	for (i = 0; i < LVMETAD_VG_SHARDS; i++)
+		pthread_rwlock_init(&ls->vg_lock[i], NULL);
 	create_metadata_hashes(ls);
 
 	ls->token[0] = 0;
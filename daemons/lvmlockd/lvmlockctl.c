@@ -13,6 +13,7 @@
 #include "lvmlockd-client.h"
 
 #include <stddef.h>
+#include <ctype.h>
 #include <getopt.h>
 #include <signal.h>
 #include <errno.h>
@@ -31,6 +32,9 @@ static int drop_vg = 0;
 static int gl_enable = 0;
 static int gl_disable = 0;
 static int stop_lockspaces = 0;
+static int stats = 0;
+static int json_opt = 0;
+static int reset_opt = 0;
 static char *arg_vg_name = NULL;
 
 #define DUMP_SOCKET_NAME "lvmlockd-dump.sock"
@@ -146,13 +150,20 @@ static void format_info_r(char *line, char *r_name_out, char *r_type_out)
 	char mode[4] = { 0 };
 	char sh_count[MAX_NAME+1] = { 0 };
 	uint32_t ver = 0;
+	uint32_t cached = 0;
 
-	(void) sscanf(line, "info=r name=%s type=%s mode=%s %s version=%u",
-	       r_name, r_type, mode, sh_count, &ver);
+	(void) sscanf(line, "info=r name=%s type=%s mode=%s %s version=%u cached=%u",
+	       r_name, r_type, mode, sh_count, &ver, &cached);
 
 	strcpy(r_name_out, r_name);
 	strcpy(r_type_out, r_type);
 
+	/* a cached lock has no lk lines */
+	if (cached) {
+		printf("LK VG %s ver %u cached\n", mode, ver);
+		return;
+	}
+
 	/* when mode is not un, wait and print each lk line */
 	if (strcmp(mode, "un"))
 		return;
@@ -299,6 +310,225 @@ static void format_info(void)
 	}
 }
 
+/*
+ * lvmlockd dumps the stats as a line of key=value fields for each
+ * lockspace (info=ls_stats) followed by a line for each of its
+ * resources that was used (info=r_stats).
+ */
+
+#define MAX_STATS_FIELDS 48
+#define LAT_BUCKETS 24	/* same as lvmlockd-internal.h */
+
+struct stats_line {
+	int count;
+	char *key[MAX_STATS_FIELDS];
+	char *val[MAX_STATS_FIELDS];
+};
+
+static void split_stats_line(char *line, struct stats_line *sl)
+{
+	char *field, *eq;
+
+	sl->count = 0;
+
+	for (field = strtok(line, " "); field && sl->count < MAX_STATS_FIELDS;
+	     field = strtok(NULL, " ")) {
+		if (!(eq = strchr(field, '=')))
+			continue;
+		*eq = '\0';
+		sl->key[sl->count] = field;
+		sl->val[sl->count] = eq + 1;
+		sl->count++;
+	}
+}
+
+static const char *stats_str(struct stats_line *sl, const char *key)
+{
+	int i;
+
+	for (i = 0; i < sl->count; i++)
+		if (!strcmp(sl->key[i], key))
+			return sl->val[i];
+
+	return "";
+}
+
+static unsigned long long stats_num(struct stats_line *sl, const char *name, const char *suffix)
+{
+	char key[MAX_NAME];
+
+	snprintf(key, sizeof(key), "%s%s", name, suffix);
+
+	return strtoull(stats_str(sl, key), NULL, 10);
+}
+
+/*
+ * The upper bound in usec of the histogram bucket holding the pct
+ * percentile as "<N", or the lower bound as ">=N" for the last bucket.
+ */
+static const char *stats_pct(struct stats_line *sl, const char *name, int pct,
+			     char *buf, size_t size)
+{
+	unsigned long long count = stats_num(sl, name, "_count");
+	unsigned long long sum = 0;
+	const char *hist;
+	char key[MAX_NAME];
+	char *end;
+	int i;
+
+	if (!count) {
+		snprintf(buf, size, "0");
+		return buf;
+	}
+
+	snprintf(key, sizeof(key), "%s_hist", name);
+	hist = stats_str(sl, key);
+
+	for (i = 0; *hist && (i < LAT_BUCKETS); i++) {
+		sum += strtoull(hist, &end, 10);
+		if (sum * 100 >= count * pct)
+			break;
+		hist = (*end == ',') ? end + 1 : end;
+	}
+
+	if (i < LAT_BUCKETS - 1)
+		snprintf(buf, size, "<%llu", 1ULL << i);
+	else
+		snprintf(buf, size, ">=%llu", 1ULL << (LAT_BUCKETS - 2));
+
+	return buf;
+}
+
+static void print_lat_text(struct stats_line *sl, const char *name)
+{
+	unsigned long long count = stats_num(sl, name, "_count");
+	char p50[32], p99[32];
+
+	if (!count) {
+		printf("  %-9s count 0\n", name);
+		return;
+	}
+
+	printf("  %-9s count %llu avg %llu p50 %s p99 %s max %llu usec\n",
+	       name, count,
+	       stats_num(sl, name, "_total_us") / count,
+	       stats_pct(sl, name, 50, p50, sizeof(p50)),
+	       stats_pct(sl, name, 99, p99, sizeof(p99)),
+	       stats_num(sl, name, "_max_us"));
+}
+
+static void format_stats_line(struct stats_line *sl)
+{
+	unsigned long long lm_count = stats_num(sl, "lm_lock", "_count");
+	unsigned long long wait_count = stats_num(sl, "wait", "_count");
+	char p99[32];
+
+	if (!strcmp(stats_str(sl, "info"), "ls_stats")) {
+		printf("VG %s lock_type=%s stats for %s sec\n",
+		       stats_str(sl, "vg_name"), stats_str(sl, "lm_type"),
+		       stats_str(sl, "window_sec"));
+		printf("  locks %llu unlocks %llu cache_hits %llu converts %llu "
+		       "retries %llu conflicts %llu errors %llu\n",
+		       stats_num(sl, "locks", ""), stats_num(sl, "unlocks", ""),
+		       stats_num(sl, "cache_hits", ""), stats_num(sl, "converts", ""),
+		       stats_num(sl, "retries", ""), stats_num(sl, "conflicts", ""),
+		       stats_num(sl, "errors", ""));
+		print_lat_text(sl, "wait");
+		print_lat_text(sl, "lm_lock");
+		print_lat_text(sl, "lm_unlock");
+		printf("  %-2s %-36s %8s %8s %9s %10s %10s %10s %10s\n",
+		       "RT", "RESOURCE", "LOCKS", "RETRIES", "CONFLICTS",
+		       "WAIT_AVG", "LM_AVG", "LM_P99", "LM_MAX");
+		return;
+	}
+
+	printf("  %-2s %-36s %8llu %8llu %9llu %10llu %10llu %10s %10llu\n",
+	       stats_str(sl, "type"), stats_str(sl, "name"),
+	       stats_num(sl, "locks", ""), stats_num(sl, "retries", ""),
+	       stats_num(sl, "conflicts", ""),
+	       wait_count ? stats_num(sl, "wait", "_total_us") / wait_count : 0,
+	       lm_count ? stats_num(sl, "lm_lock", "_total_us") / lm_count : 0,
+	       stats_pct(sl, "lm_lock", 99, p99, sizeof(p99)),
+	       stats_num(sl, "lm_lock", "_max_us"));
+}
+
+static void print_json_value(const char *key, const char *val)
+{
+	const char *c;
+
+	if (strstr(key, "_hist")) {
+		printf("[%s]", val);
+		return;
+	}
+
+	for (c = val; *c && isdigit((unsigned char) *c); c++)
+		;
+
+	if (*val && !*c) {
+		printf("%s", val);
+		return;
+	}
+
+	putchar('"');
+	for (c = val; *c; c++) {
+		if (*c == '"' || *c == '\\')
+			putchar('\\');
+		putchar(*c);
+	}
+	putchar('"');
+}
+
+static void format_stats_json_line(struct stats_line *sl, int *ls_count, int *r_count)
+{
+	int ls_line = !strcmp(stats_str(sl, "info"), "ls_stats");
+	const char *sep = "";
+	int i;
+
+	if (ls_line) {
+		printf("%s\n    {", (*ls_count)++ ? "]},": "");
+		*r_count = 0;
+	} else
+		printf("%s\n        {", (*r_count)++ ? "," : "");
+
+	for (i = 0; i < sl->count; i++) {
+		if (!strcmp(sl->key[i], "info"))
+			continue;
+		printf("%s\"%s\": ", sep, sl->key[i]);
+		print_json_value(sl->key[i], sl->val[i]);
+		sep = ", ";
+	}
+
+	if (ls_line)
+		printf("%s\"resources\": [", sep);
+	else
+		printf("}");
+}
+
+static void format_stats(void)
+{
+	struct stats_line sl;
+	char *line, *next;
+	int ls_count = 0, r_count = 0;
+
+	if (json_opt)
+		printf("{\"lockspaces\": [");
+
+	for (line = dump_buf; line && *line; line = next) {
+		if ((next = strchr(line, '\n')))
+			*next++ = '\0';
+
+		split_stats_line(line, &sl);
+
+		if (json_opt)
+			format_stats_json_line(&sl, &ls_count, &r_count);
+		else
+			format_stats_line(&sl);
+	}
+
+	if (json_opt)
+		printf("%s\n]}\n", ls_count ? "]}" : "");
+}
+
 
 static daemon_reply _lvmlockd_send(const char *req_name, ...)
 {
@@ -400,7 +630,9 @@ static int do_dump(const char *req_name)
 		return fd;
 	}
 
-	reply = daemon_send_simple(_lvmlockd, req_name, NULL);
+	reply = daemon_send_simple(_lvmlockd, req_name,
+				   "reset = " FMTd64, (int64_t) reset_opt,
+				   NULL);
 
 	if (reply.error) {
 		log_error("reply error %d", reply.error);
@@ -439,6 +671,8 @@ retry:
 	rv = 0;
 	if ((info && dump) || !strcmp(req_name, "dump"))
 		printf("%s\n", dump_buf);
+	else if (!strcmp(req_name, "stats"))
+		format_stats();
 	else
 		format_info();
 out:
@@ -608,6 +842,12 @@ static void print_usage(void)
 	printf("      Tell lvmlockd to disable the global lock in a sanlock VG.\n");
 	printf("--stop-lockspaces | -S\n");
 	printf("      Stop all lockspaces.\n");
+	printf("--stats | -s\n");
+	printf("      Print lock counts and latencies from lvmlockd.\n");
+	printf("--json | -j\n");
+	printf("      Print stats (-s) in JSON format.\n");
+	printf("--reset | -R\n");
+	printf("      Reset stats (-s) after printing them, starting a new window.\n");
 }
 
 static int read_options(int argc, char *argv[])
@@ -627,6 +867,9 @@ static int read_options(int argc, char *argv[])
 		{"gl-enable",       required_argument, 0,  'E' },
 		{"gl-disable",      required_argument, 0,  'D' },
 		{"stop-lockspaces", no_argument,       0,  'S' },
+		{"stats",           no_argument,       0,  's' },
+		{"json",            no_argument,       0,  'j' },
+		{"reset",           no_argument,       0,  'R' },
 		{0, 0, 0, 0 }
 	};
 
@@ -636,7 +879,7 @@ static int read_options(int argc, char *argv[])
 	}
 
 	while (1) {
-		c = getopt_long(argc, argv, "hqidE:D:w:k:r:S", long_options, &option_index);
+		c = getopt_long(argc, argv, "hqidE:D:w:k:r:SsjR", long_options, &option_index);
 		if (c == -1)
 			break;
 
@@ -679,6 +922,15 @@ static int read_options(int argc, char *argv[])
 		case 'S':
 			stop_lockspaces = 1;
 			break;
+		case 's':
+			stats = 1;
+			break;
+		case 'j':
+			json_opt = 1;
+			break;
+		case 'R':
+			reset_opt = 1;
+			break;
 		default:
 			print_usage();
 			exit(1);
@@ -719,6 +971,11 @@ int main(int argc, char **argv)
 		goto out;
 	}
 
+	if (stats) {
+		rv = do_dump("stats");
+		goto out;
+	}
+
 	if (kill_vg) {
 		rv = do_kill();
 		goto out;
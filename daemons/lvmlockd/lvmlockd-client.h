@@ -35,6 +35,9 @@ static inline void lvmlockd_close(daemon_handle h)
 	return daemon_close(h);
 }
 
+/* Most LV locks in one lock_lv_batch request. */
+#define LVMLOCKD_LV_BATCH_MAX 1024
+
 /*
  * Errors returned as the lvmlockd result value.
  */
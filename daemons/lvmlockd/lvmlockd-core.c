@@ -143,6 +143,13 @@ static const char *lvmlockd_protocol = "lvmlockd";
 static const int lvmlockd_protocol_version = 1;
 static int daemon_quit;
 static int adopt_opt;
+static int vg_cache_secs; /* keep unused sh VG locks this long */
+
+/*
+ * Limit of vg_cache_secs.  Other hosts cannot tell how long a VG lock is
+ * cached here, so with vg_cache_secs set they wait this long for it.
+ */
+#define VG_CACHE_MAX_SECS 30
 
 static daemon_handle lvmetad_handle;
 static pthread_mutex_t lvmetad_mutex;
@@ -259,6 +266,7 @@ static int setup_dump_socket(void);
 static void send_dump_buf(int fd, int dump_len);
 static int dump_info(int *dump_len);
 static int dump_log(int *dump_len);
+static int dump_stats(int *dump_len, int reset);
 
 static int _syslog_name_to_num(const char *name)
 {
@@ -317,6 +325,16 @@ static uint64_t monotime(void)
 	return ts.tv_sec;
 }
 
+static uint64_t monotime_us(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		return 0;
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 static void log_save_line(int len, char *line,
 			  char *log_buf, unsigned int *point, unsigned int *wrap)
 {
@@ -416,6 +434,7 @@ struct lockspace *alloc_lockspace(void)
 	}
 
 	memset(ls, 0, sizeof(struct lockspace));
+	ls->stats_start = monotime();
 	INIT_LIST_HEAD(&ls->actions);
 	INIT_LIST_HEAD(&ls->resources);
 	pthread_mutex_init(&ls->mutex, NULL);
@@ -506,8 +525,13 @@ static struct lock *alloc_lock(void)
 	return lk;
 }
 
+static void free_batch_acts(struct action *act);
+
 static void free_action(struct action *act)
 {
+	if (act->flags & LD_AF_BATCH)
+		free_batch_acts(act);
+
 	pthread_mutex_lock(&unused_struct_mutex);
 	if (unused_action_count >= MAX_UNUSED_ACTION) {
 		free(act);
@@ -518,6 +542,16 @@ static void free_action(struct action *act)
 	pthread_mutex_unlock(&unused_struct_mutex);
 }
 
+static void free_batch_acts(struct action *act)
+{
+	struct action *act_b, *safe;
+
+	list_for_each_entry_safe(act_b, safe, &act->batch_acts, list) {
+		list_del(&act_b->list);
+		free_action(act_b);
+	}
+}
+
 static void free_client(struct client *cl)
 {
 	pthread_mutex_lock(&unused_struct_mutex);
@@ -743,6 +777,10 @@ static const char *op_str(int x)
 		return "dump_info";
 	case LD_OP_BUSY:
 		return "busy";
+	case LD_OP_DUMP_STATS:
+		return "dump_stats";
+	case LD_OP_RETURN_FREE_LOCK:
+		return "return_free_lock";
 	default:
 		return "op_unknown";
 	};
@@ -862,9 +900,35 @@ static int lm_rem_lockspace(struct lockspace *ls, struct action *act, int free_v
 	return rv;
 }
 
+/*
+ * Lock statistics are updated by the lockspace thread and counted
+ * both in the resource and in the lockspace totals.
+ */
+
+#define STATS_INC(ls, r, field) \
+	do { (ls)->stats.field++; (r)->stats.field++; } while (0)
+
+#define STATS_LAT(ls, r, hist, us) \
+	do { lat_add(&(ls)->stats.hist, (us)); lat_add(&(r)->stats.hist, (us)); } while (0)
+
+static void lat_add(struct lat_hist *h, uint64_t us)
+{
+	int i = 0;
+
+	while ((i < LAT_BUCKETS - 1) && (us >= (1ULL << i)))
+		i++;
+
+	h->count++;
+	h->total_us += us;
+	if (us > h->max_us)
+		h->max_us = us;
+	h->bucket[i]++;
+}
+
 static int lm_lock(struct lockspace *ls, struct resource *r, int mode, struct action *act,
 		   struct val_blk *vb_out, int *retry, int adopt)
 {
+	uint64_t start = monotime_us();
 	int rv;
 
 	if (ls->lm_type == LD_LM_DLM)
@@ -874,6 +938,10 @@ static int lm_lock(struct lockspace *ls, struct resource *r, int mode, struct ac
 	else
 		return -1;
 
+	STATS_LAT(ls, r, lm_lock, monotime_us() - start);
+	if (rv < 0 && rv != -EAGAIN)
+		STATS_INC(ls, r, errors);
+
 	if (act)
 		act->lm_rv = rv;
 	return rv;
@@ -882,6 +950,7 @@ static int lm_lock(struct lockspace *ls, struct resource *r, int mode, struct ac
 static int lm_convert(struct lockspace *ls, struct resource *r,
 		      int mode, struct action *act, uint32_t r_version)
 {
+	uint64_t start = monotime_us();
 	int rv;
 
 	if (ls->lm_type == LD_LM_DLM)
@@ -891,6 +960,13 @@ static int lm_convert(struct lockspace *ls, struct resource *r,
 	else
 		return -1;
 
+	STATS_LAT(ls, r, lm_lock, monotime_us() - start);
+	STATS_INC(ls, r, converts);
+	if (rv == -EAGAIN)
+		STATS_INC(ls, r, conflicts);
+	else if (rv < 0)
+		STATS_INC(ls, r, errors);
+
 	if (act)
 		act->lm_rv = rv;
 	return rv;
@@ -899,6 +975,7 @@ static int lm_convert(struct lockspace *ls, struct resource *r,
 static int lm_unlock(struct lockspace *ls, struct resource *r, struct action *act,
 		     uint32_t r_version, uint32_t lmu_flags)
 {
+	uint64_t start = monotime_us();
 	int rv;
 
 	if (ls->lm_type == LD_LM_DLM)
@@ -908,6 +985,10 @@ static int lm_unlock(struct lockspace *ls, struct resource *r, struct action *ac
 	else
 		return -1;
 
+	STATS_LAT(ls, r, lm_unlock, monotime_us() - start);
+	if (rv < 0)
+		STATS_INC(ls, r, errors);
+
 	if (act)
 		act->lm_rv = rv;
 	return rv;
@@ -939,6 +1020,12 @@ static int lm_find_free_lock(struct lockspace *ls, uint64_t *free_offset)
 	return -1;
 }
 
+static void lm_return_free_lock(struct lockspace *ls, uint64_t free_offset)
+{
+	if (ls->lm_type == LD_LM_SANLOCK)
+		lm_return_free_lock_sanlock(ls, free_offset);
+}
+
 /*
  * While adopting locks, actions originate from the adopt_locks()
  * function, not from a client.  So, these actions (flagged ADOPT),
@@ -957,6 +1044,17 @@ static void add_client_result(struct action *act)
 	}
 
 	pthread_mutex_lock(&client_mutex);
+
+	/* The batch is sent back to the client once all its locks are done. */
+	if (act->batch) {
+		list_add_tail(&act->list, &act->batch->batch_acts);
+		if (--act->batch->batch_pending) {
+			pthread_mutex_unlock(&client_mutex);
+			return;
+		}
+		act = act->batch;
+	}
+
 	if (act->flags & LD_AF_ADOPT)
 		list_add_tail(&act->list, &adopt_results);
 	else
@@ -1067,13 +1165,23 @@ static int res_lock(struct lockspace *ls, struct resource *r, struct action *act
 
 	r->last_client_id = act->client_id;
 
+	/* Time spent queued before the first attempt, retries are counted. */
+	if (act->recv_us && !act->retries)
+		STATS_LAT(ls, r, wait, monotime_us() - act->recv_us);
+
 	if (r->type == LD_RT_LV)
 		log_debug("S %s R %s res_lock cl %u mode %s (%s)", ls->name, r->name, act->client_id, mode_str(act->mode), act->lv_name);
 	else
 		log_debug("S %s R %s res_lock cl %u mode %s", ls->name, r->name, act->client_id, mode_str(act->mode));
 
-	if (r->mode == LD_LK_SH && act->mode == LD_LK_SH)
+	if (r->mode == LD_LK_SH && act->mode == LD_LK_SH) {
+		if (r->cached) {
+			log_debug("S %s R %s res_lock from cache", ls->name, r->name);
+			STATS_INC(ls, r, cache_hits);
+		}
+		r->cached = 0;
 		goto add_lk;
+	}
 
 	if (r->type == LD_RT_LV && act->lv_args[0])
 		memcpy(r->lv_args, act->lv_args, MAX_ARGS);
@@ -1315,6 +1423,8 @@ add_lk:
 	if (r->mode == LD_LK_SH)
 		r->sh_count++;
 
+	STATS_INC(ls, r, locks);
+
 	if (!(lk = alloc_lock()))
 		return -ENOMEM;
 
@@ -1514,6 +1624,19 @@ do_unlock:
 			log_debug("S %s R %s res_unlock sh_count %u", ls->name, r->name, r->sh_count);
 			goto rem_lk;
 		}
+
+		/*
+		 * Keep the lm lock of the last sh VG lock for a while, so
+		 * commands that follow get the VG lock without the lm.
+		 * No other host can change the VG while we hold it sh,
+		 * so r->version remains current.
+		 */
+		if (vg_cache_secs && (r->type == LD_RT_VG)) {
+			log_debug("S %s R %s res_unlock cached for %d sec", ls->name, r->name, vg_cache_secs);
+			r->cached = 1;
+			r->cache_expire = monotime() + vg_cache_secs;
+			goto rem_lk;
+		}
 	}
 
 	if ((r->type == LD_RT_GL) && (r->mode == LD_LK_EX)) {
@@ -1545,15 +1668,54 @@ do_unlock:
 	log_debug("S %s R %s res_unlock lm done", ls->name, r->name);
 
 rem_lk:
+	STATS_INC(ls, r, unlocks);
 	list_del(&lk->list);
 	free_lock(lk);
 
-	if (list_empty(&r->locks))
+	if (list_empty(&r->locks) && !r->cached)
 		r->mode = LD_LK_UN;
 
 	return 0;
 }
 
+/* Release the lm lock kept for a cached sh VG lock. */
+static void res_uncache(struct lockspace *ls, struct resource *r, const char *reason)
+{
+	int rv;
+
+	log_debug("S %s R %s res_uncache %s", ls->name, r->name, reason);
+
+	rv = lm_unlock(ls, r, NULL, 0, 0);
+	if (rv < 0)
+		log_error("S %s R %s res_uncache lm error %d", ls->name, r->name, rv);
+
+	r->cached = 0;
+	r->mode = LD_LK_UN;
+}
+
+/*
+ * Release cached VG locks that have expired, and return the
+ * monotime at which the next one expires, 0 if none.
+ */
+static uint64_t res_uncache_expired(struct lockspace *ls)
+{
+	struct resource *r;
+	uint64_t now = monotime();
+	uint64_t next = 0;
+
+	list_for_each_entry(r, &ls->resources, list) {
+		if (!r->cached)
+			continue;
+
+		if (r->cache_expire <= now)
+			res_uncache(ls, r, "expired");
+		else if (!next || (r->cache_expire < next))
+			next = r->cache_expire;
+	}
+
+	return next;
+}
+
 static int res_update(struct lockspace *ls, struct resource *r,
 		      struct action *act)
 {
@@ -1678,6 +1840,21 @@ out:
  * meaning we should call res_process() again in a short while to retry.
  */
 
+/*
+ * With VG caching enabled, which all hosts must then do, other hosts may
+ * keep a sh VG lock cached for up to VG_CACHE_MAX_SECS after it is last
+ * used, whatever vg_cache_secs is here.  Conflicts on the VG lock are
+ * then retried (once a second) for that much longer before failing the
+ * request.
+ */
+static int res_max_retries(struct resource *r, struct action *act)
+{
+	if (vg_cache_secs && (r->type == LD_RT_VG))
+		return act->max_retries + VG_CACHE_MAX_SECS;
+
+	return act->max_retries;
+}
+
 static void res_process(struct lockspace *ls, struct resource *r,
 			struct list_head *act_close_list, int *retry_out)
 {
@@ -1984,13 +2161,16 @@ static void res_process(struct lockspace *ls, struct resource *r,
 
 			rv = res_lock(ls, r, act, &lm_retry);
 			if ((rv == -EAGAIN) &&
-			    (act->retries <= act->max_retries) &&
+			    (act->retries <= res_max_retries(r, act)) &&
 			    (lm_retry || (r->type != LD_RT_LV))) {
 				/* leave act on list */
 				log_debug("S %s R %s res_lock EAGAIN retry", ls->name, r->name);
 				act->retries++;
+				STATS_INC(ls, r, retries);
 				*retry_out = 1;
 			} else {
+				if (rv == -EAGAIN)
+					STATS_INC(ls, r, conflicts);
 				act->result = rv;
 				list_del(&act->list);
 				add_client_result(act);
@@ -2000,6 +2180,19 @@ static void res_process(struct lockspace *ls, struct resource *r,
 		}
 	}
 
+	/*
+	 * A cached lock has no holders, give it up for an ex lock action.
+	 */
+
+	if (r->cached) {
+		list_for_each_entry(act, &r->actions, list) {
+			if (act->op == LD_OP_LOCK && act->mode == LD_LK_EX) {
+				res_uncache(ls, r, "for ex");
+				break;
+			}
+		}
+	}
+
 	/*
 	 * r mode is SH, any ex lock action is blocked, just quit
 	 */
@@ -2017,13 +2210,16 @@ static void res_process(struct lockspace *ls, struct resource *r,
 
 			rv = res_lock(ls, r, act, &lm_retry);
 			if ((rv == -EAGAIN) &&
-			    (act->retries <= act->max_retries) &&
+			    (act->retries <= res_max_retries(r, act)) &&
 			    (lm_retry || (r->type != LD_RT_LV))) {
 				/* leave act on list */
 				log_debug("S %s R %s res_lock EAGAIN retry", ls->name, r->name);
 				act->retries++;
+				STATS_INC(ls, r, retries);
 				*retry_out = 1;
 			} else {
+				if (rv == -EAGAIN)
+					STATS_INC(ls, r, conflicts);
 				act->result = rv;
 				list_del(&act->list);
 				add_client_result(act);
@@ -2047,7 +2243,9 @@ r_free:
 	}
 	log_debug("S %s R %s res_process free", ls->name, r->name);
 	lm_rem_resource(ls, r);
+	pthread_mutex_lock(&ls->mutex);
 	list_del(&r->list);
+	pthread_mutex_unlock(&ls->mutex);
 	free_resource(r);
 }
 
@@ -2150,7 +2348,9 @@ static int clear_locks(struct lockspace *ls, int free_vg, int drop_vg)
  r_free:
 		log_debug("S %s R %s free", ls->name, r->name);
 		lm_rem_resource(ls, r);
+		pthread_mutex_lock(&ls->mutex);
 		list_del(&r->list);
+		pthread_mutex_unlock(&ls->mutex);
 		free_resource(r);
 	}
 
@@ -2284,6 +2484,8 @@ static void *lockspace_thread_main(void *arg_in)
 	struct list_head tmp_act;
 	struct list_head act_close;
 	char tmp_name[MAX_NAME+1];
+	struct timespec ts;
+	uint64_t cache_expire;
 	int free_vg = 0;
 	int drop_vg = 0;
 	int error = 0;
@@ -2360,13 +2562,27 @@ static void *lockspace_thread_main(void *arg_in)
 		goto out_act;
 
 	while (1) {
+		cache_expire = res_uncache_expired(ls);
+
 		pthread_mutex_lock(&ls->mutex);
 		while (!ls->thread_work) {
 			if (ls->thread_stop) {
 				pthread_mutex_unlock(&ls->mutex);
 				goto out_rem;
 			}
-			pthread_cond_wait(&ls->cond, &ls->mutex);
+			if (!cache_expire) {
+				pthread_cond_wait(&ls->cond, &ls->mutex);
+				continue;
+			}
+
+			/* Wake up to release cached locks when they expire. */
+			if (clock_gettime(CLOCK_REALTIME, &ts)) {
+				log_error("clock_gettime failed.");
+				ts.tv_sec = ts.tv_nsec = 0;
+			}
+			ts.tv_sec += (int64_t) cache_expire - (int64_t) monotime();
+			if (pthread_cond_timedwait(&ls->cond, &ls->mutex, &ts) == ETIMEDOUT)
+				break;
 		}
 
 		/*
@@ -2400,6 +2616,14 @@ static void *lockspace_thread_main(void *arg_in)
 				continue;
 			}
 
+			/* Queued by the worker thread, there is no client. */
+			if (act->op == LD_OP_RETURN_FREE_LOCK) {
+				lm_return_free_lock(ls, act->free_offset);
+				list_del(&act->list);
+				free_action(act);
+				continue;
+			}
+
 			if (ls->kill_vg && !process_op_during_kill(act)) {
 				log_debug("S %s disallow op %s after kill_vg", ls->name, op_str(act->op));
 				list_del(&act->list);
@@ -3287,6 +3511,37 @@ static void work_test_gl(void)
 	pthread_mutex_unlock(&lockspaces_mutex);
 }
 
+/*
+ * The lock found by find_free_lock was not used by init_lv.  The map of
+ * free locks belongs to the lockspace thread, so let it clear the slot.
+ */
+static void return_free_lock(char *ls_name, uint64_t free_offset)
+{
+	struct lockspace *ls;
+	struct action *act;
+
+	pthread_mutex_lock(&lockspaces_mutex);
+	ls = find_lockspace_name(ls_name);
+	if (ls && (act = alloc_action())) {
+		act->op = LD_OP_RETURN_FREE_LOCK;
+		act->rt = LD_RT_VG;
+		act->free_offset = free_offset;
+
+		pthread_mutex_lock(&ls->mutex);
+		if (!ls->thread_stop) {
+			list_add_tail(&act->list, &ls->actions);
+			ls->thread_work = 1;
+			pthread_cond_signal(&ls->cond);
+			act = NULL;
+		}
+		pthread_mutex_unlock(&ls->mutex);
+
+		if (act)
+			free_action(act);
+	}
+	pthread_mutex_unlock(&lockspaces_mutex);
+}
+
 static int work_init_lv(struct action *act)
 {
 	struct lockspace *ls;
@@ -3327,6 +3582,9 @@ static int work_init_lv(struct action *act)
 		rv = lm_init_lv_sanlock(ls_name, act->vg_name, act->lv_uuid,
 					vg_args, lv_args, free_offset);
 
+		if (rv < 0 && ls && free_offset)
+			return_free_lock(ls_name, free_offset);
+
 		memcpy(act->lv_args, lv_args, MAX_ARGS);
 		return rv;
 
@@ -3723,7 +3981,8 @@ static int client_send_result(struct client *cl, struct action *act)
 					  "result_flags = %s", result_flags[0] ? result_flags : "none",
 					  NULL);
 
-	} else if (act->op == LD_OP_DUMP_LOG || act->op == LD_OP_DUMP_INFO) {
+	} else if (act->op == LD_OP_DUMP_LOG || act->op == LD_OP_DUMP_INFO ||
+		   act->op == LD_OP_DUMP_STATS) {
 		/*
 		 * lvmlockctl creates the unix socket then asks us to write to it.
 		 * FIXME: move processing this to a new dedicated query thread to
@@ -3738,6 +3997,8 @@ static int client_send_result(struct client *cl, struct action *act)
 			act->result = dump_log(&dump_len);
 		else if (act->op == LD_OP_DUMP_INFO)
 			act->result = dump_info(&dump_len);
+		else if (act->op == LD_OP_DUMP_STATS)
+			act->result = dump_stats(&dump_len, act->flags & LD_AF_STATS_RESET);
 		else
 			act->result = -EINVAL;
 
@@ -3749,6 +4010,39 @@ static int client_send_result(struct client *cl, struct action *act)
 					  "result = " FMTd64, (int64_t) act->result,
 					  "dump_len = " FMTd64, (int64_t) dump_len,
 					  NULL);
+	} else if (act->flags & LD_AF_BATCH) {
+		/*
+		 * A result for each lock of the batch, op_result is
+		 * set when the batch as a whole could not be queued.
+		 */
+		struct action *act_b;
+		char fmt[32];
+		int count = 0;
+
+		list_for_each_entry(act_b, &act->batch_acts, list)
+			count++;
+
+		log_debug("send %s[%d] cl %u %s batch of %d rv %d %s",
+			  cl->name[0] ? cl->name : "client", cl->pid, cl->id,
+			  op_str(act->op), count, act->result, result_flags);
+
+		res = daemon_reply_simple("OK",
+					  "op = " FMTd64, (int64_t) act->op,
+					  "lock_type = %s", lm_str(act->lm_type),
+					  "op_result = " FMTd64, (int64_t) act->result,
+					  "lm_result = " FMTd64, (int64_t) act->lm_rv,
+					  "result_flags = %s", result_flags[0] ? result_flags : "none",
+					  "count = " FMTd64, (int64_t) count,
+					  NULL);
+
+		list_for_each_entry(act_b, &act->batch_acts, list) {
+			snprintf(fmt, sizeof(fmt), "op_result_%d = %s", act_b->batch_index, FMTd64);
+			if (!buffer_append_f(&res.buffer, fmt, (int64_t) act_b->result, NULL))
+				res.error = ENOMEM;
+			snprintf(fmt, sizeof(fmt), "lm_result_%d = %s", act_b->batch_index, FMTd64);
+			if (!buffer_append_f(&res.buffer, fmt, (int64_t) act_b->lm_rv, NULL))
+				res.error = ENOMEM;
+		}
 	} else {
 		/*
 		 * A normal reply.
@@ -3768,7 +4062,7 @@ static int client_send_result(struct client *cl, struct action *act)
 					  NULL);
 	}
 
-	if (!buffer_write(cl->fd, &res.buffer)) {
+	if (!buffer_write_framed(cl->fd, &res.buffer, cl->framing)) {
 		rv = -errno;
 		if (rv >= 0)
 			rv = -1;
@@ -3963,6 +4257,11 @@ static int str_to_op_rt(const char *req_name, int *op, int *rt)
 		*rt = 0;
 		return 0;
 	}
+	if (!strcmp(req_name, "stats")) {
+		*op = LD_OP_DUMP_STATS;
+		*rt = 0;
+		return 0;
+	}
 	if (!strcmp(req_name, "init_vg")) {
 		*op = LD_OP_INIT;
 		*rt = LD_RT_VG;
@@ -4018,7 +4317,7 @@ static int str_to_op_rt(const char *req_name, int *op, int *rt)
 		*rt = LD_RT_VG;
 		return 0;
 	}
-	if (!strcmp(req_name, "lock_lv")) {
+	if (!strcmp(req_name, "lock_lv") || !strcmp(req_name, "lock_lv_batch")) {
 		*op = LD_OP_LOCK;
 		*rt = LD_RT_LV;
 		return 0;
@@ -4292,13 +4591,15 @@ static int print_resource(struct resource *r, const char *prefix, int pos, int l
 			"type=%s "
 			"mode=%s "
 			"sh_count=%d "
-			"version=%u\n",
+			"version=%u "
+			"cached=%d\n",
 			prefix,
 			r->name,
 			rt_str(r->type),
 			mode_str(r->mode),
 			r->sh_count,
-			r->version);
+			r->version,
+			r->cached ? 1 : 0);
 }
 
 static int print_lock(struct lock *lk, const char *prefix, int pos, int len)
@@ -4419,6 +4720,246 @@ out:
 	return rv;
 }
 
+static int print_lat(char *buf, int len, const char *name, struct lat_hist *h)
+{
+	int last = LAT_BUCKETS - 1;
+	int pos, i;
+
+	while (last && !h->bucket[last])
+		last--;
+
+	pos = snprintf(buf, len, " %s_count=%llu %s_total_us=%llu %s_max_us=%llu %s_hist=",
+		       name, (unsigned long long)h->count,
+		       name, (unsigned long long)h->total_us,
+		       name, (unsigned long long)h->max_us, name);
+
+	for (i = 0; (i <= last) && (pos < len); i++)
+		pos += snprintf(buf + pos, len - pos, "%s%llu", i ? "," : "",
+				(unsigned long long)h->bucket[i]);
+
+	return pos;
+}
+
+static int print_stats(struct lock_stats *st, const char *head, int pos, int len)
+{
+	char buf[1024];
+	int bpos;
+
+	bpos = snprintf(buf, sizeof(buf),
+			"%s "
+			"locks=%llu "
+			"unlocks=%llu "
+			"cache_hits=%llu "
+			"converts=%llu "
+			"retries=%llu "
+			"conflicts=%llu "
+			"errors=%llu",
+			head,
+			(unsigned long long)st->locks,
+			(unsigned long long)st->unlocks,
+			(unsigned long long)st->cache_hits,
+			(unsigned long long)st->converts,
+			(unsigned long long)st->retries,
+			(unsigned long long)st->conflicts,
+			(unsigned long long)st->errors);
+
+	if (bpos < (int) sizeof(buf))
+		bpos += print_lat(buf + bpos, sizeof(buf) - bpos, "wait", &st->wait);
+	if (bpos < (int) sizeof(buf))
+		bpos += print_lat(buf + bpos, sizeof(buf) - bpos, "lm_lock", &st->lm_lock);
+	if (bpos < (int) sizeof(buf))
+		bpos += print_lat(buf + bpos, sizeof(buf) - bpos, "lm_unlock", &st->lm_unlock);
+
+	return snprintf(dump_buf + pos, len - pos, "%s\n", buf);
+}
+
+/*
+ * The lockspace thread adds and removes resources under ls->mutex,
+ * which is held here while walking them.  It updates the stats
+ * without locking, so a dump or a reset racing with lock requests
+ * may be off by those requests.  Resources without any lock requests
+ * in the window are skipped.
+ */
+static int dump_stats(int *dump_len, int reset)
+{
+	struct lockspace *ls;
+	struct resource *r;
+	char head[MAX_NAME * 2 + 128];
+	uint64_t now = monotime();
+	int len, pos, ret;
+	int rv = 0;
+
+	memset(dump_buf, 0, sizeof(dump_buf));
+	len = sizeof(dump_buf);
+	pos = 0;
+
+	pthread_mutex_lock(&lockspaces_mutex);
+	list_for_each_entry(ls, &lockspaces, list) {
+		snprintf(head, sizeof(head), "info=ls_stats ls_name=%s vg_name=%s lm_type=%s window_sec=%llu",
+			 ls->name, ls->vg_name, lm_str(ls->lm_type),
+			 (unsigned long long)(now - ls->stats_start));
+
+		pthread_mutex_lock(&ls->mutex);
+
+		ret = print_stats(&ls->stats, head, pos, len);
+		if (ret >= len - pos) {
+			pthread_mutex_unlock(&ls->mutex);
+			rv = -ENOSPC;
+			goto out;
+		}
+		pos += ret;
+
+		list_for_each_entry(r, &ls->resources, list) {
+			if (!r->stats.locks && !r->stats.unlocks && !r->stats.retries &&
+			    !r->stats.conflicts && !r->stats.errors)
+				continue;
+
+			snprintf(head, sizeof(head), "info=r_stats name=%s type=%s",
+				 r->name, rt_str(r->type));
+
+			ret = print_stats(&r->stats, head, pos, len);
+			if (ret >= len - pos) {
+				pthread_mutex_unlock(&ls->mutex);
+				rv = -ENOSPC;
+				goto out;
+			}
+			pos += ret;
+		}
+
+		if (reset) {
+			memset(&ls->stats, 0, sizeof(ls->stats));
+			list_for_each_entry(r, &ls->resources, list)
+				memset(&r->stats, 0, sizeof(r->stats));
+			ls->stats_start = now;
+		}
+
+		pthread_mutex_unlock(&ls->mutex);
+	}
+out:
+	pthread_mutex_unlock(&lockspaces_mutex);
+
+	*dump_len = pos;
+
+	return rv;
+}
+
+/*
+ * All the LV locks of a batch are queued for the lockspace thread
+ * together, so they are processed in one pass of its loop.
+ */
+static int add_lock_batch(struct action *batch)
+{
+	struct lockspace *ls;
+	struct action *act, *safe;
+	char ls_name[MAX_NAME+1];
+
+	memset(ls_name, 0, sizeof(ls_name));
+
+	vg_ls_name(batch->vg_name, ls_name);
+
+	pthread_mutex_lock(&lockspaces_mutex);
+	ls = find_lockspace_name(ls_name);
+	if (!ls) {
+		pthread_mutex_unlock(&lockspaces_mutex);
+		log_debug("lockspace \"%s\" not found", ls_name);
+		return -ENOLS;
+	}
+
+	if (batch->lm_type == LD_LM_NONE) {
+		batch->lm_type = ls->lm_type;
+	} else if (batch->lm_type != ls->lm_type) {
+		log_error("S %s add_lock_batch bad lm_type %d ls %d",
+			  ls_name, batch->lm_type, ls->lm_type);
+		pthread_mutex_unlock(&lockspaces_mutex);
+		return -EINVAL;
+	}
+
+	pthread_mutex_lock(&ls->mutex);
+	if (ls->thread_stop) {
+		pthread_mutex_unlock(&ls->mutex);
+		pthread_mutex_unlock(&lockspaces_mutex);
+		log_error("lockspace is stopping %s", ls_name);
+		return -ESTALE;
+	}
+
+	if (!ls->create_fail && !ls->create_done) {
+		pthread_mutex_unlock(&ls->mutex);
+		pthread_mutex_unlock(&lockspaces_mutex);
+		log_debug("lockspace is starting %s", ls_name);
+		return -ESTARTING;
+	}
+
+	list_for_each_entry_safe(act, safe, &batch->batch_acts, list) {
+		act->lm_type = batch->lm_type;
+		list_del(&act->list);
+		list_add_tail(&act->list, &ls->actions);
+	}
+	ls->thread_work = 1;
+	pthread_cond_signal(&ls->cond);
+	pthread_mutex_unlock(&ls->mutex);
+	pthread_mutex_unlock(&lockspaces_mutex);
+
+	return 0;
+}
+
+/*
+ * lock_lv_batch has the fields of lock_lv that are common to all the
+ * LVs (vg, opts), and count sets of lv_name_N, lv_uuid_N,
+ * lv_lock_args_N and mode_N.  An action is made for each LV lock,
+ * pointing back at the batch action that collects their results.
+ */
+static int make_lock_batch(request req, struct action *batch)
+{
+	struct action *act;
+	const char *str;
+	char key[32];
+	int count, i;
+
+	batch->flags |= LD_AF_BATCH;
+	INIT_LIST_HEAD(&batch->batch_acts);
+
+	count = daemon_request_int(req, "count", 0);
+	if (count <= 0 || count > LVMLOCKD_LV_BATCH_MAX)
+		return -EINVAL;
+
+	for (i = 0; i < count; i++) {
+		if (!(act = alloc_action()))
+			return -ENOMEM;
+
+		memcpy(act, batch, sizeof(struct action));
+		act->flags &= ~LD_AF_BATCH;
+		act->batch = batch;
+		act->batch_index = i;
+		INIT_LIST_HEAD(&act->batch_acts);
+		list_add_tail(&act->list, &batch->batch_acts);
+
+		snprintf(key, sizeof(key), "lv_name_%d", i);
+		str = daemon_request_str(req, key, NULL);
+		if (str && strcmp(str, "none"))
+			strncpy(act->lv_name, str, MAX_NAME);
+
+		snprintf(key, sizeof(key), "lv_uuid_%d", i);
+		str = daemon_request_str(req, key, NULL);
+		if (!str || !strcmp(str, "none"))
+			return -EINVAL;
+		strncpy(act->lv_uuid, str, MAX_NAME);
+
+		snprintf(key, sizeof(key), "lv_lock_args_%d", i);
+		str = daemon_request_str(req, key, NULL);
+		if (str && strcmp(str, "none"))
+			strncpy(act->lv_args, str, MAX_ARGS);
+
+		snprintf(key, sizeof(key), "mode_%d", i);
+		act->mode = str_to_mode(daemon_request_str(req, key, NULL));
+		if (act->mode == LD_LK_IV)
+			return -EINVAL;
+	}
+
+	batch->batch_pending = count;
+
+	return 0;
+}
+
 /* called from client_thread, cl->mutex is held */
 static void client_recv_action(struct client *cl)
 {
@@ -4433,13 +4974,15 @@ static void client_recv_action(struct client *cl)
 	int64_t val;
 	uint32_t opts = 0;
 	int result = 0;
+	int framing = DAEMON_FRAMING_NONE;
 	int cl_pid;
 	int op, rt, lm, mode;
+	int batch;
 	int rv;
 
 	buffer_init(&req.buffer);
 
-	rv = buffer_read(cl->fd, &req.buffer);
+	rv = buffer_read_framed(cl->fd, &req.buffer, cl->framing);
 	if (!rv) {
 		if (errno == ECONNRESET) {
 			log_debug("client recv %u ECONNRESET", cl->id);
@@ -4461,6 +5004,7 @@ static void client_recv_action(struct client *cl)
 	}
 
 	str = daemon_request_str(req, "request", NULL);
+	batch = str && !strcmp(str, "lock_lv_batch");
 	rv = str_to_op_rt(str, &op, &rt);
 	if (rv < 0) {
 		log_error("client recv %u bad request name \"%s\"", cl->id, str ? str : "");
@@ -4489,14 +5033,22 @@ static void client_recv_action(struct client *cl)
 			pthread_mutex_unlock(&lockspaces_mutex);
 		}
 
+		if (op == LD_OP_HELLO &&
+		    daemon_request_int(req, "framing", DAEMON_FRAMING_NONE) >= DAEMON_FRAMING_LENGTH)
+			framing = DAEMON_FRAMING_LENGTH;
+
 		buffer_init(&res.buffer);
 
 		res = daemon_reply_simple("OK",
 					  "result = " FMTd64, (int64_t) result,
 					  "protocol = %s", lvmlockd_protocol,
 					  "version = " FMTd64, (int64_t) lvmlockd_protocol_version,
+					  "framing = " FMTd64, (int64_t) framing,
+					  "lock_lv_batch = " FMTd64, (int64_t) LVMLOCKD_LV_BATCH_MAX,
 					  NULL);
-		buffer_write(cl->fd, &res.buffer);
+		/* The reply to hello still uses the old framing. */
+		buffer_write_framed(cl->fd, &res.buffer, cl->framing);
+		cl->framing = framing;
 		buffer_destroy(&res.buffer);
 		dm_config_destroy(req.cft);
 		buffer_destroy(&req.buffer);
@@ -4583,9 +5135,21 @@ static void client_recv_action(struct client *cl)
 
 	act->max_retries = daemon_request_int(req, "max_retries", DEFAULT_MAX_RETRIES);
 
+	act->recv_us = monotime_us();
+
+	if (op == LD_OP_DUMP_STATS && daemon_request_int(req, "reset", 0))
+		act->flags |= LD_AF_STATS_RESET;
+
+	rv = batch ? make_lock_batch(req, act) : 0;
+
 	dm_config_destroy(req.cft);
 	buffer_destroy(&req.buffer);
 
+	if (rv < 0) {
+		log_error("client recv %u bad lock_lv_batch %d", cl->id, rv);
+		goto out;
+	}
+
 	log_debug("recv %s[%d] cl %u %s %s \"%s\" mode %s flags %x",
 		  cl->name[0] ? cl->name : "client", cl->pid, cl->id,
 		  op_str(act->op), rt_str(act->rt), act->vg_name, mode_str(act->mode), opts);
@@ -4602,9 +5166,14 @@ static void client_recv_action(struct client *cl)
 		goto out;
 	}
 
-	if (act->op == LD_OP_LOCK && act->mode != LD_LK_UN)
+	if (act->op == LD_OP_LOCK && (act->mode != LD_LK_UN || batch))
 		cl->lock_ops = 1;
 
+	if (batch) {
+		rv = add_lock_batch(act);
+		goto out;
+	}
+
 	switch (act->op) {
 	case LD_OP_START:
 		rv = add_lockspace(act);
@@ -4614,6 +5183,7 @@ static void client_recv_action(struct client *cl)
 		break;
 	case LD_OP_DUMP_LOG:
 	case LD_OP_DUMP_INFO:
+	case LD_OP_DUMP_STATS:
 		/* The client thread reply will copy and send the dump. */
 		add_client_result(act);
 		rv = 0;
@@ -4644,16 +5214,44 @@ static void client_recv_action(struct client *cl)
 
 out:
 	if (rv < 0) {
+		/* None of the batch was queued, only op_result is sent. */
+		if (batch)
+			free_batch_acts(act);
 		act->result = rv;
 		add_client_result(act);
 	}
 }
 
+/* Release the LV locks acquired for a client that did not get the reply. */
+static void auto_unlock_lv(struct action *act)
+{
+	struct action *act_b;
+	struct action *act_un;
+
+	if (act->flags & LD_AF_BATCH) {
+		list_for_each_entry(act_b, &act->batch_acts, list)
+			auto_unlock_lv(act_b);
+		return;
+	}
+
+	if (!(act->flags & LD_AF_LV_LOCK))
+		return;
+
+	log_debug("auto unlock lv for failed client %u", act->client_id);
+	if ((act_un = alloc_action())) {
+		memcpy(act_un, act, sizeof(struct action));
+		act_un->batch = NULL;
+		act_un->mode = LD_LK_UN;
+		act_un->flags |= LD_AF_LV_UNLOCK;
+		act_un->flags &= ~LD_AF_LV_LOCK;
+		add_lock_action(act_un);
+	}
+}
+
 static void *client_thread_main(void *arg_in)
 {
 	struct client *cl;
 	struct action *act;
-	struct action *act_un;
 	int rv;
 
 	while (1) {
@@ -4691,16 +5289,8 @@ static void *client_thread_main(void *arg_in)
 			 * So the lv will not be active and we should release
 			 * the lv lock it requested.
 			 */
-			if ((rv < 0) && (act->flags & LD_AF_LV_LOCK)) {
-				log_debug("auto unlock lv for failed client %u", act->client_id);
-				if ((act_un = alloc_action())) {
-					memcpy(act_un, act, sizeof(struct action));
-					act_un->mode = LD_LK_UN;
-					act_un->flags |= LD_AF_LV_UNLOCK;
-					act_un->flags &= ~LD_AF_LV_LOCK;
-					add_lock_action(act_un);
-				}
-			}
+			if (rv < 0)
+				auto_unlock_lv(act);
 
 			free_action(act);
 			continue;
@@ -6007,6 +6597,9 @@ static void usage(char *prog, FILE *file)
 	fprintf(file, "        Set the sanlock lockspace I/O timeout.\n");
 	fprintf(file, "  --adopt | -A 0|1\n");
 	fprintf(file, "        Adopt locks from a previous instance of lvmlockd.\n");
+	fprintf(file, "  --vg-cache | -c <seconds>\n");
+	fprintf(file, "        Keep shared VG locks for seconds after they are last used\n");
+	fprintf(file, "        (at most %d).  Must be set on all hosts.\n", VG_CACHE_MAX_SECS);
 }
 
 int main(int argc, char *argv[])
@@ -6036,6 +6629,7 @@ int main(int argc, char *argv[])
 		{"adopt",           required_argument, 0, 'A' },
 		{"syslog-priority", required_argument, 0, 'S' },
 		{"sanlock-timeout", required_argument, 0, 'o' },
+		{"vg-cache",        required_argument, 0, 'c' },
 		{0, 0, 0, 0 }
 	};
 
@@ -6044,7 +6638,7 @@ int main(int argc, char *argv[])
 		int lm;
 		int option_index = 0;
 
-		c = getopt_long(argc, argv, "hVTfDp:s:l:g:S:I:A:o:",
+		c = getopt_long(argc, argv, "hVTfDp:s:l:g:S:I:A:o:c:",
 				long_options, &option_index);
 		if (c == -1)
 			break;
@@ -6097,6 +6691,13 @@ int main(int argc, char *argv[])
 		case 'A':
 			adopt_opt = atoi(optarg);
 			break;
+		case 'c':
+			vg_cache_secs = atoi(optarg);
+			if (vg_cache_secs < 0 || vg_cache_secs > VG_CACHE_MAX_SECS) {
+				fprintf(stderr, "invalid vg-cache option\n");
+				exit(EXIT_FAILURE);
+			}
+			break;
 		case 'S':
 			syslog_priority = _syslog_name_to_num(optarg);
 			break;
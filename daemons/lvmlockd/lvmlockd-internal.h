@@ -53,6 +53,8 @@ enum {
 	LD_OP_KILL_VG,
 	LD_OP_DROP_VG,
 	LD_OP_BUSY,
+	LD_OP_DUMP_STATS,
+	LD_OP_RETURN_FREE_LOCK,
 };
 
 /* resource types */
@@ -81,6 +83,7 @@ struct client {
 	int pid;
 	int fd;
 	int pi;
+	int framing; /* DAEMON_FRAMING_ agreed on in hello */
 	uint32_t id;
 	unsigned int recv : 1;
 	unsigned int dead : 1;
@@ -105,6 +108,8 @@ struct client {
 #define LD_AF_WARN_GL_REMOVED	   0x00020000
 #define LD_AF_LV_LOCK              0x00040000
 #define LD_AF_LV_UNLOCK            0x00080000
+#define LD_AF_BATCH                0x00100000
+#define LD_AF_STATS_RESET          0x00200000
 
 /*
  * Number of times to repeat a lock request after
@@ -134,6 +139,39 @@ struct action {
 	char vg_args[MAX_ARGS+1];
 	char lv_args[MAX_ARGS+1];
 	char vg_sysid[MAX_NAME+1];
+	uint64_t recv_us;		/* when the request was received */
+	struct action *batch;		/* lock_lv_batch this lock is part of */
+	int batch_index;
+	int batch_pending;		/* batch: locks without a result yet */
+	struct list_head batch_acts;	/* batch: locks with a result */
+	uint64_t free_offset;		/* return_free_lock: unused lock */
+};
+
+/*
+ * Latency histogram, bucket i counts times below 2^i usec,
+ * and the last bucket counts everything longer.
+ */
+#define LAT_BUCKETS 24
+
+struct lat_hist {
+	uint64_t count;
+	uint64_t total_us;
+	uint64_t max_us;
+	uint64_t bucket[LAT_BUCKETS];
+};
+
+/* Lock statistics kept for each lockspace and each of its resources. */
+struct lock_stats {
+	uint64_t locks;			/* lock requests granted */
+	uint64_t unlocks;
+	uint64_t cache_hits;		/* sh VG locks granted from cache */
+	uint64_t converts;
+	uint64_t retries;		/* lock requests retried after a conflict */
+	uint64_t conflicts;		/* lock requests failed by a conflict */
+	uint64_t errors;		/* other lock manager errors */
+	struct lat_hist wait;		/* request received to first lock attempt */
+	struct lat_hist lm_lock;	/* lock manager lock and convert calls */
+	struct lat_hist lm_unlock;	/* lock manager unlock calls */
 };
 
 struct resource {
@@ -148,6 +186,9 @@ struct resource {
 	unsigned int adopt : 1;		/* temp flag in remove_inactive_lvs */
 	unsigned int version_zero_valid : 1;
 	unsigned int use_vb : 1;
+	unsigned int cached : 1;	/* sh lm lock kept with no locks, see vg_cache_secs */
+	uint64_t cache_expire;		/* monotime when cached lm lock is released */
+	struct lock_stats stats;
 	struct list_head locks;
 	struct list_head actions;
 	char lv_args[MAX_ARGS+1];
@@ -193,6 +234,9 @@ struct lockspace {
 
 	struct list_head actions;	/* new client actions */
 	struct list_head resources;	/* resource/lock state for gl/vg/lv */
+
+	struct lock_stats stats;	/* totals of all resources */
+	uint64_t stats_start;		/* monotime when stats were last reset */
 };
 
 /* val_blk version */
@@ -489,6 +533,7 @@ int lm_get_lockspaces_sanlock(struct list_head *ls_rejoin);
 int lm_data_size_sanlock(void);
 int lm_is_running_sanlock(void);
 int lm_find_free_lock_sanlock(struct lockspace *ls, uint64_t *free_offset);
+void lm_return_free_lock_sanlock(struct lockspace *ls, uint64_t free_offset);
 
 static inline int lm_support_sanlock(void)
 {
@@ -595,6 +640,10 @@ static inline int lm_find_free_lock_sanlock(struct lockspace *ls, uint64_t *free
 	return -1;
 }
 
+static inline void lm_return_free_lock_sanlock(struct lockspace *ls, uint64_t free_offset)
+{
+}
+
 static inline int lm_support_sanlock(void)
 {
 	return 0;
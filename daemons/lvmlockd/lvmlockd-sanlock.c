@@ -141,6 +141,8 @@ struct lm_sanlock {
 	struct sanlk_lockspace ss;
 	int align_size;
 	int sock; /* sanlock daemon connection */
+	uint64_t *lv_map; /* lv lease slots, bit set if used, see lv_map_scan */
+	uint32_t lv_map_slots;
 };
 
 struct rd_sanlock {
@@ -208,6 +210,9 @@ int lm_data_size_sanlock(void)
 
 static uint64_t daemon_test_lv_count;
 
+/* Number of lv lease slots assumed by daemon_test (256MB lvmlock lv). */
+#define DAEMON_TEST_LV_SLOTS (256 - LV_LOCK_BEGIN)
+
 static int lock_lv_name_from_args(char *vg_args, char *lock_lv_name)
 {
 	return last_string_from_args(vg_args, lock_lv_name);
@@ -504,10 +509,10 @@ int lm_init_lv_sanlock(char *ls_name, char *vg_name, char *lv_name,
 
 	if (daemon_test) {
 		align_size = 1048576;
+		if (!free_offset)
+			free_offset = (align_size * LV_LOCK_BEGIN) + (align_size * daemon_test_lv_count++);
 		snprintf(lv_args, MAX_ARGS, "%s:%llu",
-			 lock_args_version,
-			 (unsigned long long)((align_size * LV_LOCK_BEGIN) + (align_size * daemon_test_lv_count)));
-		daemon_test_lv_count++;
+			 lock_args_version, (unsigned long long)free_offset);
 		return 0;
 	}
 
@@ -742,6 +747,175 @@ int lm_rename_vg_sanlock(char *ls_name, char *vg_name, uint32_t flags, char *vg_
 	return 0;
 }
 
+/*
+ * The map of lv lease slots is built when the lockspace is started, so
+ * that finding a free lease for lvcreate is a search of the map rather
+ * than a sanlock_read_resource of each slot in turn.  It is only used
+ * by the lockspace thread: built by add_lockspace, updated by
+ * find_free_lock and free_lv.  (lv leases are named by the lv uuid, so
+ * lv renames don't change them, and vg renames happen while the
+ * lockspace is stopped.)
+ *
+ * Other hosts allocate and free leases in the same area, so the map is
+ * only a hint: the slot chosen from it is read back before it is handed
+ * out, and the map is rebuilt from disk when it has no free slots left
+ * before reporting that the lvmlock lv needs to be extended.
+ */
+
+static void lv_map_set(struct lm_sanlock *lms, uint64_t offset, int used)
+{
+	uint64_t slot;
+
+	if (!lms || !lms->lv_map || !lms->align_size ||
+	    (offset < lms->align_size * LV_LOCK_BEGIN))
+		return;
+
+	slot = offset / lms->align_size - LV_LOCK_BEGIN;
+	if (slot >= lms->lv_map_slots)
+		return;
+
+	if (used)
+		lms->lv_map[slot / 64] |= UINT64_C(1) << (slot % 64);
+	else
+		lms->lv_map[slot / 64] &= ~(UINT64_C(1) << (slot % 64));
+}
+
+/* Returns the first free slot, or -1. */
+static int64_t lv_map_find(struct lm_sanlock *lms)
+{
+	uint32_t w, slot;
+	uint64_t bits;
+
+	for (w = 0; w < (lms->lv_map_slots + 63) / 64; w++) {
+		if (!(bits = ~lms->lv_map[w]))
+			continue;
+
+		for (slot = w * 64; slot < lms->lv_map_slots; slot++, bits >>= 1)
+			if (bits & 1)
+				return slot;
+	}
+
+	return -1;
+}
+
+static int lv_map_grow(struct lm_sanlock *lms, uint32_t slots)
+{
+	uint32_t old_words = (lms->lv_map_slots + 63) / 64;
+	uint32_t words = (slots + 63) / 64;
+	uint64_t *map;
+
+	if (words > old_words || !lms->lv_map) {
+		if (!(map = realloc(lms->lv_map, (words ? : 1) * sizeof(uint64_t))))
+			return -ENOMEM;
+		memset(map + old_words, 0, ((words ? : 1) - old_words) * sizeof(uint64_t));
+		lms->lv_map = map;
+	}
+
+	lms->lv_map_slots = slots;
+
+	return 0;
+}
+
+/*
+ * Read the name of each lv lease slot, from the given slot to the end of
+ * the lvmlock lv, and record which are used.  Slot 0 is at LV_LOCK_BEGIN.
+ * Newly extended space has no paxos leader yet (SANLK_LEADER_MAGIC) and
+ * counts as unused.
+ */
+static int lv_map_scan(struct lockspace *ls, struct lm_sanlock *lms, uint32_t first)
+{
+	struct sanlk_resourced rd;
+	uint64_t offset;
+	uint32_t slot, used = 0;
+	int rv, grv;
+
+	if (daemon_test) {
+		if (lms->lv_map)
+			return 0;
+		lms->align_size = 1048576;
+		return lv_map_grow(lms, DAEMON_TEST_LV_SLOTS);
+	}
+
+	memset(&rd, 0, sizeof(rd));
+
+	strncpy(rd.rs.lockspace_name, ls->name, SANLK_NAME_LEN);
+	rd.rs.num_disks = 1;
+	strncpy(rd.rs.disks[0].path, lms->ss.host_id_disk.path, SANLK_PATH_LEN-1);
+
+	offset = lms->align_size * (LV_LOCK_BEGIN + first);
+
+	for (slot = first; ; slot++, offset += lms->align_size) {
+		rd.rs.disks[0].offset = offset;
+
+		memset(rd.rs.name, 0, SANLK_NAME_LEN);
+
+		rv = sanlock_read_resource(&rd.rs, 0);
+		if (rv == -EMSGSIZE || rv == -ENOSPC)
+			break; /* end of the device */
+
+		if (rv && rv != SANLK_LEADER_MAGIC) {
+			log_error("S %s lv_map_scan read error %d offset %llu",
+				  ls->name, rv, (unsigned long long)offset);
+			goto fail;
+		}
+
+		if (!(slot % 64) && (grv = lv_map_grow(lms, slot + 64)) < 0) {
+			rv = grv;
+			goto fail;
+		}
+
+		if (rv != SANLK_LEADER_MAGIC && strcmp(rd.rs.name, "#unused")) {
+			lms->lv_map[slot / 64] |= UINT64_C(1) << (slot % 64);
+			used++;
+		} else
+			lms->lv_map[slot / 64] &= ~(UINT64_C(1) << (slot % 64));
+	}
+
+	if ((rv = lv_map_grow(lms, slot)) < 0)
+		goto fail;
+
+	log_debug("S %s lv_map_scan %u lv lease slots from %u, %u used",
+		  ls->name, slot, first, used);
+
+	return 0;
+
+fail:
+	/* A partial map is not used, the next find_free_lock rescans. */
+	free(lms->lv_map);
+	lms->lv_map = NULL;
+	lms->lv_map_slots = 0;
+	return rv;
+}
+
+/* Check on disk that the slot is still unused; returns 1 if so. */
+static int lv_map_check(struct lockspace *ls, struct lm_sanlock *lms, uint64_t offset)
+{
+	struct sanlk_resourced rd;
+	int rv;
+
+	if (daemon_test)
+		return 1;
+
+	memset(&rd, 0, sizeof(rd));
+
+	strncpy(rd.rs.lockspace_name, ls->name, SANLK_NAME_LEN);
+	rd.rs.num_disks = 1;
+	strncpy(rd.rs.disks[0].path, lms->ss.host_id_disk.path, SANLK_PATH_LEN-1);
+	rd.rs.disks[0].offset = offset;
+
+	rv = sanlock_read_resource(&rd.rs, 0);
+	if (rv == SANLK_LEADER_MAGIC)
+		return 1;
+
+	if (rv) {
+		log_error("S %s find_free_lock_san read error %d offset %llu",
+			  ls->name, rv, (unsigned long long)offset);
+		return rv;
+	}
+
+	return !strcmp(rd.rs.name, "#unused");
+}
+
 /* lvremove */
 int lm_free_lv_sanlock(struct lockspace *ls, struct resource *r)
 {
@@ -751,8 +925,10 @@ int lm_free_lv_sanlock(struct lockspace *ls, struct resource *r)
 
 	log_debug("S %s R %s free_lv_san", ls->name, r->name);
 
-	if (daemon_test)
+	if (daemon_test) {
+		lv_map_set(ls->lm_data, rs->disks[0].offset, 0);
 		return 0;
+	}
 
 	strcpy(rs->name, "#unused");
 
@@ -760,7 +936,8 @@ int lm_free_lv_sanlock(struct lockspace *ls, struct resource *r)
 	if (rv < 0) {
 		log_error("S %s R %s free_lv_san write error %d",
 			  ls->name, r->name, rv);
-	}
+	} else
+		lv_map_set(ls->lm_data, rs->disks[0].offset, 0);
 
 	return rv;
 }
@@ -938,92 +1115,86 @@ int lm_gl_is_enabled(struct lockspace *ls)
  * This way, lm_init_lv_san() should find a free
  * lock (unless the autoextend of lvmlock lv has
  * been disabled.)
+ *
+ * The slot returned is marked used in the map,
+ * so concurrent lvcreates are given different
+ * slots.  If init_lv then fails, the slot is
+ * given back by lm_return_free_lock_sanlock().
+ *
+ * When the map is full, only the space added by
+ * extending the lvmlock lv is scanned first, and
+ * all slots only if that found nothing.
  */
 
 int lm_find_free_lock_sanlock(struct lockspace *ls, uint64_t *free_offset)
 {
 	struct lm_sanlock *lms = (struct lm_sanlock *)ls->lm_data;
-	struct sanlk_resourced rd;
 	uint64_t offset;
-	uint64_t start_offset;
+	int64_t slot;
+	int rescanned = 0;
 	int rv;
-	int round = 0;
 
-	if (daemon_test) {
-		*free_offset = (1048576 * LV_LOCK_BEGIN) + (1048576 * (daemon_test_lv_count + 1));
-		return 0;
-	}
-
-	memset(&rd, 0, sizeof(rd));
-
-	strncpy(rd.rs.lockspace_name, ls->name, SANLK_NAME_LEN);
-	rd.rs.num_disks = 1;
-	strncpy(rd.rs.disks[0].path, lms->ss.host_id_disk.path, SANLK_PATH_LEN-1);
-
-	if (ls->free_lock_offset)
-		offset = ls->free_lock_offset;
-	else
-		offset = lms->align_size * LV_LOCK_BEGIN;
-
-	start_offset = offset;
+	if (!lms->lv_map && (rv = lv_map_scan(ls, lms, 0)) < 0)
+		return rv;
 
 	while (1) {
-		if (offset >= start_offset && round) {
-			/* This indicates the all space are allocated. */
-			log_debug("S %s init_lv_san read back to start offset %llu",
-				ls->name, (unsigned long long)offset);
-			rv = -EMSGSIZE;
-			return rv;
-		}
-
-		rd.rs.disks[0].offset = offset;
-
-		memset(rd.rs.name, 0, SANLK_NAME_LEN);
-
-		rv = sanlock_read_resource(&rd.rs, 0);
-		if (rv == -EMSGSIZE || rv == -ENOSPC) {
-			/* This indicates the end of the device is reached. */
-			log_debug("S %s find_free_lock_san read limit offset %llu",
-				  ls->name, (unsigned long long)offset);
-
-			/* remember the NO SPACE offset, if no free area left,
-			 * search from this offset after extend */
-			*free_offset = offset;
+		slot = lv_map_find(lms);
+
+		if (slot < 0) {
+			if (rescanned == 2) {
+				/*
+				 * Search from the current end of the device
+				 * after lvcreate extends the lvmlock lv.
+				 */
+				*free_offset = lms->align_size * (LV_LOCK_BEGIN + lms->lv_map_slots);
+				log_debug("S %s find_free_lock_san no unused area, end offset %llu",
+					  ls->name, (unsigned long long)*free_offset);
+				return -EMSGSIZE;
+			}
 
-			offset = lms->align_size * LV_LOCK_BEGIN;
-			round = 1;
+			if (!rescanned) {
+				/* The lvmlock lv may have been extended. */
+				if ((rv = lv_map_scan(ls, lms, lms->lv_map_slots)) < 0)
+					return rv;
+				rescanned = 1;
+			} else {
+				/* Pick up leases freed by other hosts. */
+				if ((rv = lv_map_scan(ls, lms, 0)) < 0)
+					return rv;
+				rescanned = 2;
+			}
 			continue;
 		}
 
-		/*
-		 * If we read newly extended space, it will not be initialized
-		 * with an "#unused" resource, but will return an error about
-		 * an invalid paxos structure on disk.
-		 */
-		if (rv == SANLK_LEADER_MAGIC) {
-			log_debug("S %s find_free_lock_san found empty area at %llu",
-				  ls->name, (unsigned long long)offset);
-			*free_offset = offset;
-			return 0;
-		}
+		offset = lms->align_size * (LV_LOCK_BEGIN + slot);
+		lms->lv_map[slot / 64] |= UINT64_C(1) << (slot % 64);
 
-		if (rv) {
-			log_error("S %s find_free_lock_san read error %d offset %llu",
-				  ls->name, rv, (unsigned long long)offset);
-			break;
-		}
+		rv = lv_map_check(ls, lms, offset);
+		if (rv < 0)
+			return rv;
 
-		if (!strcmp(rd.rs.name, "#unused")) {
+		if (rv) {
 			log_debug("S %s find_free_lock_san found unused area at %llu",
 				  ls->name, (unsigned long long)offset);
 			*free_offset = offset;
 			return 0;
 		}
 
-		offset += lms->align_size;
+		log_debug("S %s find_free_lock_san area at %llu used by another host",
+			  ls->name, (unsigned long long)offset);
 	}
+}
 
-	return rv;
+/*
+ * init_lv failed to use the lock given by find_free_lock,
+ * so it is free again.
+ */
+void lm_return_free_lock_sanlock(struct lockspace *ls, uint64_t free_offset)
+{
+	log_debug("S %s return_free_lock_san offset %llu",
+		  ls->name, (unsigned long long)free_offset);
+
+	lv_map_set(ls->lm_data, free_offset, 0);
 }
 
 /*
@@ -1254,6 +1425,10 @@ int lm_add_lockspace_sanlock(struct lockspace *ls, int adopt)
 	}
 
 out:
+	/* Without the map, the first find_free_lock builds it. */
+	if (lv_map_scan(ls, lms, 0) < 0)
+		log_error("S %s add_lockspace_san lv lease map not built", ls->name);
+
 	log_debug("S %s add_lockspace_san done", ls->name);
 	return 0;
 
@@ -1298,6 +1473,7 @@ int lm_rem_lockspace_sanlock(struct lockspace *ls, int free_vg)
 	if (close(lms->sock))
 		log_error("failed to close sanlock daemon socket connection");
 out:
+	free(lms->lv_map);
 	free(lms);
 	ls->lm_data = NULL;
 
@@ -46,6 +46,14 @@ struct lvmpolld_state {
 
 	struct lvmpolld_store *id_to_pdlv_abort;
 	struct lvmpolld_store *id_to_pdlv_poll;
+
+	/* LVs with progress watched in DM until lvpoll is needed */
+	pthread_t watch_tid;
+	pthread_mutex_t watch_lock;
+	pthread_cond_t watch_cond;
+	struct dm_list watched;
+	unsigned watch_running:1;
+	unsigned watch_exit:1;
 };
 
 static pthread_key_t key;
@@ -78,6 +86,9 @@ static void _usage(const char *prog, FILE *file)
 		"   -t|--timeout     Time to wait in seconds before shutdown on idle (missing or 0 = inifinite)\n\n", prog, prog);
 }
 
+static void _watch_init(struct lvmpolld_state *ls);
+static void _watch_fini(struct lvmpolld_state *ls);
+
 static int _init(struct daemon_state *s)
 {
 	struct lvmpolld_state *ls = s->private;
@@ -115,6 +126,8 @@ static int _init(struct daemon_state *s)
 	if (ls->idle)
 		ls->idle->is_idle = 1;
 
+	_watch_init(ls);
+
 	return 1;
 }
 
@@ -154,6 +167,10 @@ static int _fini(struct daemon_state *s)
 
 	DEBUGLOG(s, "fini");
 
+	DEBUGLOG(s, "stopping DM watch");
+
+	_watch_fini(ls);
+
 	DEBUGLOG(s, "sending cancel requests");
 
 	_lvmpolld_global_lock(ls);
@@ -372,6 +389,257 @@ static void debug_print(struct lvmpolld_state *ls, const char * const* ptr)
 	}
 }
 
+static void *fork_and_poll(void *args);
+
+static int spawn_detached_thread(struct lvmpolld_lv *pdlv)
+{
+	int r;
+	pthread_attr_t attr;
+
+	if (pthread_attr_init(&attr) != 0)
+		return 0;
+
+	if (pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) != 0)
+		return 0;
+
+	r = pthread_create(&pdlv->tid, &attr, fork_and_poll, (void *)pdlv);
+
+	if (pthread_attr_destroy(&attr) != 0)
+		return 0;
+
+	return !r;
+}
+
+/*
+ * DM progress watch
+ *
+ * Mirror syncs (pvmove, mirror up-convert) and snapshot merges spend nearly
+ * all their time waiting for the kernel.  Instead of an lvpoll process per
+ * LV repeatedly reading metadata, one thread checks the DM status of all
+ * watched LVs on a shared timer and starts lvpoll for an LV only once its
+ * status shows lvpoll has metadata to update, i.e. the running mirror
+ * segment is in sync or the merge is done.  Anything not understood (LV not
+ * active, failed mirror leg, unexpected target) is left to lvpoll as well.
+ * Aborts and thin merges are not watched.
+ */
+static int _watch_type(const struct lvmpolld_lv *pdlv)
+{
+	return pdlv_is_type(pdlv, PVMOVE) || pdlv_is_type(pdlv, CONVERT) ||
+	       pdlv_is_type(pdlv, MERGE);
+}
+
+/* Returns 1 if lvpoll should take over the LV. */
+static int _watch_check(struct lvmpolld_state *ls, struct dm_pool *mem,
+			struct lvmpolld_lv *pdlv)
+{
+	struct dm_task *dmt;
+	struct dm_info info;
+	struct dm_status_mirror *ms;
+	struct dm_status_snapshot *ss;
+	const char *target = pdlv_is_type(pdlv, MERGE) ? "snapshot-merge" : "mirror";
+	char *vgname, *lvname, *dmname, *target_type, *params;
+	uint64_t start, length;
+	void *next = NULL;
+	unsigned i, seen = 0, unfinished = 0, failed = 0;
+
+	if (!(vgname = dm_pool_strdup(mem, pdlv->lvname)) ||
+	    !(lvname = strchr(vgname, '/')))
+		return 1;
+
+	*lvname++ = '\0';
+
+	if (!(dmname = dm_build_dm_name(mem, vgname, lvname, NULL)) ||
+	    !(dmt = dm_task_create(DM_DEVICE_STATUS)))
+		return 1;
+
+	if (!dm_task_set_name(dmt, dmname) || !dm_task_no_open_count(dmt) ||
+	    !dm_task_run(dmt) || !dm_task_get_info(dmt, &info) || !info.exists)
+		goto out;
+
+	do {
+		next = dm_get_next_target(dmt, next, &start, &length,
+					  &target_type, &params);
+		if (!target_type || strcmp(target_type, target))
+			continue;
+
+		seen++;
+
+		if (pdlv_is_type(pdlv, MERGE)) {
+			if (!dm_get_status_snapshot(mem, params, &ss) || ss->invalid)
+				failed++;
+			else if (ss->used_sectors != ss->metadata_sectors)
+				unfinished++;
+			continue;
+		}
+
+		if (!dm_get_status_mirror(mem, params, &ms)) {
+			failed++;
+			continue;
+		}
+
+		for (i = 0; i < ms->dev_count; i++)
+			if (ms->devs[i].health != DM_STATUS_MIRROR_ALIVE)
+				failed++;
+		for (i = 0; i < ms->log_count; i++)
+			if (ms->logs[i].health != DM_STATUS_MIRROR_ALIVE)
+				failed++;
+
+		if (ms->insync_regions < ms->total_regions)
+			unfinished++;
+	} while (next);
+out:
+	dm_task_destroy(dmt);
+
+	DEBUGLOG(ls, "%s: %s %s: %s%u %s%u %s%u", PD_LOG_PREFIX, "DM watch of",
+		 pdlv->lvname, "targets=", seen, "unfinished=", unfinished,
+		 "failed=", failed);
+
+	return !seen || failed || !unfinished;
+}
+
+/* Stop watching the LV and run lvpoll. Call without watch lock. */
+static void _watch_release(struct lvmpolld_lv *pdlv)
+{
+	struct lvmpolld_state *ls = pdlv->ls;
+
+	pdst_lock(pdlv->pdst);
+
+	pdlv->watched = 0;
+
+	if (!spawn_detached_thread(pdlv)) {
+		ERROR(ls, "%s: %s", PD_LOG_PREFIX, "failed to spawn detached monitoring thread");
+		pdlv_set_error(pdlv, 1);
+		pdlv_set_polling_finished(pdlv, 1);
+		pdst_locked_dec(pdlv->pdst);
+	}
+
+	pdst_unlock(pdlv->pdst);
+
+	update_idle_state(ls);
+}
+
+static void *_watch_thread(void *args)
+{
+	struct lvmpolld_state *ls = args;
+	struct lvmpolld_lv *pdlv, *tmp;
+	struct dm_pool *mem;
+	struct timespec ts = { 0 };
+	struct dm_list due;
+	time_t now, next;
+
+	if (!(mem = dm_pool_create("lvmpolld_watch", 1024)))
+		ERROR(ls, "%s: %s", PD_LOG_PREFIX, "Failed to allocate DM watch memory");
+
+	pthread_mutex_lock(&ls->watch_lock);
+
+	while (!ls->watch_exit) {
+		now = time(NULL);
+		next = 0;
+		dm_list_init(&due);
+
+		dm_list_iterate_items_gen_safe(pdlv, tmp, &ls->watched, watch_list)
+			if (!mem || pdlv->watch_next <= now)
+				dm_list_move(&due, &pdlv->watch_list);
+			else if (!next || pdlv->watch_next < next)
+				next = pdlv->watch_next;
+
+		if (dm_list_empty(&due)) {
+			if (next) {
+				ts.tv_sec = next;
+				pthread_cond_timedwait(&ls->watch_cond, &ls->watch_lock, &ts);
+			} else
+				pthread_cond_wait(&ls->watch_cond, &ls->watch_lock);
+			continue;
+		}
+
+		pthread_mutex_unlock(&ls->watch_lock);
+
+		/* Status of all due LVs is read in one pass */
+		dm_list_iterate_items_gen_safe(pdlv, tmp, &due, watch_list) {
+			if (!mem || _watch_check(ls, mem, pdlv)) {
+				dm_list_del(&pdlv->watch_list);
+				INFO(ls, "%s: %s %s", PD_LOG_PREFIX,
+				     "Starting lvpoll for", pdlv->lvname);
+				_watch_release(pdlv);
+			} else
+				pdlv->watch_next = time(NULL) + pdlv->watch_interval;
+			if (mem)
+				dm_pool_empty(mem);
+		}
+
+		pthread_mutex_lock(&ls->watch_lock);
+		dm_list_splice(&ls->watched, &due);
+	}
+
+	pthread_mutex_unlock(&ls->watch_lock);
+
+	if (mem)
+		dm_pool_destroy(mem);
+
+	return NULL;
+}
+
+/* Returns 0 if the LV is not watched and needs lvpoll right away. */
+static int _watch_add(struct lvmpolld_state *ls, struct lvmpolld_lv *pdlv,
+		      unsigned abort_polling, unsigned uinterval)
+{
+	if (!ls->watch_running || abort_polling || !_watch_type(pdlv))
+		return 0;
+
+	pdlv->watched = 1;
+	pdlv->watch_interval = uinterval ? : 1;
+	pdlv->watch_next = 0; /* first check now */
+
+	pthread_mutex_lock(&ls->watch_lock);
+	dm_list_add(&ls->watched, &pdlv->watch_list);
+	pthread_cond_signal(&ls->watch_cond);
+	pthread_mutex_unlock(&ls->watch_lock);
+
+	return 1;
+}
+
+static void _watch_init(struct lvmpolld_state *ls)
+{
+	dm_list_init(&ls->watched);
+
+	if (pthread_mutex_init(&ls->watch_lock, NULL) ||
+	    pthread_cond_init(&ls->watch_cond, NULL) ||
+	    pthread_create(&ls->watch_tid, NULL, _watch_thread, ls)) {
+		WARN(ls, "%s: %s", PD_LOG_PREFIX, "Failed to start DM watch, running lvpoll for each LV");
+		return;
+	}
+
+	ls->watch_running = 1;
+}
+
+/* Watched LVs are dropped as if their lvpoll got cancelled. */
+static void _watch_fini(struct lvmpolld_state *ls)
+{
+	struct lvmpolld_lv *pdlv;
+
+	if (!ls->watch_running)
+		return;
+
+	pthread_mutex_lock(&ls->watch_lock);
+	ls->watch_exit = 1;
+	pthread_cond_signal(&ls->watch_cond);
+	pthread_mutex_unlock(&ls->watch_lock);
+
+	pthread_join(ls->watch_tid, NULL);
+	ls->watch_running = 0;
+
+	dm_list_iterate_items_gen(pdlv, &ls->watched, watch_list) {
+		pdst_lock(pdlv->pdst);
+		pdlv->watched = 0;
+		pdlv_set_polling_finished(pdlv, 1);
+		pdst_locked_dec(pdlv->pdst);
+		pdst_unlock(pdlv->pdst);
+	}
+
+	pthread_cond_destroy(&ls->watch_cond);
+	pthread_mutex_destroy(&ls->watch_lock);
+}
+
 static void *fork_and_poll(void *args)
 {
 	int outfd, errfd, state;
@@ -590,25 +858,6 @@ static struct lvmpolld_lv *construct_pdlv(request req, struct lvmpolld_state *ls
 	return pdlv;
 }
 
-static int spawn_detached_thread(struct lvmpolld_lv *pdlv)
-{
-	int r;
-	pthread_attr_t attr;
-
-	if (pthread_attr_init(&attr) != 0)
-		return 0;
-
-	if (pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) != 0)
-		return 0;
-
-	r = pthread_create(&pdlv->tid, &attr, fork_and_poll, (void *)pdlv);
-
-	if (pthread_attr_destroy(&attr) != 0)
-		return 0;
-
-	return !r;
-}
-
 static response poll_init(client_handle h, struct lvmpolld_state *ls, request req, enum poll_type type)
 {
 	char *id;
@@ -693,7 +942,8 @@ static response poll_init(client_handle h, struct lvmpolld_state *ls, request re
 			dm_free(id);
 			return reply(LVMPD_RESP_FAILED, REASON_ENOMEM);
 		}
-		if (!spawn_detached_thread(pdlv)) {
+		if (!_watch_add(ls, pdlv, abort_polling, uinterval) &&
+		    !spawn_detached_thread(pdlv)) {
 			ERROR(ls, "%s: %s", PD_LOG_PREFIX, "failed to spawn detached monitoring thread");
 			pdst_locked_remove(pdst, id);
 			pdlv_destroy(pdlv);
@@ -266,6 +266,8 @@ static void _pdlv_locked_dump(struct buffer *buff, const struct lvmpolld_lv *pdl
 		buffer_append(buff, tmp);
 	if (dm_snprintf(tmp, sizeof(tmp), "\t\tlvm_command_pid=%d\n", pdlv->cmd_pid) > 0)
 		buffer_append(buff, tmp);
+	if (dm_snprintf(tmp, sizeof(tmp), "\t\twatched_in_dm=%d\n", pdlv->watched) > 0)
+		buffer_append(buff, tmp);
 	if (dm_snprintf(tmp, sizeof(tmp), "\t\tpolling_finished=%d\n", pdlv->polling_finished) > 0)
 		buffer_append(buff, tmp);
 	if (dm_snprintf(tmp, sizeof(tmp), "\t\terror_occured=%d\n", pdlv->error) > 0)
@@ -306,7 +308,7 @@ void pdst_locked_send_cancel(const struct lvmpolld_store *pdst)
 
 	dm_hash_iterate(n, pdst->store) {
 		pdlv = dm_hash_get_data(pdst->store, n);
-		if (!pdlv_locked_polling_finished(pdlv))
+		if (!pdlv->watched && !pdlv_locked_polling_finished(pdlv))
 			pthread_cancel(pdlv->tid);
 	}
 }
@@ -16,6 +16,7 @@
 #define _LVM_LVMPOLLD_DATA_UTILS_H
 
 #include <pthread.h>
+#include <time.h>
 
 struct buffer;
 struct lvmpolld_state;
@@ -61,6 +62,12 @@ struct lvmpolld_lv {
 	pid_t cmd_pid;
 	pthread_t tid;
 
+	/* progress watched in DM before lvpoll is run, see lvmpolld-core.c */
+	struct dm_list watch_list;
+	time_t watch_next;
+	unsigned watch_interval; /* in seconds */
+	unsigned watched:1; /* no lvpoll thread yet, store lock */
+
 	pthread_mutex_t lock;
 
 	/* block of shared variables protected by lock */
@@ -28,10 +28,12 @@
 #include "config.h"
 #include "segtype.h"
 #include "sharedlib.h"
+#include "defaults.h"
 
 #include <limits.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <time.h>
 
 #define _skip(fmt, args...) log_very_verbose("Skipping: " fmt , ## args)
 
@@ -315,6 +317,10 @@ int lv_thin_device_id(const struct logical_volume *lv, uint32_t *device_id)
 {
 	return 0;
 }
+int lv_thin_pool_time_to_full(const struct logical_volume *lv, uint64_t *seconds)
+{
+	return 0;
+}
 int lvs_in_vg_activated(const struct volume_group *vg)
 {
 	return 0;
@@ -356,6 +362,15 @@ int lv_activate_with_filter(struct cmd_context *cmd, const char *lvid_s, int exc
 {
 	return 1;
 }
+int lvs_activate(struct cmd_context *cmd, struct dm_list *lvs, int exclusive,
+		 struct dm_list *failed)
+{
+	return 1;
+}
+int lvs_deactivate(struct cmd_context *cmd, struct dm_list *lvs)
+{
+	return 1;
+}
 int lv_mknodes(struct cmd_context *cmd, const struct logical_volume *lv)
 {
 	return 1;
@@ -419,6 +434,14 @@ int monitor_dev_for_events(struct cmd_context *cmd, const struct logical_volume
 {
 	return 1;
 }
+int monitor_dev_for_events_batch(struct cmd_context *cmd, int unmonitor)
+{
+	return 1;
+}
+int monitor_dev_for_events_flush(struct cmd_context *cmd)
+{
+	return 1;
+}
 /* fs.c */
 void fs_unlock(void)
 {
@@ -1358,6 +1381,59 @@ int lv_thin_device_id(const struct logical_volume *lv, uint32_t *device_id)
 	return r;
 }
 
+/* dmeventd refreshes its projection every 10 seconds */
+#define THIN_FILL_STALE_SECONDS 30
+
+/*
+ * Returns 1 and sets seconds when dmeventd projects the monitored thin pool
+ * runs out of data or metadata space, else 0 (not monitored, not filling).
+ */
+int lv_thin_pool_time_to_full(const struct logical_volume *lv, uint64_t *seconds)
+{
+	char path[PATH_MAX];
+	const char *uuid;
+	int64_t sampled, data_ttf, metadata_ttf, ttf, now;
+	FILE *fp;
+	int r;
+
+	if (!(uuid = build_dm_uuid(lv->vg->cmd->mem, lv, "tpool")))
+		return_0;
+
+	if (dm_snprintf(path, sizeof(path), DEFAULT_THIN_FILL_DIR "/%s", uuid) < 0)
+		return_0;
+
+	if (!(fp = fopen(path, "r")))
+		return 0;
+
+	r = (fscanf(fp, FMTd64 " " FMTd64 " " FMTd64,
+		    &sampled, &data_ttf, &metadata_ttf) == 3);
+
+	if (fclose(fp))
+		log_sys_debug("fclose", path);
+
+	if (!r)
+		return 0;
+
+	now = (int64_t) time(NULL);
+	if ((sampled > now) || (now - sampled > THIN_FILL_STALE_SECONDS))
+		return 0; /* dmeventd no longer updates it */
+
+	if (data_ttf < 0)
+		ttf = metadata_ttf;
+	else if (metadata_ttf < 0 || data_ttf < metadata_ttf)
+		ttf = data_ttf;
+	else
+		ttf = metadata_ttf;
+
+	if (ttf < 0)
+		return 0; /* Not filling */
+
+	ttf -= now - sampled;
+	*seconds = (ttf > 0) ? (uint64_t) ttf : 0;
+
+	return 1;
+}
+
 static int _lv_active(struct cmd_context *cmd, const struct logical_volume *lv)
 {
 	struct lvinfo info;
@@ -1436,6 +1512,106 @@ static int _lv_deactivate(const struct logical_volume *lv)
 	return r;
 }
 
+/*
+ * Suspend windows reported by libdevmapper for the optional trace.
+ * Records are written only outside of critical section, as the trace
+ * file may be placed on a device which is still suspended.
+ */
+struct suspend_trace {
+	struct dm_list list;
+	time_t time;
+	uint32_t major;
+	uint32_t minor;
+	uint64_t suspended_ns;
+	char name[0];
+};
+
+static DM_LIST_INIT(_suspend_traces);
+
+static void _suspend_time(const char *name, uint32_t major, uint32_t minor,
+			  uint64_t suspended_ns, void *data)
+{
+	struct cmd_context *cmd = data;
+	struct suspend_trace *st;
+
+	log_verbose("Device %s (" FMTu32 ":" FMTu32 ") was suspended for "
+		    FMTu64 ".%03u ms.", name, major, minor, suspended_ns / 1000000,
+		    (unsigned) ((suspended_ns / 1000) % 1000));
+
+	if (!find_config_tree_str(cmd, activation_suspend_trace_file_CFG, NULL))
+		return;
+
+	if (!(st = dm_malloc(sizeof(*st) + strlen(name) + 1))) {
+		log_debug_activation("Cannot trace suspend of %s.", name);
+		return;
+	}
+
+	st->time = time(NULL);
+	st->major = major;
+	st->minor = minor;
+	st->suspended_ns = suspended_ns;
+	strcpy(st->name, name);
+	dm_list_add(&_suspend_traces, &st->list);
+}
+
+/* Quote and escape a string for the JSON trace */
+static void _fprint_json_string(FILE *fp, const char *str)
+{
+	fputc('"', fp);
+
+	for (; *str; str++)
+		if ((*str == '"') || (*str == '\\'))
+			fprintf(fp, "\\%c", *str);
+		else if ((unsigned char) *str < 0x20)
+			fprintf(fp, "\\u%04x", (unsigned char) *str);
+		else
+			fputc(*str, fp);
+
+	fputc('"', fp);
+}
+
+/*
+ * Append JSON line for each recorded suspend window to the trace file.
+ * Without cmd the records are just dropped.  Once nothing is suspended
+ * the libdm callback, which holds cmd, is unregistered as well.
+ */
+static void _write_suspend_trace(struct cmd_context *cmd)
+{
+	struct suspend_trace *st, *tmp;
+	const char *file = NULL;
+	FILE *fp = NULL;
+
+	if (critical_section())
+		return;
+
+	/* Everything is resumed, libdm must not keep using cmd. */
+	dm_set_suspend_time_fn(NULL, NULL);
+
+	if (dm_list_empty(&_suspend_traces))
+		return;
+
+	if (cmd && (file = find_config_tree_str(cmd, activation_suspend_trace_file_CFG, NULL)) &&
+	    !(fp = fopen(file, "a")))
+		log_sys_debug("fopen", file);
+
+	dm_list_iterate_items_safe(st, tmp, &_suspend_traces) {
+		if (fp) {
+			fprintf(fp, "{\"time\":%lld,\"command\":", (long long) st->time);
+			_fprint_json_string(fp, cmd->name ? : "");
+			fprintf(fp, ",\"pid\":%d,\"device\":", (int) getpid());
+			_fprint_json_string(fp, st->name);
+			fprintf(fp, ",\"major\":" FMTu32 ",\"minor\":" FMTu32 ","
+				"\"suspended_us\":" FMTu64 "}\n",
+				st->major, st->minor, st->suspended_ns / 1000);
+		}
+		dm_list_del(&st->list);
+		dm_free(st);
+	}
+
+	if (fp && fclose(fp))
+		log_sys_debug("fclose", file);
+}
+
 static int _lv_suspend_lv(const struct logical_volume *lv, struct lv_activate_opts *laopts,
 			  int lockfs, int flush_required)
 {
@@ -1444,6 +1620,9 @@ static int _lv_suspend_lv(const struct logical_volume *lv, struct lv_activate_op
 
 	laopts->read_only = _passes_readonly_filter(lv->vg->cmd, lv);
 
+	/* Measure time until the devices are resumed again */
+	dm_set_suspend_time_fn(_suspend_time, lv->vg->cmd);
+
 	/*
 	 * When we are asked to manipulate (normally suspend/resume) the PVMOVE
 	 * device directly, we don't want to touch the devices that use it.
@@ -1775,6 +1954,12 @@ int target_registered_with_dmeventd(struct cmd_context *cmd, const char *dso,
 	return evmask;
 }
 
+/* Is the (un)registration queued for monitor_dev_for_events_flush()? */
+static int _monitor_batched(struct cmd_context *cmd, int set)
+{
+	return cmd->monitor_batch && (set || cmd->monitor_batch_unmonitor);
+}
+
 int target_register_events(struct cmd_context *cmd, const char *dso, const struct logical_volume *lv,
 			    int evmask __attribute__((unused)), int set, int timeout)
 {
@@ -1793,6 +1978,19 @@ int target_register_events(struct cmd_context *cmd, const char *dso, const struc
 					       DM_EVENT_ALL_ERRORS | (timeout ? DM_EVENT_TIMEOUT : 0))))
 		return_0;
 
+	if (_monitor_batched(cmd, set)) {
+		r = dm_event_batch_add(cmd->monitor_batch, dmevh, set);
+		dm_event_handler_destroy(dmevh);
+		if (!r)
+			return_0;
+		log_very_verbose("Queued %s for %smonitoring events", uuid, set ? "" : "un");
+		return 1;
+	}
+
+	/* Unregistration must not overtake registrations queued before. */
+	if (cmd->monitor_batch && !dm_event_batch_submit(cmd->monitor_batch))
+		cmd->monitor_batch_failed = 1;
+
 	r = set ? dm_event_register_handler(dmevh) : dm_event_unregister_handler(dmevh);
 
 	dm_event_handler_destroy(dmevh);
@@ -1807,6 +2005,39 @@ int target_register_events(struct cmd_context *cmd, const char *dso, const struc
 
 #endif
 
+int monitor_dev_for_events_batch(struct cmd_context *cmd, int unmonitor)
+{
+#ifdef DMEVENTD
+	if (!cmd->monitor_batch && !(cmd->monitor_batch = dm_event_batch_create()))
+		return_0;
+
+	cmd->monitor_batch_unmonitor = unmonitor ? 1 : 0;
+#endif
+	return 1;
+}
+
+int monitor_dev_for_events_flush(struct cmd_context *cmd)
+{
+	int r = 1;
+#ifdef DMEVENTD
+	if (!cmd->monitor_batch)
+		return 1;
+
+	if (dm_event_batch_get_count(cmd->monitor_batch))
+		log_verbose("Submitting %u dmeventd registrations.",
+			    dm_event_batch_get_count(cmd->monitor_batch));
+
+	if (!dm_event_batch_submit(cmd->monitor_batch) || cmd->monitor_batch_failed)
+		r = 0;
+
+	dm_event_batch_destroy(cmd->monitor_batch);
+	cmd->monitor_batch = NULL;
+	cmd->monitor_batch_unmonitor = 0;
+	cmd->monitor_batch_failed = 0;
+#endif
+	return r;
+}
+
 /*
  * Returns 0 if an attempt to (un)monitor the device failed.
  * Returns 1 otherwise.
@@ -2014,6 +2245,10 @@ int monitor_dev_for_events(struct cmd_context *cmd, const struct logical_volume
 		} else
 			continue;
 
+		/* Results of a batch are only known after it is flushed. */
+		if (_monitor_batched(cmd, monitor))
+			continue;
+
 		/* Check [un]monitor results */
 		/* Try a couple times if pending, but not forever... */
 		for (i = 0;; i++) {
@@ -2223,14 +2458,14 @@ static int _lv_suspend(struct cmd_context *cmd, const char *lvid_s,
 	if (laopts->origin_only && lv_is_thin_volume(lv) && lv_is_thin_volume(lv_pre))
 		lockfs = 1;
 
-	critical_section_inc(cmd, "suspending");
-
 	if (!lv_is_locked(lv) && lv_is_locked(lv_pre) &&
 	    (pvmove_lv = find_pvmove_lv_in_lv(lv_pre))) {
 		/*
 		 * When starting PVMOVE, suspend participating LVs first
 		 * with committed metadata by looking at precommited pvmove list.
 		 * In committed metadata these LVs are not connected in any way.
+		 * The list is prepared before entering the critical section
+		 * so the devices stay suspended no longer than necessary.
 		 *
 		 * TODO: prepare list of LVs needed to be suspended and pass them
 		 *       via 'struct laopts' directly to _lv_suspend_lv() and handle this
@@ -2266,6 +2501,11 @@ static int _lv_suspend(struct cmd_context *cmd, const char *lvid_s,
 			}
 			dm_list_add(&suspend_lvs, &lvl->list);
 		}
+	}
+
+	critical_section_inc(cmd, "suspending");
+
+	if (mem) {
 		dm_list_iterate_items(lvl, &suspend_lvs)
 			if (!_lv_suspend_lv(lvl->lv, laopts, lockfs, 1)) {
 				critical_section_dec(cmd, "failed suspend");
@@ -2392,6 +2632,8 @@ needs_resume:
 
 	critical_section_dec(cmd, "resumed");
 
+	_write_suspend_trace(cmd);
+
 	if (!monitor_dev_for_events(cmd, lv, laopts, 1))
 		stack;
 
@@ -2560,6 +2802,34 @@ out:
 	return r;
 }
 
+/* Refuse activation of partial LVs or LVs with unknown segments */
+static int _lv_activation_allowed(const struct logical_volume *lv)
+{
+	if ((!lv->vg->cmd->partial_activation) && lv_is_partial(lv)) {
+		if (!lv_is_raid_type(lv) || !partial_raid_lv_supports_degraded_activation(lv)) {
+			log_error("Refusing activation of partial LV %s.  "
+				  "Use '--activationmode partial' to override.",
+				  display_lvname(lv));
+			return 0;
+		}
+
+		if (!lv->vg->cmd->degraded_activation) {
+			log_error("Refusing activation of partial LV %s.  "
+				  "Try '--activationmode degraded'.",
+				  display_lvname(lv));
+			return 0;
+		}
+	}
+
+	if (lv_has_unknown_segments(lv)) {
+		log_error("Refusing activation of LV %s containing "
+			  "an unrecognised segment.", display_lvname(lv));
+		return 0;
+	}
+
+	return 1;
+}
+
 static int _lv_activate(struct cmd_context *cmd, const char *lvid_s,
 			struct lv_activate_opts *laopts, int filter,
 	                const struct logical_volume *lv)
@@ -2590,27 +2860,8 @@ static int _lv_activate(struct cmd_context *cmd, const char *lvid_s,
 		goto out;
 	}
 
-	if ((!lv->vg->cmd->partial_activation) && lv_is_partial(lv)) {
-		if (!lv_is_raid_type(lv) || !partial_raid_lv_supports_degraded_activation(lv)) {
-			log_error("Refusing activation of partial LV %s.  "
-				  "Use '--activationmode partial' to override.",
-				  display_lvname(lv));
-			goto out;
-		}
-
-		if (!lv->vg->cmd->degraded_activation) {
-			log_error("Refusing activation of partial LV %s.  "
-				  "Try '--activationmode degraded'.",
-				  display_lvname(lv));
-			goto out;
-		}
-	}
-
-	if (lv_has_unknown_segments(lv)) {
-		log_error("Refusing activation of LV %s containing "
-			  "an unrecognised segment.", display_lvname(lv));
-		goto out;
-	}
+	if (!_lv_activation_allowed(lv))
+		goto_out;
 
 	/*
 	 * Check if cmirrord is running for clustered mirrors.
@@ -2695,6 +2946,253 @@ int lv_activate_with_filter(struct cmd_context *cmd, const char *lvid_s, int exc
 	return 1;
 }
 
+/* Remember an LV lvs_activate() could not activate */
+static int _lvs_activate_failed(struct cmd_context *cmd, struct dm_list *failed,
+				struct logical_volume *lv)
+{
+	struct lv_list *lvl;
+
+	if (!(lvl = dm_pool_alloc(cmd->mem, sizeof(*lvl)))) {
+		log_error("Failed to allocate failed activation list.");
+		return 0;
+	}
+
+	lvl->lv = lv;
+	dm_list_add(failed, &lvl->list);
+
+	return 1;
+}
+
+/*
+ * Activate all LVs from the list (struct lv_list) of one VG with a single
+ * dependency tree.  Each LV passes the same checks and filters as with
+ * lv_activate_with_filter().  LVs failing them are reported, skipped and
+ * added to the failed list, so the caller does not retry them; the
+ * remaining LVs are still activated.  Returns 0 when activating the
+ * tree failed.
+ * Only local activation is performed, the caller is responsible for locking.
+ */
+int lvs_activate(struct cmd_context *cmd, struct dm_list *lvs, int exclusive,
+		 struct dm_list *failed)
+{
+	struct dm_pool *mem;
+	struct dm_list items;
+	struct lv_activate_item *item;
+	struct lv_list *lvl;
+	const struct logical_volume *lv;
+	struct dev_manager *dm;
+	struct lvinfo info;
+	const char *vg_name = NULL;
+	int activated = 1;
+	int r = 1;
+
+	if (!activation() || dm_list_empty(lvs))
+		return 1;
+
+	if (!(mem = dm_pool_create("lvs_activate", 1024)))
+		return_0;
+
+	dm_list_init(&items);
+
+	dm_list_iterate_items(lvl, lvs) {
+		if (!(lv = lv_committed(lvl->lv))) {
+			if (!_lvs_activate_failed(cmd, failed, lvl->lv))
+				r = 0;
+			continue;
+		}
+		vg_name = lv->vg->name;
+
+		if (!_passes_activation_filter(cmd, lv)) {
+			log_verbose("Not activating %s since it does not pass "
+				    "activation filter.", display_lvname(lv));
+			continue;
+		}
+
+		if (!_lv_activation_allowed(lv)) {
+			if (!_lvs_activate_failed(cmd, failed, lvl->lv))
+				r = 0;
+			continue;
+		}
+
+		if (test_mode()) {
+			_skip("Activating %s.", display_lvname(lv));
+			continue;
+		}
+
+		if (!(item = dm_pool_zalloc(mem, sizeof(*item)))) {
+			log_error("Failed to allocate activation item.");
+			r = 0;
+			goto out;
+		}
+
+		item->lv = lv;
+		item->laopts.exclusive = exclusive || lv_is_origin(lv) ||
+			seg_only_exclusive(first_seg(lv));
+		item->laopts.read_only = _passes_readonly_filter(cmd, lv);
+
+		if (!lv_info(cmd, lv, 0, &info, 0, 0)) {
+			if (!_lvs_activate_failed(cmd, failed, lvl->lv))
+				r = 0;
+			continue;
+		}
+
+		if (info.exists && !info.suspended && info.live_table &&
+		    (info.read_only == read_only_lv(lv, &item->laopts))) {
+			log_debug_activation("LV %s is already active.", display_lvname(lv));
+			continue;
+		}
+
+		log_debug_activation("Activating %s%s%s in bulk.", display_lvname(lv),
+				     item->laopts.exclusive ? " exclusively" : "",
+				     item->laopts.read_only ? " read-only" : "");
+
+		lv_calculate_readahead(lv, NULL);
+		dm_list_add(&items, &item->list);
+	}
+
+	if (dm_list_empty(&items))
+		goto out;
+
+	critical_section_inc(cmd, "activating");
+	if (!(dm = dev_manager_create(cmd, vg_name, 1)))
+		activated = 0;
+	else {
+		if (!dev_manager_activate_lvs(dm, &items)) {
+			stack;
+			activated = 0;
+		}
+		dev_manager_destroy(dm);
+	}
+	critical_section_dec(cmd, "activated");
+
+	/* Monitor what the tree activated, whatever happened to the other LVs. */
+	if (!activated)
+		r = 0;
+	else
+		dm_list_iterate_items(item, &items)
+			if (!monitor_dev_for_events(cmd, item->lv, &item->laopts, 1))
+				stack;
+out:
+	dm_pool_destroy(mem);
+
+	return r;
+}
+
+/*
+ * Deactivate all LVs from the list (struct lv_list) of one VG with
+ * a single dependency tree.  Returns 0 without deactivating anything
+ * when any of the LVs is in use.
+ */
+int lvs_deactivate(struct cmd_context *cmd, struct dm_list *lvs)
+{
+	static const struct lv_activate_opts laopts = { .skip_in_use = 1 };
+	struct dm_pool *mem;
+	struct dm_list items;
+	struct lv_activate_item *item;
+	struct lv_list *lvl;
+	const struct logical_volume *lv;
+	struct dev_manager *dm;
+	struct lvinfo info;
+	const char *vg_name = NULL;
+	int r = 1;
+
+	if (!activation() || dm_list_empty(lvs))
+		return 1;
+
+	if (!(mem = dm_pool_create("lvs_deactivate", 1024)))
+		return_0;
+
+	dm_list_init(&items);
+
+	dm_list_iterate_items(lvl, lvs) {
+		if (!(lv = lv_committed(lvl->lv))) {
+			r = 0;
+			goto out;
+		}
+		vg_name = lv->vg->name;
+
+		if (test_mode()) {
+			_skip("Deactivating %s.", display_lvname(lv));
+			continue;
+		}
+
+		if (!lv_info(cmd, lv, 0, &info, 0, 0)) {
+			r = 0;
+			goto out;
+		}
+
+		/* Inactive origin may still have its snapshots left in table */
+		if (!info.exists && dm_list_empty(&lv->snapshot_segs))
+			continue;
+
+		if (lv_is_visible(lv) || lv_is_virtual_origin(lv) ||
+		    lv_is_merging_thin_snapshot(lv)) {
+			if (!lv_check_not_in_use(lv, 1)) {
+				r = 0;
+				goto out;
+			}
+
+			if (lv_is_origin(lv) && _lv_has_open_snapshots(lv)) {
+				r = 0;
+				goto out;
+			}
+		}
+
+		if (!(item = dm_pool_zalloc(mem, sizeof(*item)))) {
+			log_error("Failed to allocate deactivation item.");
+			r = 0;
+			goto out;
+		}
+
+		item->lv = lv;
+		item->laopts = laopts;
+		dm_list_add(&items, &item->list);
+	}
+
+	if (dm_list_empty(&items))
+		goto out;
+
+	dm_list_iterate_items(item, &items)
+		if (!monitor_dev_for_events(cmd, item->lv, &laopts, 0))
+			stack;
+
+	critical_section_inc(cmd, "deactivating");
+	if (!(dm = dev_manager_create(cmd, vg_name, 1)))
+		r = 0;
+	else {
+		if (!dev_manager_deactivate_lvs(dm, &items)) {
+			stack;
+			r = 0;
+		}
+		dev_manager_destroy(dm);
+	}
+
+	/*
+	 * Remove any transiently activated error
+	 * devices which arean't used any more.
+	 */
+	if (r)
+		dm_list_iterate_items(item, &items)
+			if (lv_is_raid(item->lv) &&
+			    !lv_deactivate_any_missing_subdevs(item->lv)) {
+				log_error("Failed to remove temporary SubLVs from %s",
+					  display_lvname(item->lv));
+				r = 0;
+			}
+	critical_section_dec(cmd, "deactivated");
+
+	dm_list_iterate_items(item, &items)
+		if (!lv_info(cmd, item->lv, 0, &info, 0, 0) || info.exists) {
+			log_debug_activation("Deactivated volume is still %s present.",
+					     display_lvname(item->lv));
+			r = 0;
+		}
+out:
+	dm_pool_destroy(mem);
+
+	return r;
+}
+
 int lv_mknodes(struct cmd_context *cmd, const struct logical_volume *lv)
 {
 	int r;
@@ -2806,11 +3304,15 @@ void activation_release(void)
 		/* May leak stacked operation */
 		log_error("Releasing activation in critical section.");
 
+	_write_suspend_trace(NULL);
+
 	fs_unlock(); /* Implicit dev_manager_release(); */
 }
 
 void activation_exit(void)
 {
+	/* Even a leaked suspend must not report to a destroyed cmd. */
+	dm_set_suspend_time_fn(NULL, NULL);
 	activation_release();
 	dev_manager_exit();
 }
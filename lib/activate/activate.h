@@ -85,6 +85,13 @@ struct lv_activate_opts {
 	unsigned resuming;	/* Set when resuming after a suspend. */
 };
 
+/* Entry of the list passed to dev_manager_(de)activate_lvs() */
+struct lv_activate_item {
+	struct dm_list list;
+	const struct logical_volume *lv;
+	struct lv_activate_opts laopts;
+};
+
 void set_activation(int activation, int silent);
 int activation(void);
 
@@ -122,6 +129,15 @@ int lv_activate_with_filter(struct cmd_context *cmd, const char *lvid_s, int exc
 			    int noscan, int temporary, const struct logical_volume *lv);
 int lv_deactivate(struct cmd_context *cmd, const char *lvid_s, const struct logical_volume *lv);
 
+/*
+ * Bulk (de)activation of a list (struct lv_list) of LVs from one VG
+ * using a single dependency tree.  LVs that lvs_activate() could not
+ * even try to activate are added to the failed list.
+ */
+int lvs_activate(struct cmd_context *cmd, struct dm_list *lvs, int exclusive,
+		 struct dm_list *failed);
+int lvs_deactivate(struct cmd_context *cmd, struct dm_list *lvs);
+
 int lv_mknodes(struct cmd_context *cmd, const struct logical_volume *lv);
 
 int lv_deactivate_any_missing_subdevs(const struct logical_volume *lv);
@@ -183,6 +199,7 @@ int lv_thin_percent(const struct logical_volume *lv, int mapped,
 int lv_thin_pool_transaction_id(const struct logical_volume *lv,
 				uint64_t *transaction_id);
 int lv_thin_device_id(const struct logical_volume *lv, uint32_t *device_id);
+int lv_thin_pool_time_to_full(const struct logical_volume *lv, uint64_t *seconds);
 
 /*
  * Return number of LVs in the VG that are active.
@@ -204,6 +221,15 @@ int lv_has_target_type(struct dm_pool *mem, const struct logical_volume *lv,
 int monitor_dev_for_events(struct cmd_context *cmd, const struct logical_volume *lv,
 			   const struct lv_activate_opts *laopts, int monitor);
 
+/*
+ * Queue the dmeventd registrations of following monitor_dev_for_events()
+ * calls and submit them together with monitor_dev_for_events_flush().
+ * Unregistrations are queued too with unmonitor set, which is only safe
+ * when no device gets deactivated before the flush.
+ */
+int monitor_dev_for_events_batch(struct cmd_context *cmd, int unmonitor);
+int monitor_dev_for_events_flush(struct cmd_context *cmd);
+
 #ifdef DMEVENTD
 #  include "libdevmapper-event.h"
 char *get_monitor_dso_path(struct cmd_context *cmd, const char *libpath);
@@ -26,6 +26,7 @@
 #include "activate.h"
 #include "lvm-exec.h"
 #include "str_list.h"
+#include "memlock.h"
 
 #include <limits.h>
 #include <dirent.h>
@@ -3064,6 +3065,7 @@ static int _tree_action(struct dev_manager *dm, const struct logical_volume *lv,
 	struct dm_tree *dtree;
 	struct dm_tree_node *root;
 	char *dlid;
+	int jobs;
 	int r = 0;
 
 	if (action < DM_ARRAY_SIZE(_action_names))
@@ -3128,6 +3130,11 @@ static int _tree_action(struct dev_manager *dm, const struct logical_volume *lv,
 		break;
 	case PRELOAD:
 	case ACTIVATE:
+		/* Threads are not started with devices suspended */
+		if (!critical_section() &&
+		    ((jobs = find_config_tree_int(dm->cmd, activation_parallel_activation_jobs_CFG, NULL)) > 1))
+			dm_tree_set_parallel_jobs(root, (unsigned) jobs);
+
 		/* Add all required new devices to tree */
 		if (!_add_new_lv_to_dtree(dm, dtree, lv, laopts,
 					  (lv_is_origin(lv) && laopts->origin_only) ? "real" :
@@ -3208,6 +3215,132 @@ int dev_manager_deactivate(struct dev_manager *dm, const struct logical_volume *
 	return 1;
 }
 
+/*
+ * Build one tree with all LVs from the items list (struct lv_activate_item)
+ * so the state of shared dependencies is queried only once, all tables
+ * are preloaded before anything is resumed and udev is synchronised
+ * with only once by the caller.
+ */
+static int _tree_action_lvs(struct dev_manager *dm, struct dm_list *items, action_t action)
+{
+	const size_t DLID_SIZE = ID_LEN + sizeof(UUID_PREFIX) - 1;
+	struct lv_activate_item *item;
+	const struct logical_volume *lv;
+	struct dm_tree *dtree;
+	struct dm_tree_node *root;
+	char *dlid;
+	int jobs;
+	int r = 0;
+
+	if (dm_list_empty(items))
+		return 1;
+
+	lv = dm_list_item(dm_list_first(items), struct lv_activate_item)->lv;
+
+	log_debug_activation("Creating %s tree for %u LVs in VG %s.",
+			     (action == ACTIVATE) ? "ACTIVATE" :
+			     (action == DEACTIVATE) ? "DEACTIVATE" : "CLEAN",
+			     dm_list_size(items), lv->vg->name);
+
+	dm->activation = (action == ACTIVATE);
+	dm->suspend = 0;
+	dm->track_external_lv_deps = 1;
+
+	if (!(dtree = dm_tree_create())) {
+		log_debug_activation("Partial dtree creation failed for VG %s.",
+				     lv->vg->name);
+		return 0;
+	}
+
+	dm_tree_set_optional_uuid_suffixes(dtree, &uuid_suffix_list[0]);
+
+	dm_list_iterate_items(item, items)
+		if (!_add_lv_to_dtree(dm, dtree, item->lv, 0)) {
+			stack;
+			goto out_no_root;
+		}
+
+	if (!(root = dm_tree_find_node(dtree, 0, 0))) {
+		log_error("Lost dependency tree root node.");
+		goto out_no_root;
+	}
+
+	/* Restore fs cookie */
+	dm_tree_set_cookie(root, fs_get_cookie());
+
+	/* Any LV of the VG gives the "LVM-" plus VG id prefix */
+	if (!(dlid = build_dm_uuid(dm->mem, lv, NULL)))
+		goto_out;
+
+	switch (action) {
+	case CLEAN:
+		if (retry_deactivation())
+			dm_tree_retry_remove(root);
+		if (!_clean_tree(dm, root, NULL))
+			goto_out;
+		break;
+	case DEACTIVATE:
+		if (retry_deactivation())
+			dm_tree_retry_remove(root);
+		if (!dm_tree_deactivate_children(root, dlid, DLID_SIZE))
+			goto_out;
+		if (!_remove_lv_symlinks(dm, root))
+			log_warn("Failed to remove all device symlinks in VG %s.",
+				 lv->vg->name);
+		break;
+	case ACTIVATE:
+		/* Threads are not started with devices suspended */
+		if (!critical_section() &&
+		    ((jobs = find_config_tree_int(dm->cmd, activation_parallel_activation_jobs_CFG, NULL)) > 1))
+			dm_tree_set_parallel_jobs(root, (unsigned) jobs);
+
+		dm_list_iterate_items(item, items)
+			if (!_add_new_lv_to_dtree(dm, dtree, item->lv, &item->laopts, NULL))
+				goto_out;
+
+		if (!dm_tree_preload_children(root, dlid, DLID_SIZE))
+			goto_out;
+
+		if (!dm_tree_activate_children(root, dlid, DLID_SIZE))
+			goto_out;
+
+		if (!_create_lv_symlinks(dm, root))
+			log_warn("Failed to create symlinks in VG %s.", lv->vg->name);
+		break;
+	default:
+		log_error(INTERNAL_ERROR "_tree_action_lvs: Action %u not supported.", action);
+		goto out;
+	}
+	r = 1;
+
+out:
+	/* Save fs cookie for udev settle, do not wait here */
+	fs_set_cookie(dm_tree_get_cookie(root));
+out_no_root:
+	dm_tree_free(dtree);
+
+	return r;
+}
+
+int dev_manager_activate_lvs(struct dev_manager *dm, struct dm_list *items)
+{
+	if (!_tree_action_lvs(dm, items, ACTIVATE))
+		return_0;
+
+	if (!_tree_action_lvs(dm, items, CLEAN))
+		return_0;
+
+	return 1;
+}
+
+int dev_manager_deactivate_lvs(struct dev_manager *dm, struct dm_list *items)
+{
+	if (!_tree_action_lvs(dm, items, DEACTIVATE))
+		return_0;
+
+	return 1;
+}
+
 int dev_manager_suspend(struct dev_manager *dm, const struct logical_volume *lv,
 			struct lv_activate_opts *laopts, int lockfs, int flush_required)
 {
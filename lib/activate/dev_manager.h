@@ -86,6 +86,12 @@ int dev_manager_activate(struct dev_manager *dm, const struct logical_volume *lv
 int dev_manager_preload(struct dev_manager *dm, const struct logical_volume *lv,
 			struct lv_activate_opts *laopts, int *flush_required);
 int dev_manager_deactivate(struct dev_manager *dm, const struct logical_volume *lv);
+
+/*
+ * Bulk operations processing all listed LVs of one VG with a single tree.
+ */
+int dev_manager_activate_lvs(struct dev_manager *dm, struct dm_list *items);
+int dev_manager_deactivate_lvs(struct dev_manager *dm, struct dm_list *items);
 int dev_manager_transient(struct dev_manager *dm, const struct logical_volume *lv) __attribute__((nonnull(1, 2)));
 
 int dev_manager_mknodes(const struct logical_volume *lv);
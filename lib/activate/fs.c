@@ -65,25 +65,6 @@ static int _mk_dir(const char *dev_dir, const char *vg_name)
 	return 1;
 }
 
-static int _rm_dir(const char *dev_dir, const char *vg_name)
-{
-	static char vg_path[PATH_MAX];
-
-	if (dm_snprintf(vg_path, sizeof(vg_path), "%s%s",
-			 dev_dir, vg_name) == -1) {
-		log_error("Couldn't construct name of volume "
-			  "group directory.");
-		return 0;
-	}
-
-	if (dir_exists(vg_path) && is_empty_dir(vg_path)) {
-		log_very_verbose("Removing directory %s", vg_path);
-		rmdir(vg_path);
-	}
-
-	return 1;
-}
-
 static void _rm_blks(const char *dir)
 {
 	const char *name;
@@ -121,20 +102,38 @@ static void _rm_blks(const char *dir)
 		log_sys_error("closedir", dir);
 }
 
-static int _mk_link(const char *dev_dir, const char *vg_name,
-		    const char *lv_name, const char *dev, int check_udev)
+/*
+ * To reach this point, the VG must have been locked.
+ * As locking fails if the VG is active under LVM1, it's
+ * now safe to remove any LVM1 devices we find here
+ * (as well as any existing LVM2 symlink).
+ */
+static void _rm_lvm1_group(int vg_fd, const char *vg_path)
 {
-	static char lv_path[PATH_MAX], link_path[PATH_MAX], lvm1_group_path[PATH_MAX];
-	static char vg_path[PATH_MAX];
-	struct stat buf, buf_lp;
+	struct stat buf;
 
-	if (dm_snprintf(vg_path, sizeof(vg_path), "%s%s",
-			 dev_dir, vg_name) == -1) {
-		log_error("Couldn't create path for volume group dir %s",
-			  vg_name);
-		return 0;
+	if (fstatat(vg_fd, "group", &buf, AT_SYMLINK_NOFOLLOW))
+		return;
+
+	if (!S_ISCHR(buf.st_mode)) {
+		log_error("Non-LVM1 character device found at %s/group",
+			  vg_path);
+		return;
 	}
 
+	_rm_blks(vg_path);
+
+	log_very_verbose("Removing %s/group", vg_path);
+	if (unlinkat(vg_fd, "group", 0) < 0)
+		log_sys_error("unlink", "group");
+}
+
+static int _mk_link(int vg_fd, const char *vg_path, const char *lv_name,
+		    const char *dev, int check_udev)
+{
+	static char lv_path[PATH_MAX], link_path[PATH_MAX];
+	struct stat buf, buf_lp;
+
 	if (dm_snprintf(lv_path, sizeof(lv_path), "%s/%s", vg_path,
 			 lv_name) == -1) {
 		log_error("Couldn't create source pathname for "
@@ -149,31 +148,7 @@ static int _mk_link(const char *dev_dir, const char *vg_name,
 		return 0;
 	}
 
-	if (dm_snprintf(lvm1_group_path, sizeof(lvm1_group_path), "%s/group",
-			 vg_path) == -1) {
-		log_error("Couldn't create pathname for LVM1 group file for %s",
-			  vg_name);
-		return 0;
-	}
-
-	/* To reach this point, the VG must have been locked.
-	 * As locking fails if the VG is active under LVM1, it's
-	 * now safe to remove any LVM1 devices we find here
-	 * (as well as any existing LVM2 symlink). */
-	if (!lstat(lvm1_group_path, &buf)) {
-		if (!S_ISCHR(buf.st_mode)) {
-			log_error("Non-LVM1 character device found at %s",
-				  lvm1_group_path);
-		} else {
-			_rm_blks(vg_path);
-
-			log_very_verbose("Removing %s", lvm1_group_path);
-			if (unlink(lvm1_group_path) < 0)
-				log_sys_error("unlink", lvm1_group_path);
-		}
-	}
-
-	if (!lstat(lv_path, &buf)) {
+	if (!fstatat(vg_fd, lv_name, &buf, AT_SYMLINK_NOFOLLOW)) {
 		if (!S_ISLNK(buf.st_mode) && !S_ISBLK(buf.st_mode)) {
 			log_error("Symbolic link %s not created: file exists",
 				  link_path);
@@ -183,7 +158,7 @@ static int _mk_link(const char *dev_dir, const char *vg_name,
 		if (dm_udev_get_sync_support() && udev_checking() && check_udev) {
 			/* Check udev created the correct link. */
 			if (!stat(link_path, &buf_lp) &&
-			    !stat(lv_path, &buf)) {
+			    !fstatat(vg_fd, lv_name, &buf, 0)) {
 				if (buf_lp.st_rdev == buf.st_rdev)
 					return 1;
 
@@ -200,7 +175,7 @@ static int _mk_link(const char *dev_dir, const char *vg_name,
 		}
 
 		log_very_verbose("Removing %s", lv_path);
-		if (unlink(lv_path) < 0) {
+		if (unlinkat(vg_fd, lv_name, 0) < 0) {
 			log_sys_error("unlink", lv_path);
 			return 0;
 		}
@@ -212,7 +187,7 @@ static int _mk_link(const char *dev_dir, const char *vg_name,
 	log_very_verbose("Linking %s -> %s", lv_path, link_path);
 
 	(void) dm_prepare_selinux_context(lv_path, S_IFLNK);
-	if (symlink(link_path, lv_path) < 0) {
+	if (symlinkat(link_path, vg_fd, lv_name) < 0) {
 		log_sys_error("symlink", lv_path);
 		(void) dm_prepare_selinux_context(NULL, 0);
 		return 0;
@@ -222,19 +197,19 @@ static int _mk_link(const char *dev_dir, const char *vg_name,
 	return 1;
 }
 
-static int _rm_link(const char *dev_dir, const char *vg_name,
-		    const char *lv_name, int check_udev)
+static int _rm_link(int vg_fd, const char *vg_path, const char *lv_name,
+		    int check_udev)
 {
 	struct stat buf;
 	static char lv_path[PATH_MAX];
 
-	if (dm_snprintf(lv_path, sizeof(lv_path), "%s%s/%s",
-			 dev_dir, vg_name, lv_name) == -1) {
+	if (dm_snprintf(lv_path, sizeof(lv_path), "%s/%s",
+			 vg_path, lv_name) == -1) {
 		log_error("Couldn't determine link pathname.");
 		return 0;
 	}
 
-	if (lstat(lv_path, &buf)) {
+	if (fstatat(vg_fd, lv_name, &buf, AT_SYMLINK_NOFOLLOW)) {
 		if (errno == ENOENT)
 			return 1;
 		log_sys_error("lstat", lv_path);
@@ -252,7 +227,7 @@ static int _rm_link(const char *dev_dir, const char *vg_name,
 	}
 
 	log_very_verbose("Removing link %s", lv_path);
-	if (unlink(lv_path) < 0) {
+	if (unlinkat(vg_fd, lv_name, 0) < 0) {
 		log_sys_error("unlink", lv_path);
 		return 0;
 	}
@@ -267,42 +242,13 @@ typedef enum {
 	NUM_FS_OPS
 } fs_op_t;
 
-static int _do_fs_op(fs_op_t type, const char *dev_dir, const char *vg_name,
-		     const char *lv_name, const char *dev,
-		     const char *old_lv_name, int check_udev)
-{
-	switch (type) {
-	case FS_ADD:
-		if (!_mk_dir(dev_dir, vg_name) ||
-		    !_mk_link(dev_dir, vg_name, lv_name, dev, check_udev))
-			return_0;
-		break;
-	case FS_DEL:
-		if (!_rm_link(dev_dir, vg_name, lv_name, check_udev) ||
-		    !_rm_dir(dev_dir, vg_name))
-			return_0;
-		break;
-		/* FIXME Use rename() */
-	case FS_RENAME:
-		if (old_lv_name && !_rm_link(dev_dir, vg_name, old_lv_name,
-					     check_udev))
-			stack;
-
-		if (!_mk_link(dev_dir, vg_name, lv_name, dev, check_udev))
-			stack;
-	default:
-		; /* NOTREACHED */
-	}
-
-	return 1;
-}
-
 static DM_LIST_INIT(_fs_ops);
 /*
  * Count number of stacked fs_op_t operations to allow to skip dm_list search.
- * FIXME: handling of FS_RENAME
  */
 static int _count_fs_ops[NUM_FS_OPS];
+/* Number of stacked FS_ADD and FS_DEL operations for each "vg/lv" name */
+static struct dm_hash_table *_fs_names = NULL;
 
 struct fs_op_parms {
 	struct dm_list list;
@@ -323,9 +269,58 @@ static void _store_str(char **pos, char **ptr, const char *str)
 	*pos += strlen(*ptr) + 1;
 }
 
+static int _fs_name_key(char *key, size_t len, const char *vg_name,
+			const char *lv_name)
+{
+	if (dm_snprintf(key, len, "%s/%s", vg_name, lv_name) < 0) {
+		log_error("Couldn't create key for %s/%s.", vg_name, lv_name);
+		return 0;
+	}
+
+	return 1;
+}
+
+static unsigned _fs_name_ops(const char *vg_name, const char *lv_name)
+{
+	char key[PATH_MAX];
+
+	if (!_fs_names || !_fs_name_key(key, sizeof(key), vg_name, lv_name))
+		return 0;
+
+	return (unsigned) (uintptr_t) dm_hash_lookup(_fs_names, key);
+}
+
+static int _fs_name_ref(const char *vg_name, const char *lv_name, int delta)
+{
+	char key[PATH_MAX];
+	unsigned count = _fs_name_ops(vg_name, lv_name) + delta;
+
+	if (!_fs_name_key(key, sizeof(key), vg_name, lv_name))
+		return_0;
+
+	if (!_fs_names && !(_fs_names = dm_hash_create(64))) {
+		log_error("Failed to allocate fs name hash.");
+		return 0;
+	}
+
+	if (!count) {
+		dm_hash_remove(_fs_names, key);
+		return 1;
+	}
+
+	if (!dm_hash_insert(_fs_names, key, (void *) (uintptr_t) count)) {
+		log_error("Failed to add %s to fs name hash.", key);
+		return 0;
+	}
+
+	return 1;
+}
+
 static void _del_fs_op(struct fs_op_parms *fsp)
 {
 	_count_fs_ops[fsp->type]--;
+	if (fsp->type != FS_RENAME)
+		(void) _fs_name_ref(fsp->vg_name, fsp->lv_name, -1);
 	dm_list_del(&fsp->list);
 	dm_free(fsp);
 }
@@ -341,10 +336,29 @@ static int _other_fs_ops(fs_op_t type)
 	return 0;
 }
 
-/* Check if udev is supposed to create nodes */
-static int _check_udev(int check_udev)
+/*
+ * Drop stacked FS_ADD and FS_DEL operations on the link, they are
+ * superseded by any later operation which sets the link again.
+ * FS_RENAME is kept as it also removes the link with the old name.
+ */
+static void _unstack_fs_ops(const char *vg_name, const char *lv_name)
 {
-    return check_udev && dm_udev_get_sync_support() && dm_udev_get_checking();
+	struct dm_list *fsph, *fspht;
+	struct fs_op_parms *fsp;
+
+	if (!_fs_name_ops(vg_name, lv_name))
+		return;
+
+	dm_list_iterate_safe(fsph, fspht, &_fs_ops) {
+		fsp = dm_list_item(fsph, struct fs_op_parms);
+		if ((fsp->type != FS_RENAME) &&
+		    !strcmp(lv_name, fsp->lv_name) &&
+		    !strcmp(vg_name, fsp->vg_name)) {
+			_del_fs_op(fsp);
+			if (!_fs_name_ops(vg_name, lv_name))
+				break; /* no other ops on the link */
+		}
+	}
 }
 
 /* FIXME: duplication of the  code from libdm-common.c */
@@ -352,54 +366,20 @@ static int _stack_fs_op(fs_op_t type, const char *dev_dir, const char *vg_name,
 			const char *lv_name, const char *dev,
 			const char *old_lv_name, int check_udev)
 {
-	struct dm_list *fsph, *fspht;
 	struct fs_op_parms *fsp;
 	size_t len = strlen(dev_dir) + strlen(vg_name) + strlen(lv_name) +
 	    strlen(dev) + strlen(old_lv_name) + 5;
 	char *pos;
 
-	if ((type == FS_DEL) && _other_fs_ops(type))
-		/*
-		 * Ignore any outstanding operations on the fs_op if deleting it.
-		 */
-		dm_list_iterate_safe(fsph, fspht, &_fs_ops) {
-			fsp = dm_list_item(fsph, struct fs_op_parms);
-			if (!strcmp(lv_name, fsp->lv_name) &&
-			    !strcmp(vg_name, fsp->vg_name)) {
-				_del_fs_op(fsp);
-				if (!_other_fs_ops(type))
-					break; /* no other non DEL ops */
-			}
-		}
-	else if ((type == FS_ADD) && _count_fs_ops[FS_DEL] && _check_udev(check_udev))
-		/*
-		 * If udev is running ignore previous DEL operation on added fs_op.
-		 * (No other operations for this device then DEL could be stacked here).
-		 */
-		dm_list_iterate_safe(fsph, fspht, &_fs_ops) {
-			fsp = dm_list_item(fsph, struct fs_op_parms);
-			if ((fsp->type == FS_DEL) &&
-			    !strcmp(lv_name, fsp->lv_name) &&
-			    !strcmp(vg_name, fsp->vg_name)) {
-				_del_fs_op(fsp);
-				break; /* no other DEL ops */
-			}
-		}
-	else if ((type == FS_RENAME) && _check_udev(check_udev))
-		/*
-		 * If udev is running ignore any outstanding operations if renaming it.
-		 *
-		 * Currently RENAME operation happens through 'suspend -> resume'.
-		 * On 'resume' device is added with read_ahead settings, so it
-		 * safe to remove any stacked ADD, RENAME, READ_AHEAD operation
-		 * There cannot be any DEL operation on the renamed device.
-		 */
-		dm_list_iterate_safe(fsph, fspht, &_fs_ops) {
-			fsp = dm_list_item(fsph, struct fs_op_parms);
-			if (!strcmp(old_lv_name, fsp->lv_name) &&
-			    !strcmp(vg_name, fsp->vg_name))
-				_del_fs_op(fsp);
-		}
+	/*
+	 * Collapse sequences of operations on the same link, so e.g.
+	 * add + remove of the same link is not done at all.
+	 */
+	_unstack_fs_ops(vg_name, lv_name);
+
+	/* Renaming removes the old link */
+	if (type == FS_RENAME)
+		_unstack_fs_ops(vg_name, old_lv_name);
 
 	if (!(fsp = dm_malloc(sizeof(*fsp) + len))) {
 		log_error("No space to stack fs operation");
@@ -416,40 +396,140 @@ static int _stack_fs_op(fs_op_t type, const char *dev_dir, const char *vg_name,
 	_store_str(&pos, &fsp->dev, dev);
 	_store_str(&pos, &fsp->old_lv_name, old_lv_name);
 
+	if ((type != FS_RENAME) && !_fs_name_ref(vg_name, lv_name, 1)) {
+		dm_free(fsp);
+		return 0;
+	}
+
 	_count_fs_ops[type]++;
 	dm_list_add(&_fs_ops, &fsp->list);
 
 	return 1;
 }
 
-static void _pop_fs_ops(void)
+/*
+ * Process all stacked operations for one VG directory in a single pass,
+ * working with the links relative to the opened directory.
+ */
+static void _pop_fs_dir_ops(const char *dev_dir, const char *vg_name)
 {
+	char vg_path[PATH_MAX];
 	struct dm_list *fsph, *fspht;
 	struct fs_op_parms *fsp;
+	int dev_fd, vg_fd = -1;
+	int need_dir = 0, rm_dir = 0;
+
+	if (dm_snprintf(vg_path, sizeof(vg_path), "%s%s", dev_dir, vg_name) == -1) {
+		log_error("Couldn't construct name of volume "
+			  "group directory.");
+		return;
+	}
+
+	dm_list_iterate_items(fsp, &_fs_ops)
+		if ((fsp->type != FS_DEL) &&
+		    !strcmp(vg_name, fsp->vg_name) &&
+		    !strcmp(dev_dir, fsp->dev_dir)) {
+			need_dir = 1;
+			break;
+		}
+
+	if ((dev_fd = open(dev_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+		log_sys_error("open", dev_dir);
+	else if ((!need_dir || _mk_dir(dev_dir, vg_name)) &&
+		 ((vg_fd = openat(dev_fd, vg_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) &&
+		 (need_dir || (errno != ENOENT)))
+		log_sys_error("open", vg_path);
+
+	if (need_dir && (vg_fd >= 0))
+		_rm_lvm1_group(vg_fd, vg_path);
 
 	dm_list_iterate_safe(fsph, fspht, &_fs_ops) {
 		fsp = dm_list_item(fsph, struct fs_op_parms);
-		_do_fs_op(fsp->type, fsp->dev_dir, fsp->vg_name, fsp->lv_name,
-			  fsp->dev, fsp->old_lv_name, fsp->check_udev);
+		if (strcmp(vg_name, fsp->vg_name) || strcmp(dev_dir, fsp->dev_dir))
+			continue;
+
+		if (vg_fd >= 0)
+			switch (fsp->type) {
+			case FS_ADD:
+				if (!_mk_link(vg_fd, vg_path, fsp->lv_name, fsp->dev, fsp->check_udev))
+					stack;
+				break;
+			case FS_DEL:
+				if (!_rm_link(vg_fd, vg_path, fsp->lv_name, fsp->check_udev))
+					stack;
+				rm_dir = 1;
+				break;
+				/* FIXME Use rename() */
+			case FS_RENAME:
+				if (*fsp->old_lv_name &&
+				    !_rm_link(vg_fd, vg_path, fsp->old_lv_name, fsp->check_udev))
+					stack;
+
+				if (!_mk_link(vg_fd, vg_path, fsp->lv_name, fsp->dev, fsp->check_udev))
+					stack;
+				break;
+			default:
+				; /* NOTREACHED */
+			}
+
 		_del_fs_op(fsp);
 	}
 
+	if ((vg_fd >= 0) && close(vg_fd))
+		log_sys_debug("close", vg_path);
+
+	/* Removing non-empty directory simply fails */
+	if (rm_dir && (dev_fd >= 0)) {
+		if (!unlinkat(dev_fd, vg_name, AT_REMOVEDIR))
+			log_very_verbose("Removed directory %s", vg_path);
+		else if ((errno != ENOTEMPTY) && (errno != EEXIST) && (errno != ENOENT))
+			log_sys_debug("rmdir", vg_path);
+	}
+
+	if ((dev_fd >= 0) && close(dev_fd))
+		log_sys_debug("close", dev_dir);
+}
+
+static void _pop_fs_ops(void)
+{
+	char dev_dir[PATH_MAX], vg_name[NAME_LEN];
+	struct fs_op_parms *fsp;
+
+	while (!dm_list_empty(&_fs_ops)) {
+		fsp = dm_list_item(dm_list_first(&_fs_ops), struct fs_op_parms);
+
+		/* Processed operations are freed */
+		if (!dm_strncpy(dev_dir, fsp->dev_dir, sizeof(dev_dir)) ||
+		    !dm_strncpy(vg_name, fsp->vg_name, sizeof(vg_name))) {
+			log_error(INTERNAL_ERROR "Too long name in stacked fs operation.");
+			_del_fs_op(fsp);
+			continue;
+		}
+
+		_pop_fs_dir_ops(dev_dir, vg_name);
+	}
+
+	if (_fs_names) {
+		dm_hash_destroy(_fs_names);
+		_fs_names = NULL;
+	}
+
 	_fs_create = 0;
 }
 
+/*
+ * Operations are always stacked and processed in a batch by fs_unlock(),
+ * together with the device nodes libdevmapper creates at the same time.
+ */
 static int _fs_op(fs_op_t type, const char *dev_dir, const char *vg_name,
 		  const char *lv_name, const char *dev, const char *old_lv_name,
 		  int check_udev)
 {
-	if (critical_section()) {
-		if (!_stack_fs_op(type, dev_dir, vg_name, lv_name, dev,
-				  old_lv_name, check_udev))
-			return_0;
-		return 1;
-	}
+	if (!_stack_fs_op(type, dev_dir, vg_name, lv_name, dev,
+			  old_lv_name, check_udev))
+		return_0;
 
-	return _do_fs_op(type, dev_dir, vg_name, lv_name, dev,
-			 old_lv_name, check_udev);
+	return 1;
 }
 
 int fs_add_lv(const struct logical_volume *lv, const char *dev)
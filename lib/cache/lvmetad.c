@@ -38,6 +38,25 @@ static struct cmd_context *_lvmetad_cmd = NULL;
 static int64_t _lvmetad_update_timeout;
 
 static int _found_lvm1_metadata = 0;
+static int _lvmetad_no_delta = 0;
+
+/*
+ * PVs found between lvmetad_pv_found_batch_begin() and _end() are queued
+ * and sent in pv_found_batch requests of up to LVMETAD_BATCH_MAX_PVS.
+ */
+#define LVMETAD_BATCH_MAX_PVS 256
+
+static struct {
+	int active;
+	struct cmd_context *cmd;
+	struct dm_list *found_vgnames;
+	struct dm_list *changed_vgnames;
+	struct dm_config_tree *pvs;	/* pvs { pv0 { pvmeta {} vg = "vg0" } ... } */
+	struct dm_config_tree *vgs;	/* vgs { vg0 { vgname = metadata {} } ... } */
+	struct dm_hash_table *vg_refs;	/* "vgid/seqno" to the node in vgs */
+	unsigned pv_count;
+	unsigned vg_count;
+} _lvmetad_batch;
 
 static struct volume_group *_lvmetad_pvscan_vg(struct cmd_context *cmd, struct volume_group *vg);
 
@@ -657,6 +676,9 @@ static int _lvmetad_handle_reply(daemon_reply reply, const char *id, const char
 	else if (!strcmp(id, "pv_found")) {
 		action = "update PV";
 		action_modifies = 1;
+	} else if (!strcmp(id, "pv_found_batch")) {
+		action = "update PVs";
+		action_modifies = 1;
 	} else if (!strcmp(id, "pv_gone")) {
 		action = "drop PV";
 		action_modifies = 1;
@@ -1103,6 +1125,11 @@ struct volume_group *lvmetad_vg_lookup(struct cmd_context *cmd, const char *vgna
 			release_vg(vg);
 			vg = vg2;
 			fid = vg2->fid;
+		} else {
+			/* Keep what lvmetad has as the base of a later vg_update_delta. */
+			reply.cft->root = top;
+			vg->lvmetad_base = reply.cft;
+			reply.cft = NULL;
 		}
 
 		dm_list_iterate_items(pvl, &vg->pvs) {
@@ -1196,6 +1223,198 @@ int lvmetad_vg_update_pending(struct volume_group *vg)
 	return 1;
 }
 
+/*
+ * Compare two nodes including their keys and everything below them.
+ */
+static int _config_node_equal(const struct dm_config_node *a, const struct dm_config_node *b)
+{
+	const struct dm_config_value *av, *bv;
+	const struct dm_config_node *ac, *bc;
+
+	if (strcmp(a->key, b->key))
+		return 0;
+
+	for (av = a->v, bv = b->v; av && bv; av = av->next, bv = bv->next) {
+		if (av->type != bv->type)
+			return 0;
+		if ((av->type == DM_CFG_STRING) && strcmp(av->v.str, bv->v.str))
+			return 0;
+		if ((av->type == DM_CFG_INT) && (av->v.i != bv->v.i))
+			return 0;
+		if ((av->type == DM_CFG_FLOAT) && memcmp(&av->v.f, &bv->v.f, sizeof(av->v.f)))
+			return 0;
+	}
+
+	if (av || bv)
+		return 0;
+
+	for (ac = a->child, bc = b->child; ac && bc; ac = ac->sib, bc = bc->sib)
+		if (!_config_node_equal(ac, bc))
+			return 0;
+
+	return !ac && !bc;
+}
+
+/*
+ * Both trees are exported in the same order, so the child looked for is
+ * nearly always the one following the previous match in *next.
+ */
+static const struct dm_config_node *_find_child(const struct dm_config_node *parent, const char *key,
+						const struct dm_config_node **next)
+{
+	const struct dm_config_node *cn;
+
+	if (!(cn = *next) || strcmp(cn->key, key))
+		for (cn = parent->child; cn; cn = cn->sib)
+			if (!strcmp(cn->key, key))
+				break;
+
+	if (cn)
+		*next = cn->sib;
+
+	return cn;
+}
+
+struct vg_delta {
+	struct dm_config_tree *cft;
+	struct dm_config_node *last;	/* last op in cft->root */
+	unsigned count;
+};
+
+static int _vg_delta_add(struct vg_delta *d, const char *parent, const char *after,
+			 const struct dm_config_node *set, const char *remove)
+{
+	struct dm_config_node *op, *cn, *node;
+	char name[32];
+
+	if (dm_snprintf(name, sizeof(name), "op%u", d->count) < 0 ||
+	    !(op = make_config_node(d->cft, name, d->cft->root, d->last)) ||
+	    !make_text_node(d->cft, "parent", dm_pool_strdup(d->cft->mem, parent), op, NULL))
+		return_0;
+
+	if (after && !make_text_node(d->cft, "after", dm_pool_strdup(d->cft->mem, after), op, NULL))
+		return_0;
+
+	if (set) {
+		if (!(cn = make_config_node(d->cft, "set", op, NULL)) ||
+		    !(node = dm_config_clone_node(d->cft, set, 0)))
+			return_0;
+		chain_node(node, cn, NULL);
+	} else if (!make_text_node(d->cft, "remove", dm_pool_strdup(d->cft->mem, remove), op, NULL))
+		return_0;
+
+	d->last = op;
+	d->count++;
+
+	return 1;
+}
+
+/*
+ * Add the ops turning the children of base into the children of new.
+ * Sections found in both are compared member by member for depth more
+ * levels (VG, LVs, LV segments), anything else differing is sent whole.
+ * physical_volumes is left to the caller, the base from vg_lookup also
+ * carries lvmetad's own PV information.
+ */
+static int _vg_delta_diff(struct vg_delta *d, const char *path,
+			  const struct dm_config_node *base, const struct dm_config_node *new,
+			  int depth)
+{
+	const struct dm_config_node *cn, *bn, *prev = NULL, *next;
+	char child_path[NAME_LEN * 2 + 32];
+	int root = !*path;
+
+	next = base->child;
+	for (cn = new->child; cn; prev = cn, cn = cn->sib) {
+		if (root && !strcmp(cn->key, "physical_volumes"))
+			continue;
+
+		if (!(bn = _find_child(base, cn->key, &next))) {
+			if (!_vg_delta_add(d, path, prev ? prev->key : NULL, cn, NULL))
+				return_0;
+		} else if (depth && !bn->v && !cn->v) {
+			if (dm_snprintf(child_path, sizeof(child_path), "%s%s%s",
+					path, root ? "" : "/", cn->key) < 0)
+				return_0;
+			if (!_vg_delta_diff(d, child_path, bn, cn, depth - 1))
+				return_0;
+		} else if (!_config_node_equal(bn, cn) &&
+			   !_vg_delta_add(d, path, NULL, cn, NULL))
+			return_0;
+	}
+
+	next = new->child;
+	for (bn = base->child; bn; bn = bn->sib) {
+		if (root && (!strcmp(bn->key, "physical_volumes") ||
+			     !strcmp(bn->key, "outdated_pvs")))
+			continue;
+
+		if (!_find_child(new, bn->key, &next) &&
+		    !_vg_delta_add(d, path, NULL, NULL, bn->key))
+			return_0;
+	}
+
+	return 1;
+}
+
+/*
+ * Send only the parts of the metadata that changed since vg->lvmetad_base.
+ * Returns 0 if lvmetad did not apply the delta and needs the whole VG.
+ */
+static int _lvmetad_vg_update_delta(struct volume_group *vg, struct volume_group *vgu,
+				    const char *uuid, struct dm_config_tree *vgmeta)
+{
+	struct vg_delta d = { 0 };
+	const struct dm_config_node *base = vg->lvmetad_base->root;
+	const struct dm_config_node *pvs;
+	daemon_reply reply;
+	const char *response;
+	int64_t base_seqno;
+	int r = 0;
+
+	if (!base || ((base_seqno = dm_config_find_int64(base->child, "seqno", -1)) <= 0) ||
+	    (base_seqno >= vgu->seqno))
+		return 0;
+
+	if (!(d.cft = dm_config_create()) ||
+	    !(d.cft->root = make_config_node(d.cft, "delta", NULL, NULL)) ||
+	    !_vg_delta_diff(&d, "", base, vgmeta->root, 2))
+		goto_out;
+
+	if ((pvs = dm_config_find_node(vgmeta->root->child, "physical_volumes")) &&
+	    !_vg_delta_add(&d, "", NULL, pvs, NULL))
+		goto_out;
+
+	log_debug_lvmetad("Sending lvmetad delta for VG %s (seqno " FMTd64 " to %" PRIu32 ", %u changes)",
+			  vg->name, base_seqno, vgu->seqno, d.count);
+	reply = _lvmetad_send(vg->cmd, "vg_update_delta",
+			      "vgname = %s", vg->name,
+			      "uuid = %s", uuid,
+			      "base_seqno = %" PRId64, base_seqno,
+			      "seqno = %" PRId64, (int64_t)vgu->seqno,
+			      "delta = %t", d.cft,
+			      NULL);
+
+	if (!reply.error) {
+		response = daemon_reply_str(reply, "response", "");
+		if (!strcmp(response, "OK"))
+			r = 1;
+		else {
+			if (!strcmp(daemon_reply_str(reply, "reason", ""), "request not implemented"))
+				_lvmetad_no_delta = 1;
+			log_debug_lvmetad("lvmetad needs full update of VG %s: %s %s", vg->name,
+					  response, daemon_reply_str(reply, "reason", ""));
+		}
+	}
+
+	daemon_reply_destroy(reply);
+out:
+	if (d.cft)
+		dm_config_destroy(d.cft);
+
+	return r;
+}
+
 int lvmetad_vg_update_finish(struct volume_group *vg)
 {
 	char uuid[64] __attribute__((aligned(8)));
@@ -1240,14 +1459,16 @@ int lvmetad_vg_update_finish(struct volume_group *vg)
 		return 0;
 	}
 
+	if (vg->lvmetad_base && !_lvmetad_no_delta &&
+	    _lvmetad_vg_update_delta(vg, vgu, uuid, vgmeta))
+		goto updated;
+
 	log_debug_lvmetad("Sending lvmetad updated VG %s (seqno %" PRIu32 ")", vg->name, vg->seqno);
 	reply = _lvmetad_send(vg->cmd, "vg_update",
 			      "vgname = %s", vg->name,
 			      "metadata = %t", vgmeta,
 			      NULL);
 
-	dm_config_destroy(vgmeta);
-
 	if (!_lvmetad_handle_reply(reply, "vg_update", vg->name, NULL)) {
 		/*
 		 * In this failure case, the VG cached in lvmetad remains in
@@ -1256,10 +1477,16 @@ int lvmetad_vg_update_finish(struct volume_group *vg)
 		 * copy, read the VG from disk, and update the cached copy.
 		 */
 		daemon_reply_destroy(reply);
+		dm_config_destroy(vgmeta);
 		return 0;
 	}
 
 	daemon_reply_destroy(reply);
+updated:
+	/* lvmetad now has this metadata, the next update of vg is against it. */
+	if (vg->lvmetad_base)
+		dm_config_destroy(vg->lvmetad_base);
+	vg->lvmetad_base = vgmeta;
 
 	n = (vgu->fid && vgu->fid->metadata_areas_index) ?
 		dm_hash_get_first(vgu->fid->metadata_areas_index) : NULL;
@@ -1599,6 +1826,191 @@ static int _extract_mdas(struct lvmcache_info *info, struct dm_config_tree *cft,
 	return 1;
 }
 
+static void _lvmetad_batch_destroy(void)
+{
+	if (_lvmetad_batch.pvs)
+		dm_config_destroy(_lvmetad_batch.pvs);
+	if (_lvmetad_batch.vgs)
+		dm_config_destroy(_lvmetad_batch.vgs);
+	if (_lvmetad_batch.vg_refs)
+		dm_hash_destroy(_lvmetad_batch.vg_refs);
+
+	_lvmetad_batch.pvs = _lvmetad_batch.vgs = NULL;
+	_lvmetad_batch.vg_refs = NULL;
+	_lvmetad_batch.pv_count = _lvmetad_batch.vg_count = 0;
+}
+
+/*
+ * Queue the PV and, unless another PV already carried the same version of
+ * it, the VG metadata read from it.
+ */
+static int _lvmetad_batch_add(struct dm_config_tree *pvmeta, struct volume_group *vg)
+{
+	struct dm_config_tree *vgmeta;
+	struct dm_config_node *pv, *vgn, *cn;
+	char uuid[64], key[80], name[32];
+
+	if (!_lvmetad_batch.pvs &&
+	    (!(_lvmetad_batch.pvs = dm_config_create()) ||
+	     !(_lvmetad_batch.pvs->root = make_config_node(_lvmetad_batch.pvs, "pvs", NULL, NULL)) ||
+	     !(_lvmetad_batch.vgs = dm_config_create()) ||
+	     !(_lvmetad_batch.vgs->root = make_config_node(_lvmetad_batch.vgs, "vgs", NULL, NULL)) ||
+	     !(_lvmetad_batch.vg_refs = dm_hash_create(64))))
+		goto_bad;
+
+	if (dm_snprintf(name, sizeof(name), "pv%u", _lvmetad_batch.pv_count) < 0 ||
+	    !(pv = make_config_node(_lvmetad_batch.pvs, name, _lvmetad_batch.pvs->root, NULL)) ||
+	    !config_make_nodes(_lvmetad_batch.pvs, pv, NULL, "pvmeta = %t", pvmeta, NULL))
+		goto_bad;
+
+	if (vg) {
+		if (!id_write_format(&vg->id, uuid, sizeof(uuid)) ||
+		    dm_snprintf(key, sizeof(key), "%s/%u", uuid, vg->seqno) < 0)
+			goto_bad;
+
+		if (!(vgn = dm_hash_lookup(_lvmetad_batch.vg_refs, key))) {
+			if (!(vgmeta = export_vg_to_config_tree(vg)))
+				goto_bad;
+
+			/* Keys are exact here, the VGs are looked up again in the reply. */
+			if (dm_snprintf(name, sizeof(name), "vg%u", _lvmetad_batch.vg_count++) < 0 ||
+			    !(vgn = make_config_node(_lvmetad_batch.vgs, name, _lvmetad_batch.vgs->root, NULL)) ||
+			    !make_text_node(_lvmetad_batch.vgs, "vgname",
+					    dm_pool_strdup(_lvmetad_batch.vgs->mem, vg->name), vgn, NULL) ||
+			    !(cn = dm_config_clone_node(_lvmetad_batch.vgs, vgmeta->root, 0)) ||
+			    !dm_hash_insert(_lvmetad_batch.vg_refs, key, vgn)) {
+				dm_config_destroy(vgmeta);
+				goto_bad;
+			}
+
+			cn->key = "metadata";
+			chain_node(cn, vgn, NULL);
+			dm_config_destroy(vgmeta);
+		}
+
+		if (!config_make_nodes(_lvmetad_batch.pvs, pv, NULL, "vg = %s",
+				       dm_pool_strdup(_lvmetad_batch.pvs->mem, vgn->key), NULL))
+			goto_bad;
+	}
+
+	_lvmetad_batch.pv_count++;
+
+	return 1;
+bad:
+	log_error("Failed to queue PV for lvmetad.");
+	return 0;
+}
+
+/*
+ * Send the queued PVs to lvmetad.  It replies once for each VG touched by
+ * the batch, which is used like the reply to pv_found, and lists the PVs
+ * it could not store.  These do not affect the VGs of the other PVs.
+ */
+static int _lvmetad_batch_flush(void)
+{
+	struct cmd_context *cmd = _lvmetad_batch.cmd;
+	struct dm_config_node *reply_vgs = NULL, *vgn, *pvn, *cn;
+	daemon_reply reply;
+	const char *vgid, *vgname, *status;
+	int64_t seqno;
+	dev_t devno;
+	int result;
+
+	if (!_lvmetad_batch.pv_count)
+		return 1;
+
+	log_debug_lvmetad("Telling lvmetad to store %u PVs in %u VG versions.",
+			  _lvmetad_batch.pv_count, _lvmetad_batch.vg_count);
+
+	reply = _lvmetad_send(cmd, "pv_found_batch",
+			      "pvs = %t", _lvmetad_batch.pvs,
+			      "vgs = %t", _lvmetad_batch.vgs,
+			      NULL);
+
+	result = _lvmetad_handle_reply(reply, "pv_found_batch", "", NULL);
+
+	/* Each PV lvmetad could not store is reported on its own. */
+	if (!reply.error && reply.cft && daemon_reply_int(reply, "pvs_failed", 0)) {
+		if ((cn = dm_config_find_node(reply.cft->root, "failed_pvs")))
+			for (cn = cn->child; cn; cn = cn->sib) {
+				if (!(pvn = dm_config_find_node(_lvmetad_batch.pvs->root->child, cn->key)))
+					continue;
+				devno = (dev_t) dm_config_find_int64(pvn->child, "pvmeta/device", 0);
+				log_error("lvmetad could not store PV %s on device %d:%d.",
+					  dm_config_find_str(pvn->child, "pvmeta/id", ""),
+					  (int) MAJOR(devno), (int) MINOR(devno));
+			}
+		result = 0;
+	}
+
+	/* The VGs of the stored PVs are used even when some PVs failed. */
+	if (!reply.error && reply.cft &&
+	    (reply_vgs = dm_config_find_node(reply.cft->root, "volume_groups")))
+		for (vgn = _lvmetad_batch.vgs->root->child; vgn; vgn = vgn->sib) {
+			vgname = dm_config_find_str(vgn->child, "vgname", "");
+			vgid = dm_config_find_str(vgn->child, "metadata/id", "");
+			seqno = dm_config_find_int64(vgn->child, "metadata/seqno", -1);
+
+			if (!(cn = dm_config_find_node(reply_vgs->child, vgid)))
+				continue;
+
+			if ((dm_config_find_int64(cn->child, "seqno_after", -1) != seqno) ||
+			    (dm_config_find_int64(cn->child, "seqno_before", -1) != seqno))
+				log_warn("WARNING: Inconsistent metadata found for VG %s", vgname);
+		}
+
+	/* See lvmetad_pv_found() for how the VG lists are used. */
+	if (reply_vgs && _lvmetad_batch.found_vgnames)
+		for (cn = reply_vgs->child; cn; cn = cn->sib) {
+			status = dm_config_find_str(cn->child, "status", "");
+			vgname = dm_config_find_str(cn->child, "vgname", "");
+
+			if (strcmp(status, "complete"))
+				continue;
+
+			log_debug("VG %s is complete in lvmetad.", vgname);
+			if (!str_list_add(cmd->mem, _lvmetad_batch.found_vgnames, dm_pool_strdup(cmd->mem, vgname)))
+				log_error("str_list_add failed");
+
+			if (_lvmetad_batch.changed_vgnames && dm_config_find_int64(cn->child, "changed", 0)) {
+				log_debug("VG %s is changed in lvmetad.", vgname);
+				if (!str_list_add(cmd->mem, _lvmetad_batch.changed_vgnames, dm_pool_strdup(cmd->mem, vgname)))
+					log_error("str_list_add failed");
+			}
+		}
+
+	daemon_reply_destroy(reply);
+	_lvmetad_batch_destroy();
+
+	return result;
+}
+
+void lvmetad_pv_found_batch_begin(struct cmd_context *cmd,
+				  struct dm_list *found_vgnames,
+				  struct dm_list *changed_vgnames)
+{
+	_lvmetad_batch.active = 1;
+	_lvmetad_batch.cmd = cmd;
+	_lvmetad_batch.found_vgnames = found_vgnames;
+	_lvmetad_batch.changed_vgnames = changed_vgnames;
+}
+
+int lvmetad_pv_found_batch_end(void)
+{
+	int r = 1;
+
+	if (!_lvmetad_batch.active)
+		return 1;
+
+	if (lvmetad_used() && !test_mode())
+		r = _lvmetad_batch_flush();
+
+	_lvmetad_batch_destroy();
+	_lvmetad_batch.active = 0;
+
+	return r;
+}
+
 int lvmetad_pv_found(struct cmd_context *cmd, const struct id *pvid, struct device *dev, const struct format_type *fmt,
 		     uint64_t label_sector, struct volume_group *vg,
 		     struct dm_list *found_vgnames,
@@ -1649,6 +2061,18 @@ int lvmetad_pv_found(struct cmd_context *cmd, const struct id *pvid, struct devi
 		/* FIXME A more direct route would be much preferable. */
 		_extract_mdas(info, pvmeta, pvmeta->root);
 
+	if (_lvmetad_batch.active) {
+		log_debug_lvmetad("Queueing PV %s (%s)%s%s for lvmetad", dev_name(dev), uuid,
+				  vg ? " in VG " : "", vg ? vg->name : "");
+		result = _lvmetad_batch_add(pvmeta, vg);
+		dm_config_destroy(pvmeta);
+
+		if (result && (_lvmetad_batch.pv_count >= LVMETAD_BATCH_MAX_PVS))
+			result = _lvmetad_batch_flush();
+
+		return result;
+	}
+
 	if (vg) {
 		if (!(vgmeta = export_vg_to_config_tree(vg))) {
 			dm_config_destroy(pvmeta);
@@ -1733,6 +2157,10 @@ int lvmetad_pv_gone(dev_t devno, const char *pv_name)
 	if (!lvmetad_used() || test_mode())
 		return 1;
 
+	/* Keep the order of found and gone PVs. */
+	if (!_lvmetad_batch_flush())
+		return_0;
+
 	/*
 	 *  TODO: automatic volume deactivation takes place here *before*
 	 *        all cached info is gone - call handler. Also, consider
@@ -2237,6 +2665,8 @@ int lvmetad_pvscan_all_devs(struct cmd_context *cmd, int do_wait)
 	was_silent = silent_mode();
 	init_silent(1);
 
+	lvmetad_pv_found_batch_begin(cmd, NULL, NULL);
+
 	while ((dev = dev_iter_get(iter))) {
 		if (sigint_caught()) {
 			ret = 0;
@@ -2251,6 +2681,9 @@ int lvmetad_pvscan_all_devs(struct cmd_context *cmd, int do_wait)
 		}
 	}
 
+	if (!lvmetad_pv_found_batch_end())
+		ret = 0;
+
 	init_silent(was_silent);
 
 	dev_iter_destroy(iter);
@@ -103,6 +103,18 @@ int lvmetad_pv_found(struct cmd_context *cmd, const struct id *pvid, struct devi
 		     struct dm_list *found_vgnames,
 		     struct dm_list *changed_vgnames);
 
+/*
+ * Between these calls, lvmetad_pv_found() queues the PVs instead of sending
+ * them one by one, and lvmetad checks only once per VG whether it is
+ * complete.  VGs found complete are added to found_vgnames and
+ * changed_vgnames as lvmetad_pv_found() would, when the PVs are sent.
+ * lvmetad_pv_gone() sends the queued PVs first.
+ */
+void lvmetad_pv_found_batch_begin(struct cmd_context *cmd,
+				  struct dm_list *found_vgnames,
+				  struct dm_list *changed_vgnames);
+int lvmetad_pv_found_batch_end(void);
+
 /*
  * Inform the daemon that the device no longer exists.
  */
@@ -178,6 +190,8 @@ void lvmetad_clear_disabled(struct cmd_context *cmd);
 #    define lvmetad_vg_remove_pending(vg)	(1)
 #    define lvmetad_vg_remove_finish(vg)	(1)
 #    define lvmetad_pv_found(cmd, pvid, dev, fmt, label_sector, vg, found_vgnames, changed_vgnames)	(1)
+#    define lvmetad_pv_found_batch_begin(cmd, found_vgnames, changed_vgnames)	do { } while (0)
+#    define lvmetad_pv_found_batch_end()	(1)
 #    define lvmetad_pv_gone(devno, pv_name)	(1)
 #    define lvmetad_pv_gone_by_dev(dev)	(1)
 #    define lvmetad_pv_list_to_lvmcache(cmd)	(1)
@@ -54,6 +54,7 @@ struct profile_params;
 struct archive_params;
 struct backup_params;
 struct arg_values;
+struct dm_event_batch;
 
 struct config_tree_list {
 	struct dm_list list;
@@ -223,6 +224,9 @@ struct cmd_context {
 	const char *time_format;
 	unsigned rand_seed;
 	struct dm_list unused_duplicate_devs; /* save preferences between lvmcache instances */
+	struct dm_event_batch *monitor_batch;	/* dmeventd registrations submitted together */
+	unsigned monitor_batch_unmonitor:1;	/* unregistrations are batched too */
+	unsigned monitor_batch_failed:1;	/* some batched registration failed */
 };
 
 /*
@@ -983,6 +983,14 @@ cfg(global_lvmetad_update_wait_time_CFG, "lvmetad_update_wait_time", global_CFG_
 	"After waiting for this period, a command will not use lvmetad, and\n"
 	"will revert to disk scanning.\n")
 
+cfg(global_lvmetad_pvscan_coalesce_time_CFG, "lvmetad_pvscan_coalesce_time", global_CFG_SECTION, CFG_DEFAULT_COMMENTED, CFG_TYPE_INT, DEFAULT_LVMETAD_PVSCAN_COALESCE_TIME, vsn(2, 2, 178), NULL, 0, NULL,
+	"Number of milliseconds pvscan --cache for a device waits for more\n"
+	"devices to be announced by udev, so that they are all sent to lvmetad\n"
+	"in one batch. Each pvscan run in this time leaves its devices to the\n"
+	"first one, which scans all of them and autoactivates the complete VGs.\n"
+	"This avoids many small lvmetad updates when a lot of devices appear at\n"
+	"once, e.g. during boot. Set to 0 to scan each device on its own.\n")
+
 cfg(global_use_lvmlockd_CFG, "use_lvmlockd", global_CFG_SECTION, 0, CFG_TYPE_BOOL, 0, vsn(2, 2, 124), NULL, 0, NULL,
 	"Use lvmlockd for locking among hosts using LVM on shared storage.\n"
 	"Applicable only if LVM is compiled with lockd support in which\n"
@@ -1166,6 +1174,30 @@ cfg(activation_retry_deactivation_CFG, "retry_deactivation", activation_CFG_SECT
 	"failing. This may happen because a process run from a quick udev rule\n"
 	"temporarily opened the device.\n")
 
+cfg(activation_parallel_activation_jobs_CFG, "parallel_activation_jobs", activation_CFG_SECTION, 0, CFG_TYPE_INT, DEFAULT_PARALLEL_ACTIVATION_JOBS, vsn(2, 2, 178), NULL, 0, NULL,
+	"Number of threads used to load and resume devices during activation.\n"
+	"Devices which do not depend on each other are created, loaded and\n"
+	"resumed concurrently, so activation of many independent LVs is not\n"
+	"bound by the latency of each device-mapper operation. Devices are\n"
+	"still resumed only after the devices they use. The value 1 processes\n"
+	"devices one at a time. Parallel processing is not used while devices\n"
+	"are suspended.\n")
+
+cfg(activation_bulk_activation_CFG, "bulk_activation", activation_CFG_SECTION, 0, CFG_TYPE_BOOL, DEFAULT_BULK_ACTIVATION, vsn(2, 2, 178), NULL, 0, NULL,
+	"Activate and deactivate all LVs of a VG at once with vgchange.\n"
+	"All devices of the VG are then processed within a single\n"
+	"device-mapper tree instead of building one tree for each LV, so\n"
+	"shared devices are looked up and udev is synchronised only once.\n"
+	"This is not used with clustered or shared VGs. If the bulk operation\n"
+	"fails, LVs are processed one by one again.\n")
+
+cfg(activation_suspend_trace_file_CFG, "suspend_trace_file", activation_CFG_SECTION, CFG_DEFAULT_UNDEFINED, CFG_TYPE_STRING, NULL, vsn(2, 2, 178), NULL, 0, NULL,
+	"Record how long each device stayed suspended in this file.\n"
+	"While a device is suspended, all I/O to it is stalled. A JSON object\n"
+	"with the device name and the suspended time in microseconds is\n"
+	"appended to the file on a separate line for each suspend. The time is\n"
+	"also reported in verbose output.\n")
+
 cfg(activation_missing_stripe_filler_CFG, "missing_stripe_filler", activation_CFG_SECTION, CFG_ADVANCED, CFG_TYPE_STRING, DEFAULT_STRIPE_FILLER, vsn(1, 0, 0), NULL, 0, NULL,
 	"Method to fill missing stripes when activating an incomplete LV.\n"
 	"Using 'error' will make inaccessible parts of the device return I/O\n"
@@ -1426,6 +1458,25 @@ cfg(activation_thin_pool_autoextend_percent_CFG, "thin_pool_autoextend_percent",
 	"thin_pool_autoextend_percent = 20\n"
 	"#\n")
 
+cfg(activation_thin_pool_autoextend_lead_time_CFG, "thin_pool_autoextend_lead_time", activation_CFG_SECTION, CFG_DEFAULT_COMMENTED, CFG_TYPE_INT, DEFAULT_THIN_POOL_AUTOEXTEND_LEAD_TIME, vsn(2, 2, 178), NULL, 0, NULL,
+	"Extend a thin pool this many seconds before it is projected to fill.\n"
+	"dmeventd tracks how fast the data and metadata usage of a monitored\n"
+	"thin pool grows and runs the autoextend policy early when, at the\n"
+	"recent fill rate, the pool would run out of space within this time\n"
+	"(plus the time the previous extension took). This protects pools\n"
+	"that fill faster than the thin_pool_autoextend_threshold steps are\n"
+	"checked. The projected time is reported by the time_to_full field.\n"
+	"The default 0 disables the prediction.\n"
+	"Also see thin_pool_autoextend_history.\n"
+	"Automatic extension requires dmeventd to be monitoring the LV and\n"
+	"thin_pool_autoextend_threshold below 100.\n")
+
+cfg(activation_thin_pool_autoextend_history_CFG, "thin_pool_autoextend_history", activation_CFG_SECTION, CFG_DEFAULT_COMMENTED, CFG_TYPE_INT, DEFAULT_THIN_POOL_AUTOEXTEND_HISTORY, vsn(2, 2, 178), NULL, 0, NULL,
+	"Estimate the thin pool fill rate from this many seconds of samples.\n"
+	"dmeventd samples a monitored pool every 10 seconds. The fill rate\n"
+	"used for thin_pool_autoextend_lead_time is the highest rate seen\n"
+	"over this window, so short bursts of writes are not averaged away.\n")
+
 cfg_array(activation_mlock_filter_CFG, "mlock_filter", activation_CFG_SECTION, CFG_DEFAULT_UNDEFINED | CFG_ADVANCED, CFG_TYPE_STRING, NULL, vsn(2, 2, 62), NULL, 0, NULL,
 	"Do not mlock these memory areas.\n"
 	"While activating devices, I/O to devices being (re)configured is\n"
@@ -54,6 +54,7 @@
 #define DEFAULT_WAIT_FOR_LOCKS 1
 #define DEFAULT_LVMLOCKD_LOCK_RETRIES 3
 #define DEFAULT_LVMETAD_UPDATE_WAIT_TIME 10
+#define DEFAULT_LVMETAD_PVSCAN_COALESCE_TIME 0
 #define DEFAULT_PRIORITISE_WRITE_LOCKS 1
 #define DEFAULT_USE_MLOCKALL 0
 #define DEFAULT_METADATA_READ_ONLY 0
@@ -155,6 +156,8 @@
 #define DEFAULT_NOTIFY_DBUS 1
 #define DEFAULT_VERIFY_UDEV_OPERATIONS 0
 #define DEFAULT_RETRY_DEACTIVATION 1
+#define DEFAULT_PARALLEL_ACTIVATION_JOBS 1
+#define DEFAULT_BULK_ACTIVATION 1
 #define DEFAULT_ACTIVATION_CHECKS 0
 #define DEFAULT_EXTENT_SIZE 4096	/* In KB */
 #define DEFAULT_MAX_PV 0
@@ -266,5 +269,8 @@
 #define DEFAULT_SNAPSHOT_AUTOEXTEND_PERCENT 20
 #define DEFAULT_THIN_POOL_AUTOEXTEND_THRESHOLD 100
 #define DEFAULT_THIN_POOL_AUTOEXTEND_PERCENT 20
+#define DEFAULT_THIN_POOL_AUTOEXTEND_LEAD_TIME 0
+#define DEFAULT_THIN_POOL_AUTOEXTEND_HISTORY 120
+#define DEFAULT_THIN_FILL_DIR DEFAULT_RUN_DIR "/thin_fill"
 
 #endif				/* _LVM_DEFAULTS_H */
@@ -24,6 +24,33 @@ static struct cmd_context *_lvmlockd_cmd = NULL;
 static int _use_lvmlockd = 0;         /* is 1 if command is configured to use lvmlockd */
 static int _lvmlockd_connected = 0;   /* is 1 if command is connected to lvmlockd */
 static int _lvmlockd_init_failed = 0; /* used to suppress further warnings */
+static int _lvmlockd_batch_max = -1;  /* lock_lv_batch size lvmlockd accepts, 0 if none */
+
+/*
+ * LV lock requests collected by lockd_lv_name between
+ * lockd_lv_batch_begin and lockd_lv_batch_send.
+ */
+struct lv_batch_lock {
+	struct dm_list list;
+	const char *lv_name;
+	struct id lv_id;
+	const char *lv_uuid;
+	const char *lock_args;
+	const char *mode;
+	const char *opts;
+	int result;
+	int used;
+};
+
+static struct {
+	struct dm_pool *mem;
+	struct volume_group *vg;
+	struct dm_list locks;
+	unsigned count;
+	unsigned collecting:1;
+	unsigned sent:1;
+	unsigned unlock:1;
+} _lv_batch;
 
 void lvmlockd_set_socket(const char *sock)
 {
@@ -103,6 +130,7 @@ void lvmlockd_disconnect(void)
 	if (_lvmlockd_connected)
 		daemon_close(_lvmlockd);
 	_lvmlockd_connected = 0;
+	_lvmlockd_batch_max = -1;
 	_lvmlockd_cmd = NULL;
 }
 
@@ -2012,6 +2040,276 @@ int lockd_vg_update(struct volume_group *vg)
 	return ret;
 }
 
+/*
+ * Locking many LVs, e.g. for vgchange -a, sends all the LV locks in one
+ * lock_lv_batch request so that lvmlockd queues them to the lockspace
+ * together.  While a batch is collecting, lockd_lv_name only records the
+ * lock.  After a batch of locks is sent, lockd_lv_name for a lock that
+ * was acquired by the batch returns success without a request, and a
+ * lock that failed in the batch is requested again individually to get
+ * the usual retries and error reporting.
+ */
+
+static int _lv_batch_add(struct volume_group *vg, const char *lv_name,
+			 struct id *lv_id, const char *lv_uuid, const char *lock_args,
+			 const char *mode, const char *opts)
+{
+	struct lv_batch_lock *lbl;
+
+	if (!_lv_batch.collecting || (_lv_batch.vg != vg))
+		return 0;
+
+	if (_lv_batch.unlock != !strcmp(mode, "un"))
+		return 0;
+
+	/* A thin pool lock is requested for each of its thin LVs. */
+	dm_list_iterate_items(lbl, &_lv_batch.locks)
+		if (!strcmp(lbl->lv_uuid, lv_uuid))
+			return 1;
+
+	if (!(lbl = dm_pool_zalloc(_lv_batch.mem, sizeof(*lbl))) ||
+	    !(lbl->lv_name = dm_pool_strdup(_lv_batch.mem, lv_name)) ||
+	    !(lbl->lv_uuid = dm_pool_strdup(_lv_batch.mem, lv_uuid)) ||
+	    (lock_args && !(lbl->lock_args = dm_pool_strdup(_lv_batch.mem, lock_args)))) {
+		/* The lock is requested on its own. */
+		log_debug("lockd LV %s/%s not added to batch", vg->name, lv_name);
+		return 0;
+	}
+
+	lbl->lv_id = *lv_id;
+	lbl->mode = mode;
+	lbl->opts = opts;
+	lbl->result = NO_LOCKD_RESULT;
+	dm_list_add(&_lv_batch.locks, &lbl->list);
+	_lv_batch.count++;
+
+	return 1;
+}
+
+static int _lv_batch_locked(struct volume_group *vg, const char *lv_uuid, const char *mode)
+{
+	struct lv_batch_lock *lbl;
+
+	if (!_lv_batch.sent || _lv_batch.unlock || (_lv_batch.vg != vg))
+		return 0;
+
+	dm_list_iterate_items(lbl, &_lv_batch.locks)
+		if (!strcmp(lbl->lv_uuid, lv_uuid)) {
+			if (strcmp(lbl->mode, mode) ||
+			    (lbl->result && (lbl->result != -EALREADY)))
+				return 0;
+			lbl->used = 1;
+			return 1;
+		}
+
+	return 0;
+}
+
+/* The largest lock_lv_batch lvmlockd accepts, from its reply to hello. */
+static int _lv_batch_max(void)
+{
+	daemon_reply reply;
+
+	if (_lvmlockd_batch_max >= 0)
+		return _lvmlockd_batch_max;
+
+	/* Repeating hello has to keep the framing of the connection. */
+	reply = _lockd_send("hello",
+			    "framing = " FMTd64, (int64_t) _lvmlockd.framing,
+			    NULL);
+
+	if (!reply.error && !strcmp(daemon_reply_str(reply, "response", ""), "OK"))
+		_lvmlockd_batch_max = daemon_reply_int(reply, "lock_lv_batch", 0);
+	else
+		_lvmlockd_batch_max = 0;
+
+	daemon_reply_destroy(reply);
+
+	log_debug("lvmlockd lock_lv_batch max %d", _lvmlockd_batch_max);
+
+	return _lvmlockd_batch_max;
+}
+
+/*
+ * Returns 1 when the lvmlockd in use takes LV lock batches and
+ * lockd_lv_name will collect the LV locks of vg until
+ * lockd_lv_batch_send.  With unlock set, only unlocks are collected,
+ * otherwise only locks.
+ */
+int lockd_lv_batch_begin(struct cmd_context *cmd, struct volume_group *vg, int unlock)
+{
+	if (!is_lockd_type(vg->lock_type) || !_use_lvmlockd || !_lvmlockd_connected)
+		return 0;
+
+	if (_lv_batch.mem) {
+		log_error(INTERNAL_ERROR "lvmlockd LV lock batch already started.");
+		return 0;
+	}
+
+	if (_lv_batch_max() <= 0)
+		return 0;
+
+	if (!(_lv_batch.mem = dm_pool_create("lockd_lv_batch", 1024)))
+		return_0;
+
+	_lv_batch.vg = vg;
+	dm_list_init(&_lv_batch.locks);
+	_lv_batch.count = 0;
+	_lv_batch.collecting = 1;
+	_lv_batch.sent = 0;
+	_lv_batch.unlock = unlock ? 1 : 0;
+
+	return 1;
+}
+
+static int _lv_batch_request(struct cmd_context *cmd, struct dm_list *start, unsigned count)
+{
+	struct volume_group *vg = _lv_batch.vg;
+	const char *cmd_name = get_cmd_name();
+	struct lv_batch_lock *lbl;
+	daemon_request req;
+	daemon_reply reply;
+	struct dm_list *lh;
+	char fmt[64];
+	int result;
+	unsigned i;
+	int r = 0;
+
+	if (!cmd_name || !cmd_name[0])
+		cmd_name = "none";
+
+	req = daemon_request_make("lock_lv_batch");
+
+	if (!daemon_request_extend(req,
+				   "cmd = %s", cmd_name,
+				   "pid = " FMTd64, (int64_t) getpid(),
+				   "vg_name = %s", vg->name,
+				   "vg_lock_type = %s", vg->lock_type ?: "none",
+				   "vg_lock_args = %s", vg->lock_args ?: "none",
+				   "count = " FMTd64, (int64_t) count,
+				   NULL))
+		goto_out;
+
+	for (i = 0, lh = start; i < count; i++, lh = lh->n) {
+		lbl = dm_list_item(lh, struct lv_batch_lock);
+		if ((dm_snprintf(fmt, sizeof(fmt), "lv_name_%u = %%s", i) < 0) ||
+		    !daemon_request_extend(req, fmt, lbl->lv_name, NULL) ||
+		    (dm_snprintf(fmt, sizeof(fmt), "lv_uuid_%u = %%s", i) < 0) ||
+		    !daemon_request_extend(req, fmt, lbl->lv_uuid, NULL) ||
+		    (dm_snprintf(fmt, sizeof(fmt), "lv_lock_args_%u = %%s", i) < 0) ||
+		    !daemon_request_extend(req, fmt, lbl->lock_args ?: "none", NULL) ||
+		    (dm_snprintf(fmt, sizeof(fmt), "mode_%u = %%s", i) < 0) ||
+		    !daemon_request_extend(req, fmt, lbl->mode, NULL))
+			goto_out;
+	}
+
+	/* The batch takes the persistent option of its first lock. */
+	lbl = dm_list_item(start, struct lv_batch_lock);
+	if (lbl->opts && !daemon_request_extend(req, "opts = %s", lbl->opts, NULL))
+		goto_out;
+
+	reply = daemon_send(_lvmlockd, req);
+
+	if (_lockd_result(reply, &result, NULL)) {
+		log_debug("lvmlockd lock_lv_batch %s vg %s count %u result %d",
+			  _lv_batch.unlock ? "un" : "lock", vg->name, count, result);
+
+		for (i = 0, lh = start; !result && (i < count); i++, lh = lh->n) {
+			lbl = dm_list_item(lh, struct lv_batch_lock);
+			if (dm_snprintf(fmt, sizeof(fmt), "op_result_%u", i) < 0)
+				break;
+			lbl->result = daemon_reply_int(reply, fmt, NO_LOCKD_RESULT);
+		}
+		r = 1;
+	}
+
+	daemon_reply_destroy(reply);
+out:
+	daemon_request_destroy(req);
+
+	return r;
+}
+
+/*
+ * Sends the collected LV locks in batches as large as lvmlockd takes.
+ * Locks that the batch could not get are left to be requested again
+ * by lockd_lv_name.  Unlocks that failed are retried here individually.
+ */
+int lockd_lv_batch_send(struct cmd_context *cmd)
+{
+	struct lv_batch_lock *lbl;
+	struct dm_list *start = dm_list_first(&_lv_batch.locks);
+	unsigned count, sent = 0;
+	int r = 1;
+
+	if (!_lv_batch.collecting)
+		return 1;
+
+	_lv_batch.collecting = 0;
+	_lv_batch.sent = 1;
+
+	if (_lv_batch.count)
+		log_verbose("Sending %u LV %s to lvmlockd for VG %s.", _lv_batch.count,
+			    _lv_batch.unlock ? "unlocks" : "locks", _lv_batch.vg->name);
+
+	while (sent < _lv_batch.count) {
+		count = _lv_batch.count - sent;
+		if (count > (unsigned) _lvmlockd_batch_max)
+			count = _lvmlockd_batch_max;
+
+		if (!_lv_batch_request(cmd, start, count))
+			log_debug("lvmlockd lock_lv_batch failed no result");
+
+		for (sent += count; count--; start = start->n)
+			;
+	}
+
+	if (!_lv_batch.unlock)
+		return 1;
+
+	dm_list_iterate_items(lbl, &_lv_batch.locks) {
+		if (!lbl->result || (lbl->result == -ENOENT))
+			continue;
+		if (!lockd_lv_name(cmd, _lv_batch.vg, lbl->lv_name, &lbl->lv_id, lbl->lock_args,
+				   "un", lbl->opts ? LDLV_PERSISTENT : 0)) {
+			log_error("Failed to unlock logical volume %s/%s.",
+				  _lv_batch.vg->name, lbl->lv_name);
+			r = 0;
+		}
+	}
+
+	return r;
+}
+
+/*
+ * Ends the batch.  LV locks that the batch acquired and that
+ * were not then used by lockd_lv_name are released.
+ */
+void lockd_lv_batch_end(struct cmd_context *cmd)
+{
+	struct lv_batch_lock *lbl;
+	struct dm_pool *mem = _lv_batch.mem;
+
+	if (!mem)
+		return;
+
+	if (_lv_batch.collecting)
+		(void) lockd_lv_batch_send(cmd);
+
+	_lv_batch.mem = NULL;
+	_lv_batch.sent = 0;
+
+	if (!_lv_batch.unlock)
+		dm_list_iterate_items(lbl, &_lv_batch.locks)
+			if (!lbl->result && !lbl->used)
+				(void) lockd_lv_name(cmd, _lv_batch.vg, lbl->lv_name, &lbl->lv_id,
+						     lbl->lock_args, "un",
+						     lbl->opts ? LDLV_PERSISTENT : 0);
+
+	_lv_batch.vg = NULL;
+	dm_pool_destroy(mem);
+}
+
 /*
  * When this is called directly (as opposed to being called from
  * lockd_lv), the caller knows that the LV has a lock.
@@ -2058,25 +2356,36 @@ int lockd_lv_name(struct cmd_context *cmd, struct volume_group *vg,
 
 	if (mode && !strcmp(mode, "sh") && (flags & LDLV_MODE_NO_SH)) {
 		struct logical_volume *lv = find_lv(vg, lv_name);
+
+		/* Reported when the LV itself is activated. */
+		if (_lv_batch.collecting && !_lv_batch.unlock)
+			return 1;
+
 		log_error("Shared activation not compatible with LV type %s of %s/%s",
 			  lv ? lvseg_name(first_seg(lv)) : "", vg->name, lv_name);
 		return 0;
 	}
 
+	if (!mode)
+		mode = "ex";
+
+	if (flags & LDLV_PERSISTENT)
+		opts = "persistent";
+
+	if (_lv_batch_add(vg, lv_name, lv_id, lv_uuid, lock_args, mode, opts))
+		return 1;
+
 	/*
 	 * This is a hack for mirror LVs which need to know at a very low level
 	 * which lock mode the LV is being activated with so that it can pick
 	 * a mirror log type during activation.  Do not use this for anything
 	 * else.
 	 */
-	if (mode && !strcmp(mode, "sh"))
+	if (!strcmp(mode, "sh"))
 		cmd->lockd_lv_sh = 1;
 
-	if (!mode)
-		mode = "ex";
-
-	if (flags & LDLV_PERSISTENT)
-		opts = "persistent";
+	if (_lv_batch_locked(vg, lv_uuid, mode))
+		return 1;
 
  retry:
 	log_debug("lockd LV %s/%s mode %s uuid %s", vg->name, lv_name, mode, lv_uuid);
@@ -81,6 +81,12 @@ int lockd_lv_name(struct cmd_context *cmd, struct volume_group *vg,
 int lockd_lv(struct cmd_context *cmd, struct logical_volume *lv,
 	     const char *def_mode, uint32_t flags);
 
+/* lock or unlock many LVs of a VG with one request */
+
+int lockd_lv_batch_begin(struct cmd_context *cmd, struct volume_group *vg, int unlock);
+int lockd_lv_batch_send(struct cmd_context *cmd);
+void lockd_lv_batch_end(struct cmd_context *cmd);
+
 /* lvcreate/lvremove use init/free */
 
 int lockd_init_lv(struct cmd_context *cmd, struct volume_group *vg, struct logical_volume *lv,
@@ -206,6 +212,20 @@ static inline int lockd_lv(struct cmd_context *cmd, struct logical_volume *lv,
 	return 1;
 }
 
+static inline int lockd_lv_batch_begin(struct cmd_context *cmd, struct volume_group *vg, int unlock)
+{
+	return 0;
+}
+
+static inline int lockd_lv_batch_send(struct cmd_context *cmd)
+{
+	return 1;
+}
+
+static inline void lockd_lv_batch_end(struct cmd_context *cmd)
+{
+}
+
 static inline int lockd_init_lv(struct cmd_context *cmd, struct volume_group *vg,
 		  	struct logical_volume *lv, struct lvcreate_params *lp)
 {
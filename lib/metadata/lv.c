@@ -1458,8 +1458,12 @@ static int _lv_is_exclusive(struct logical_volume *lv)
 	return lv_is_origin(lv);
 }
 
-int lv_active_change(struct cmd_context *cmd, struct logical_volume *lv,
-		     enum activation_change activate, int needs_exclusive)
+/*
+ * Acquire the LV lock that lv_active_change takes for an activation.
+ * This lets callers lock many LVs first, e.g. in one lvmlockd batch.
+ */
+int lv_active_change_lock(struct cmd_context *cmd, struct logical_volume *lv,
+			  enum activation_change activate)
 {
 	const char *ay_with_mode = NULL;
 
@@ -1467,9 +1471,15 @@ int lv_active_change(struct cmd_context *cmd, struct logical_volume *lv,
 		ay_with_mode = "sh";
 	if (activate == CHANGE_AEY)
 		ay_with_mode = "ex";
-	
+
+	return lockd_lv(cmd, lv, ay_with_mode, LDLV_PERSISTENT);
+}
+
+int lv_active_change(struct cmd_context *cmd, struct logical_volume *lv,
+		     enum activation_change activate, int needs_exclusive)
+{
 	if (is_change_activating(activate) &&
-	    !lockd_lv(cmd, lv, ay_with_mode, LDLV_PERSISTENT)) {
+	    !lv_active_change_lock(cmd, lv, activate)) {
 		log_error("Failed to lock logical volume %s.", display_lvname(lv));
 		return 0;
 	}
@@ -4656,6 +4656,24 @@ static uint32_t _adjust_amount(dm_percent_t percent, int policy_threshold, int p
 	return (policy_amount < percent) ? (uint32_t) percent : (uint32_t) policy_amount;
 }
 
+/*
+ * dmeventd passes the projected seconds until the thin pool data or metadata
+ * runs out of space when it runs the policy ahead of the threshold.
+ */
+static int _thin_pool_predicted_full(const struct logical_volume *lv, const char *name)
+{
+	const char *str = getenv(name);
+	int64_t ttf;
+
+	if (!str || (sscanf(str, FMTd64, &ttf) != 1) || (ttf < 0))
+		return 0;
+
+	log_verbose("Extending %s projected to fill in " FMTd64 " seconds.",
+		    display_lvname(lv), ttf);
+
+	return 1;
+}
+
 static int _lvresize_adjust_policy(const struct logical_volume *lv,
 				   uint32_t *amount, uint32_t *meta_amount)
 {
@@ -4713,6 +4731,10 @@ static int _lvresize_adjust_policy(const struct logical_volume *lv,
 		min_threshold = pool_metadata_min_threshold(first_seg(lv)) / DM_PERCENT_1;
 		*meta_amount = _adjust_amount(percent, (min_threshold < policy_threshold) ?
 					      min_threshold : policy_threshold, policy_amount);
+		if (!*meta_amount &&
+		    _thin_pool_predicted_full(first_seg(lv)->metadata_lv,
+					      "DMEVENTD_THIN_POOL_METADATA_TIME_TO_FULL"))
+			*meta_amount = policy_amount;
 
 		if (!lv_thin_pool_percent(lv, 0, &percent))
 			return_0;
@@ -4723,6 +4745,10 @@ static int _lvresize_adjust_policy(const struct logical_volume *lv,
 
 	*amount = _adjust_amount(percent, policy_threshold, policy_amount);
 
+	if (!*amount && lv_is_thin_pool(lv) &&
+	    _thin_pool_predicted_full(lv, "DMEVENTD_THIN_POOL_DATA_TIME_TO_FULL"))
+		*amount = policy_amount;
+
 	return 1;
 }
 
@@ -88,6 +88,9 @@ static void _free_vg(struct volume_group *vg)
 
 	log_debug_mem("Freeing VG %s at %p.", vg->name ? : "<no name>", vg);
 
+	if (vg->lvmetad_base)
+		dm_config_destroy(vg->lvmetad_base);
+
 	dm_hash_destroy(vg->hostnames);
 	dm_pool_destroy(vg->vgmem);
 }
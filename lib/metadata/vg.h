@@ -61,6 +61,12 @@ struct volume_group {
 	struct volume_group *vg_committed;
 	struct volume_group *vg_precommitted;
 
+	/*
+	 * The metadata lvmetad holds for this VG when it was read from or
+	 * last sent to lvmetad; updates are sent as a delta against it.
+	 */
+	struct dm_config_tree *lvmetad_base;
+
 	alloc_policy_t alloc;
 	struct profile *profile;
 	uint64_t status;
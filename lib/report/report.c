@@ -3785,6 +3785,19 @@ static int _lvhistorical_disp(struct dm_report *rh, struct dm_pool *mem,
 	return _binary_disp(rh, mem, field, lv_is_historical(lv), "historical", private);
 }
 
+static int _lvtimetofull_disp(struct dm_report *rh, struct dm_pool *mem,
+			      struct dm_report_field *field,
+			      const void *data, void *private)
+{
+	const struct logical_volume *lv = (const struct logical_volume *) data;
+	uint64_t seconds;
+
+	if (lv_is_thin_pool(lv) && lv_thin_pool_time_to_full(lv, &seconds))
+		return dm_report_field_uint64(rh, field, &seconds);
+
+	return _field_set_value(field, "", &GET_TYPE_RESERVED_VALUE(num_undef_64));
+}
+
 /*
  * Macro to generate '_cache_<cache_status_field_name>_disp' reporting function.
  * The 'cache_status_field_name' is field name from struct dm_cache_status.
@@ -50,7 +50,9 @@ daemon_handle daemon_open(daemon_info i)
 	}
 
 	log_debug("Sending daemon %s: hello", i.path);
-	r = daemon_send_simple(h, "hello", NULL);
+	r = daemon_send_simple(h, "hello",
+			       "framing = " FMTd64, (int64_t) DAEMON_FRAMING_LENGTH,
+			       NULL);
 	if (r.error || strcmp(daemon_reply_str(r, "response", "unknown"), "OK")) {
 		h.error = r.error;
 		log_error("Daemon %s returned error %d", i.path, r.error);
@@ -63,6 +65,10 @@ daemon_handle daemon_open(daemon_info i)
 		h.protocol = dm_strdup(h.protocol); /* keep around */
 	h.protocol_version = daemon_reply_int(r, "version", 0);
 
+	/* Daemons not knowing about framing do not reply with it. */
+	if (daemon_reply_int(r, "framing", DAEMON_FRAMING_NONE) == DAEMON_FRAMING_LENGTH)
+		h.framing = DAEMON_FRAMING_LENGTH;
+
 	if (i.protocol && (!h.protocol || strcmp(h.protocol, i.protocol))) {
 		log_error("Daemon %s: requested protocol %s != %s",
 			i.path, i.protocol, h.protocol ? : "");
@@ -116,10 +122,10 @@ daemon_reply daemon_send(daemon_handle h, daemon_request rq)
 		return reply;
 	}
 
-	if (!buffer_write(h.socket_fd, &buffer))
+	if (!buffer_write_framed(h.socket_fd, &buffer, h.framing))
 		reply.error = errno;
 
-	if (buffer_read(h.socket_fd, &reply.buffer)) {
+	if (buffer_read_framed(h.socket_fd, &reply.buffer, h.framing)) {
 		reply.cft = config_tree_from_string_without_dup_node_check(reply.buffer.mem);
 		if (!reply.cft)
 			reply.error = EPROTO;
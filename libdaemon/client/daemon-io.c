@@ -19,6 +19,155 @@
 #include "daemon-io.h"
 
 #include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/uio.h>
+
+/*
+ * With DAEMON_FRAMING_LENGTH each message is preceded by a header with
+ * a magic and the payload length (big endian) instead of being followed
+ * by the "\n##\n" terminator.
+ */
+#define FRAME_MAGIC "#LF1"
+#define FRAME_HEADER_SIZE 8
+
+/* Sleep until fd is readable (in) or writable (!in). */
+static void _wait_fd(int fd, int in)
+{
+	struct pollfd pfd = { .fd = fd, .events = in ? POLLIN : POLLOUT };
+
+	/* ignore the result, this is just a glorified sleep */
+	(void) poll(&pfd, 1, -1);
+}
+
+static int _retry_errno(void)
+{
+	return (errno == EAGAIN ||
+		(EWOULDBLOCK != EAGAIN && errno == EWOULDBLOCK) ||
+		errno == EINTR || errno == EIO);
+}
+
+/* Read exactly size bytes into mem. */
+static int _read_all(int fd, char *mem, size_t size)
+{
+	ssize_t result;
+	size_t done = 0;
+
+	while (done < size) {
+		result = read(fd, mem + done, size - done);
+		if (result > 0)
+			done += result;
+		else if (result == 0) {
+			errno = ECONNRESET;
+			return 0; /* we should never encounter EOF here */
+		} else if (_retry_errno())
+			_wait_fd(fd, 1);
+		else
+			return 0;
+	}
+
+	return 1;
+}
+
+static uint32_t _frame_length(const char *header)
+{
+	const unsigned char *h = (const unsigned char *) header;
+
+	return ((uint32_t) h[4] << 24) | ((uint32_t) h[5] << 16) |
+	       ((uint32_t) h[6] << 8) | (uint32_t) h[7];
+}
+
+static int _buffer_read_length(int fd, struct buffer *buffer)
+{
+	unsigned char header[FRAME_HEADER_SIZE];
+	uint32_t length;
+
+	if (!_read_all(fd, (char *) header, sizeof(header)))
+		return 0;
+
+	if (memcmp(header, FRAME_MAGIC, 4)) {
+		errno = EPROTO;
+		return 0;
+	}
+
+	length = _frame_length((const char *) header);
+
+	if (length >= INT_MAX) {
+		errno = EPROTO;
+		return 0;
+	}
+
+	/* The size is known up front, allocate it at once. */
+	if ((buffer->allocated - buffer->used <= (int) length) &&
+	    !buffer_realloc(buffer, length + 1))
+		return 0;
+
+	if (!_read_all(fd, buffer->mem + buffer->used, length))
+		return 0;
+
+	buffer->used += length;
+	buffer->mem[buffer->used] = 0;
+
+	return 1;
+}
+
+/*
+ * Read whatever is available on a non-blocking fd and append it to buffer.
+ * Returns 1 once buffer holds a complete message, which is then stripped
+ * of its framing like buffer_read() does.  Returns 0 with errno EAGAIN
+ * while the message is incomplete, any other errno is an error.
+ */
+int buffer_read_available(int fd, struct buffer *buffer, int framing)
+{
+	ssize_t result;
+	size_t want;
+	uint32_t length;
+
+	while (1) {
+		if (framing != DAEMON_FRAMING_LENGTH)
+			want = 1024;
+		else if (buffer->used < FRAME_HEADER_SIZE)
+			want = FRAME_HEADER_SIZE - buffer->used;
+		else {
+			length = _frame_length(buffer->mem);
+			if (memcmp(buffer->mem, FRAME_MAGIC, 4) || (length >= INT_MAX)) {
+				errno = EPROTO;
+				return 0;
+			}
+
+			/* Never read past the end of this message. */
+			if (!(want = FRAME_HEADER_SIZE + length - buffer->used)) {
+				memmove(buffer->mem, buffer->mem + FRAME_HEADER_SIZE, length);
+				buffer->used = length;
+				buffer->mem[buffer->used] = 0;
+				return 1;
+			}
+		}
+
+		if ((buffer->allocated - buffer->used <= (int) want) &&
+		    !buffer_realloc(buffer, want + 1))
+			return 0;
+
+		result = read(fd, buffer->mem + buffer->used, want);
+		if (result == 0) {
+			errno = ECONNRESET;
+			return 0;
+		}
+		if (result < 0) {
+			if (errno == EINTR)
+				continue;
+			return 0; /* EAGAIN included */
+		}
+		buffer->used += result;
+
+		if ((framing != DAEMON_FRAMING_LENGTH) && buffer->used >= 4 &&
+		    !strncmp(buffer->mem + buffer->used - 4, "\n##\n", 4)) {
+			buffer->used -= 4;
+			buffer->mem[buffer->used] = 0;
+			return 1;
+		}
+	}
+}
 
 /*
  * Read a single message from a (socket) filedescriptor. Messages are delimited
@@ -29,8 +178,15 @@
  * See also write_buffer about blocking (read_buffer has identical behaviour).
  */
 int buffer_read(int fd, struct buffer *buffer) {
+	return buffer_read_framed(fd, buffer, DAEMON_FRAMING_NONE);
+}
+
+int buffer_read_framed(int fd, struct buffer *buffer, int framing) {
 	int result;
 
+	if (framing == DAEMON_FRAMING_LENGTH)
+		return _buffer_read_length(fd, buffer);
+
 	if (!buffer_realloc(buffer, 32)) /* ensure we have some space */
 		return 0;
 
@@ -49,14 +205,8 @@ int buffer_read(int fd, struct buffer *buffer) {
 		} else if (result == 0) {
 			errno = ECONNRESET;
 			return 0; /* we should never encounter EOF here */
-		} else if (result < 0 && (errno == EAGAIN ||
-					  (EWOULDBLOCK != EAGAIN && errno == EWOULDBLOCK) ||
-					  errno == EINTR || errno == EIO)) {
-			fd_set in;
-			FD_ZERO(&in);
-			FD_SET(fd, &in);
-			/* ignore the result, this is just a glorified sleep */
-			select(FD_SETSIZE, &in, NULL, NULL, NULL);
+		} else if (result < 0 && _retry_errno()) {
+			_wait_fd(fd, 1);
 		} else if (result < 0)
 			return 0;
 	}
@@ -64,30 +214,78 @@ int buffer_read(int fd, struct buffer *buffer) {
 	return 1;
 }
 
+/* Write the header and the payload, both in one writev() if possible. */
+static int _buffer_write_length(int fd, const struct buffer *buffer)
+{
+	unsigned char header[FRAME_HEADER_SIZE];
+	struct iovec iov[2];
+	uint32_t length = buffer->used;
+	size_t total = sizeof(header) + length;
+	size_t written = 0;
+	ssize_t result;
+	int i;
+
+	memcpy(header, FRAME_MAGIC, 4);
+	header[4] = (length >> 24) & 0xff;
+	header[5] = (length >> 16) & 0xff;
+	header[6] = (length >> 8) & 0xff;
+	header[7] = length & 0xff;
+
+	while (written < total) {
+		iov[0].iov_base = header;
+		iov[0].iov_len = sizeof(header);
+		iov[1].iov_base = buffer->mem;
+		iov[1].iov_len = length;
+
+		/* Skip what was already written. */
+		for (i = 0, result = written; i < 2; i++) {
+			if ((size_t) result >= iov[i].iov_len) {
+				result -= iov[i].iov_len;
+				iov[i].iov_len = 0;
+			} else {
+				iov[i].iov_base = (char *) iov[i].iov_base + result;
+				iov[i].iov_len -= result;
+				break;
+			}
+		}
+
+		result = writev(fd, iov, 2);
+		if (result > 0)
+			written += result;
+		else if (result < 0 && _retry_errno())
+			_wait_fd(fd, 0);
+		else if (result < 0)
+			return 0; /* too bad */
+	}
+
+	return 1;
+}
+
 /*
  * Write a buffer to a filedescriptor. Keep trying. Blocks (even on
  * SOCK_NONBLOCK) until all of the write went through.
  */
 int buffer_write(int fd, const struct buffer *buffer) {
+	return buffer_write_framed(fd, buffer, DAEMON_FRAMING_NONE);
+}
+
+int buffer_write_framed(int fd, const struct buffer *buffer, int framing) {
 	static const struct buffer _terminate = { .mem = (char *) "\n##\n", .used = 4 };
 	const struct buffer *use;
 	int done, written, result;
 
+	if (framing == DAEMON_FRAMING_LENGTH)
+		return _buffer_write_length(fd, buffer);
+
 	for (done = 0; done < 2; ++done) {
 		use = (done == 0) ? buffer : &_terminate;
 		for (written = 0; written < use->used;) {
 			result = write(fd, use->mem + written, use->used - written);
 			if (result > 0)
 				written += result;
-			else if (result < 0 && (errno == EAGAIN ||
-						(EWOULDBLOCK != EAGAIN && errno == EWOULDBLOCK) ||
-						errno == EINTR || errno == EIO)) {
-				fd_set out;
-				FD_ZERO(&out);
-				FD_SET(fd, &out);
-				/* ignore the result, this is just a glorified sleep */
-				select(FD_SETSIZE, NULL, &out, NULL, NULL);
-			} else if (result < 0)
+			else if (result < 0 && _retry_errno())
+				_wait_fd(fd, 0);
+			else if (result < 0)
 				return 0; /* too bad */
 		}
 	}
@@ -19,7 +19,18 @@
 
 /* TODO function names */
 
+/*
+ * Message framing, negotiated per connection with the "framing" field
+ * of the hello request and reply.  Peers not knowing about it keep
+ * using DAEMON_FRAMING_NONE.
+ */
+#define DAEMON_FRAMING_NONE	0	/* message followed by "\n##\n" */
+#define DAEMON_FRAMING_LENGTH	1	/* message preceded by its length */
+
 int buffer_read(int fd, struct buffer *buffer);
 int buffer_write(int fd, const struct buffer *buffer);
+int buffer_read_framed(int fd, struct buffer *buffer, int framing);
+int buffer_write_framed(int fd, const struct buffer *buffer, int framing);
+int buffer_read_available(int fd, struct buffer *buffer, int framing);
 
 #endif /* _LVM_DAEMON_IO_H */
@@ -28,6 +28,7 @@
 #include <sys/resource.h>
 #include <netinet/in.h>
 #include <sys/un.h>
+#include <sys/epoll.h>
 #include <unistd.h>
 #include <signal.h>
 
@@ -82,22 +83,74 @@ static void _exit_handler(int sig __attribute__((unused)))
 #  define SD_LISTEN_FDS_START 3
 #  define SD_FD_SOCKET_SERVER SD_LISTEN_FDS_START
 
-static int _is_idle(daemon_state s)
+/*
+ * Requests are read by the main loop and handled by a fixed number of
+ * worker threads.  Every connection has at most one request queued or in
+ * progress and is only watched for the next one after the reply is sent,
+ * so the FIFO queue serves clients round robin.  While the queue holds
+ * max_queue requests or more, no new connections are accepted.
+ */
+#define DAEMON_WORKER_THREADS		8
+#define DAEMON_QUEUE_PER_WORKER		16
+#define DAEMON_EPOLL_EVENTS		32
+
+/* A client connection, owned either by the main loop or by one worker. */
+struct daemon_conn {
+	struct dm_list list;	/* in pool->queue */
+	client_handle client;
+	struct buffer buffer;	/* the request being received */
+	uint64_t queued;	/* when the request was complete */
+};
+
+struct daemon_pool {
+	daemon_state s;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct dm_list queue;
+	pthread_t *workers;
+	int worker_count;
+	int max_queue;
+	int epoll_fd;
+	int wake_fd[2];
+	int accept_paused;
+	int stop;
+
+	/* Protected by mutex. */
+	unsigned connections;
+	unsigned queue_depth;
+	unsigned queue_depth_max;
+	uint64_t accept_pauses;
+	uint64_t requests;
+	uint64_t wait_ns;
+	uint64_t wait_max_ns;
+	uint64_t latency_ns;
+	uint64_t latency_max_ns;
+};
+
+static uint64_t _now_ns(void)
 {
-	return s.idle && s.idle->is_idle && !s.threads->next;
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		return 0;
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
-static struct timeval *_get_timeout(daemon_state s)
+static unsigned _connections(struct daemon_pool *pool)
 {
-	return s.idle ? s.idle->ptimeout : NULL;
+	unsigned connections;
+
+	pthread_mutex_lock(&pool->mutex);
+	connections = pool->connections;
+	pthread_mutex_unlock(&pool->mutex);
+
+	return connections;
 }
 
-static void _reset_timeout(daemon_state s)
+static int _is_idle(daemon_state s)
 {
-	if (s.idle) {
-		s.idle->ptimeout->tv_sec = 1;
-		s.idle->ptimeout->tv_usec = 0;
-	}
+	return s.idle && s.idle->is_idle && !_connections(s.pool);
 }
 
 static unsigned _get_max_timeouts(daemon_state s)
@@ -298,7 +351,7 @@ static int _open_socket(daemon_state s)
 
 	file_created = 1;
 
-	if (listen(fd, 1) != 0) {
+	if (listen(fd, SOMAXCONN) != 0) {
 		perror("listen local");
 		goto error;
 	}
@@ -434,6 +487,44 @@ end:
 	return res;
 }
 
+/*
+ * Framing to use after replying to the hello request r, old clients
+ * do not ask for any.
+ */
+static int _hello_framing(request r)
+{
+	if (r.cft && !strcmp(daemon_request_str(r, "request", "NONE"), "hello") &&
+	    daemon_request_int(r, "framing", DAEMON_FRAMING_NONE) >= DAEMON_FRAMING_LENGTH)
+		return DAEMON_FRAMING_LENGTH;
+
+	return DAEMON_FRAMING_NONE;
+}
+
+static response _daemon_stats(struct daemon_pool *pool)
+{
+	response res;
+
+	pthread_mutex_lock(&pool->mutex);
+	res = daemon_reply_simple("OK",
+				  "worker_threads = %" PRId64, (int64_t) pool->worker_count,
+				  "connections = %" PRId64, (int64_t) pool->connections,
+				  "queue_depth = %" PRId64, (int64_t) pool->queue_depth,
+				  "queue_depth_max = %" PRId64, (int64_t) pool->queue_depth_max,
+				  "queue_limit = %" PRId64, (int64_t) pool->max_queue,
+				  "accept_pauses = %" PRId64, (int64_t) pool->accept_pauses,
+				  "requests = %" PRId64, (int64_t) pool->requests,
+				  "queue_wait_avg_us = %" PRId64,
+				  (int64_t) (pool->requests ? pool->wait_ns / pool->requests / 1000 : 0),
+				  "queue_wait_max_us = %" PRId64, (int64_t) (pool->wait_max_ns / 1000),
+				  "latency_avg_us = %" PRId64,
+				  (int64_t) (pool->requests ? pool->latency_ns / pool->requests / 1000 : 0),
+				  "latency_max_us = %" PRId64, (int64_t) (pool->latency_max_ns / 1000),
+				  NULL);
+	pthread_mutex_unlock(&pool->mutex);
+
+	return res;
+}
+
 static response _builtin_handler(daemon_state s, client_handle h, request r)
 {
 	const char *rq = daemon_request_str(r, "request", "NONE");
@@ -441,126 +532,350 @@ static response _builtin_handler(daemon_state s, client_handle h, request r)
 
 	if (!strcmp(rq, "hello")) {
 		return daemon_reply_simple("OK", "protocol = %s", s.protocol ?: "default",
-					   "version = %" PRId64, (int64_t) s.protocol_version, NULL);
+					   "version = %" PRId64, (int64_t) s.protocol_version,
+					   "framing = %" PRId64, (int64_t) _hello_framing(r), NULL);
 	}
 
+	if (!strcmp(rq, "daemon_stats") && s.pool)
+		return _daemon_stats(s.pool);
+
 	buffer_init(&res.buffer);
 	return res;
 }
 
-static void *_client_thread(void *state)
+/* Handle the complete request in conn->buffer and send the reply. */
+static int _handle_request(struct daemon_pool *pool, struct daemon_conn *conn)
 {
-	thread_state *ts = state;
-	request req;
+	request req = { .buffer = conn->buffer };
 	response res;
+	int framing;
+	int r = 1;
 
-	buffer_init(&req.buffer);
+	req.cft = config_tree_from_string_without_dup_node_check(req.buffer.mem);
 
-	while (1) {
-		if (!buffer_read(ts->client.socket_fd, &req.buffer))
-			goto fail;
+	if (!req.cft)
+		fprintf(stderr, "error parsing request:\n %s\n", req.buffer.mem);
+	else
+		daemon_log_cft(pool->s.log, DAEMON_LOG_WIRE, "<- ", req.cft->root);
 
-		req.cft = config_tree_from_string_without_dup_node_check(req.buffer.mem);
+	conn->client.thread_id = pthread_self();
 
-		if (!req.cft)
-			fprintf(stderr, "error parsing request:\n %s\n", req.buffer.mem);
-		else
-			daemon_log_cft(ts->s.log, DAEMON_LOG_WIRE, "<- ", req.cft->root);
+	res = _builtin_handler(pool->s, conn->client, req);
 
-		res = _builtin_handler(ts->s, ts->client, req);
+	if (res.error == EPROTO) /* Not a builtin, delegate to the custom handler. */
+		res = pool->s.handler(pool->s, conn->client, req);
 
-		if (res.error == EPROTO) /* Not a builtin, delegate to the custom handler. */
-			res = ts->s.handler(ts->s, ts->client, req);
+	/* The reply to hello still uses the old framing. */
+	framing = conn->client.framing;
+	if (_hello_framing(req) != DAEMON_FRAMING_NONE)
+		conn->client.framing = _hello_framing(req);
 
-		if (!res.buffer.mem) {
-			if (!dm_config_write_node(res.cft->root, buffer_line, &res.buffer))
-				goto fail;
-			if (!buffer_append(&res.buffer, "\n\n"))
-				goto fail;
-			dm_config_destroy(res.cft);
-		}
+	if (req.cft)
+		dm_config_destroy(req.cft);
+	buffer_destroy(&conn->buffer);
 
-		if (req.cft)
-			dm_config_destroy(req.cft);
-		buffer_destroy(&req.buffer);
+	if (!res.buffer.mem) {
+		if (!dm_config_write_node(res.cft->root, buffer_line, &res.buffer) ||
+		    !buffer_append(&res.buffer, "\n\n"))
+			r = 0;
+		dm_config_destroy(res.cft);
+	}
+
+	if (r) {
+		daemon_log_multi(pool->s.log, DAEMON_LOG_WIRE, "-> ", res.buffer.mem);
+		if (!buffer_write_framed(conn->client.socket_fd, &res.buffer, framing))
+			r = 0;
+	}
+
+	buffer_destroy(&res.buffer);
 
-		daemon_log_multi(ts->s.log, DAEMON_LOG_WIRE, "-> ", res.buffer.mem);
-		buffer_write(ts->client.socket_fd, &res.buffer);
+	return r;
+}
+
+/* Watch conn for its next request, the main loop owns it again then. */
+static int _conn_watch(struct daemon_pool *pool, struct daemon_conn *conn, int op)
+{
+	struct epoll_event ev = { .events = EPOLLIN | EPOLLONESHOT, .data.ptr = conn };
 
-		buffer_destroy(&res.buffer);
+	if (epoll_ctl(pool->epoll_fd, op, conn->client.socket_fd, &ev)) {
+		ERROR(&pool->s, "Failed to watch client socket fd %d: %s.",
+		      conn->client.socket_fd, strerror(errno));
+		return 0;
 	}
-fail:
-	/* TODO what should we really do here? */
-	if (close(ts->client.socket_fd))
+
+	return 1;
+}
+
+static void _conn_close(struct daemon_pool *pool, struct daemon_conn *conn)
+{
+	/* Closing the fd also drops it from the epoll set. */
+	if (close(conn->client.socket_fd))
 		perror("close");
-	buffer_destroy(&req.buffer);
-	ts->active = 0;
+	buffer_destroy(&conn->buffer);
+	dm_free(conn);
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->connections--;
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+static void *_worker_thread(void *arg)
+{
+	struct daemon_pool *pool = arg;
+	struct daemon_conn *conn;
+	uint64_t start, ns;
+	int wake;
+
+	while (1) {
+		pthread_mutex_lock(&pool->mutex);
+		while (dm_list_empty(&pool->queue) && !pool->stop)
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+
+		if (dm_list_empty(&pool->queue)) {
+			pthread_mutex_unlock(&pool->mutex);
+			break;
+		}
+
+		conn = dm_list_item(dm_list_first(&pool->queue), struct daemon_conn);
+		dm_list_del(&conn->list);
+		/* Let the main loop accept again once below the limit. */
+		wake = (pool->queue_depth-- == (unsigned) pool->max_queue);
+
+		start = _now_ns();
+		ns = start - conn->queued;
+		pool->wait_ns += ns;
+		if (ns > pool->wait_max_ns)
+			pool->wait_max_ns = ns;
+		pthread_mutex_unlock(&pool->mutex);
+
+		if (wake && (write(pool->wake_fd[1], "", 1) < 0) && (errno != EAGAIN))
+			perror("wake write");
+
+		if (!_handle_request(pool, conn)) {
+			_conn_close(pool, conn);
+			continue;
+		}
+
+		ns = _now_ns() - start;
+		pthread_mutex_lock(&pool->mutex);
+		pool->requests++;
+		pool->latency_ns += ns;
+		if (ns > pool->latency_max_ns)
+			pool->latency_max_ns = ns;
+		pthread_mutex_unlock(&pool->mutex);
+
+		if (!_conn_watch(pool, conn, EPOLL_CTL_MOD))
+			_conn_close(pool, conn);
+	}
+
 	return NULL;
 }
 
-static int _handle_connect(daemon_state s)
+/* Read what the client sent, queue the request once it is complete. */
+static void _handle_input(struct daemon_pool *pool, struct daemon_conn *conn)
 {
-	thread_state *ts;
+	if (!buffer_read_available(conn->client.socket_fd, &conn->buffer, conn->client.framing)) {
+		if ((errno != EAGAIN) || !_conn_watch(pool, conn, EPOLL_CTL_MOD))
+			_conn_close(pool, conn);
+		return;
+	}
+
+	conn->queued = _now_ns();
+
+	pthread_mutex_lock(&pool->mutex);
+	dm_list_add(&pool->queue, &conn->list);
+	if (++pool->queue_depth > pool->queue_depth_max)
+		pool->queue_depth_max = pool->queue_depth;
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+static int _handle_connect(struct daemon_pool *pool)
+{
+	struct daemon_conn *conn;
 	struct sockaddr_un sockaddr;
-	client_handle client = { .thread_id = 0 };
 	socklen_t sl = sizeof(sockaddr);
+	int fd;
 
-	client.socket_fd = accept(s.socket_fd, (struct sockaddr *) &sockaddr, &sl);
-	if (client.socket_fd < 0) {
+	fd = accept(pool->s.socket_fd, (struct sockaddr *) &sockaddr, &sl);
+	if (fd < 0) {
 		if (errno != EAGAIN || !_shutdown_requested)
-			ERROR(&s, "Failed to accept connection: %s.", strerror(errno));
+			ERROR(&pool->s, "Failed to accept connection: %s.", strerror(errno));
 		return 0;
 	}
 
-	 if (fcntl(client.socket_fd, F_SETFD, FD_CLOEXEC))
-		WARN(&s, "setting CLOEXEC on client socket fd %d failed", client.socket_fd);
+	if (fcntl(fd, F_SETFD, FD_CLOEXEC))
+		WARN(&pool->s, "setting CLOEXEC on client socket fd %d failed", fd);
 
-	if (!(ts = dm_malloc(sizeof(thread_state)))) {
-		if (close(client.socket_fd))
+	/* Requests are read by the main loop as they arrive. */
+	if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK))
+		WARN(&pool->s, "setting O_NONBLOCK on client socket fd %d failed", fd);
+
+	if (!(conn = dm_zalloc(sizeof(*conn)))) {
+		if (close(fd))
 			perror("close");
-		ERROR(&s, "Failed to allocate thread state");
+		ERROR(&pool->s, "Failed to allocate client state");
 		return 0;
 	}
 
-	ts->next = s.threads->next;
-	s.threads->next = ts;
+	conn->client.socket_fd = fd;
+	buffer_init(&conn->buffer);
 
-	ts->active = 1;
-	ts->s = s;
-	ts->client = client;
+	pthread_mutex_lock(&pool->mutex);
+	pool->connections++;
+	pthread_mutex_unlock(&pool->mutex);
 
-	if ((errno = pthread_create(&ts->client.thread_id, NULL, _client_thread, ts))) {
-		ERROR(&s, "Failed to create client thread: %s.", strerror(errno));
+	if (!_conn_watch(pool, conn, EPOLL_CTL_ADD)) {
+		_conn_close(pool, conn);
 		return 0;
 	}
 
 	return 1;
 }
 
-static void _reap(daemon_state s, int waiting)
+/* Stop or resume accepting connections depending on the queue depth. */
+static void _update_accept(struct daemon_pool *pool)
+{
+	struct epoll_event ev = { .events = 0, .data.ptr = NULL };
+	int full;
+
+	pthread_mutex_lock(&pool->mutex);
+	full = (pool->queue_depth >= (unsigned) pool->max_queue);
+	if (full && !pool->accept_paused)
+		pool->accept_pauses++;
+	pthread_mutex_unlock(&pool->mutex);
+
+	if (full == pool->accept_paused)
+		return;
+
+	if (!full)
+		ev.events = EPOLLIN;
+
+	if (epoll_ctl(pool->epoll_fd, EPOLL_CTL_MOD, pool->s.socket_fd, &ev))
+		ERROR(&pool->s, "Failed to update listening socket: %s.", strerror(errno));
+	else
+		pool->accept_paused = full;
+}
+
+static void _pool_destroy(struct daemon_pool *pool)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->worker_count; i++)
+		if ((errno = pthread_join(pool->workers[i], NULL)))
+			ERROR(&pool->s, "pthread_join failed: %s", strerror(errno));
+
+	if (pool->epoll_fd >= 0 && close(pool->epoll_fd))
+		perror("close");
+	for (i = 0; i < 2; i++)
+		if (pool->wake_fd[i] >= 0 && close(pool->wake_fd[i]))
+			perror("close");
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+	dm_free(pool->workers);
+	dm_free(pool);
+}
+
+static struct daemon_pool *_pool_create(daemon_state *s)
 {
-	thread_state *last = s.threads, *ts = last->next;
-	void *rv;
-
-	while (ts) {
-		if (waiting || !ts->active) {
-			if ((errno = pthread_join(ts->client.thread_id, &rv)))
-				ERROR(&s, "pthread_join failed: %s", strerror(errno));
-			last->next = ts->next;
-			dm_free(ts);
-		} else
-			last = ts;
-		ts = last->next;
+	struct daemon_pool *pool;
+	struct epoll_event ev = { .events = EPOLLIN };
+	pthread_attr_t attr;
+	int i;
+
+	if (!(pool = dm_zalloc(sizeof(*pool)))) {
+		ERROR(s, "Failed to allocate worker pool.");
+		return NULL;
+	}
+
+	pool->epoll_fd = pool->wake_fd[0] = pool->wake_fd[1] = -1;
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	dm_list_init(&pool->queue);
+
+	pool->worker_count = (s->worker_threads > 0) ? s->worker_threads : DAEMON_WORKER_THREADS;
+	pool->max_queue = (s->max_queue > 0) ? s->max_queue :
+		pool->worker_count * DAEMON_QUEUE_PER_WORKER;
+
+	if ((pool->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		ERROR(s, "Failed to create epoll instance: %s.", strerror(errno));
+		goto bad;
+	}
+
+	if (pipe(pool->wake_fd)) {
+		ERROR(s, "Failed to create wake pipe: %s.", strerror(errno));
+		goto bad;
+	}
+
+	for (i = 0; i < 2; i++)
+		if (fcntl(pool->wake_fd[i], F_SETFD, FD_CLOEXEC) ||
+		    fcntl(pool->wake_fd[i], F_SETFL, O_NONBLOCK))
+			WARN(s, "setting flags on wake pipe fd %d failed", pool->wake_fd[i]);
+
+	/* data.ptr NULL is the listening socket, &wake_fd the wake pipe */
+	ev.data.ptr = NULL;
+	if (epoll_ctl(pool->epoll_fd, EPOLL_CTL_ADD, s->socket_fd, &ev)) {
+		ERROR(s, "Failed to watch listening socket: %s.", strerror(errno));
+		goto bad;
+	}
+
+	ev.data.ptr = pool->wake_fd;
+	if (epoll_ctl(pool->epoll_fd, EPOLL_CTL_ADD, pool->wake_fd[0], &ev)) {
+		ERROR(s, "Failed to watch wake pipe: %s.", strerror(errno));
+		goto bad;
+	}
+
+	s->pool = pool;
+	pool->s = *s;
+
+	if (!(pool->workers = dm_zalloc(sizeof(pthread_t) * pool->worker_count))) {
+		ERROR(s, "Failed to allocate worker threads.");
+		goto bad;
+	}
+
+	if (pthread_attr_init(&attr)) {
+		ERROR(s, "Failed to initialize thread attributes.");
+		goto bad;
 	}
+
+	if (s->thread_stack_size &&
+	    pthread_attr_setstacksize(&attr, s->thread_stack_size))
+		WARN(s, "Failed to set stack size %d for worker threads.", s->thread_stack_size);
+
+	for (i = 0; i < pool->worker_count; i++)
+		if ((errno = pthread_create(&pool->workers[i], &attr, _worker_thread, pool))) {
+			ERROR(s, "Failed to create worker thread: %s.", strerror(errno));
+			pool->worker_count = i;
+			pthread_attr_destroy(&attr);
+			goto bad;
+		}
+
+	pthread_attr_destroy(&attr);
+
+	return pool;
+
+bad:
+	s->pool = NULL;
+	_pool_destroy(pool);
+
+	return NULL;
 }
 
 void daemon_start(daemon_state s)
 {
 	int failed = 0;
 	log_state _log = { { 0 } };
-	thread_state _threads = { .next = NULL };
+	struct daemon_pool *pool = NULL;
+	struct epoll_event events[DAEMON_EPOLL_EVENTS];
 	unsigned timeout_count = 0;
-	fd_set in;
+	char drain[64];
+	int i, n;
 
 	/*
 	 * Switch to C locale to avoid reading large locale-archive file used by
@@ -579,7 +894,6 @@ void daemon_start(daemon_state s)
 
 	s.log = &_log;
 	s.log->name = s.name;
-	s.threads = &_threads;
 
 	/* Log important things to syslog by default. */
 	daemon_log_enable(s.log, DAEMON_LOG_OUTLET_SYSLOG, DAEMON_LOG_FATAL, 1);
@@ -643,24 +957,35 @@ void daemon_start(daemon_state s)
 		if (!s.daemon_init(&s))
 			failed = 1;
 
+	if (!failed && !(pool = _pool_create(&s)))
+		failed = 1;
+
 	while (!failed) {
-		_reset_timeout(s);
-		FD_ZERO(&in);
-		FD_SET(s.socket_fd, &in);
-		if (select(FD_SETSIZE, &in, NULL, NULL, _get_timeout(s)) < 0 && errno != EINTR)
-			perror("select error");
-		if (FD_ISSET(s.socket_fd, &in)) {
-			timeout_count = 0;
-			_handle_connect(s);
+		n = epoll_wait(pool->epoll_fd, events, DAEMON_EPOLL_EVENTS, s.idle ? 1000 : -1);
+		if (n < 0) {
+			if (errno != EINTR)
+				perror("epoll_wait error");
+			n = 0;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (!events[i].data.ptr) {
+				timeout_count = 0;
+				_handle_connect(pool);
+			} else if (events[i].data.ptr == pool->wake_fd) {
+				while (read(pool->wake_fd[0], drain, sizeof(drain)) > 0)
+					;
+			} else
+				_handle_input(pool, events[i].data.ptr);
 		}
 
-		_reap(s, 0);
+		_update_accept(pool);
 
-		if (_shutdown_requested && !s.threads->next)
+		if (_shutdown_requested && !_connections(pool))
 			break;
 
 		/* s.idle == NULL equals no shutdown on timeout */
-		if (_is_idle(s)) {
+		if (!n && _is_idle(s)) {
 			DEBUGLOG(&s, "timeout occured");
 			if (++timeout_count >= _get_max_timeouts(s)) {
 				INFO(&s, "Inactive for %d seconds. Exiting.", timeout_count);
@@ -670,7 +995,8 @@ void daemon_start(daemon_state s)
 	}
 
 	INFO(&s, "%s waiting for client threads to finish", s.name);
-	_reap(s, 1);
+	if (pool)
+		_pool_destroy(pool);
 out:
 	/* If activated by systemd, do not unlink the socket - systemd takes care of that! */
 	if (!_systemd_activation && s.socket_fd >= 0)
@@ -22,6 +22,7 @@ typedef struct {
 	pthread_t thread_id;
 	char *read_buf;
 	void *private; /* this holds per-client state */
+	int framing; /* DAEMON_FRAMING_ used on the connection */
 } client_handle;
 
 typedef struct {
@@ -41,8 +42,8 @@ struct timeval;
  * is_idle:	 daemon implementation sets it to true when no background task
  *		 is running
  * max_timeouts: how many seconds do daemon allow to be idle before it shutdowns
- * ptimeout:	 internal variable passed to select(). has to be reset to 1 second
- *		 before each select
+ * ptimeout:	 unused, the main loop wakes up every second while idle
+ *		 shutdown is enabled
  */
 typedef struct {
 	volatile unsigned is_idle;
@@ -71,11 +72,11 @@ static inline const char *daemon_request_str(request r, const char *path, const
 }
 
 /*
- * The callback. Called once per request issued, in the respective client's
- * thread. It is presented by a parsed request (in the form of a config tree).
- * The output is a new config tree that is serialised and sent back to the
- * client. The client blocks until the request processing is done and reply is
- * sent.
+ * The callback. Called once per request issued, in one of the worker threads
+ * of the daemon; requests from different clients run concurrently. It is
+ * presented by a parsed request (in the form of a config tree). The output is
+ * a new config tree that is serialised and sent back to the client. The
+ * client blocks until the request processing is done and reply is sent.
  */
 typedef response (*handle_request)(struct daemon_state s, client_handle h, request r);
 
@@ -85,7 +86,7 @@ typedef struct {
 	const char *name;
 } log_state;
 
-struct thread_state;
+struct daemon_pool;
 
 typedef struct daemon_state {
 	/*
@@ -104,6 +105,14 @@ typedef struct daemon_state {
 	const char *protocol;
 	int protocol_version;
 
+	/*
+	 * Number of threads handling requests and the number of complete
+	 * requests allowed to wait for them before new connections are no
+	 * longer accepted.  Zero selects the defaults.
+	 */
+	int worker_threads;
+	int max_queue;
+
 	handle_request handler;
 	int (*daemon_init)(struct daemon_state *st);
 	int (*daemon_fini)(struct daemon_state *st);
@@ -113,7 +122,7 @@ typedef struct daemon_state {
 	int socket_fd;
 
 	log_state *log;
-	struct thread_state *threads;
+	struct daemon_pool *pool;
 
 	/* suport for shutdown on idle */
 	daemon_idle *idle;
@@ -121,13 +130,6 @@ typedef struct daemon_state {
 	void *private; /* the global daemon state */
 } daemon_state;
 
-typedef struct thread_state {
-	daemon_state s;
-	client_handle client;
-	struct thread_state *next;
-	volatile int active;
-} thread_state;
-
 /*
  * Start serving the requests. This does all the daemonisation, socket setup
  * work and so on. This function takes over the process, and upon failure, it
@@ -1759,7 +1759,7 @@ static struct dm_ioctl *_do_dm_ioctl(struct dm_task *dmt, unsigned command,
 {
 	struct dm_ioctl *dmi;
 	int ioctl_with_uevent;
-	int r;
+	int r, ioctl_errno;
 
 	dmt->ioctl_errno = 0;
 
@@ -1847,7 +1847,11 @@ static struct dm_ioctl *_do_dm_ioctl(struct dm_task *dmt, unsigned command,
 			     dmt->sector, _sanitise_message(dmt->message),
 			     dmi->data_size, retry_repeat_count);
 #ifdef DM_IOCTLS
+	parallel_unlock();
 	r = ioctl(_control_fd, command, dmi);
+	ioctl_errno = errno;
+	parallel_lock();
+	errno = ioctl_errno;
 
 	if (dmt->record_timestamp)
 		if (!dm_timestamp_get(_dm_ioctl_timestamp))
@@ -90,6 +90,16 @@ int dm_log_is_non_default(void);
  */
 int dm_get_suspended_counter(void);
 
+/*
+ * Report how long devices suspended via dm_tree stayed suspended.
+ * The function is called once the device is resumed (or removed) with
+ * the time elapsed since its suspend was started, in nanoseconds.
+ * Pass NULL to stop reporting.
+ */
+typedef void (*dm_suspend_time_fn) (const char *name, uint32_t major, uint32_t minor,
+				    uint64_t suspended_ns, void *data);
+void dm_set_suspend_time_fn(dm_suspend_time_fn fn, void *data);
+
 enum {
 	DM_DEVICE_CREATE,
 	DM_DEVICE_RELOAD,
@@ -1362,6 +1372,11 @@ uint64_t *dm_stats_create_regions_from_fd(struct dm_stats *dms, int fd,
  * is guaranteed to be in a listed state, and to contain any region
  * and group identifiers created by the operation.
  *
+ * Regions of unchanged extents are kept together with their counters.
+ * An extent that has grown keeps its region and gains a second one
+ * covering the space added to it, so the group may contain more
+ * regions than the file has extents.
+ *
  * This function cannot be used with file mapped regions that are
  * not members of a group: either group the regions, or remove them
  * and re-map them with dm_stats_create_regions_from_fd().
@@ -1369,6 +1384,25 @@ uint64_t *dm_stats_create_regions_from_fd(struct dm_stats *dms, int fd,
 uint64_t *dm_stats_update_regions_from_fd(struct dm_stats *dms, int fd,
 					  uint64_t group_id);
 
+/*
+ * Limit the number of regions that dm_stats_create_regions_from_fd()
+ * and dm_stats_update_regions_from_fd() map to a file to max_regions.
+ *
+ * If a file has more extents than this, the extents separated by the
+ * smallest gaps on the device are merged into one region until the
+ * limit is met. The merged regions also count I/O to the sectors in
+ * between, which may belong to other files or be unallocated.
+ *
+ * A value of zero (the default) maps each extent to its own region.
+ * The default is taken from the DM_STATS_MAX_FILE_REGIONS environment
+ * variable when the handle is created: dmfilemapd processes started by
+ * dm_stats_start_filemapd() inherit it, so that updates of a group
+ * keep the limit it was created with.
+ */
+#define DM_STATS_MAX_FILE_REGIONS_ENV_VAR_NAME "DM_STATS_MAX_FILE_REGIONS"
+
+void dm_stats_set_max_file_regions(struct dm_stats *dms, uint64_t max_regions);
+
 
 /*
  * The file map monitoring daemon can monitor files in two distinct
@@ -1715,6 +1749,16 @@ void dm_tree_use_no_flush_suspend(struct dm_tree_node *dnode);
  */
 void dm_tree_retry_remove(struct dm_tree_node *dnode);
 
+/*
+ * Preload and activate independent parts of the tree in parallel
+ * using up to 'jobs' threads.  Nodes are still processed after the
+ * nodes they use.  Only the device-mapper ioctls run concurrently,
+ * any other library processing including logging stays serialised.
+ * Values 0 and 1 select the default serial processing.
+ * Does nothing with other functions.
+ */
+void dm_tree_set_parallel_jobs(struct dm_tree_node *dnode, unsigned jobs);
+
 /*
  * Is the uuid prefix present in the tree?
  * Only returns 0 if every node was checked successfully.
@@ -3746,6 +3790,26 @@ int dm_udev_wait(uint32_t cookie);
  */
 int dm_udev_wait_immediate(uint32_t cookie, int *ready);
 
+/*
+ * Event driven alternative to dm_udev_wait().
+ *
+ * dm_udev_get_cookie_fd() returns in *fd a non-blocking descriptor that
+ * becomes readable whenever udev completes processing of an event bound
+ * to the cookie.  Read and discard the pending data and then call
+ * dm_udev_wait_immediate() to check whether the wait is complete.
+ * The caller closes the fd.  *fd is -1 when there is nothing to wait
+ * for (no cookie or udev synchronisation disabled).  Only one fd can
+ * exist for a cookie at a time.
+ *
+ * dm_udev_wait_cookies() waits for up to count cookies at once.
+ * ready[i] is set to 1 for each cookie whose wait completed, the others
+ * must be waited for again.  A negative timeout_ms waits without limit.
+ * Returns 0 on error.
+ */
+int dm_udev_get_cookie_fd(uint32_t cookie, int *fd);
+int dm_udev_wait_cookies(const uint32_t *cookies, int *ready,
+			 unsigned count, int timeout_ms);
+
 #define DM_DEV_DIR_UMASK 0022
 #define DM_CONTROL_NODE_UMASK 0177
 
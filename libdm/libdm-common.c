@@ -24,11 +24,16 @@
 #include <sys/ioctl.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <pthread.h>
 
 #ifdef UDEV_SYNC_SUPPORT
 #  include <sys/types.h>
 #  include <sys/ipc.h>
 #  include <sys/sem.h>
+#  include <sys/socket.h>
+#  include <sys/un.h>
+#  include <stddef.h>
+#  include <poll.h>
 #  include <libudev.h>
 #endif
 
@@ -262,14 +267,58 @@ int dm_get_library_version(char *version, size_t size)
 	return dm_strncpy(version, DM_LIB_VERSION, size);
 }
 
-void inc_suspended(void)
+/*
+ * Devices suspended via the library with the time their suspend started,
+ * used to measure how long each device stays suspended.
+ */
+struct suspended_dev {
+	struct dm_list list;
+	uint32_t major;
+	uint32_t minor;
+	struct dm_timestamp *start;
+	char name[0];
+};
+
+static DM_LIST_INIT(_suspended_devs);
+static dm_suspend_time_fn _suspend_time_fn = NULL;
+static void *_suspend_time_data = NULL;
+
+void dm_set_suspend_time_fn(dm_suspend_time_fn fn, void *data)
+{
+	_suspend_time_fn = fn;
+	_suspend_time_data = data;
+}
+
+void inc_suspended(const char *name, uint32_t major, uint32_t minor,
+		   struct dm_timestamp *start)
 {
+	struct suspended_dev *sd;
+
 	_suspended_dev_counter++;
 	log_debug_activation("Suspended device counter increased to %d", _suspended_dev_counter);
+
+	if (!start)
+		return;
+
+	if (!(sd = dm_malloc(sizeof(*sd) + strlen(name) + 1))) {
+		log_debug_activation("Cannot track suspended time of %s.", name);
+		dm_timestamp_destroy(start);
+		return;
+	}
+
+	sd->major = major;
+	sd->minor = minor;
+	sd->start = start;
+	strcpy(sd->name, name);
+	dm_list_add(&_suspended_devs, &sd->list);
 }
 
-void dec_suspended(void)
+void dec_suspended(uint32_t major, uint32_t minor)
 {
+	struct dm_timestamp *end;
+	struct suspended_dev *sd;
+	uint64_t suspended_ns;
+
 	if (!_suspended_dev_counter) {
 		log_error("Attempted to decrement suspended device counter below zero.");
 		return;
@@ -277,6 +326,26 @@ void dec_suspended(void)
 
 	_suspended_dev_counter--;
 	log_debug_activation("Suspended device counter reduced to %d", _suspended_dev_counter);
+
+	dm_list_iterate_items(sd, &_suspended_devs)
+		if ((sd->major == major) && (sd->minor == minor)) {
+			if ((end = dm_timestamp_alloc())) {
+				if (dm_timestamp_get(end)) {
+					suspended_ns = dm_timestamp_delta(end, sd->start);
+					log_debug_activation("Device %s (" FMTu32 ":" FMTu32 ") was suspended for "
+							     FMTu64 " us.", sd->name, major, minor,
+							     suspended_ns / 1000);
+					if (_suspend_time_fn)
+						_suspend_time_fn(sd->name, major, minor, suspended_ns,
+								 _suspend_time_data);
+				}
+				dm_timestamp_destroy(end);
+			}
+			dm_list_del(&sd->list);
+			dm_timestamp_destroy(sd->start);
+			dm_free(sd);
+			break;
+		}
 }
 
 int dm_get_suspended_counter(void)
@@ -284,6 +353,75 @@ int dm_get_suspended_counter(void)
 	return _suspended_dev_counter;
 }
 
+/*
+ * Parallel tree processing.
+ *
+ * Threads taking part in parallel processing of a dm tree share one
+ * library lock which protects all internal state (udev cookies, stacked
+ * node operations, counters, log buffers).  The lock is dropped only
+ * around the blocking device-mapper ioctl, so just the kernel round
+ * trips overlap.  Threads that did not enter parallel mode are
+ * unaffected.
+ */
+static pthread_mutex_t _parallel_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t _parallel_once = PTHREAD_ONCE_INIT;
+static pthread_key_t _parallel_key;
+static int _parallel_key_valid = 0;
+
+static void _parallel_key_create(void)
+{
+	if (!pthread_key_create(&_parallel_key, NULL))
+		_parallel_key_valid = 1;
+}
+
+static int _is_parallel_thread(void)
+{
+	return _parallel_key_valid && pthread_getspecific(_parallel_key);
+}
+
+int parallel_enter(void)
+{
+	if (pthread_once(&_parallel_once, _parallel_key_create) ||
+	    !_parallel_key_valid)
+		return 0;
+
+	/* Nested parallel processing runs serially in the calling thread */
+	if (_is_parallel_thread())
+		return 0;
+
+	pthread_mutex_lock(&_parallel_mutex);
+
+	if (pthread_setspecific(_parallel_key, &_parallel_mutex)) {
+		pthread_mutex_unlock(&_parallel_mutex);
+		return 0;
+	}
+
+	return 1;
+}
+
+void parallel_exit(void)
+{
+	(void) pthread_setspecific(_parallel_key, NULL);
+	pthread_mutex_unlock(&_parallel_mutex);
+}
+
+void parallel_wait(pthread_cond_t *cond)
+{
+	pthread_cond_wait(cond, &_parallel_mutex);
+}
+
+void parallel_unlock(void)
+{
+	if (_is_parallel_thread())
+		pthread_mutex_unlock(&_parallel_mutex);
+}
+
+void parallel_lock(void)
+{
+	if (_is_parallel_thread())
+		pthread_mutex_lock(&_parallel_mutex);
+}
+
 int dm_set_name_mangling_mode(dm_string_mangling_t name_mangling_mode)
 {
 	_name_mangling_mode = name_mangling_mode;
@@ -1026,18 +1164,43 @@ static int _warn_if_op_needed(int warn_if_udev_failed)
     return warn_if_udev_failed && dm_udev_get_sync_support() && dm_udev_get_checking();
 }
 
+/*
+ * Descriptor of the dm directory cached while stacked node operations
+ * are processed, so nodes are resolved relative to it with the *at()
+ * calls instead of walking the full path for each syscall.
+ */
+static int _dev_dir_fd = -1;
+
+/* Select directory fd and name to use for the node with full path */
+static int _dev_at(const char *path, const char *dev_name, const char **name)
+{
+	/* If there's a /, the full path is used */
+	if ((_dev_dir_fd < 0) || strchr(dev_name, '/')) {
+		*name = path;
+		return AT_FDCWD;
+	}
+
+	*name = dev_name;
+
+	return _dev_dir_fd;
+}
+
 static int _add_dev_node(const char *dev_name, uint32_t major, uint32_t minor,
 			 uid_t uid, gid_t gid, mode_t mode, int warn_if_udev_failed)
 {
 	char path[PATH_MAX];
+	const char *name;
 	struct stat info;
 	dev_t dev = MKDEV((dev_t)major, (dev_t)minor);
 	mode_t old_mask;
+	int dir_fd;
 
 	if (!_build_dev_path(path, sizeof(path), dev_name))
 		return_0;
 
-	if (stat(path, &info) >= 0) {
+	dir_fd = _dev_at(path, dev_name, &name);
+
+	if (fstatat(dir_fd, name, &info, 0) >= 0) {
 		if (!S_ISBLK(info.st_mode)) {
 			log_error("A non-block device file at '%s' "
 				  "is already present", path);
@@ -1048,7 +1211,7 @@ static int _add_dev_node(const char *dev_name, uint32_t major, uint32_t minor,
 		if (info.st_rdev == dev)
 			return 1;
 
-		if (unlink(path) < 0) {
+		if (unlinkat(dir_fd, name, 0) < 0) {
 			log_error("Unable to unlink device node for '%s'",
 				  dev_name);
 			return 0;
@@ -1061,7 +1224,7 @@ static int _add_dev_node(const char *dev_name, uint32_t major, uint32_t minor,
 	old_mask = umask(0);
 
 	/* The node may already have been created by udev. So ignore EEXIST. */
-	if (mknod(path, S_IFBLK | mode, dev) < 0 && errno != EEXIST) {
+	if (mknodat(dir_fd, name, S_IFBLK | mode, dev) < 0 && errno != EEXIST) {
 		log_error("%s: mknod for %s failed: %s", path, dev_name, strerror(errno));
 		umask(old_mask);
 		(void) dm_prepare_selinux_context(NULL, 0);
@@ -1070,7 +1233,7 @@ static int _add_dev_node(const char *dev_name, uint32_t major, uint32_t minor,
 	umask(old_mask);
 	(void) dm_prepare_selinux_context(NULL, 0);
 
-	if (chown(path, uid, gid) < 0) {
+	if (fchownat(dir_fd, name, uid, gid, 0) < 0) {
 		log_sys_error("chown", path);
 		return 0;
 	}
@@ -1083,18 +1246,23 @@ static int _add_dev_node(const char *dev_name, uint32_t major, uint32_t minor,
 static int _rm_dev_node(const char *dev_name, int warn_if_udev_failed)
 {
 	char path[PATH_MAX];
+	const char *name;
 	struct stat info;
+	int dir_fd;
 
 	if (!_build_dev_path(path, sizeof(path), dev_name))
 		return_0;
-	if (lstat(path, &info) < 0)
+
+	dir_fd = _dev_at(path, dev_name, &name);
+
+	if (fstatat(dir_fd, name, &info, AT_SYMLINK_NOFOLLOW) < 0)
 		return 1;
 	else if (_warn_if_op_needed(warn_if_udev_failed))
 		log_warn("Node %s was not removed by udev. "
 			 "Falling back to direct node removal.", path);
 
 	/* udev may already have deleted the node. Ignore ENOENT. */
-	if (unlink(path) < 0 && errno != ENOENT) {
+	if (unlinkat(dir_fd, name, 0) < 0 && errno != ENOENT) {
 		log_error("Unable to unlink device node for '%s'", dev_name);
 		return 0;
 	}
@@ -1109,16 +1277,21 @@ static int _rename_dev_node(const char *old_name, const char *new_name,
 {
 	char oldpath[PATH_MAX];
 	char newpath[PATH_MAX];
+	const char *oldname, *newname;
 	struct stat info, info2;
 	struct stat *info_block_dev;
+	int old_fd, new_fd;
 
 	if (!_build_dev_path(oldpath, sizeof(oldpath), old_name) ||
 	    !_build_dev_path(newpath, sizeof(newpath), new_name))
 		return_0;
 
-	if (lstat(newpath, &info) == 0) {
+	old_fd = _dev_at(oldpath, old_name, &oldname);
+	new_fd = _dev_at(newpath, new_name, &newname);
+
+	if (fstatat(new_fd, newname, &info, AT_SYMLINK_NOFOLLOW) == 0) {
 		if (S_ISLNK(info.st_mode)) {
-			if (stat(newpath, &info2) == 0)
+			if (fstatat(new_fd, newname, &info2, 0) == 0)
 				info_block_dev = &info2;
 			else {
 				log_sys_error("stat", newpath);
@@ -1133,7 +1306,7 @@ static int _rename_dev_node(const char *old_name, const char *new_name,
 			return 0;
 		}
 		else if (_warn_if_op_needed(warn_if_udev_failed)) {
-			if (lstat(oldpath, &info) < 0 &&
+			if (fstatat(old_fd, oldname, &info, AT_SYMLINK_NOFOLLOW) < 0 &&
 				 errno == ENOENT)
 				/* assume udev already deleted this */
 				return 1;
@@ -1145,7 +1318,7 @@ static int _rename_dev_node(const char *old_name, const char *new_name,
 			return _rm_dev_node(old_name, 0);
 		}
 
-		if (unlink(newpath) < 0) {
+		if (unlinkat(new_fd, newname, 0) < 0) {
 			if (errno == EPERM) {
 				/* devfs, entry has already been renamed */
 				return 1;
@@ -1180,7 +1353,7 @@ static int _rename_dev_node(const char *old_name, const char *new_name,
 	 * to rename to an unsupported mode??? So a fix for this would be
 	 * just for completeness.
 	 */
-	if (rename(oldpath, newpath) < 0 && errno != ENOENT) {
+	if (renameat(old_fd, oldname, new_fd, newname) < 0 && errno != ENOENT) {
 		log_error("Unable to rename device node from '%s' to '%s'",
 			  old_name, new_name);
 		return 0;
@@ -1196,11 +1369,15 @@ static int _open_dev_node(const char *dev_name)
 {
 	int fd = -1;
 	char path[PATH_MAX];
+	const char *name;
+	int dir_fd;
 
 	if (!_build_dev_path(path, sizeof(path), dev_name))
 		return fd;
 
-	if ((fd = open(path, O_RDONLY, 0)) < 0)
+	dir_fd = _dev_at(path, dev_name, &name);
+
+	if ((fd = openat(dir_fd, name, O_RDONLY, 0)) < 0)
 		log_sys_error("open", path);
 
 	return fd;
@@ -1419,6 +1596,8 @@ static int _do_node_op(node_op_t type, const char *dev_name, uint32_t major,
 
 static DM_LIST_INIT(_node_ops);
 static int _count_node_ops[NUM_NODES];
+/* Number of stacked operations for each node name to avoid list scans */
+static struct dm_hash_table *_node_names = NULL;
 
 struct node_op_parms {
 	struct dm_list list;
@@ -1444,9 +1623,37 @@ static void _store_str(char **pos, char **ptr, const char *str)
 	*pos += strlen(*ptr) + 1;
 }
 
+static unsigned _node_name_ops(const char *dev_name)
+{
+	return _node_names ? (unsigned) (uintptr_t) dm_hash_lookup(_node_names, dev_name) : 0;
+}
+
+static int _node_name_ref(const char *dev_name, int delta)
+{
+	unsigned count = _node_name_ops(dev_name) + delta;
+
+	if (!_node_names && !(_node_names = dm_hash_create(64))) {
+		log_error("Failed to allocate node name hash.");
+		return 0;
+	}
+
+	if (!count) {
+		dm_hash_remove(_node_names, dev_name);
+		return 1;
+	}
+
+	if (!dm_hash_insert(_node_names, dev_name, (void *) (uintptr_t) count)) {
+		log_error("Failed to add node name %s to hash.", dev_name);
+		return 0;
+	}
+
+	return 1;
+}
+
 static void _del_node_op(struct node_op_parms *nop)
 {
 	_count_node_ops[nop->type]--;
+	(void) _node_name_ref(nop->dev_name, -1);
 	dm_list_del(&nop->list);
 	dm_free(nop);
 
@@ -1503,7 +1710,7 @@ static int _stack_node_op(node_op_t type, const char *dev_name, uint32_t major,
 	/*
 	 * Note: warn_if_udev_failed must have valid content
 	 */
-	if ((type == NODE_DEL) && _other_node_ops(type))
+	if ((type == NODE_DEL) && _other_node_ops(type) && _node_name_ops(dev_name))
 		/*
 		 * Ignore any outstanding operations on the node if deleting it.
 		 */
@@ -1516,7 +1723,7 @@ static int _stack_node_op(node_op_t type, const char *dev_name, uint32_t major,
 					break; /* no other non DEL ops */
 			}
 		}
-	else if ((type == NODE_ADD) && _count_node_ops[NODE_DEL])
+	else if ((type == NODE_ADD) && _count_node_ops[NODE_DEL] && _node_name_ops(dev_name))
 		/*
 		 * Ignore previous DEL operation on added node.
 		 * (No other operations for this device then DEL could be stacked here).
@@ -1530,7 +1737,7 @@ static int _stack_node_op(node_op_t type, const char *dev_name, uint32_t major,
 				break; /* no other DEL ops */
 			}
 		}
-	else if (type == NODE_RENAME)
+	else if ((type == NODE_RENAME) && _node_name_ops(old_name))
 		/*
 		 * Ignore any outstanding operations if renaming it.
 		 *
@@ -1577,6 +1784,11 @@ static int _stack_node_op(node_op_t type, const char *dev_name, uint32_t major,
 	_store_str(&pos, &nop->dev_name, dev_name);
 	_store_str(&pos, &nop->old_name, old_name);
 
+	if (!_node_name_ref(nop->dev_name, 1)) {
+		dm_free(nop);
+		return 0;
+	}
+
 	_count_node_ops[type]++;
 	dm_list_add(&_node_ops, &nop->list);
 
@@ -1590,6 +1802,17 @@ static void _pop_node_ops(void)
 	struct dm_list *noph, *nopht;
 	struct node_op_parms *nop;
 
+	if (dm_list_empty(&_node_ops))
+		return;
+
+	/* Process all nodes in a single pass relative to the dm directory */
+	dm_list_iterate_items(nop, &_node_ops)
+		if (!nop->rely_on_udev) {
+			if ((_dev_dir_fd = open(_dm_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+				log_sys_debug("open", _dm_dir);
+			break;
+		}
+
 	dm_list_iterate_safe(noph, nopht, &_node_ops) {
 		nop = dm_list_item(noph, struct node_op_parms);
 		if (!nop->rely_on_udev) {
@@ -1602,6 +1825,15 @@ static void _pop_node_ops(void)
 			_log_node_op("Skipping", nop);
 		_del_node_op(nop);
 	}
+
+	if ((_dev_dir_fd >= 0) && close(_dev_dir_fd))
+		log_sys_debug("close", _dm_dir);
+	_dev_dir_fd = -1;
+
+	if (_node_names) {
+		dm_hash_destroy(_node_names);
+		_node_names = NULL;
+	}
 }
 
 int add_dev_node(const char *dev_name, uint32_t major, uint32_t minor,
@@ -2138,6 +2370,26 @@ int dm_udev_wait_immediate(uint32_t cookie, int *ready)
 	return 1;
 }
 
+int dm_udev_get_cookie_fd(uint32_t cookie, int *fd)
+{
+	*fd = -1;
+
+	return 1;
+}
+
+int dm_udev_wait_cookies(const uint32_t *cookies, int *ready,
+			 unsigned count, int timeout_ms)
+{
+	unsigned i;
+
+	update_devs();
+
+	for (i = 0; i < count; i++)
+		ready[i] = 1;
+
+	return 1;
+}
+
 #else		/* UDEV_SYNC_SUPPORT */
 
 static int _check_semaphore_is_supported(void)
@@ -2542,6 +2794,88 @@ bad:
 	return 0;
 }
 
+/*
+ * Completion notification channel.
+ *
+ * The semaphore stays the only record of pending udev processing, the
+ * channel just avoids blocking in semop(): dm_udev_complete() sends
+ * a datagram to an abstract unix socket named after the cookie and
+ * the waiter, which has the socket bound, rechecks the semaphore once
+ * the socket becomes readable.  Nothing is queued when nobody listens.
+ */
+#define DM_UDEV_NOTIFY_NAME "dm-udev-cookie-0x%08" PRIx32
+/* Recheck semaphores periodically in case a notification got lost */
+#define DM_UDEV_NOTIFY_RECHECK_MS 1000
+#define DM_UDEV_NOFD_RECHECK_MS 100
+
+static socklen_t _udev_notify_addr(uint32_t cookie, struct sockaddr_un *addr)
+{
+	int len;
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+
+	/* Leading '\0' in sun_path selects abstract namespace */
+	len = dm_snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1,
+			  DM_UDEV_NOTIFY_NAME, cookie);
+
+	return (socklen_t) (offsetof(struct sockaddr_un, sun_path) + 1 + len);
+}
+
+static void _udev_notify_send(uint32_t cookie)
+{
+	struct sockaddr_un addr;
+	socklen_t len = _udev_notify_addr(cookie, &addr);
+	int fd;
+
+	if ((fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) < 0) {
+		log_sys_debug("socket", "udev notification");
+		return;
+	}
+
+	/* No listener or full queue is fine, the waiter is already awake */
+	if ((sendto(fd, &cookie, sizeof(cookie), MSG_NOSIGNAL,
+		    (struct sockaddr *) &addr, len) < 0) &&
+	    (errno != ECONNREFUSED) && (errno != EAGAIN))
+		log_sys_debug("sendto", "udev notification");
+
+	if (close(fd))
+		log_sys_debug("close", "udev notification");
+}
+
+static int _udev_notify_open(uint32_t cookie)
+{
+	struct sockaddr_un addr;
+	socklen_t len = _udev_notify_addr(cookie, &addr);
+	int fd;
+
+	if ((fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) < 0) {
+		log_sys_debug("socket", "udev notification");
+		return -1;
+	}
+
+	/* EADDRINUSE when some other fd already watches this cookie */
+	if (bind(fd, (struct sockaddr *) &addr, len) < 0) {
+		log_sys_debug("bind", "udev notification");
+		if (close(fd))
+			log_sys_debug("close", "udev notification");
+		return -1;
+	}
+
+	log_debug_activation("Udev cookie 0x%" PRIx32 " notification fd %d opened.",
+			     cookie, fd);
+
+	return fd;
+}
+
+static void _udev_notify_drain(int fd)
+{
+	uint32_t cookie;
+
+	while (recv(fd, &cookie, sizeof(cookie), MSG_DONTWAIT) >= 0)
+		;
+}
+
 int dm_udev_complete(uint32_t cookie)
 {
 	int semid;
@@ -2559,6 +2893,8 @@ int dm_udev_complete(uint32_t cookie)
 		return 0;
 	}
 
+	_udev_notify_send(cookie);
+
 	return 1;
 }
 
@@ -2648,4 +2984,119 @@ int dm_udev_wait_immediate(uint32_t cookie, int *ready)
 
 	return r;
 }
+
+int dm_udev_get_cookie_fd(uint32_t cookie, int *fd)
+{
+	*fd = -1;
+
+	if (!cookie || !dm_udev_get_sync_support())
+		return 1;
+
+	if ((*fd = _udev_notify_open(cookie)) < 0) {
+		log_error("Failed to open notification channel for udev cookie 0x%" PRIx32 ".",
+			  cookie);
+		return 0;
+	}
+
+	return 1;
+}
+
+int dm_udev_wait_cookies(const uint32_t *cookies, int *ready,
+			 unsigned count, int timeout_ms)
+{
+	struct dm_timestamp *start = NULL, *now = NULL;
+	struct pollfd *pfds;
+	uint64_t elapsed_ms;
+	unsigned i, pending;
+	int nofd = 0, poll_ms, r = 0;
+
+	if (!(pfds = dm_malloc(sizeof(*pfds) * (count ? : 1)))) {
+		log_error("Failed to allocate udev cookie poll fds.");
+		return 0;
+	}
+
+	/*
+	 * Bind all sockets before the first check of the semaphores,
+	 * so no completion can pass unnoticed between the two.
+	 */
+	for (i = 0; i < count; i++) {
+		ready[i] = 0;
+		pfds[i].fd = -1;
+		pfds[i].events = POLLIN;
+		pfds[i].revents = 0;
+		if (cookies[i] && dm_udev_get_sync_support() &&
+		    ((pfds[i].fd = _udev_notify_open(cookies[i])) < 0))
+			nofd = 1; /* Fall back to periodic checks only */
+	}
+
+	if ((timeout_ms >= 0) &&
+	    (!(start = dm_timestamp_alloc()) || !(now = dm_timestamp_alloc()) ||
+	     !dm_timestamp_get(start)))
+		goto_out;
+
+	for (;;) {
+		for (i = 0, pending = 0; i < count; i++) {
+			if (ready[i])
+				continue;
+
+			/* dm_udev_wait_immediate() never reports these ready */
+			if (!cookies[i] || !dm_udev_get_sync_support()) {
+				update_devs();
+				ready[i] = 1;
+				continue;
+			}
+
+			if (pfds[i].fd >= 0)
+				_udev_notify_drain(pfds[i].fd);
+
+			if (!dm_udev_wait_immediate(cookies[i], &ready[i]))
+				goto_out;
+
+			if (!ready[i])
+				pending++;
+			else if (pfds[i].fd >= 0) {
+				if (close(pfds[i].fd))
+					log_sys_debug("close", "udev notification");
+				pfds[i].fd = -1; /* Ignored by poll() */
+			}
+		}
+
+		if (!pending)
+			break;
+
+		poll_ms = nofd ? DM_UDEV_NOFD_RECHECK_MS : DM_UDEV_NOTIFY_RECHECK_MS;
+
+		if (timeout_ms >= 0) {
+			if (!dm_timestamp_get(now))
+				goto_out;
+			elapsed_ms = dm_timestamp_delta(now, start) / 1000000;
+			if (elapsed_ms >= (uint64_t) timeout_ms) {
+				log_debug_activation("Timed out waiting for %u udev cookie(s).",
+						     pending);
+				break;
+			}
+			if ((uint64_t) timeout_ms - elapsed_ms < (uint64_t) poll_ms)
+				poll_ms = (int) ((uint64_t) timeout_ms - elapsed_ms);
+		}
+
+		if ((poll(pfds, count, poll_ms) < 0) && (errno != EINTR)) {
+			log_sys_error("poll", "udev notification");
+			goto out;
+		}
+	}
+
+	r = 1;
+out:
+	for (i = 0; i < count; i++)
+		if ((pfds[i].fd >= 0) && close(pfds[i].fd))
+			log_sys_debug("close", "udev notification");
+
+	if (start)
+		dm_timestamp_destroy(start);
+	if (now)
+		dm_timestamp_destroy(now);
+	dm_free(pfds);
+
+	return r;
+}
 #endif		/* UDEV_SYNC_SUPPORT */
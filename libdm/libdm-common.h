@@ -18,6 +18,8 @@
 
 #include "libdevmapper.h"
 
+#include <pthread.h>
+
 #define DM_DEFAULT_NAME_MANGLING_MODE_ENV_VAR_NAME "DM_DEFAULT_NAME_MANGLING_MODE"
 
 #define DEV_NAME(dmt) (dmt->mangled_dev_name ? : dmt->dev_name)
@@ -48,8 +50,19 @@ int set_dev_node_read_ahead(const char *dev_name, uint32_t major, uint32_t minor
 void update_devs(void);
 void selinux_release(void);
 
-void inc_suspended(void);
-void dec_suspended(void);
+void inc_suspended(const char *name, uint32_t major, uint32_t minor,
+		   struct dm_timestamp *start);
+void dec_suspended(uint32_t major, uint32_t minor);
+
+/*
+ * Serialisation of threads processing a dm tree in parallel.
+ * parallel_enter() returns with the library lock held.
+ */
+int parallel_enter(void);
+void parallel_exit(void);
+void parallel_wait(pthread_cond_t *cond);
+void parallel_unlock(void);
+void parallel_lock(void);
 
 int parse_thin_pool_status(const char *params, struct dm_status_thin_pool *s);
 
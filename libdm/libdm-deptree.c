@@ -24,6 +24,9 @@
 
 #define MAX_TARGET_PARAMSIZE 500000
 
+/* Upper limit of threads used by parallel tree processing */
+#define DM_TREE_MAX_PARALLEL_JOBS 256
+
 /* Supported segment types */
 enum {
 	SEG_CACHE,
@@ -301,6 +304,8 @@ struct dm_tree_node {
 	 */
 	struct dm_list activated;	/* Head of activated nodes for preload revert */
 	struct dm_list activated_list;	/* List of activated nodes for preload revert */
+
+	struct dm_tree_job *job;	/* Set during parallel tree processing */
 };
 
 struct dm_tree {
@@ -311,6 +316,7 @@ struct dm_tree {
 	int skip_lockfs;		/* 1 skips lockfs (for non-snapshots) */
 	int no_flush;			/* 1 sets noflush (mirrors/multipath) */
 	int retry_remove;		/* 1 retries remove if not successful */
+	unsigned parallel_jobs;		/* >1 preloads and activates in parallel */
 	uint32_t cookie;
 	char buf[DM_NAME_LEN + 32];	/* print buffer for device_name (major:minor) */
 	const char **optional_uuid_suffixes;	/* uuid suffixes ignored when matching */
@@ -392,6 +398,12 @@ void dm_tree_retry_remove(struct dm_tree_node *dnode)
 	dnode->dtree->retry_remove = 1;
 }
 
+void dm_tree_set_parallel_jobs(struct dm_tree_node *dnode, unsigned jobs)
+{
+	dnode->dtree->parallel_jobs = (jobs > DM_TREE_MAX_PARALLEL_JOBS) ?
+		DM_TREE_MAX_PARALLEL_JOBS : jobs;
+}
+
 /*
  * Node functions.
  */
@@ -1105,7 +1117,7 @@ static int _node_clear_table(struct dm_tree_node *dnode, uint16_t udev_flags)
 			log_error("Failed to deactivate no-longer-used device %s (%"
 				  PRIu32 ":%" PRIu32 ")", name, deps_info.major, deps_info.minor);
 		} else if (deps_info.suspended)
-			dec_suspended();
+			dec_suspended(deps_info.major, deps_info.minor);
 	}
 
 out:
@@ -1330,7 +1342,7 @@ static int _resume_node(const char *name, uint32_t major, uint32_t minor,
 		goto_out;
 
 	if (already_suspended)
-		dec_suspended();
+		dec_suspended(major, minor);
 
 	if (!(r = dm_task_get_info(dmt, newinfo)))
 		stack;
@@ -1344,6 +1356,7 @@ out:
 static int _suspend_node(const char *name, uint32_t major, uint32_t minor,
 			 int skip_lockfs, int no_flush, struct dm_info *newinfo)
 {
+	struct dm_timestamp *start = NULL;
 	struct dm_task *dmt;
 	int r = 0;
 
@@ -1371,11 +1384,20 @@ static int _suspend_node(const char *name, uint32_t major, uint32_t minor,
 	if (no_flush && !dm_task_no_flush(dmt))
 		log_warn("WARNING: Failed to set no_flush flag.");
 
+	/* Device stalls I/O from the start of the suspend */
+	if ((start = dm_timestamp_alloc()) && !dm_timestamp_get(start)) {
+		dm_timestamp_destroy(start);
+		start = NULL;
+	}
+
 	if ((r = dm_task_run(dmt))) {
-		inc_suspended();
+		inc_suspended(name, major, minor, start);
+		start = NULL;
 		r = dm_task_get_info(dmt, newinfo);
 	}
 out:
+	if (start)
+		dm_timestamp_destroy(start);
 	dm_task_destroy(dmt);
 
 	return r;
@@ -1674,7 +1696,7 @@ static int _dm_tree_deactivate_children(struct dm_tree_node *dnode,
 		}
 
 		if (info.suspended && info.live_table)
-			dec_suspended();
+			dec_suspended(info.major, info.minor);
 
 		if (child->callback &&
 		    !child->callback(child, DM_NODE_CALLBACK_DEACTIVATED,
@@ -1840,9 +1862,9 @@ static int _rename_conflict_exists(struct dm_tree_node *parent,
 	return 0;
 }
 
-int dm_tree_activate_children(struct dm_tree_node *dnode,
-				 const char *uuid_prefix,
-				 size_t uuid_prefix_len)
+static int _dm_tree_activate_children(struct dm_tree_node *dnode,
+				      const char *uuid_prefix,
+				      size_t uuid_prefix_len)
 {
 	int r = 1;
 	int resolvable_name_conflict, awaiting_peer_rename = 0;
@@ -1863,7 +1885,7 @@ int dm_tree_activate_children(struct dm_tree_node *dnode,
 			continue;
 
 		if (dm_tree_node_num_children(child, 0))
-			if (!dm_tree_activate_children(child, uuid_prefix, uuid_prefix_len))
+			if (!_dm_tree_activate_children(child, uuid_prefix, uuid_prefix_len))
 				return_0;
 	}
 
@@ -2803,11 +2825,124 @@ static int _dm_tree_revert_activated(struct dm_tree_node *parent)
 	return 1;
 }
 
-int dm_tree_preload_children(struct dm_tree_node *dnode,
-			     const char *uuid_prefix,
-			     size_t uuid_prefix_len)
+/*
+ * Create, load and, when its size grew, resume one child of dnode.
+ * Returns 0 if preload has to be aborted.  A failed resume of a child
+ * only clears *r as each child is handled independently.
+ */
+static int _preload_child(struct dm_tree_node *dnode,
+			  struct dm_tree_node *child,
+			  const char *uuid_prefix,
+			  size_t uuid_prefix_len,
+			  int *r, int *update_devs_flag)
 {
-	int r = 1, node_created = 0;
+	int node_created = 0;
+
+	/* FIXME Cope if name exists with no uuid? */
+	if (!child->info.exists && !(node_created = _create_node(child)))
+		return_0;
+
+	/* Propagate delayed resume from exteded child node */
+	if (child->props.delay_resume_if_extended)
+		dnode->props.delay_resume_if_extended = 1;
+
+	if (!child->info.inactive_table &&
+	    child->props.segment_count &&
+	    !_load_node(child)) {
+		/*
+		 * If the table load does not succeed, we remove the
+		 * device in the kernel that would otherwise have an
+		 * empty table.  This makes the create + load of the
+		 * device atomic.  However, if other dependencies have
+		 * already been created and loaded; this code is
+		 * insufficient to remove those - only the node
+		 * encountering the table load failure is removed.
+		 */
+		if (node_created && !_remove_node(child))
+			return_0;
+		return_0;
+	}
+
+	/* No resume for a device without parents or with unchanged or smaller size */
+	if (!dm_tree_node_num_children(child, 1) || (child->props.size_changed <= 0))
+		return 1;
+
+	if (!child->info.inactive_table && !child->info.suspended)
+		return 1;
+
+	if (!_resume_node(child->name, child->info.major, child->info.minor,
+			  child->props.read_ahead, child->props.read_ahead_flags,
+			  &child->info, &child->dtree->cookie, child->udev_flags,
+			  child->info.suspended)) {
+		log_error("Unable to resume %s.", _node_name(child));
+		/* If the device was not previously active, we might as well remove this node. */
+		if (!child->info.live_table &&
+		    !_deactivate_node(child->name, child->info.major, child->info.minor,
+				      &child->dtree->cookie, child->udev_flags, 0))
+			log_error("Unable to deactivate %s.", _node_name(child));
+		*r = 0;
+		return 1;
+	}
+
+	if (node_created) {
+		/* Collect newly introduced devices for revert */
+		dm_list_add_h(&dnode->activated, &child->activated_list);
+
+		/* When creating new node also check transaction_id. */
+		if (child->props.send_messages &&
+		    !_node_send_messages(child, uuid_prefix, uuid_prefix_len, 0)) {
+			stack;
+			if (!dm_udev_wait(dm_tree_get_cookie(dnode)))
+				stack;
+			dm_tree_set_cookie(dnode, 0);
+			(void) _dm_tree_revert_activated(dnode);
+			*r = 0;
+			return 1;
+		}
+	}
+
+	/*
+	 * Prepare for immediate synchronization with udev and flush all stacked
+	 * dev node operations if requested by immediate_dev_node property. But
+	 * finish processing current level in the tree first.
+	 */
+	if (child->props.immediate_dev_node)
+		*update_devs_flag = 1;
+
+	return 1;
+}
+
+/*
+ * Synchronise with udev when requested by any preloaded child and
+ * run the preload callback of dnode once all its children are loaded.
+ */
+static int _preload_children_done(struct dm_tree_node *dnode,
+				  int update_devs_flag, int r)
+{
+	if (update_devs_flag ||
+	    (r && !dnode->info.exists && dnode->callback)) {
+		if (!dm_udev_wait(dm_tree_get_cookie(dnode)))
+			stack;
+		dm_tree_set_cookie(dnode, 0);
+
+		if (r && !dnode->info.exists && dnode->callback &&
+		    !dnode->callback(dnode, DM_NODE_CALLBACK_PRELOADED,
+				     dnode->callback_data))
+		{
+			/* Try to deactivate what has been activated in preload phase */
+			(void) _dm_tree_revert_activated(dnode);
+			return_0;
+		}
+	}
+
+	return r;
+}
+
+static int _dm_tree_preload_children(struct dm_tree_node *dnode,
+				     const char *uuid_prefix,
+				     size_t uuid_prefix_len)
+{
+	int r = 1;
 	void *handle = NULL;
 	struct dm_tree_node *child;
 	int update_devs_flag = 0;
@@ -2828,101 +2963,510 @@ int dm_tree_preload_children(struct dm_tree_node *dnode,
 			continue;
 
 		if (dm_tree_node_num_children(child, 0))
-			if (!dm_tree_preload_children(child, uuid_prefix, uuid_prefix_len))
+			if (!_dm_tree_preload_children(child, uuid_prefix, uuid_prefix_len))
 				return_0;
 
-		/* FIXME Cope if name exists with no uuid? */
-		if (!child->info.exists && !(node_created = _create_node(child)))
+		if (!_preload_child(dnode, child, uuid_prefix, uuid_prefix_len,
+				    &r, &update_devs_flag))
 			return_0;
+	}
 
-		/* Propagate delayed resume from exteded child node */
-		if (child->props.delay_resume_if_extended)
-			dnode->props.delay_resume_if_extended = 1;
+	return _preload_children_done(dnode, update_devs_flag, r);
+}
 
-		if (!child->info.inactive_table &&
-		    child->props.segment_count &&
-		    !_load_node(child)) {
-			/*
-			 * If the table load does not succeed, we remove the
-			 * device in the kernel that would otherwise have an
-			 * empty table.  This makes the create + load of the
-			 * device atomic.  However, if other dependencies have
-			 * already been created and loaded; this code is
-			 * insufficient to remove those - only the node
-			 * encountering the table load failure is removed.
-			 */
-			if (node_created && !_remove_node(child))
+/*
+ * Parallel preload and activation.
+ *
+ * Every node below the processed node becomes a job.  A job is ready
+ * once the jobs of all the nodes it uses have finished, so parents are
+ * still created, loaded and resumed after their children and siblings
+ * keep their activation_priority ordering.  Ready jobs are taken by
+ * a pool of threads which share the library lock and release it only
+ * while waiting in the device-mapper ioctl, so independent subtrees
+ * overlap their kernel round trips and the total time depends on the
+ * depth of the tree rather than on the number of nodes.
+ *
+ * Jobs which need to synchronise with udev, run a node callback or
+ * send thin pool messages run exclusively, after all running jobs
+ * finished and with no other job started until they complete.
+ * When a job fails, the jobs depending on it are skipped while the
+ * independent ones are still processed.
+ */
+enum {
+	_PARALLEL_PRELOAD,
+	_PARALLEL_ACTIVATE
+};
+
+struct dm_tree_job_link {
+	struct dm_list list;
+	struct dm_tree_job *job;
+};
+
+struct dm_tree_job {
+	struct dm_list list;		/* Ready queue */
+	struct dm_list all_list;	/* All jobs */
+	struct dm_tree_node *node;
+	struct dm_tree_node *parent;	/* Node through which the job was found */
+	struct dm_list dependents;	/* Jobs waiting for this one */
+	unsigned pending;		/* Unfinished dependencies */
+	int update_devs;		/* Child needs immediate dev nodes */
+	int failed;			/* Job or its dependency failed */
+};
+
+struct dm_tree_parallel {
+	struct dm_pool *mem;
+	struct dm_tree_node *top;
+	const char *uuid_prefix;
+	size_t uuid_prefix_len;
+	int action;
+	int serial_only;		/* Tree needs serial processing */
+	int update_devs;		/* Top level needs immediate dev nodes */
+	struct dm_list all;
+	struct dm_list ready;
+	unsigned jobs;			/* Unfinished jobs */
+	unsigned running;
+	int exclusive_running;
+	int stalled;
+	int failed;
+	pthread_cond_t cond;
+};
+
+static struct dm_tree_job *_parallel_new_job(struct dm_tree_parallel *tp,
+					     struct dm_tree_node *node,
+					     struct dm_tree_node *parent)
+{
+	struct dm_tree_job *job;
+
+	if (!(job = dm_pool_zalloc(tp->mem, sizeof(*job)))) {
+		log_error("Failed to allocate job for %s.", _node_name(node));
+		return NULL;
+	}
+
+	job->node = node;
+	job->parent = parent;
+	dm_list_init(&job->dependents);
+	dm_list_add(&tp->all, &job->all_list);
+	node->job = job;
+	tp->jobs++;
+
+	return job;
+}
+
+/* Job may not start before dep has finished */
+static int _parallel_add_dep(struct dm_tree_parallel *tp,
+			     struct dm_tree_job *job,
+			     struct dm_tree_job *dep)
+{
+	struct dm_tree_job_link *link;
+
+	if (!(link = dm_pool_alloc(tp->mem, sizeof(*link)))) {
+		log_error("Failed to allocate job dependency for %s.",
+			  _node_name(job->node));
+		return 0;
+	}
+
+	link->job = job;
+	dm_list_add(&dep->dependents, &link->list);
+	job->pending++;
+
+	return 1;
+}
+
+/* Is dep reachable from node through the nodes it uses? */
+static int _node_uses(const struct dm_tree_node *node,
+		      const struct dm_tree_node *dep)
+{
+	struct dm_tree_link *dlink;
+
+	dm_list_iterate_items(dlink, &node->uses)
+		if ((dlink->node == dep) || _node_uses(dlink->node, dep))
+			return 1;
+
+	return 0;
+}
+
+/* Mirrors the traversal of _dm_tree_activate_children() */
+static int _parallel_collect_activate(struct dm_tree_parallel *tp,
+				      struct dm_tree_node *dnode)
+{
+	void *handle = NULL, *sibling_handle;
+	struct dm_tree_node *child, *sibling;
+	struct dm_tree_job *job;
+	const char *uuid;
+
+	while ((child = dm_tree_next_child(&handle, dnode, 0))) {
+		if (!(uuid = dm_tree_node_get_uuid(child))) {
+			stack;
+			continue;
+		}
+
+		if (!_uuid_prefix_matches(uuid, tp->uuid_prefix, tp->uuid_prefix_len))
+			continue;
+
+		/* Peer rename conflicts are resolved by the serial code */
+		if (child->props.new_name) {
+			tp->serial_only = 1;
+			return 1;
+		}
+
+		if (!(job = child->job)) {
+			if (!(job = _parallel_new_job(tp, child, dnode)))
 				return_0;
-			return_0;
+			if (!_parallel_collect_activate(tp, child))
+				return_0;
+			if (tp->serial_only)
+				return 1;
 		}
 
-		/* No resume for a device without parents or with unchanged or smaller size */
-		if (!dm_tree_node_num_children(child, 1) || (child->props.size_changed <= 0))
+		if (dnode->job && !_parallel_add_dep(tp, dnode->job, job))
+			return_0;
+	}
+
+	/* Siblings with lower activation_priority are resumed first */
+	handle = NULL;
+	while ((child = dm_tree_next_child(&handle, dnode, 0))) {
+		if (!child->job || !child->activation_priority)
 			continue;
 
-		if (!child->info.inactive_table && !child->info.suspended)
+		sibling_handle = NULL;
+		while ((sibling = dm_tree_next_child(&sibling_handle, dnode, 0)))
+			if (sibling->job &&
+			    (sibling->activation_priority < child->activation_priority) &&
+			    !_node_uses(sibling, child) &&
+			    !_parallel_add_dep(tp, child->job, sibling->job))
+				return_0;
+	}
+
+	return 1;
+}
+
+/* Mirrors the traversal of _dm_tree_preload_children() */
+static int _parallel_collect_preload(struct dm_tree_parallel *tp,
+				     struct dm_tree_node *dnode)
+{
+	void *handle = NULL;
+	struct dm_tree_node *child;
+	struct dm_tree_job *job;
+
+	while ((child = dm_tree_next_child(&handle, dnode, 0))) {
+		/* Propagate delay of resume from parent node */
+		if (dnode->props.delay_resume_if_new > 1)
+			child->props.delay_resume_if_new = dnode->props.delay_resume_if_new;
+
+		/* Skip existing non-device-mapper devices */
+		if (!child->info.exists && child->info.major)
 			continue;
 
-		if (!_resume_node(child->name, child->info.major, child->info.minor,
-				  child->props.read_ahead, child->props.read_ahead_flags,
-				  &child->info, &child->dtree->cookie, child->udev_flags,
-				  child->info.suspended)) {
-			log_error("Unable to resume %s.", _node_name(child));
-			/* If the device was not previously active, we might as well remove this node. */
-			if (!child->info.live_table &&
-			    !_deactivate_node(child->name, child->info.major, child->info.minor,
-					      &child->dtree->cookie, child->udev_flags, 0))
-				log_error("Unable to deactivate %s.", _node_name(child));
-			r = 0;
-			/* Each child is handled independently */
+		/* Ignore if it doesn't belong to this VG */
+		if (child->info.exists &&
+		    !_uuid_prefix_matches(child->uuid, tp->uuid_prefix, tp->uuid_prefix_len))
 			continue;
+
+		if (!(job = child->job)) {
+			if (!(job = _parallel_new_job(tp, child, dnode)))
+				return_0;
+			if (!_parallel_collect_preload(tp, child))
+				return_0;
 		}
 
-		if (node_created) {
-			/* Collect newly introduced devices for revert */
-			dm_list_add_h(&dnode->activated, &child->activated_list);
+		if (dnode->job && !_parallel_add_dep(tp, dnode->job, job))
+			return_0;
+	}
 
-			/* When creating new node also check transaction_id. */
-			if (child->props.send_messages &&
-			    !_node_send_messages(child, uuid_prefix, uuid_prefix_len, 0)) {
-				stack;
-				if (!dm_udev_wait(dm_tree_get_cookie(dnode)))
-					stack;
-				dm_tree_set_cookie(dnode, 0);
-				(void) _dm_tree_revert_activated(dnode);
-				r = 0;
-				continue;
+	return 1;
+}
+
+static int _parallel_preload_node(struct dm_tree_parallel *tp,
+				  struct dm_tree_job *job)
+{
+	struct dm_tree_node *child = job->node;
+	struct dm_tree_link *dlink;
+	int r = 1, update_devs_flag = 0;
+
+	if (dm_tree_node_num_children(child, 0) &&
+	    !_preload_children_done(child, job->update_devs, 1))
+		return_0;
+
+	if (!_preload_child(job->parent, child, tp->uuid_prefix, tp->uuid_prefix_len,
+			    &r, &update_devs_flag))
+		return_0;
+
+	/* Propagate to every parent which found this node */
+	dm_list_iterate_items(dlink, &child->used_by) {
+		if (dlink->node == tp->top) {
+			if (child->props.delay_resume_if_extended)
+				tp->top->props.delay_resume_if_extended = 1;
+			if (update_devs_flag)
+				tp->update_devs = 1;
+		} else if (dlink->node->job) {
+			if (child->props.delay_resume_if_extended)
+				dlink->node->props.delay_resume_if_extended = 1;
+			if (update_devs_flag)
+				dlink->node->job->update_devs = 1;
+		}
+	}
+
+	return r;
+}
+
+static int _parallel_activate_node(struct dm_tree_parallel *tp,
+				   struct dm_tree_job *job)
+{
+	struct dm_tree_node *child = job->node;
+
+	if ((child->props.send_messages > 1) &&
+	    dm_tree_node_num_children(child, 0) &&
+	    !_node_send_messages(child, tp->uuid_prefix, tp->uuid_prefix_len, 1))
+		return_0;
+
+	if (!child->info.inactive_table && !child->info.suspended)
+		return 1;
+
+	if (!_resume_node(child->name, child->info.major, child->info.minor,
+			  child->props.read_ahead, child->props.read_ahead_flags,
+			  &child->info, &child->dtree->cookie, child->udev_flags,
+			  child->info.suspended)) {
+		log_error("Unable to resume %s.", _node_name(child));
+		return 0;
+	}
+
+	return 1;
+}
+
+static int _parallel_job_is_exclusive(struct dm_tree_parallel *tp,
+				      struct dm_tree_job *job)
+{
+	struct dm_tree_node *node = job->node;
+
+	if (tp->action == _PARALLEL_ACTIVATE)
+		return (node->props.send_messages > 1);
+
+	return job->update_devs ||
+		(!node->info.exists && (node->callback || node->props.send_messages));
+}
+
+static struct dm_tree_job *_parallel_next_job(struct dm_tree_parallel *tp,
+					      int *exclusive)
+{
+	struct dm_tree_job *job;
+
+	*exclusive = 0;
+
+	if (tp->exclusive_running || dm_list_empty(&tp->ready))
+		return NULL;
+
+	job = dm_list_item(dm_list_first(&tp->ready), struct dm_tree_job);
+
+	if (!job->failed && _parallel_job_is_exclusive(tp, job)) {
+		if (tp->running)
+			return NULL;
+		*exclusive = 1;
+	}
+
+	dm_list_del(&job->list);
+
+	return job;
+}
+
+/* Called with the library lock held */
+static void _parallel_run_jobs(struct dm_tree_parallel *tp)
+{
+	struct dm_tree_job *job;
+	struct dm_tree_job_link *link;
+	int exclusive, r;
+
+	while (tp->jobs && !tp->stalled) {
+		if (!(job = _parallel_next_job(tp, &exclusive))) {
+			if (!tp->running && !tp->exclusive_running &&
+			    dm_list_empty(&tp->ready)) {
+				log_error(INTERNAL_ERROR "Parallel processing of %s "
+					  "stalled with %u unfinished nodes.",
+					  _node_name(tp->top), tp->jobs);
+				tp->stalled = 1;
+				tp->failed = 1;
+				pthread_cond_broadcast(&tp->cond);
+				break;
 			}
+			parallel_wait(&tp->cond);
+			continue;
 		}
 
-		/*
-		 * Prepare for immediate synchronization with udev and flush all stacked
-		 * dev node operations if requested by immediate_dev_node property. But
-		 * finish processing current level in the tree first.
-		 */
-		if (child->props.immediate_dev_node)
-			update_devs_flag = 1;
+		if (job->failed)
+			/* Skip job depending on a failed one */
+			r = 0;
+		else {
+			tp->running++;
+			tp->exclusive_running = exclusive;
+
+			r = (tp->action == _PARALLEL_PRELOAD) ?
+				_parallel_preload_node(tp, job) :
+				_parallel_activate_node(tp, job);
+
+			tp->exclusive_running = 0;
+			tp->running--;
+		}
+
+		if (!r)
+			tp->failed = 1;
+
+		dm_list_iterate_items(link, &job->dependents) {
+			if (!r)
+				link->job->failed = 1;
+			if (!--link->job->pending)
+				dm_list_add(&tp->ready, &link->job->list);
+		}
+
+		tp->jobs--;
+		pthread_cond_broadcast(&tp->cond);
 	}
+}
 
-	if (update_devs_flag ||
-	    (r && !dnode->info.exists && dnode->callback)) {
-		if (!dm_udev_wait(dm_tree_get_cookie(dnode)))
-			stack;
-		dm_tree_set_cookie(dnode, 0);
+static void *_parallel_worker(void *arg)
+{
+	struct dm_tree_parallel *tp = arg;
 
-		if (r && !dnode->info.exists && dnode->callback &&
-		    !dnode->callback(dnode, DM_NODE_CALLBACK_PRELOADED,
-				     dnode->callback_data))
-		{
-			/* Try to deactivate what has been activated in preload phase */
-			(void) _dm_tree_revert_activated(dnode);
-			return_0;
+	if (!parallel_enter())
+		return NULL;
+
+	_parallel_run_jobs(tp);
+
+	parallel_exit();
+
+	return NULL;
+}
+
+/*
+ * Process the children of dnode with a pool of threads.
+ * Sets *serial when the tree has to be processed serially instead.
+ */
+static int _dm_tree_parallel(struct dm_tree_node *dnode,
+			     const char *uuid_prefix,
+			     size_t uuid_prefix_len,
+			     int action, int *serial)
+{
+	struct dm_tree_parallel tp = { 0 };
+	struct dm_tree_job *job;
+	pthread_t threads[DM_TREE_MAX_PARALLEL_JOBS];
+	unsigned i, count = 0, workers;
+	int r = 0;
+
+	*serial = 1;
+
+	if (!(tp.mem = dm_pool_create("dtree_jobs", 1024))) {
+		log_error("Failed to allocate parallel jobs pool.");
+		return 0;
+	}
+
+	tp.top = dnode;
+	tp.uuid_prefix = uuid_prefix;
+	tp.uuid_prefix_len = uuid_prefix_len;
+	tp.action = action;
+	dm_list_init(&tp.all);
+	dm_list_init(&tp.ready);
+
+	if (!((action == _PARALLEL_PRELOAD) ?
+	      _parallel_collect_preload(&tp, dnode) :
+	      _parallel_collect_activate(&tp, dnode))) {
+		*serial = 0;
+		goto_out;
+	}
+
+	/* No gain with less than 2 nodes */
+	if (tp.serial_only || (tp.jobs < 2))
+		goto out;
+
+	if (pthread_cond_init(&tp.cond, NULL)) {
+		log_sys_debug("pthread_cond_init", _node_name(dnode));
+		goto out;
+	}
+
+	if (!parallel_enter()) {
+		log_debug_activation("Using serial processing for nested tree.");
+		goto out_cond;
+	}
+
+	*serial = 0;
+
+	dm_list_iterate_items_gen(job, &tp.all, all_list)
+		if (!job->pending)
+			dm_list_add(&tp.ready, &job->list);
+
+	/* Calling thread is one of the workers */
+	workers = dnode->dtree->parallel_jobs;
+	if (workers > tp.jobs)
+		workers = tp.jobs;
+
+	for (i = 1; i < workers; ++i) {
+		if (pthread_create(&threads[count], NULL, _parallel_worker, &tp)) {
+			log_debug_activation("Failed to create worker thread, "
+					     "continuing with %u threads.", count + 1);
+			break;
 		}
+		count++;
 	}
 
+	log_debug_activation("Processing %u nodes below %s with %u threads.",
+			     tp.jobs, _node_name(dnode), count + 1);
+
+	_parallel_run_jobs(&tp);
+
+	parallel_exit();
+
+	for (i = 0; i < count; ++i)
+		if (pthread_join(threads[i], NULL))
+			log_sys_debug("pthread_join", "");
+
+	r = !tp.failed;
+
+	if (r && (action == _PARALLEL_PRELOAD))
+		r = _preload_children_done(dnode, tp.update_devs, r);
+	else if (r && (dnode->props.send_messages > 1) &&
+		 !(r = _node_send_messages(dnode, uuid_prefix, uuid_prefix_len, 1)))
+		stack;
+out_cond:
+	if (pthread_cond_destroy(&tp.cond))
+		stack;
+out:
+	dm_list_iterate_items_gen(job, &tp.all, all_list)
+		job->node->job = NULL;
+
+	dm_pool_destroy(tp.mem);
+
 	return r;
 }
 
+int dm_tree_preload_children(struct dm_tree_node *dnode,
+			     const char *uuid_prefix,
+			     size_t uuid_prefix_len)
+{
+	int r, serial;
+
+	if (dnode->dtree->parallel_jobs > 1) {
+		r = _dm_tree_parallel(dnode, uuid_prefix, uuid_prefix_len,
+				      _PARALLEL_PRELOAD, &serial);
+		if (!serial)
+			return r;
+	}
+
+	return _dm_tree_preload_children(dnode, uuid_prefix, uuid_prefix_len);
+}
+
+int dm_tree_activate_children(struct dm_tree_node *dnode,
+			      const char *uuid_prefix,
+			      size_t uuid_prefix_len)
+{
+	int r, serial;
+
+	if (dnode->dtree->parallel_jobs > 1) {
+		r = _dm_tree_parallel(dnode, uuid_prefix, uuid_prefix_len,
+				      _PARALLEL_ACTIVATE, &serial);
+		if (!serial)
+			return r;
+	}
+
+	return _dm_tree_activate_children(dnode, uuid_prefix, uuid_prefix_len);
+}
+
 /*
  * Returns 1 if unsure.
  */
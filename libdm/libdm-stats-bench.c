@@ -0,0 +1,297 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of the device-mapper userspace tools.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU Lesser General Public License v.2.1.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Parse synthetic @stats_print responses the way dm_stats_populate()
+ * does and report the time spent per row, against the sscanf() based
+ * parser libdm used before.  Both parsers must produce the same counters.
+ * No device-mapper device is needed.
+ *
+ * e.g. 10000 single area regions, as dmfilemapd creates for a file:
+ *   libdm-stats-bench -r 10000 -a 1 -n 100
+ * or regions with histograms:
+ *   libdm-stats-bench -r 100 -a 100 -b 8 -n 100
+ */
+
+/* The parser is static. */
+#include "libdm-stats.c"
+
+#include <time.h>
+
+static uint64_t _now_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		return 0;
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* The parser replaced by _stats_parse_region(), for comparison. */
+static int _parse_region_sscanf(struct dm_stats *dms, const char *resp,
+				struct dm_stats_region *region)
+{
+	struct dm_histogram *hist = NULL;
+	struct dm_pool *mem = dms->mem;
+	struct dm_stats_counters cur;
+	FILE *stats_rows = NULL;
+	uint64_t start = 0, len = 0;
+	char row[STATS_ROW_BUF_LEN];
+	char *hist_str;
+
+	region->start = UINT64_MAX;
+
+	if (!dm_pool_begin_object(mem, 512))
+		return_0;
+
+	if (!(stats_rows = fmemopen((char *)resp, strlen(resp), "r")))
+		goto_bad;
+
+	while (fgets(row, sizeof(row), stats_rows)) {
+		if (sscanf(row, FMTu64 "+" FMTu64
+			   FMTu64 " " FMTu64 " " FMTu64 " " FMTu64 " "
+			   FMTu64 " " FMTu64 " " FMTu64 " " FMTu64 " "
+			   FMTu64 " " FMTu64 " " FMTu64 " "
+			   FMTu64 " " FMTu64, &start, &len,
+			   &cur.reads, &cur.reads_merged, &cur.read_sectors,
+			   &cur.read_nsecs,
+			   &cur.writes, &cur.writes_merged, &cur.write_sectors,
+			   &cur.write_nsecs,
+			   &cur.io_in_progress,
+			   &cur.io_nsecs, &cur.weighted_io_nsecs,
+			   &cur.total_read_nsecs, &cur.total_write_nsecs) != 15)
+			goto_bad;
+
+		if (region->bounds) {
+			if (!(hist_str = strchr(row, ':')))
+				goto_bad;
+			while (*(hist_str - 1) != ' ')
+				hist_str--;
+			if (!_stats_parse_histogram(dms->hist_mem, hist_str,
+						    &hist, region))
+				goto_bad;
+		}
+
+		cur.histogram = hist;
+
+		if (!dm_pool_grow_object(mem, &cur, sizeof(cur)))
+			goto_bad;
+
+		if (region->start == UINT64_MAX) {
+			region->start = start;
+			region->step = len;
+		}
+	}
+
+	region->len = (start + len) - region->start;
+	region->counters = dm_pool_end_object(mem);
+
+	(void) fclose(stats_rows);
+
+	return 1;
+bad:
+	if (stats_rows)
+		(void) fclose(stats_rows);
+	dm_pool_abandon_object(mem);
+
+	return 0;
+}
+
+static int _regions = 1000;
+static int _areas = 1;
+static int _bins;
+static int _iterations = 100;
+
+static char *_response(int nr_areas, int nr_bins, unsigned *seed)
+{
+	/* 15 numbers of up to 20 digits, the bins and separators */
+	size_t size = (size_t) nr_areas * (16 * 21 + nr_bins * 21 + 2) + 1;
+	uint64_t v[13];
+	char *buf, *p;
+	int a, i;
+
+	if (!(buf = p = dm_malloc(size)))
+		return NULL;
+
+	for (a = 0; a < nr_areas; a++) {
+		for (i = 0; i < 13; i++)
+			/* Mostly small values, some near the 64 bit limit */
+			v[i] = (rand_r(seed) % 16) ? (uint64_t) rand_r(seed) :
+				UINT64_MAX - (uint64_t) rand_r(seed);
+
+		p += sprintf(p, "%d+8 " FMTu64 " " FMTu64 " " FMTu64 " " FMTu64 " "
+			     FMTu64 " " FMTu64 " " FMTu64 " " FMTu64 " " FMTu64 " "
+			     FMTu64 " " FMTu64 " " FMTu64 " " FMTu64, a * 8,
+			     v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7],
+			     v[8], v[9], v[10], v[11], v[12]);
+
+		for (i = 0; i < nr_bins; i++)
+			p += sprintf(p, "%c%d", i ? ':' : ' ', rand_r(seed) % 1000);
+
+		*p++ = '\n';
+	}
+	*p = '\0';
+
+	return buf;
+}
+
+static int _same_counters(const struct dm_stats_region *r1,
+			  const struct dm_stats_region *r2, int nr_areas)
+{
+	const struct dm_stats_counters *c1, *c2;
+	int a;
+
+	if (r1->start != r2->start || r1->len != r2->len || r1->step != r2->step)
+		return 0;
+
+	for (a = 0; a < nr_areas; a++) {
+		c1 = &r1->counters[a];
+		c2 = &r2->counters[a];
+		if (memcmp(c1, c2, offsetof(struct dm_stats_counters, histogram)))
+			return 0;
+		if (c1->histogram &&
+		    (c1->histogram->sum != c2->histogram->sum ||
+		     memcmp(c1->histogram->bins, c2->histogram->bins,
+			    sizeof(c1->histogram->bins[0]) * c1->histogram->nr_bins)))
+			return 0;
+	}
+
+	return 1;
+}
+
+static uint64_t _run(struct dm_stats *dms, struct dm_stats_region *regions,
+		     char **resp, int new_parser)
+{
+	uint64_t start, total = 0;
+	int i, r;
+
+	for (i = 0; i < _iterations; i++) {
+		dm_pool_empty(dms->mem);
+		dm_pool_empty(dms->hist_mem);
+
+		start = _now_ns();
+		for (r = 0; r < _regions; r++)
+			if (!(new_parser ? _stats_parse_region(dms, resp[r], &regions[r], 1) :
+			      _parse_region_sscanf(dms, resp[r], &regions[r]))) {
+				fprintf(stderr, "Failed to parse region %d.\n", r);
+				return 0;
+			}
+		total += _now_ns() - start;
+	}
+
+	return total;
+}
+
+static void _usage(const char *prog)
+{
+	printf("Usage: %s [-r regions] [-a areas] [-b histogram_bins] [-n iterations]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct dm_stats_region *regions = NULL, *check = NULL;
+	struct dm_histogram *bounds = NULL;
+	struct dm_stats *dms = NULL;
+	char **resp = NULL, bounds_str[256];
+	uint64_t old_ns, new_ns, rows;
+	unsigned seed = 1;
+	int opt, i, r = 1;
+
+	while ((opt = getopt(argc, argv, "hr:a:b:n:")) != -1) {
+		switch (opt) {
+		case 'r':
+			_regions = atoi(optarg);
+			break;
+		case 'a':
+			_areas = atoi(optarg);
+			break;
+		case 'b':
+			_bins = atoi(optarg);
+			break;
+		case 'n':
+			_iterations = atoi(optarg);
+			break;
+		default:
+			_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	/* The old parser finds the histogram by its first ':' */
+	if ((_regions < 1) || (_areas < 1) || (_bins < 0) || (_bins == 1) ||
+	    (_bins > 32) || (_iterations < 1)) {
+		_usage(argv[0]);
+		return 1;
+	}
+
+	if (!(dms = dm_stats_create("bench")) ||
+	    !(regions = dm_zalloc(sizeof(*regions) * _regions)) ||
+	    !(check = dm_zalloc(sizeof(*check) * _regions)) ||
+	    !(resp = dm_zalloc(sizeof(*resp) * _regions))) {
+		fprintf(stderr, "Failed to allocate memory.\n");
+		goto out;
+	}
+
+	if (_bins) {
+		/* One bin starting at each bound: 0,1ms,2ms,... */
+		bounds_str[0] = '\0';
+		for (i = 0; i < _bins; i++)
+			sprintf(bounds_str + strlen(bounds_str), "%s%dms", i ? "," : "", i);
+		if (!(bounds = dm_histogram_bounds_from_string(bounds_str)))
+			goto out;
+	}
+
+	for (i = 0; i < _regions; i++) {
+		regions[i].bounds = check[i].bounds = bounds;
+		if (!(resp[i] = _response(_areas, bounds ? bounds->nr_bins : 0, &seed))) {
+			fprintf(stderr, "Failed to allocate memory.\n");
+			goto out;
+		}
+	}
+
+	/* Both parsers must agree before anything is timed. */
+	for (i = 0; i < _regions; i++)
+		if (!_parse_region_sscanf(dms, resp[i], &check[i]) ||
+		    !_stats_parse_region(dms, resp[i], &regions[i], 1) ||
+		    !_same_counters(&check[i], &regions[i], _areas)) {
+			fprintf(stderr, "Parsers disagree on region %d.\n", i);
+			goto out;
+		}
+
+	if (!(old_ns = _run(dms, regions, resp, 0)) ||
+	    !(new_ns = _run(dms, regions, resp, 1)))
+		goto out;
+
+	rows = (uint64_t) _regions * _areas * _iterations;
+	printf("regions %d areas %d bins %d rows " FMTu64 "\n", _regions, _areas,
+	       bounds ? bounds->nr_bins : 0, rows);
+	printf("sscanf     %8.1f ns/row\n", (double) old_ns / rows);
+	printf("hand-coded %8.1f ns/row  %.1fx\n", (double) new_ns / rows,
+	       (double) old_ns / new_ns);
+	r = 0;
+out:
+	if (resp)
+		for (i = 0; i < _regions; i++)
+			dm_free(resp[i]);
+	dm_free(resp);
+	dm_free(check);
+	dm_free(regions);
+	if (bounds)
+		dm_histogram_bounds_destroy(bounds);
+	if (dms)
+		dm_stats_destroy(dms);
+
+	return r;
+}
@@ -20,6 +20,7 @@
 
 #include "math.h" /* log10() */
 
+#include <stddef.h> /* offsetof */
 #include <sys/sysmacros.h>
 #include <sys/ioctl.h>
 #include <sys/vfs.h> /* fstatfs */
@@ -126,6 +127,7 @@ struct dm_stats {
 	uint64_t interval_ns;  /* sampling interval in nanoseconds */
 	uint64_t timescale; /* default sample value multiplier */
 	int precise; /* use precise_timestamps when creating regions */
+	uint64_t max_file_regions; /* limit on regions mapping a file */
 	struct dm_stats_region *regions;
 	struct dm_stats_group *groups;
 	/* statistics cursor */
@@ -182,6 +184,8 @@ struct dm_stats *dm_stats_create(const char *program_id)
 	size_t hist_hint = sizeof(struct dm_histogram_bin);
 	size_t group_hint = sizeof(struct dm_stats_group);
 	struct dm_stats *dms = NULL;
+	const char *env;
+	char *endptr;
 
 	if (!(dms = dm_zalloc(sizeof(*dms))))
 		return_NULL;
@@ -219,6 +223,17 @@ struct dm_stats *dm_stats_create(const char *program_id)
 	dms->timescale = NSEC_PER_MSEC;
 	dms->precise = 0;
 
+	if ((env = getenv(DM_STATS_MAX_FILE_REGIONS_ENV_VAR_NAME))) {
+		errno = 0;
+		dms->max_file_regions = strtoull(env, &endptr, 10);
+		if (errno || (endptr == env) || *endptr) {
+			log_warn("WARNING: Ignoring invalid "
+				 DM_STATS_MAX_FILE_REGIONS_ENV_VAR_NAME
+				 " value: %s.", env);
+			dms->max_file_regions = 0;
+		}
+	}
+
 	dms->nr_regions = DM_STATS_REGION_NOT_PRESENT;
 	dms->max_region = DM_STATS_REGION_NOT_PRESENT;
 	dms->regions = NULL;
@@ -614,6 +629,35 @@ bad:
 	return NULL;
 }
 
+/*
+ * Send msg using the message task in *dmt, creating it on first use.
+ * The kernel handles one region per message: reusing a single task
+ * for a series of them avoids setting up the task and the device for
+ * each region. The caller destroys the task when done.
+ */
+static int _stats_send_next_message(struct dm_stats *dms,
+				    struct dm_task **dmt, const char *msg)
+{
+	if (!*dmt) {
+		if (!(*dmt = dm_task_create(DM_DEVICE_TARGET_MSG)))
+			return_0;
+
+		if (!_set_stats_device(dms, *dmt)) {
+			dm_task_destroy(*dmt);
+			*dmt = NULL;
+			return_0;
+		}
+	}
+
+	if (!dm_task_set_message(*dmt, msg))
+		return_0;
+
+	if (!dm_task_run(*dmt))
+		return_0;
+
+	return 1;
+}
+
 /*
  * Cache the dm device_name for the device bound to dms.
  */
@@ -1214,36 +1258,88 @@ bad:
 	return 0;
 }
 
+/*
+ * Parse the unsigned decimal number at *c and advance *c past it.
+ * Counter rows are parsed by hand as sscanf() dominates the cost of
+ * populating handles with many regions or areas.
+ */
+static int _stats_parse_u64(const char **c, uint64_t *val)
+{
+	const char *p = *c;
+	uint64_t v = 0;
+	unsigned d;
+
+	if ((d = (unsigned) (*p - '0')) > 9)
+		return 0;
+
+	do {
+		if ((v > UINT64_MAX / 10) ||
+		    ((v == UINT64_MAX / 10) && (d > UINT64_MAX % 10)))
+			return 0;
+		v = v * 10 + d;
+	} while ((d = (unsigned) (*++p - '0')) <= 9);
+
+	*val = v;
+	*c = p;
+
+	return 1;
+}
+
+/* Counter fields of a @stats_print row in the order the kernel prints them. */
+static const size_t _stats_row_fields[] = {
+	offsetof(struct dm_stats_counters, reads),
+	offsetof(struct dm_stats_counters, reads_merged),
+	offsetof(struct dm_stats_counters, read_sectors),
+	offsetof(struct dm_stats_counters, read_nsecs),
+	offsetof(struct dm_stats_counters, writes),
+	offsetof(struct dm_stats_counters, writes_merged),
+	offsetof(struct dm_stats_counters, write_sectors),
+	offsetof(struct dm_stats_counters, write_nsecs),
+	offsetof(struct dm_stats_counters, io_in_progress),
+	offsetof(struct dm_stats_counters, io_nsecs),
+	offsetof(struct dm_stats_counters, weighted_io_nsecs),
+	offsetof(struct dm_stats_counters, total_read_nsecs),
+	offsetof(struct dm_stats_counters, total_write_nsecs)
+};
+
+#define STATS_ROW_FIELDS DM_ARRAY_SIZE(_stats_row_fields)
+
+/*
+ * Parse one @stats_print row into cur and return a pointer to the
+ * following row, or NULL if the row is malformed.
+ */
+static const char *_stats_parse_row(const char *c, uint64_t *start,
+				    uint64_t *len, struct dm_stats_counters *cur)
+{
+	unsigned i;
+
+	if (!_stats_parse_u64(&c, start) || (*c++ != '+') ||
+	    !_stats_parse_u64(&c, len))
+		return NULL;
+
+	for (i = 0; i < STATS_ROW_FIELDS; i++)
+		if ((*c++ != ' ') ||
+		    !_stats_parse_u64(&c, (uint64_t *)((char *) cur + _stats_row_fields[i])))
+			return NULL;
+
+	return c;
+}
+
 static int _stats_parse_region(struct dm_stats *dms, const char *resp,
 			       struct dm_stats_region *region,
 			       uint64_t timescale)
 {
 	struct dm_histogram *hist = NULL;
 	struct dm_pool *mem = dms->mem;
-	struct dm_stats_counters cur;
-	FILE *stats_rows = NULL;
-	uint64_t start = 0, len = 0;
-	char row[STATS_ROW_BUF_LEN];
-	int r;
+	struct dm_stats_counters *counters, *cur;
+	uint64_t start = 0, len = 0, nr_rows = 0;
+	const char *c, *next;
 
 	if (!resp) {
 		log_error("Could not parse empty @stats_print response.");
 		return 0;
 	}
 
-	region->start = UINT64_MAX;
-
-	if (!dm_pool_begin_object(mem, 512))
-		goto_bad;
-
-	/*
-	 * dm_task_get_message_response() returns a 'const char *' but
-	 * since fmemopen also permits "w" it expects a 'char *'.
-	 */
-	stats_rows = fmemopen((char *)resp, strlen(resp), "r");
-	if (!stats_rows)
-		goto_bad;
-
 	/*
 	 * Output format for each step-sized area of a region:
 	 *
@@ -1270,90 +1366,87 @@ static int _stats_parse_region(struct dm_stats *dms, const char *resp,
 	 * 12. the total time spent reading in milliseconds
 	 * 13. the total time spent writing in milliseconds
 	 *
-	*/
-	while (fgets(row, sizeof(row), stats_rows)) {
-		r = sscanf(row, FMTu64 "+" FMTu64 /* start+len */
-			   /* reads */
-			   FMTu64 " " FMTu64 " " FMTu64 " " FMTu64 " "
-			   /* writes */
-			   FMTu64 " " FMTu64 " " FMTu64 " " FMTu64 " "
-			   /* in flight & io nsecs */
-			   FMTu64 " " FMTu64 " " FMTu64 " "
-			   /* tot read/write nsecs */
-			   FMTu64 " " FMTu64, &start, &len,
-			   &cur.reads, &cur.reads_merged, &cur.read_sectors,
-			   &cur.read_nsecs,
-			   &cur.writes, &cur.writes_merged, &cur.write_sectors,
-			   &cur.write_nsecs,
-			   &cur.io_in_progress,
-			   &cur.io_nsecs, &cur.weighted_io_nsecs,
-			   &cur.total_read_nsecs, &cur.total_write_nsecs);
-		if (r != 15) {
+	 * Regions with histograms append the bin counts to each row.
+	 *
+	 * Each row fills one area of the counter table, so count the
+	 * rows to allocate the table in one go.
+	 */
+	for (c = resp; *c; c = next) {
+		if (!(next = strchr(c, '\n'))) {
+			nr_rows++;
+			break;
+		}
+		if (next++ != c)
+			nr_rows++;
+	}
+
+	if (!nr_rows) {
+		/* no area data read from @stats_print */
+		log_error("Could not parse empty @stats_print response.");
+		return 0;
+	}
+
+	if (!(counters = dm_pool_alloc(mem, nr_rows * sizeof(*counters))))
+		return_0;
+
+	for (c = resp, cur = counters; *c; c = next) {
+		if (*c == '\n') {
+			next = c + 1;
+			continue;
+		}
+
+		if (!(c = _stats_parse_row(c, &start, &len, cur))) {
 			log_error("Could not parse @stats_print row.");
 			goto bad;
 		}
 
 		/* scale time values up if needed */
 		if (timescale != 1) {
-			cur.read_nsecs *= timescale;
-			cur.write_nsecs *= timescale;
-			cur.io_nsecs *= timescale;
-			cur.weighted_io_nsecs *= timescale;
-			cur.total_read_nsecs *= timescale;
-			cur.total_write_nsecs *= timescale;
+			cur->read_nsecs *= timescale;
+			cur->write_nsecs *= timescale;
+			cur->io_nsecs *= timescale;
+			cur->weighted_io_nsecs *= timescale;
+			cur->total_read_nsecs *= timescale;
+			cur->total_write_nsecs *= timescale;
 		}
 
 		if (region->bounds) {
-			/* Find first histogram separator. */
-			char *hist_str = strchr(row, ':');
-			if (!hist_str) {
+			/* The histogram follows the last counter. */
+			if (*c++ != ' ') {
 				log_error("Could not parse histogram value.");
 				goto bad;
 			}
-			/* Find space preceding histogram. */
-			while (hist_str && *(hist_str - 1) != ' ')
-				hist_str--;
 
 			/* Use a separate pool for histogram objects since we
 			 * are growing the area table and each area's histogram
 			 * table simultaneously.
 			 */
-			if (!_stats_parse_histogram(dms->hist_mem, hist_str,
+			if (!_stats_parse_histogram(dms->hist_mem, (char *) c,
 						    &hist, region))
 				goto_bad;
 			hist->dms = dms;
 			hist->region = region;
 		}
 
-		cur.histogram = hist;
+		cur->histogram = hist;
 
-		if (!dm_pool_grow_object(mem, &cur, sizeof(cur)))
-			goto_bad;
-
-		if (region->start == UINT64_MAX) {
+		if (cur++ == counters) {
 			region->start = start;
 			region->step = len; /* area size is always uniform. */
 		}
-	}
 
-	if (region->start == UINT64_MAX)
-		/* no area data read from @stats_print */
-		goto bad;
+		/* Ignore any fields added after the ones we know. */
+		next = (next = strchr(c, '\n')) ? next + 1 : c + strlen(c);
+	}
 
 	region->len = (start + len) - region->start;
 	region->timescale = timescale;
-	region->counters = dm_pool_end_object(mem);
-
-	if (fclose(stats_rows))
-		stack;
+	region->counters = counters;
 
 	return 1;
 
 bad:
-	if (stats_rows)
-		if (fclose(stats_rows))
-			stack;
-	dm_pool_abandon_object(mem);
+	dm_pool_free(mem, counters);
 
 	return 0;
 }
@@ -1917,36 +2010,22 @@ bad:
 }
 
 /*
- * Maximum length of a "start+end" range string:
- * Two 20 digit uint64_t, '+', and NULL.
+ * Build the arguments that follow the range of a @stats_create message:
+ * "<step> <nr_opts> [<opts>] <program_id> <aux_data>". The string must
+ * be freed with dm_free().
  */
-#define RANGE_LEN 42
-static int _stats_create_region(struct dm_stats *dms, uint64_t *region_id,
-				uint64_t start, uint64_t len, int64_t step,
+static char *_stats_create_args(struct dm_stats *dms, int64_t step,
 				int precise, const char *hist_arg,
-				const char *program_id,	const char *aux_data)
+				const char *program_id, const char *aux_data)
 {
-	char msg[STATS_MSG_BUF_LEN], range[RANGE_LEN], *endptr = NULL;
 	const char *err_fmt = "Could not prepare @stats_create %s.";
 	const char *precise_str = PRECISE_ARG;
-	const char *resp, *opt_args = NULL;
-	struct dm_task *dmt = NULL;
-	int r = 0, nr_opt = 0;
-
-	if (!_stats_bound(dms))
-		return_0;
+	char *opt_args = NULL, *args = NULL;
+	int nr_opt = 0;
 
 	if (!program_id || !strlen(program_id))
 		program_id = dms->program_id;
 
-	if (start || len) {
-		if (!dm_snprintf(range, sizeof(range), FMTu64 "+" FMTu64,
-				 start, len)) {
-			log_error(err_fmt, "range");
-			return 0;
-		}
-	}
-
 	if (precise < 0)
 		precise = dms->precise;
 
@@ -1961,48 +2040,98 @@ static int _stats_create_region(struct dm_stats *dms, uint64_t *region_id,
 		hist_arg = "";
 
 	if (nr_opt) {
-		if ((dm_asprintf((char **)&opt_args, "%d %s %s%s", nr_opt,
+		if ((dm_asprintf(&opt_args, "%d %s %s%s", nr_opt,
 				 precise_str,
 				 (strlen(hist_arg)) ? HISTOGRAM_ARG : "",
 				 hist_arg)) < 0) {
 			log_error(err_fmt, PRECISE_ARG " option.");
-			return 0;
+			return NULL;
 		}
-	} else
-		opt_args = dm_strdup("");
+	}
 
-	if (!dm_snprintf(msg, sizeof(msg), "@stats_create %s %s" FMTu64
-			 " %s %s %s", (start || len) ? range : "-",
-			 (step < 0) ? "/" : "",
-			 (uint64_t)llabs(step),
-			 opt_args, program_id, aux_data)) {
+	if (dm_asprintf(&args, "%s" FMTu64 " %s %s %s",
+			(step < 0) ? "/" : "", (uint64_t)llabs(step),
+			opt_args ? : "", program_id, aux_data) < 0) {
 		log_error(err_fmt, "message");
-		dm_free((void *) opt_args);
-		return 0;
+		args = NULL;
 	}
 
-	if (!(dmt = _stats_send_message(dms, msg)))
-		goto_out;
+	dm_free(opt_args);
+
+	return args;
+}
+
+/*
+ * Read the new region_id from the response to a @stats_create message.
+ */
+static int _stats_create_response(struct dm_task *dmt, uint64_t *region_id)
+{
+	char *endptr = NULL;
+	const char *resp;
 
 	resp = dm_task_get_message_response(dmt);
 	if (!resp) {
 		log_error("Could not parse empty @stats_create response.");
-		goto out;
+		return 0;
 	}
 
 	if (region_id) {
 		errno = 0;
 		*region_id = strtoull(resp, &endptr, 10);
 		if (errno || resp == endptr)
-			goto_out;
+			return_0;
+	}
+
+	return 1;
+}
+
+/*
+ * Maximum length of a "start+end" range string:
+ * Two 20 digit uint64_t, '+', and NULL.
+ */
+#define RANGE_LEN 42
+static int _stats_create_region(struct dm_stats *dms, uint64_t *region_id,
+				uint64_t start, uint64_t len, int64_t step,
+				int precise, const char *hist_arg,
+				const char *program_id,	const char *aux_data)
+{
+	char msg[STATS_MSG_BUF_LEN], range[RANGE_LEN], *args;
+	struct dm_task *dmt = NULL;
+	int r = 0;
+
+	if (!_stats_bound(dms))
+		return_0;
+
+	if (start || len) {
+		if (!dm_snprintf(range, sizeof(range), FMTu64 "+" FMTu64,
+				 start, len)) {
+			log_error("Could not prepare @stats_create range.");
+			return 0;
+		}
+	}
+
+	if (!(args = _stats_create_args(dms, step, precise, hist_arg,
+					program_id, aux_data)))
+		return_0;
+
+	if (!dm_snprintf(msg, sizeof(msg), "@stats_create %s %s",
+			 (start || len) ? range : "-", args)) {
+		log_error("Could not prepare @stats_create message.");
+		goto out;
 	}
 
+	if (!(dmt = _stats_send_message(dms, msg)))
+		goto_out;
+
+	if (!_stats_create_response(dmt, region_id))
+		goto_out;
+
 	r = 1;
 
 out:
 	if (dmt)
 		dm_task_destroy(dmt);
-	dm_free((void *) opt_args);
+	dm_free(args);
 
 	return r;
 }
@@ -2045,8 +2174,14 @@ static void _stats_clear_group_regions(struct dm_stats *dms, uint64_t group_id)
 		dms->regions[i].group_id = DM_STATS_GROUP_NOT_PRESENT;
 }
 
+/*
+ * Remove a region from its group. Unless set_aux is zero the group
+ * descriptor in the leader's aux_data is rewritten: callers changing
+ * several members at once clear it and update the descriptor when
+ * done.
+ */
 static int _stats_remove_region_id_from_group(struct dm_stats *dms,
-					      uint64_t region_id)
+					      uint64_t region_id, int set_aux)
 {
 	struct dm_stats_region *region = &dms->regions[region_id];
 	uint64_t group_id = region->group_id;
@@ -2063,6 +2198,9 @@ static int _stats_remove_region_id_from_group(struct dm_stats *dms,
 		_stats_group_destroy(&dms->groups[group_id]);
 	}
 
+	if (!set_aux)
+		return 1;
+
 	return _stats_set_aux(dms, group_id, dms->regions[group_id].aux_data);
 }
 
@@ -2072,7 +2210,7 @@ static int _stats_delete_region(struct dm_stats *dms, uint64_t region_id)
 	struct dm_task *dmt;
 
 	if (_stats_region_is_grouped(dms, region_id))
-		if (!_stats_remove_region_id_from_group(dms, region_id)) {
+		if (!_stats_remove_region_id_from_group(dms, region_id, 1)) {
 			log_error("Could not remove region ID " FMTu64 " from "
 				  "group ID " FMTu64,
 				  region_id, dms->regions[region_id].group_id);
@@ -2318,6 +2456,7 @@ int dm_stats_populate(struct dm_stats *dms, const char *program_id,
 	int all_regions = (region_id == DM_STATS_REGIONS_ALL);
 	struct dm_task *dmt = NULL; /* @stats_print task */
 	uint64_t saved_flags; /* saved walk flags */
+	char msg[STATS_MSG_BUF_LEN];
 	const char *resp;
 
 	/*
@@ -2358,24 +2497,30 @@ int dm_stats_populate(struct dm_stats *dms, const char *program_id,
 			     ? dm_stats_get_current_region(dms) : region_id;
 
 		/* obtain all lines and clear counter values */
-		if (!(dmt = _stats_print_region(dms, region_id, 0, 0, 1)))
+		if (dm_snprintf(msg, sizeof(msg), "@stats_print_clear " FMTu64,
+				region_id) < 0) {
+			log_error("Could not prepare @stats_print message.");
+			goto bad;
+		}
+
+		if (!_stats_send_next_message(dms, &dmt, msg))
 			goto_bad;
 
 		resp = dm_task_get_message_response(dmt);
-		if (!_dm_stats_populate_region(dms, region_id, resp)) {
-			dm_task_destroy(dmt);
+		if (!_dm_stats_populate_region(dms, region_id, resp))
 			goto_bad;
-		}
 
-		dm_task_destroy(dmt);
 		dm_stats_walk_next(dms);
 
 	} while (all_regions && !dm_stats_walk_end(dms));
 
+	dm_task_destroy(dmt);
 	dms->walk_flags = saved_flags;
 	return 1;
 
 bad:
+	if (dmt)
+		dm_task_destroy(dmt);
 	dms->walk_flags = saved_flags;
 	_stats_regions_destroy(dms);
 	dms->regions = NULL;
@@ -4175,6 +4320,11 @@ int dm_stats_get_group_descriptor(const struct dm_stats *dms,
 	return 1;
 }
 
+void dm_stats_set_max_file_regions(struct dm_stats *dms, uint64_t max_regions)
+{
+	dms->max_file_regions = max_regions;
+}
+
 #ifdef HAVE_LINUX_FIEMAP_H
 /*
  * Resize the group bitmap corresponding to group_id so that it can
@@ -4471,17 +4621,74 @@ bad:
 	return NULL;
 }
 
-#define MATCH_EXTENT(e, s, l) \
-(((e).start == (s)) && ((e).len == (l)))
+static int _gap_compare(const void *p1, const void *p2)
+{
+	uint64_t g1 = *(const uint64_t *) p1, g2 = *(const uint64_t *) p2;
 
-static struct _extent *_find_extent(uint64_t nr_extents, struct _extent *extents,
-				    uint64_t start, uint64_t len)
+	return (g1 < g2) ? -1 : (g1 > g2);
+}
+
+/*
+ * Merge the extents of a file that are closest together on the device
+ * until no more than max_regions remain. The gaps are closed smallest
+ * first, so physically adjacent extents are always merged before any
+ * sectors that do not belong to the file are counted.
+ */
+static int _stats_merge_extents(struct _extent *extents, uint64_t *count,
+				uint64_t max_regions)
 {
-	size_t i;
-	for (i = 0; i < nr_extents; i++)
-		if (MATCH_EXTENT(extents[i], start, len))
-			return extents + i;
-	return NULL;
+	uint64_t i, j, end, nr_gaps, nr_merge, nr_equal, threshold;
+	uint64_t *gaps, *sorted;
+
+	if (!max_regions || (*count <= max_regions))
+		return 1;
+
+	nr_gaps = *count - 1;
+	nr_merge = *count - max_regions;
+
+	if (!(gaps = dm_malloc(2 * nr_gaps * sizeof(*gaps)))) {
+		log_error("Could not allocate memory for extent gaps.");
+		return 0;
+	}
+	sorted = gaps + nr_gaps;
+
+	qsort(extents, *count, sizeof(*extents), _extent_start_compare);
+
+	for (i = 0; i < nr_gaps; i++) {
+		end = extents[i].start + extents[i].len;
+		gaps[i] = (extents[i + 1].start > end) ?
+			   extents[i + 1].start - end : 0;
+	}
+
+	/* Close every gap below the threshold and enough equal to it. */
+	memcpy(sorted, gaps, nr_gaps * sizeof(*gaps));
+	qsort(sorted, nr_gaps, sizeof(*sorted), _gap_compare);
+	threshold = sorted[nr_merge - 1];
+	for (nr_equal = nr_merge; nr_equal && (sorted[nr_equal - 1] == threshold);)
+		nr_equal--;
+	nr_equal = nr_merge - nr_equal;
+
+	for (i = 0, j = 0; i < nr_gaps; i++) {
+		if ((gaps[i] < threshold) ||
+		    ((gaps[i] == threshold) && nr_equal && nr_equal--)) {
+			end = extents[i + 1].start + extents[i + 1].len;
+			if (end > extents[j].start + extents[j].len)
+				extents[j].len = end - extents[j].start;
+			continue;
+		}
+		extents[++j] = extents[i + 1];
+	}
+
+	log_very_verbose("Merged " FMTu64 " file extents into " FMTu64
+			 " regions.", *count, j + 1);
+
+	*count = j + 1;
+	for (i = 0; i < *count; i++)
+		extents[i].id = i;
+
+	dm_free(gaps);
+
+	return 1;
 }
 
 /*
@@ -4500,82 +4707,276 @@ static void _stats_cleanup_region_ids(struct dm_stats *dms, uint64_t *regions,
 }
 
 /*
- * First update pass: prune no-longer-allocated extents from the group
- * and build a table of the remaining extents so that their creation
- * can be skipped in the second pass.
+ * Delete a region of the file mapped group being updated. Unlike
+ * _stats_delete_region() the group descriptor stored in the leader's
+ * aux_data is not rewritten for every region: the caller updates it
+ * once all changes to the group have been made, or have failed.
  */
-static int _stats_unmap_regions(struct dm_stats *dms, uint64_t group_id,
-				struct dm_pool *mem, struct _extent *extents,
-				struct _extent **old_extents, uint64_t *count,
-				int *regroup)
+static int _stats_delete_file_region(struct dm_stats *dms,
+				     struct dm_task **dmt, uint64_t region_id)
 {
-	struct dm_stats_region *region = NULL;
-	struct dm_stats_group *group = NULL;
-	uint64_t nr_kept, nr_old;
-	struct _extent ext;
-	int64_t i;
+	char msg[STATS_MSG_BUF_LEN];
 
-	group = &dms->groups[group_id];
+	if (!dm_snprintf(msg, sizeof(msg), "@stats_delete " FMTu64, region_id)) {
+		log_error("Could not prepare @stats_delete message.");
+		return 0;
+	}
+
+	if (!_stats_send_next_message(dms, dmt, msg))
+		return_0;
+
+	/* only drop the region from the group once it is gone */
+	if (_stats_region_is_grouped(dms, region_id))
+		return _stats_remove_region_id_from_group(dms, region_id, 0);
+
+	return 1;
+}
+
+/*
+ * Create a region for a file extent. The arguments that follow the
+ * range in the @stats_create message are the same for every extent
+ * and are prepared once by the caller.
+ */
+static int _stats_create_file_region(struct dm_stats *dms,
+				     struct dm_task **dmt, uint64_t *region_id,
+				     const struct _extent *extent,
+				     const char *args)
+{
+	char msg[STATS_MSG_BUF_LEN];
+
+	if (!dm_snprintf(msg, sizeof(msg), "@stats_create " FMTu64 "+" FMTu64
+			 " %s", extent->start, extent->len, args)) {
+		log_error("Could not prepare @stats_create message.");
+		return 0;
+	}
+
+	if (!_stats_send_next_message(dms, dmt, msg))
+		return_0;
+
+	return _stats_create_response(*dmt, region_id);
+}
+
+/*
+ * Find the region of the group being updated that starts at start
+ * and is no longer than len, and that is not yet kept for another
+ * extent. A region of exactly len is preferred, and is required if
+ * exact is set. The regions are sorted by start.
+ */
+static struct _extent *_find_file_region(struct _extent *old, uint64_t nr_old,
+					 dm_bitset_t kept, uint64_t start,
+					 uint64_t len, int exact)
+{
+	struct _extent *found = NULL;
+	uint64_t lo = 0, hi = nr_old, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (old[mid].start < start)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (; (lo < nr_old) && (old[lo].start == start); lo++) {
+		if (dm_bit(kept, lo) || (old[lo].len > len))
+			continue;
+		if (old[lo].len == len)
+			return old + lo;
+		if (!exact && (!found || (old[lo].len > found->len)))
+			found = old + lo;
+	}
+
+	return found;
+}
+
+/*
+ * Update the regions of a file mapped group to match the current
+ * extents of the file, changing only the regions that no longer do.
+ *
+ * An extent keeps the region that begins with it (its head) as long
+ * as the head does not extend past the end of the extent. If the
+ * extent has grown, a second region covers the rest of it, and later
+ * growth only replaces that tail. This preserves the counters of all
+ * unchanged extents and of the bulk of extents that a file grows by
+ * appending. Regions of the group not kept are deleted and regions
+ * are created for everything not covered: the kernel cannot resize a
+ * region, so an extent that shrank or moved gets a new one.
+ *
+ * Returns the table of the group's region_ids, terminated by
+ * DM_STATS_REGION_NOT_PRESENT, and the number of regions in *count.
+ */
+static uint64_t *_stats_update_file_regions(struct dm_stats *dms,
+					    uint64_t group_id,
+					    struct dm_task **dmt,
+					    struct _extent *extents,
+					    uint64_t *count, const char *args,
+					    int *regroup)
+{
+	uint64_t nr_old = 0, nr_regions = 0, nr_new = 0, nr_created = 0;
+	uint64_t nr_deleted = 0;
+	struct dm_stats_group *group = &dms->groups[group_id];
+	struct _extent *old = NULL, *new = NULL, *head, *tail;
+	uint64_t i, end, *regions = NULL, num_bits;
+	dm_bitset_t kept = NULL;
+	int64_t id;
 
 	log_very_verbose("Checking for changed file extents in group ID "
 			 FMTu64, group_id);
 
-	if (!dm_pool_begin_object(mem, sizeof(**old_extents))) {
-		log_error("Could not allocate extent table.");
-		return 0;
+	/* The regions of the group, sorted by start. */
+	for (id = dm_bit_get_first(group->regions); id >= 0;
+	     id = dm_bit_get_next(group->regions, id))
+		nr_old++;
+
+	/* An extent maps to at most two regions. */
+	if (!(old = dm_malloc((nr_old + 1) * sizeof(*old))) ||
+	    !(new = dm_malloc((2 * *count + 1) * sizeof(*new))) ||
+	    !(regions = dm_malloc((2 * *count + 1) * sizeof(*regions))) ||
+	    !(kept = dm_bitset_create(NULL, (unsigned) nr_old + 1))) {
+		log_error("Could not allocate memory for file region update.");
+		goto bad;
+	}
+
+	i = 0;
+	for (id = dm_bit_get_first(group->regions); id >= 0;
+	     id = dm_bit_get_next(group->regions, id)) {
+		old[i].id = (uint64_t) id;
+		old[i].start = dms->regions[id].start;
+		old[i++].len = dms->regions[id].len;
 	}
+	qsort(old, nr_old, sizeof(*old), _extent_start_compare);
+
+	for (i = 0; i < *count; i++) {
+		end = extents[i].start + extents[i].len;
+
+		if (!(head = _find_file_region(old, nr_old, kept,
+					       extents[i].start,
+					       extents[i].len, 0))) {
+			new[nr_new] = extents[i];
+			new[nr_new++].id = nr_regions++;
+			continue;
+		}
 
-	nr_kept = nr_old = 0; /* counts of old and retained extents */
+		dm_bit_set(kept, head - old);
+		regions[nr_regions++] = head->id;
+
+		if (head->start + head->len == end)
+			continue;
+
+		if ((tail = _find_file_region(old, nr_old, kept,
+					      head->start + head->len,
+					      end - head->start - head->len,
+					      1))) {
+			dm_bit_set(kept, tail - old);
+			regions[nr_regions++] = tail->id;
+			continue;
+		}
+
+		new[nr_new].start = head->start + head->len;
+		new[nr_new].len = end - new[nr_new].start;
+		new[nr_new++].id = nr_regions++;
+	}
 
 	/*
-	 * First pass: delete de-allocated extents and set regroup=1 if
-	 * deleting the current group leader.
+	 * Delete the regions not kept before creating new ones, so that
+	 * their region_ids can be reused. Deleting the group leader
+	 * destroys the group: it is re-created by the caller.
 	 */
-	i = dm_bit_get_last(group->regions);
-	for (; i >= 0; i = dm_bit_get_prev(group->regions, i)) {
-		region = &dms->regions[i];
-		nr_old++;
+	for (i = 0; i < nr_old; i++) {
+		if (dm_bit(kept, i))
+			continue;
 
-		if (extents && _find_extent(*count, extents,
-				  region->start, region->len)) {
-			ext.start = region->start;
-			ext.len = region->len;
-			ext.id = i;
-			nr_kept++;
+		if (old[i].id == group_id)
+			*regroup = 1;
 
-			if (!dm_pool_grow_object(mem, &ext, sizeof(ext)))
-				goto out;
+		if (!_stats_delete_file_region(dms, dmt, old[i].id)) {
+			log_error("Could not remove region ID " FMTu64,
+				  old[i].id);
+			goto out_aux;
+		}
+		nr_deleted++;
 
-			log_very_verbose("Kept region " FMTu64, i);
-		} else {
+		log_very_verbose("Deleted region " FMTu64, old[i].id);
+	}
 
-			if (i == group_id)
-				*regroup = 1;
+	for (i = 0; i < nr_new; i++) {
+		if (!_stats_create_file_region(dms, dmt, regions + new[i].id,
+					       new + i, args)) {
+			log_error("Failed to create region for extent at "
+				  FMTu64 "+" FMTu64 ".", new[i].start,
+				  new[i].len);
+			goto out_remove;
+		}
+		nr_created++;
 
-			if (!_stats_delete_region(dms, i)) {
-				log_error("Could not remove region ID " FMTu64,
-					  i);
-				goto out;
-			}
+		log_very_verbose("Created new region mapping " FMTu64 "+" FMTu64
+				 " with region ID " FMTu64, new[i].start,
+				 new[i].len, regions[new[i].id]);
 
-			log_very_verbose("Deleted region " FMTu64, i);
+		if (!*regroup) {
+			/* expand group bitmap */
+			if (regions[new[i].id] > (group->regions[0] - 1)) {
+				num_bits = regions[new[i].id] + nr_new;
+				if (!_stats_resize_group(group, num_bits)) {
+					log_error("Failed to resize group "
+						  "bitmap.");
+					goto out_remove;
+				}
+			}
+			dm_bit_set(group->regions, regions[new[i].id]);
 		}
 	}
 
-	*old_extents = dm_pool_end_object(mem);
-	if (!*old_extents) {
-		log_error("Could not finalize region extent table.");
-		goto out;
-	}
-	log_very_verbose("Kept " FMTd64 " of " FMTd64 " old extents",
-			 nr_kept, nr_old);
-	log_very_verbose("Found " FMTu64 " new extents",
-			 *count - nr_kept);
+	/* Update group leader aux_data once for all changed members. */
+	if (!*regroup && (nr_new || (nr_regions - nr_new < nr_old)))
+		if (!_stats_set_aux(dms, group_id,
+				    dms->regions[group_id].aux_data))
+			log_error("Failed to update group aux_data.");
 
-	return (int) nr_kept;
-out:
-	dm_pool_abandon_object(mem);
-	return -1;
+	log_verbose("Updated file map group ID " FMTu64 ": kept " FMTu64
+		    ", deleted " FMTu64 ", created " FMTu64 " regions.",
+		    group_id, nr_regions - nr_new,
+		    nr_old - (nr_regions - nr_new), nr_new);
+
+	regions[nr_regions] = DM_STATS_REGION_NOT_PRESENT;
+	*count = nr_regions;
+
+	dm_bitset_destroy(kept);
+	dm_free(new);
+	dm_free(old);
+
+	return regions;
+
+out_remove:
+	/* The regions created are rolled back: drop them from the group. */
+	if (!*regroup)
+		for (i = 0; i < nr_created; i++)
+			if (regions[new[i].id] < group->regions[0])
+				dm_bit_clear(group->regions, regions[new[i].id]);
+out_aux:
+	/*
+	 * The regions deleted so far are gone. Describe the group by the
+	 * kept regions before the list below reads the descriptor back.
+	 */
+	if (!*regroup && (nr_deleted || nr_created) &&
+	    !_stats_set_aux(dms, group_id, dms->regions[group_id].aux_data))
+		log_error("Failed to update group aux_data.");
+
+	/* Only roll back the regions created by this update. */
+	if (nr_created && dm_stats_list(dms, NULL))
+		for (i = 0; i < nr_created; i++)
+			if (!_stats_delete_region(dms, regions[new[i].id]))
+				log_error("Could not delete region " FMTu64 ".",
+					  regions[new[i].id]);
+bad:
+	if (kept)
+		dm_bitset_destroy(kept);
+	dm_free(regions);
+	dm_free(new);
+	dm_free(old);
+	*count = 0;
+
+	return NULL;
 }
 
 /*
@@ -4594,14 +4995,12 @@ static uint64_t *_stats_map_file_regions(struct dm_stats *dms, int fd,
 					 int precise, uint64_t group_id,
 					 uint64_t *count, int *regroup)
 {
-	struct _extent *extents = NULL, *old_extents = NULL;
-	uint64_t *regions = NULL, fail_region, i, num_bits;
-	struct dm_stats_group *group = NULL;
+	uint64_t *regions = NULL, fail_region, i;
 	struct dm_pool *extent_mem = NULL;
-	struct _extent *old_ext;
-	char *hist_arg = NULL;
+	struct _extent *extents = NULL;
+	struct dm_task *dmt = NULL;
+	char *hist_arg = NULL, *args = NULL;
 	struct statfs fsbuf;
-	int64_t nr_kept = 0;
 	struct stat buf;
 	int update;
 
@@ -4662,45 +5061,37 @@ static uint64_t *_stats_map_file_regions(struct dm_stats *dms, int fd,
 			goto out;
 	}
 
-	if (update) {
-		group = &dms->groups[group_id];
-		if ((nr_kept = _stats_unmap_regions(dms, group_id, extent_mem,
-						     extents, &old_extents,
-						     count, regroup)) < 0)
-			goto_out;
-	}
+	if (extents && !_stats_merge_extents(extents, count,
+					     dms->max_file_regions))
+		goto_out;
 
         if (bounds)
                 if (!(hist_arg = _build_histogram_arg(bounds, &precise)))
                         goto_out;
 
+	/* all regions are created with the same step and options */
+	if (!(args = _stats_create_args(dms, -1, precise, hist_arg,
+					dms->program_id, "")))
+		goto_out;
+
+	if (update) {
+		if (!(regions = _stats_update_file_regions(dms, group_id, &dmt,
+							   extents, count,
+							   args, regroup)))
+			goto_out;
+		goto done;
+	}
+
 	/* make space for end-of-table marker */
 	if (!(regions = dm_malloc((1 + *count) * sizeof(*regions)))) {
 		log_error("Could not allocate memory for region IDs.");
 		goto_out;
 	}
 
-	/*
-	 * Second pass (first for non-update case): create regions for
-	 * all extents not retained from the prior mapping, and insert
-	 * retained regions into the table of region_id values.
-	 *
-	 * If a regroup is not scheduled, set group bits for newly
-	 * created regions in the group leader bitmap.
-	 */
+	/* Create a region for each extent of the new file map. */
 	for (i = 0; i < *count; i++) {
-		if (update) {
-			if ((old_ext = _find_extent((uint64_t) nr_kept,
-						    old_extents,
-						    extents[i].start,
-						    extents[i].len))) {
-				regions[i] = old_ext->id;
-				continue;
-			}
-		}
-		if (!_stats_create_region(dms, regions + i, extents[i].start,
-					  extents[i].len, -1, precise, hist_arg,
-					  dms->program_id, "")) {
+		if (!_stats_create_file_region(dms, &dmt, regions + i,
+					       extents + i, args)) {
 			log_error("Failed to create region " FMTu64 " of "
 				  FMTu64 " at " FMTu64 ".", i, *count,
 				  extents[i].start);
@@ -4710,28 +5101,13 @@ static uint64_t *_stats_map_file_regions(struct dm_stats *dms, int fd,
 		log_very_verbose("Created new region mapping " FMTu64 "+" FMTu64
 				 " with region ID " FMTu64, extents[i].start,
 				 extents[i].len, regions[i]);
-
-		if (!*regroup && update) {
-			/* expand group bitmap */
-			if (regions[i] > (group->regions[0] - 1)) {
-				num_bits = regions[i] + *count;
-				if (!_stats_resize_group(group, num_bits)) {
-					log_error("Failed to resize group "
-						  "bitmap.");
-					goto out_remove;
-				}
-			}
-			dm_bit_set(group->regions, regions[i]);
-		}
-
 	}
 	regions[*count] = DM_STATS_REGION_NOT_PRESENT;
 
-	/* Update group leader aux_data for new group members. */
-	if (!*regroup && update)
-		if (!_stats_set_aux(dms, group_id,
-				    dms->regions[group_id].aux_data))
-			log_error("Failed to update group aux_data.");
+done:
+	if (dmt)
+		dm_task_destroy(dmt);
+	dm_free(args);
 
 	if (bounds)
 		dm_free(hist_arg);
@@ -4757,10 +5133,13 @@ out_remove:
 
 	fail_region = i;
 	_stats_cleanup_region_ids(dms, regions, fail_region);
-	*count = 0;
 
 out:
+	*count = 0;
+	if (dmt)
+		dm_task_destroy(dmt);
 	dm_pool_destroy(extent_mem);
+	dm_free(args);
 	dm_free(hist_arg);
 	dm_free(regions);
 	return NULL;
@@ -138,12 +138,14 @@ prepare_lvmlockd() {
 	elif test -n "$LVM_TEST_LVMLOCKD_TEST_DLM"; then
 		# make check_lvmlockd_test
 		echo "starting lvmlockd --test (dlm)"
-		lvmlockd --test -g dlm
+		# shellcheck disable=SC2086
+		lvmlockd --test -g dlm ${LVM_TEST_LVMLOCKD_OPTS-}
 
 	elif test -n "$LVM_TEST_LVMLOCKD_TEST_SANLOCK"; then
 		# FIXME: add option for this combination of --test and sanlock
 		echo "starting lvmlockd --test (sanlock)"
-		lvmlockd --test -g sanlock -o 2
+		# shellcheck disable=SC2086
+		lvmlockd --test -g sanlock -o 2 ${LVM_TEST_LVMLOCKD_OPTS-}
 	else
 		echo "not starting lvmlockd"
 		exit 0
@@ -0,0 +1,68 @@
+#!/usr/bin/env bash
+
+# Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+# Check /dev/VG/LV links maintained by lvm itself without udev rules
+
+SKIP_WITH_LVMLOCKD=1
+SKIP_WITH_LVMPOLLD=1
+
+. lib/inittest
+
+aux lvmconf "activation/udev_rules = 0" \
+	    "activation/udev_sync = 0" \
+	    "activation/verify_udev_operations = 0"
+
+aux prepare_vg 2
+
+check_link() {
+	test -L "$DM_DEV_DIR/$vg/$1"
+	test -b "$DM_DEV_DIR/$vg/$1"
+}
+
+for i in 1 2 3 4 5 ; do
+	lvcreate -l1 -n lv$i $vg
+	check_link lv$i
+done
+
+# The VG directory goes with its last link
+vgchange -an $vg
+not test -e "$DM_DEV_DIR/$vg"
+
+vgchange -ay $vg
+for i in 1 2 3 4 5 ; do check_link lv$i ; done
+
+lvrename $vg lv1 lvnew
+not test -e "$DM_DEV_DIR/$vg/lv1"
+check_link lvnew
+
+lvremove -f $vg/lv2
+not test -e "$DM_DEV_DIR/$vg/lv2"
+
+lvchange -an $vg/lv3
+not test -e "$DM_DEV_DIR/$vg/lv3"
+check_link lv4
+
+# A stale link is replaced on activation
+vgchange -an $vg
+mkdir "$DM_DEV_DIR/$vg"
+ln -s "$DM_DEV_DIR/mapper/nonexistent" "$DM_DEV_DIR/$vg/lv4"
+vgchange -ay $vg
+check_link lv4
+
+# Other files keep the VG directory
+touch "$DM_DEV_DIR/$vg/keep"
+vgchange -an $vg
+test -d "$DM_DEV_DIR/$vg"
+not test -e "$DM_DEV_DIR/$vg/lv4"
+rm -r "$DM_DEV_DIR/$vg"
+
+vgremove -ff $vg
@@ -0,0 +1,63 @@
+#!/usr/bin/env bash
+
+# Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+# Test activation with activation/parallel_activation_jobs
+SKIP_WITH_LVMLOCKD=1
+SKIP_WITH_LVMPOLLD=1
+
+. lib/inittest
+
+aux have_thin 1 0 0 || skip
+
+aux prepare_vg 3
+
+aux lvmconf "activation/parallel_activation_jobs = 4"
+
+for i in $(seq 1 10); do
+	lvcreate -an -Zn -l1 -n lin$i $vg
+done
+
+lvcreate -l2 -i2 -n striped $vg
+lvcreate -s -l1 -n snap $vg/striped
+lvcreate -T -L8 -V8 -n thin1 $vg/pool
+lvcreate -V8 -n thin2 $vg/pool
+lvchange -an $vg
+
+vgchange -ay $vg
+
+for i in $(seq 1 10); do
+	check active $vg lin$i
+done
+check active $vg striped
+check active $vg snap
+check active $vg thin1
+check active $vg thin2
+
+# Resizing preloads tree with resumed children
+lvextend -l+1 $vg/lin1
+lvextend -L+4 $vg/thin1
+check active $vg lin1
+check active $vg thin1
+
+vgchange -an $vg
+
+for i in $(seq 1 10); do
+	check inactive $vg lin$i
+done
+
+# Same tree with serial processing
+aux lvmconf "activation/parallel_activation_jobs = 1"
+vgchange -ay $vg
+check active $vg thin2
+vgchange -an $vg
+
+vgremove -ff $vg
@@ -0,0 +1,61 @@
+#!/usr/bin/env bash
+
+# Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+# Check activation of LVs in several VGs at once through clvmd
+# and the request statistics it reports
+
+export LVM_CLVMD_BINARY=clvmd
+
+SKIP_WITH_LVMLOCKD=1
+SKIP_WITHOUT_CLVMD=1
+SKIP_WITH_LVMPOLLD=1
+
+. lib/inittest
+
+aux prepare_devs 4
+
+for i in 1 2 3 4 ; do
+	dev="dev$i"
+	vgcreate $vg$i "${!dev}"
+	lvcreate -an --zero n -n $lv1 -l1 $vg$i
+	lvcreate -an --zero n -n $lv2 -l1 $vg$i
+done
+
+"$LVM_CLVMD_BINARY" -M | tee stats
+grep "^threads 4 " stats
+
+for i in 1 2 3 4 ; do
+	vgchange -ay $vg$i &
+done
+wait
+
+for i in 1 2 3 4 ; do
+	check active $vg$i $lv1
+	check active $vg$i $lv2
+done
+
+"$LVM_CLVMD_BINARY" -M | tee stats
+grep "^lock_lv requests [1-9]" stats
+grep "^lock_vg requests [1-9]" stats
+
+for i in 1 2 3 4 ; do
+	vgchange -an $vg$i &
+done
+wait
+
+"$LVM_CLVMD_BINARY" -M | tee stats
+grep "^lock_vg requests [1-9]" stats
+
+for i in 1 2 3 4 ; do
+	check inactive $vg$i $lv1
+	vgremove -ff $vg$i
+done
@@ -0,0 +1,59 @@
+#!/usr/bin/env bash
+
+# Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+# Check vgchange (un)monitors all LVs of a VG with one dmeventd batch
+
+SKIP_WITH_LVMLOCKD=1
+SKIP_WITH_LVMPOLLD=1
+
+. lib/inittest
+
+aux prepare_dmeventd
+
+aux prepare_vg 3
+
+for i in 1 2 3 4 ; do
+	lvcreate -aey --type mirror -m 1 --nosync --ignoremonitoring -l1 -n mirror$i $vg
+done
+
+# Batched registrations are not waited for, dmeventd may still be pending
+check_monitor() {
+	for i in 1 2 3 4 ; do
+		for j in $(seq 10) ; do
+			test "$(get lv_field $vg/mirror$i seg_monitor)" != "pending" && break
+			sleep .1
+		done
+		check lv_first_seg_field $vg/mirror$i seg_monitor "$1"
+	done
+}
+
+check_monitor "not monitored"
+
+vgchange --monitor y --verbose $vg 2>&1 | tee vgchange.out
+grep "Submitting 4 dmeventd registrations" vgchange.out
+check_monitor "monitored"
+
+vgchange --monitor n --verbose $vg 2>&1 | tee vgchange.out
+grep "Submitting 4 dmeventd registrations" vgchange.out
+check_monitor "not monitored"
+
+# Activation registers all the LVs together, deactivation unregisters
+# each of them before it is deactivated.
+vgchange -an $vg
+vgchange -ay --monitor y --verbose $vg 2>&1 | tee vgchange.out
+grep "Submitting [0-9]* dmeventd registrations" vgchange.out
+check_monitor "monitored"
+
+vgchange -an $vg
+pgrep -o dmeventd >/dev/null
+
+vgremove -ff $vg
@@ -0,0 +1,62 @@
+#!/usr/bin/env bash
+
+# Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+# Check dmeventd handles the events of several devices from its event
+# loop while another monitored device is stalled
+
+SKIP_WITH_LVMLOCKD=1
+SKIP_WITH_LVMPOLLD=1
+
+. lib/inittest
+
+aux mirror_recovery_works || skip
+
+aux prepare_dmeventd
+grep "Monitoring devices from event loop" debug.log_DMEVENTD_out || skip
+
+aux prepare_vg 6
+
+lvcreate -aey --type mirror -m1 --mirrorlog core --ignoremonitoring -L1 -n m1 $vg "$dev1" "$dev2"
+lvcreate -aey --type mirror -m1 --mirrorlog core --ignoremonitoring -L1 -n m2 $vg "$dev3" "$dev4"
+lvcreate -aey --type mirror -m1 --mirrorlog core --ignoremonitoring -L1 -n m3 $vg "$dev5" "$dev6"
+lvchange --monitor y $vg
+
+# A renamed device is missing in the device list and checked by its UUID
+dmsetup rename $vg-m3 $vg-m3_renamed
+dmsetup rename $vg-m3_renamed $vg-m3
+check lv_first_seg_field $vg/m3 seg_monitor "monitored"
+
+# Keep m1 suspended with I/O queued while a leg of m2 fails
+dmsetup suspend $vg-m1
+dd if=/dev/zero of="$DM_DEV_DIR/$vg/m1" bs=4k count=1 oflag=direct &
+DD=$!
+
+aux disable_dev "$dev4"
+dd if=/dev/zero of="$DM_DEV_DIR/$vg/m2" bs=4k count=1 oflag=direct || true
+
+for i in $(seq 1 20); do
+	test "$(get lv_field $vg/m2 segtype)" = "linear" && break
+	sleep .5
+done
+
+# m2 was repaired while m1 is still suspended
+dmsetup info -c --noheadings -o suspended $vg-m1 | grep Suspended
+check linear $vg m2
+
+dmsetup resume $vg-m1
+wait $DD
+aux enable_dev "$dev4"
+
+check mirror $vg m1
+check mirror $vg m3
+
+vgremove -ff $vg
@@ -0,0 +1,69 @@
+#!/usr/bin/env bash
+
+# Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+# Check dmstats --filemap --maxregions merges file extents into fewer regions
+
+SKIP_WITH_LVMPOLLD=1
+
+. lib/inittest
+
+aux driver_at_least 4 33 || skip
+which mkfs.ext4 || skip
+
+aux prepare_devs 1 64
+
+mount_dir="mnt"
+mkdir -p "$mount_dir"
+
+cleanup_mounted_and_teardown()
+{
+	umount "$mount_dir" || true
+	aux teardown
+}
+
+trap 'cleanup_mounted_and_teardown' EXIT
+
+mkfs.ext4 -b 1024 "$dev1"
+mount "$dev1" "$mount_dir"
+
+# Fragment the free space, then fill the holes with one file
+for i in $(seq 64) ; do
+	dd if=/dev/zero of="$mount_dir/f$i" bs=1k count=16 conv=fsync
+done
+rm -f "$mount_dir"/f*[02468]
+dd if=/dev/zero of="$mount_dir/frag" bs=1k count=1024 conv=fsync
+
+nr_regions() {
+	sed -n "s/.* with \([0-9]*\) region(s).*/\1/p" out
+}
+
+dmstats create --filemap --nomonitor "$mount_dir/frag" | tee out
+extents=$(nr_regions)
+dmstats delete --allregions "$dev1"
+
+test "$extents" -gt 2 || skip
+
+dmstats create --filemap --nomonitor --maxregions 2 "$mount_dir/frag" | tee out
+test "$(nr_regions)" -eq 2
+group_id=$(sed -n "s/.* as group ID \([0-9]*\)\./\1/p" out)
+
+# Updates keep to the limit, or revert to one region per extent.
+# Nothing changed, so the update keeps all the regions.
+dmstats update_filemap -v --nomonitor --groupid "$group_id" --maxregions 2 "$mount_dir/frag" 2>&1 | tee out
+test "$(nr_regions)" -eq 2
+grep "kept 2, deleted 0, created 0 regions" out
+dmstats update_filemap --nomonitor --groupid "$group_id" "$mount_dir/frag" | tee out
+test "$(nr_regions)" -eq "$extents"
+
+not dmstats create --maxregions 2 "$dev1"
+
+dmstats delete --allregions "$dev1"
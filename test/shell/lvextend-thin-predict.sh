@@ -0,0 +1,60 @@
+#!/usr/bin/env bash
+
+# Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+# Test thin pool extension ahead of threshold when dmeventd projects it fills
+
+SKIP_WITH_LVMLOCKD=1
+SKIP_WITH_LVMPOLLD=1
+
+export LVM_TEST_THIN_REPAIR_CMD=${LVM_TEST_THIN_REPAIR_CMD-/bin/false}
+
+. lib/inittest
+
+aux have_thin 1 0 0 || skip
+
+aux lvmconf "activation/thin_pool_autoextend_percent = 20" \
+	    "activation/thin_pool_autoextend_threshold = 75"
+
+aux prepare_vg 2
+
+lvcreate -L10M -c 64k -T $vg/pool
+lvcreate -V10M $vg/pool -n $lv1
+
+dd if=/dev/zero of="$DM_DEV_DIR/mapper/$vg-$lv1" bs=1M count=2 conv=fdatasync
+
+# Below threshold and without projection there is nothing to do
+lvextend --use-policies $vg/pool
+check lv_field $vg/pool size "10.00m"
+
+# Not monitored, so there is no projection to report
+check lv_field $vg/pool time_to_full ""
+
+# Projected to fill soon - extended by autoextend percent
+DMEVENTD_THIN_POOL_DATA_TIME_TO_FULL=30 lvextend --use-policies $vg/pool
+check lv_field $vg/pool size "12.00m"
+
+# Not filling
+DMEVENTD_THIN_POOL_DATA_TIME_TO_FULL=-1 lvextend --use-policies $vg/pool
+check lv_field $vg/pool size "12.00m"
+
+# Metadata projected to fill extends only the metadata
+meta=$(get lv_field $vg/pool_tmeta size)
+DMEVENTD_THIN_POOL_METADATA_TIME_TO_FULL=30 lvextend --use-policies $vg/pool
+check lv_field $vg/pool size "12.00m"
+test "$(get lv_field $vg/pool_tmeta size)" != "$meta"
+
+# Threshold 100 disables autoextension, even ahead of it
+aux lvmconf "activation/thin_pool_autoextend_threshold = 100"
+DMEVENTD_THIN_POOL_DATA_TIME_TO_FULL=30 lvextend --use-policies $vg/pool
+check lv_field $vg/pool size "12.00m"
+
+vgremove -ff $vg
@@ -0,0 +1,58 @@
+#!/usr/bin/env bash
+
+# Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+# Check pvscan --cache sending devices to lvmetad in batches
+
+SKIP_WITH_LVMLOCKD=1
+SKIP_WITHOUT_LVMETAD=1
+SKIP_WITH_LVMPOLLD=1
+
+. lib/inittest
+
+aux prepare_pvs 3
+
+vgcreate $vg1 "$dev1" "$dev2"
+vgcreate $vg2 "$dev3"
+lvcreate -n $lv1 -l 1 -a n $vg1
+lvcreate -n $lv1 -l 1 -a n $vg2
+
+# All named devices go in one batch, each complete VG is activated
+pvscan --cache -aay "$dev1" "$dev2" "$dev3"
+check lv_field $vg1/$lv1 lv_active "active"
+check lv_field $vg2/$lv1 lv_active "active"
+vgchange -an $vg1 $vg2
+
+# Concurrent pvscans leave their devices to the first one
+aux lvmconf "global/lvmetad_pvscan_coalesce_time = 500"
+pvscan --cache -aay "$dev1" &
+pvscan --cache -aay "$dev2" &
+pvscan --cache -aay "$dev3"
+wait
+check lv_field $vg1/$lv1 lv_active "active"
+check lv_field $vg2/$lv1 lv_active "active"
+vgchange -an $vg1 $vg2
+
+# A device appearing while another pvscan holds the spool lock is left
+# to that pvscan, which has to find it in its dev cache
+aux lvmconf "global/lvmetad_pvscan_coalesce_time = 3000"
+aux disable_dev "$dev3"
+pvscan --cache -aay "$dev1" &
+sleep .5
+aux enable_dev --silent "$dev3"
+pvscan --cache -aay "$dev3"
+wait
+pvs "$dev3" | tee out
+grep $vg2 out
+check lv_field $vg2/$lv1 lv_active "active"
+vgchange -an $vg1 $vg2
+
+vgremove -ff $vg1 $vg2
@@ -0,0 +1,80 @@
+#!/usr/bin/env bash
+
+# Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+# Check the VG cached by lvmetad after updates sent as deltas
+
+SKIP_WITH_LVMLOCKD=1
+SKIP_WITHOUT_LVMETAD=1
+SKIP_WITH_LVMPOLLD=1
+
+. lib/inittest
+
+aux prepare_pvs 3
+
+vgcreate $vg1 "$dev1" "$dev2"
+
+# Each command overwrites debug.log
+check_delta() {
+	grep "Sending lvmetad delta for VG $vg1" debug.log
+	not grep "lvmetad needs full update" debug.log
+	not grep "Sending lvmetad updated VG" debug.log
+}
+
+# lvmetad rejects the delta and the whole VG is sent instead
+check_full() {
+	grep "Sending lvmetad delta for VG $1" debug.log
+	grep "lvmetad needs full update of VG $1: mismatch $2" debug.log
+	grep "Sending lvmetad updated VG $3" debug.log
+}
+
+compare_cached() {
+	lvs -a -o+seg_start_pe,devices,lv_tags,vg_tags $vg1 > cached
+	lvs --config 'global/use_lvmetad=0' -a -o+seg_start_pe,devices,lv_tags,vg_tags $vg1 2>/dev/null > disk
+	diff cached disk
+}
+
+lvcreate -n $lv1 -l 2 -a n $vg1
+check_delta
+lvcreate -n $lv2 -l 2 -a n $vg1 "$dev2"
+check_delta
+lvextend -l +3 $vg1/$lv1
+check_delta
+compare_cached
+
+lvrename $vg1/$lv2 $lv3
+check_delta
+lvchange --addtag foo $vg1/$lv3
+check_delta
+vgchange --addtag bar $vg1
+check_delta
+compare_cached
+
+lvremove -f $vg1/$lv1
+check_delta
+vgchange --deltag bar $vg1
+check_delta
+compare_cached
+
+# Changes of the PVs or the VG name are rejected and sent as a whole
+vgextend $vg1 "$dev3"
+check_full $vg1 "VG PVs changed" $vg1
+compare_cached
+vgrename $vg1 $vg2
+check_full $vg2 "VG name or UUID changed" $vg2
+vgrename $vg2 $vg1
+vgreduce $vg1 "$dev3"
+check_full $vg1 "VG PVs changed" $vg1
+lvchange --deltag foo $vg1/$lv3
+check_delta
+compare_cached
+
+vgremove -ff $vg1
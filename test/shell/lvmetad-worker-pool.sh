@@ -0,0 +1,55 @@
+#!/usr/bin/env bash
+
+# Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+# Check slow and concurrent clients of the lvmetad worker pool
+
+SKIP_WITH_LVMLOCKD=1
+SKIP_WITHOUT_LVMETAD=1
+SKIP_WITH_LVMPOLLD=1
+
+. lib/inittest
+
+aux prepare_vg 2
+lvcreate -n $lv1 -l 1 $vg
+
+# More clients with a partial request (no '##' end) than worker threads
+pids=
+for i in $(seq 1 12) ; do
+	(printf 'request="dump"\n'; sleep 5) | aux lvmetad_talk >/dev/null &
+	pids="$pids $!"
+done
+sleep .5
+
+# Slow clients do not tie up the workers
+pvs
+lvs $vg/$lv1
+
+# Concurrent commands all get their replies
+pids2=
+for i in $(seq 1 16) ; do
+	vgs $vg >/dev/null &
+	pids2="$pids2 $!"
+done
+for p in $pids2 ; do
+	wait "$p"
+done
+
+(echo 'request="daemon_stats"'; echo '##') | aux lvmetad_talk | tee stats.txt
+grep 'response *= *"OK"' stats.txt
+grep "worker_threads *= *8" stats.txt
+test "$(sed -ne 's/^[[:space:]]*requests *= *//p' stats.txt)" -gt 16
+
+for p in $pids ; do
+	wait "$p" || true
+done
+
+vgremove -ff $vg
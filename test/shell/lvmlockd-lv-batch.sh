@@ -0,0 +1,52 @@
+#!/usr/bin/env bash
+
+# Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+test_description='Check vgchange sends the LV locks of a lockd VG in batches'
+
+. lib/inittest
+
+[ -z "$LVM_TEST_LVMLOCKD" ] && skip
+
+aux prepare_pvs 2
+
+vgcreate $SHARED $vg "$dev1" "$dev2"
+
+for i in 1 2 3 4 ; do
+	lvcreate -an -l1 -n lv$i $vg
+done
+
+# All four ex locks go to lvmlockd in one request
+vgchange -aey $vg
+for i in 1 2 3 4 ; do
+	check lv_field $vg/lv$i lv_active "active"
+done
+lvmlockctl --info | tee info
+test "$(grep -c "LK LV ex" info)" -eq 4
+lvmlockctl --dump | tee dump
+grep "batch of 4" dump
+
+# The unlocks are sent together when deactivating
+vgchange -an $vg
+for i in 1 2 3 4 ; do
+	check lv_field $vg/lv$i lv_active ""
+done
+lvmlockctl --info | tee info
+not grep "LK LV ex" info
+
+# With one LV already active there is still one lock per LV
+lvchange -aey $vg/lv1
+vgchange -aey $vg
+lvmlockctl --info | tee info
+test "$(grep -c "LK LV ex" info)" -eq 4
+vgchange -an $vg
+
+vgremove -ff $vg
@@ -34,6 +34,13 @@ LOCKARGS2="dlm"
 LOCKARGS3="dlm"
 fi
 
+# lvmlockd --test allocates sanlock LV locks from the same free lock map
+if test -n "$LVM_TEST_LVMLOCKD_TEST_SANLOCK" ; then
+LOCKARGS1="1.0.0:70254592"
+LOCKARGS2="1.0.0:71303168"
+LOCKARGS3="1.0.0:72351744"
+fi
+
 aux prepare_devs 5
 
 vgcreate --shared $vg "$dev1" "$dev2" "$dev3" "$dev4" "$dev5"
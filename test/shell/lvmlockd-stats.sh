@@ -0,0 +1,50 @@
+#!/usr/bin/env bash
+
+# Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+test_description='Check lvmlockctl --stats counts the locks of a VG'
+
+. lib/inittest
+
+[ -z "$LVM_TEST_LVMLOCKD" ] && skip
+
+aux prepare_pvs 1
+
+vgcreate $SHARED $vg "$dev1"
+lvcreate -an -l1 -n $lv1 $vg
+
+# Start a new window
+lvmlockctl --stats --reset
+
+lvchange -aey $vg/$lv1
+lvchange -an $vg/$lv1
+
+lvmlockctl --stats | tee stats
+grep "^VG $vg lock_type=" stats
+# Counters of the VG follow its header line
+locks=$(grep -A1 "^VG $vg " stats | sed -ne 's/^  locks \([0-9]*\) unlocks \([0-9]*\) .*/\1/p')
+unlocks=$(grep -A1 "^VG $vg " stats | sed -ne 's/^  locks \([0-9]*\) unlocks \([0-9]*\) .*/\2/p')
+test "$locks" -ge 2
+test "$unlocks" -ge 2
+# The LV lock was used in this window
+grep "^  lv " stats
+
+lvmlockctl --stats --json | tee stats.json
+grep "\"vg_name\": \"$vg\"" stats.json
+grep "\"lm_lock_hist\": \[" stats.json
+
+# Nothing was used since the reset
+lvmlockctl --stats --reset
+lvmlockctl --stats | tee stats
+grep -A1 "^VG $vg " stats | grep "^  locks 0 unlocks 0 "
+not grep "^  lv " stats
+
+vgremove -ff $vg
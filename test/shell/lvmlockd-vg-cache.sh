@@ -0,0 +1,45 @@
+#!/usr/bin/env bash
+
+# Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+test_description='Check lvmlockd --vg-cache keeps and releases shared VG locks'
+
+# lvmlockd --test is started for each test with these options
+export LVM_TEST_LVMLOCKD_OPTS="--vg-cache 3"
+
+. lib/inittest
+
+[ -z "$LVM_TEST_LVMLOCKD_TEST" ] && skip;
+
+aux prepare_pvs 2
+
+vgcreate $SHARED $vg "$dev1" "$dev2"
+
+# The sh VG lock of a reading command stays cached
+vgs $vg
+lvmlockctl --info | tee info
+grep "LK VG sh ver .* cached" info
+
+# A local ex VG lock request releases the cached lock
+lvcreate -an -l1 -n $lv1 $vg
+check lv_exists $vg $lv1
+lvmlockctl --info | tee info
+not grep "LK VG sh ver .* cached" info
+
+# The cached lock is released when it expires
+lvs $vg
+lvmlockctl --info | tee info
+grep "LK VG sh ver .* cached" info
+sleep 5
+lvmlockctl --info | tee info
+not grep "cached" info
+
+vgremove -ff $vg
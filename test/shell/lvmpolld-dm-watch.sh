@@ -0,0 +1,46 @@
+#!/usr/bin/env bash
+
+# Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+# Check lvmpolld watches pvmove progress in DM before running lvpoll
+
+SKIP_WITH_LVMLOCKD=1
+SKIP_WITHOUT_LVMPOLLD=1
+
+. lib/inittest
+
+aux prepare_vg 2
+
+lvcreate -aey -L10 -n $lv1 $vg "$dev1"
+
+# Slow down the copy so the pvmove is watched for a while
+aux delay_dev "$dev2" 0 200 "$(get first_extent_sector "$dev2"):"
+
+pvmove -i1 -b "$dev1" "$dev2"
+aux wait_pvmove_lv_ready "$vg-pvmove0"
+
+# Still copying: no lvpoll yet, the progress is watched in DM
+aux lvmpolld_dump | tee lvmpolld_dump.txt
+grep "watched_in_dm=1" lvmpolld_dump.txt
+
+aux enable_dev "$dev2"
+
+i=0
+while get lv_field $vg name -a | grep -E "^\[?pvmove"; do
+	# wait for 30 secs at max
+	test $i -ge 300 && die "Pvmove is too slow or does not progress."
+	sleep .1
+	i=$((i + 1))
+done
+
+check lv_on $vg $lv1 "$dev2"
+
+vgremove -ff $vg
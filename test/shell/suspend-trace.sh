@@ -0,0 +1,42 @@
+#!/usr/bin/env bash
+
+# Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+# Check the suspend time reported with activation/suspend_trace_file
+
+SKIP_WITH_LVMPOLLD=1
+
+. lib/inittest
+
+aux prepare_vg 2
+
+aux lvmconf "activation/suspend_trace_file = \"$PWD/trace\""
+
+lvcreate -l1 -n $lv1 $vg
+
+# Activation does not suspend anything
+test ! -s trace
+
+lvextend -v -l+1 $vg/$lv1 2>&1 | tee out
+grep "Device $vg-$lv1 (.*) was suspended for [0-9]*\.[0-9]* ms" out
+
+test "$(wc -l < trace)" -eq 1
+grep "\"device\":\"$vg-$lv1\"" trace
+grep "\"command\":\"lvextend\"" trace
+us=$(sed -e 's/.*"suspended_us":\([0-9]*\)}$/\1/' trace)
+test "$us" -lt 60000000
+
+# Records of later commands are appended
+lvcreate -s -l1 -n snap $vg/$lv1
+grep "\"command\":\"lvcreate\",.*\"device\":\"$vg-$lv1\"" trace
+test "$(wc -l < trace)" -gt 1
+
+vgremove -ff $vg
@@ -0,0 +1,85 @@
+#!/usr/bin/env bash
+
+# Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+# Test vgchange with activation/bulk_activation
+SKIP_WITH_LVMLOCKD=1
+SKIP_WITH_LVMPOLLD=1
+
+. lib/inittest
+
+aux have_thin 1 0 0 || skip
+
+aux prepare_vg 3
+
+aux lvmconf "activation/bulk_activation = 1"
+
+for i in $(seq 1 5); do
+	lvcreate -an -Zn -l1 -n lin$i $vg
+done
+
+lvcreate -l2 -i2 -n striped $vg
+lvcreate -s -l1 -n snap $vg/striped
+lvcreate -T -L8 -V8 -n thin1 $vg/pool
+lvcreate -V8 -n thin2 $vg/pool
+lvchange -an $vg
+
+vgchange -v -ay $vg 2>&1 | tee out
+grep "at once" out
+
+for i in $(seq 1 5); do
+	check active $vg lin$i
+done
+check active $vg striped
+check active $vg snap
+check active $vg thin1
+check active $vg thin2
+
+# Already active LVs are skipped
+vgchange -ay $vg
+
+# Activation skip flag is honoured
+lvchange -an $vg/lin5
+lvchange -ky $vg/lin5
+vgchange -ay $vg
+check inactive $vg lin5
+lvchange -kn $vg/lin5
+
+# Opened LV fails the whole bulk deactivation,
+# the fallback then deactivates all unused LVs
+sleep 10 < "$DM_DEV_DIR/$vg/lin1" &
+SLEEP_PID=$!
+sleep .5
+
+not vgchange -v -an $vg 2>&1 | tee out
+grep "one by one" out
+check active $vg lin1
+check inactive $vg lin2
+check inactive $vg thin1
+check inactive $vg snap
+
+kill $SLEEP_PID || true
+wait
+
+vgchange -an $vg
+for i in $(seq 1 5); do
+	check inactive $vg lin$i
+done
+
+# Same with per-LV activation
+aux lvmconf "activation/bulk_activation = 0"
+vgchange -v -ay $vg 2>&1 | tee out
+not grep "at once" out
+check active $vg thin2
+vgchange -an $vg
+check inactive $vg thin2
+
+vgremove -ff $vg
@@ -19,7 +19,9 @@ CU_SuiteInfo suites[] = {
 	USE(dmstatus),
 	USE(regex),
 	USE(percent),
+	USE(stats),
 	USE(string),
+	USE(udev),
 	CU_SUITE_INFO_NULL
 };
 
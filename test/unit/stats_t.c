@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "units.h"
+
+/* The @stats_print parsers are static. */
+#include "libdm-stats.c"
+
+#define ROW_COUNTERS " 1 2 3 4 5 6 7 8 9 10 11 12 13"
+
+static struct dm_stats *_dms;
+
+int stats_init(void)
+{
+	_dms = dm_stats_create("stats test");
+	return (_dms == NULL);
+}
+
+int stats_fini(void)
+{
+	dm_stats_destroy(_dms);
+	return 0;
+}
+
+static void _test_parse_u64(void)
+{
+	const char *c;
+	uint64_t v;
+
+	c = "18446744073709551615 ";
+	CU_ASSERT(_stats_parse_u64(&c, &v));
+	CU_ASSERT_EQUAL(v, UINT64_MAX);
+	CU_ASSERT_EQUAL(*c, ' ');
+
+	c = "0+";
+	CU_ASSERT(_stats_parse_u64(&c, &v));
+	CU_ASSERT_EQUAL(v, 0);
+	CU_ASSERT_EQUAL(*c, '+');
+
+	c = "18446744073709551616";
+	CU_ASSERT(!_stats_parse_u64(&c, &v));
+
+	c = "99999999999999999999";
+	CU_ASSERT(!_stats_parse_u64(&c, &v));
+
+	c = "-1";
+	CU_ASSERT(!_stats_parse_u64(&c, &v));
+
+	c = "";
+	CU_ASSERT(!_stats_parse_u64(&c, &v));
+}
+
+static void _test_parse_row(void)
+{
+	struct dm_stats_counters cur;
+	uint64_t start, len;
+	const char *c;
+
+	memset(&cur, 0, sizeof(cur));
+	c = _stats_parse_row("16+8" ROW_COUNTERS "\n0+8" ROW_COUNTERS,
+			     &start, &len, &cur);
+	CU_ASSERT_PTR_NOT_NULL(c);
+	if (c)
+		CU_ASSERT(!strcmp(c, "\n0+8" ROW_COUNTERS));
+	CU_ASSERT_EQUAL(start, 16);
+	CU_ASSERT_EQUAL(len, 8);
+	CU_ASSERT_EQUAL(cur.reads, 1);
+	CU_ASSERT_EQUAL(cur.reads_merged, 2);
+	CU_ASSERT_EQUAL(cur.read_sectors, 3);
+	CU_ASSERT_EQUAL(cur.read_nsecs, 4);
+	CU_ASSERT_EQUAL(cur.writes, 5);
+	CU_ASSERT_EQUAL(cur.writes_merged, 6);
+	CU_ASSERT_EQUAL(cur.write_sectors, 7);
+	CU_ASSERT_EQUAL(cur.write_nsecs, 8);
+	CU_ASSERT_EQUAL(cur.io_in_progress, 9);
+	CU_ASSERT_EQUAL(cur.io_nsecs, 10);
+	CU_ASSERT_EQUAL(cur.weighted_io_nsecs, 11);
+	CU_ASSERT_EQUAL(cur.total_read_nsecs, 12);
+	CU_ASSERT_EQUAL(cur.total_write_nsecs, 13);
+
+	/* Missing length, missing counter, two spaces, overflow */
+	CU_ASSERT_PTR_NULL(_stats_parse_row("0" ROW_COUNTERS, &start, &len, &cur));
+	CU_ASSERT_PTR_NULL(_stats_parse_row("0+8 1 2 3", &start, &len, &cur));
+	CU_ASSERT_PTR_NULL(_stats_parse_row("0+8  1 2 3 4 5 6 7 8 9 10 11 12 13",
+					    &start, &len, &cur));
+	CU_ASSERT_PTR_NULL(_stats_parse_row("0+8 1 2 3 4 5 6 7 8 9 10 11 12 "
+					    "18446744073709551616",
+					    &start, &len, &cur));
+}
+
+static void _test_parse_region(void)
+{
+	struct dm_stats_region region;
+
+	memset(&region, 0, sizeof(region));
+	CU_ASSERT(_stats_parse_region(_dms, "0+8" ROW_COUNTERS "\n"
+				      "8+8" ROW_COUNTERS " 14\n", &region, 1000));
+	CU_ASSERT_EQUAL(region.start, 0);
+	CU_ASSERT_EQUAL(region.step, 8);
+	CU_ASSERT_EQUAL(region.len, 16);
+	if (region.counters) {
+		CU_ASSERT_EQUAL(region.counters[1].reads, 1);
+		CU_ASSERT_EQUAL(region.counters[1].read_nsecs, 4000);
+		CU_ASSERT_EQUAL(region.counters[1].total_write_nsecs, 13000);
+		CU_ASSERT_PTR_NULL(region.counters[1].histogram);
+	}
+
+	memset(&region, 0, sizeof(region));
+	CU_ASSERT(!_stats_parse_region(_dms, "0+8 1 2 3 4 5 6 7 8 9 10 11 12 x\n",
+				       &region, 1));
+	CU_ASSERT(!_stats_parse_region(_dms, "0+99999999999999999999" ROW_COUNTERS,
+				       &region, 1));
+	CU_ASSERT(!_stats_parse_region(_dms, "\n", &region, 1));
+}
+
+static void _test_parse_histogram_row(void)
+{
+	struct dm_stats_region region;
+	struct dm_histogram *hist;
+
+	/* Bounds as @stats_list reports them, with the final bin added */
+	memset(&region, 0, sizeof(region));
+	region.timescale = 1;
+	if (!_stats_parse_histogram_spec(_dms, &region, "histogram:10,20")) {
+		CU_FAIL("Failed to parse histogram bounds.");
+		return;
+	}
+
+	CU_ASSERT(_stats_parse_region(_dms, "0+8" ROW_COUNTERS " 3:2:1\n",
+				      &region, 1));
+	if (region.counters && (hist = region.counters[0].histogram)) {
+		CU_ASSERT_EQUAL(region.counters[0].total_write_nsecs, 13);
+		CU_ASSERT_EQUAL(hist->nr_bins, 3);
+		CU_ASSERT_EQUAL(hist->sum, 6);
+		CU_ASSERT_EQUAL(hist->bins[0].upper, 10);
+		CU_ASSERT_EQUAL(hist->bins[0].count, 3);
+		CU_ASSERT_EQUAL(hist->bins[2].upper, UINT64_MAX);
+		CU_ASSERT_EQUAL(hist->bins[2].count, 1);
+	} else
+		CU_FAIL("No histogram parsed.");
+
+	/* A region with a histogram needs the bin counts */
+	CU_ASSERT(!_stats_parse_region(_dms, "0+8" ROW_COUNTERS "\n",
+				       &region, 1));
+	CU_ASSERT(!_stats_parse_region(_dms, "0+8" ROW_COUNTERS " 3:x:1\n",
+				       &region, 1));
+}
+
+CU_TestInfo stats_list[] = {
+	{ (char*)"parse_u64", _test_parse_u64 },
+	{ (char*)"parse_row", _test_parse_row },
+	{ (char*)"parse_region", _test_parse_region },
+	{ (char*)"parse_histogram_row", _test_parse_histogram_row },
+	CU_TEST_INFO_NULL
+};
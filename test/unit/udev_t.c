@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2018 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "units.h"
+
+#include <errno.h>
+#include <sys/ipc.h>
+#include <sys/sem.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define NR_COOKIES 4
+
+int udev_init(void)
+{
+	return 0;
+}
+
+int udev_fini(void)
+{
+	return 0;
+}
+
+/*
+ * Create a cookie the way dm_task_set_cookie() leaves it with one udev
+ * event pending: semaphore value 1 for the waiter and 1 for the event.
+ */
+static int _cookie_create(uint32_t *cookie)
+{
+	struct sembuf sb = { 0, 2, 0 };
+	uint16_t base = (uint16_t) getpid();
+	int semid;
+
+	do {
+		if (!++base)
+			continue;
+
+		*cookie = DM_COOKIE_MAGIC << 16 | base;
+
+		if ((semid = semget((key_t) *cookie, 1, 0600 | IPC_CREAT | IPC_EXCL)) >= 0)
+			return !semop(semid, &sb, 1);
+	} while (errno == EEXIST);
+
+	return 0;
+}
+
+static int _cookie_exists(uint32_t cookie)
+{
+	return semget((key_t) cookie, 1, 0) >= 0;
+}
+
+static void _cookie_destroy(uint32_t cookie)
+{
+	int semid;
+
+	if ((semid = semget((key_t) cookie, 1, 0)) >= 0)
+		(void) semctl(semid, 0, IPC_RMID, 0);
+}
+
+/* Completes cookies in reverse order from a separate process like udev */
+static pid_t _complete_cookies(const uint32_t *cookies, unsigned count)
+{
+	pid_t pid;
+
+	if ((pid = fork()))
+		return pid;
+
+	(void) usleep(100000);
+
+	while (count--)
+		if (!dm_udev_complete(cookies[count]))
+			_exit(1);
+
+	_exit(0);
+}
+
+static void _test_wait_cookies(void)
+{
+	/* cookies[0] stays 0: nothing to wait for */
+	uint32_t cookies[NR_COOKIES] = { 0 };
+	int ready[NR_COOKIES];
+	int sync = dm_udev_get_sync_support();
+	int status;
+	unsigned i;
+	pid_t pid;
+
+	for (i = 1; sync && (i < NR_COOKIES); i++)
+		CU_ASSERT_FATAL(_cookie_create(&cookies[i]));
+
+	pid = _complete_cookies(cookies, NR_COOKIES);
+	CU_ASSERT_FATAL(pid > 0);
+
+	CU_ASSERT(dm_udev_wait_cookies(cookies, ready, NR_COOKIES, 10000));
+
+	CU_ASSERT_EQUAL(waitpid(pid, &status, 0), pid);
+	CU_ASSERT(WIFEXITED(status) && !WEXITSTATUS(status));
+
+	for (i = 0; i < NR_COOKIES; i++) {
+		CU_ASSERT(ready[i]);
+		/* The wait releases the semaphore */
+		if (cookies[i]) {
+			CU_ASSERT(!_cookie_exists(cookies[i]));
+			_cookie_destroy(cookies[i]);
+		}
+	}
+}
+
+static void _test_wait_cookies_timeout(void)
+{
+	uint32_t cookies[2] = { 0 };
+	int ready[2];
+	int sync = dm_udev_get_sync_support();
+	int status;
+	pid_t pid;
+
+	if (sync) {
+		CU_ASSERT_FATAL(_cookie_create(&cookies[0]));
+		CU_ASSERT_FATAL(_cookie_create(&cookies[1]));
+	}
+
+	/* Only the second cookie completes */
+	pid = _complete_cookies(cookies + 1, 1);
+	CU_ASSERT_FATAL(pid > 0);
+
+	CU_ASSERT(dm_udev_wait_cookies(cookies, ready, 2, 500));
+
+	CU_ASSERT_EQUAL(waitpid(pid, &status, 0), pid);
+	CU_ASSERT(WIFEXITED(status) && !WEXITSTATUS(status));
+
+	CU_ASSERT(ready[1]);
+	if (sync) {
+		/* Still pending, to be waited for again */
+		CU_ASSERT(!ready[0]);
+		CU_ASSERT(_cookie_exists(cookies[0]));
+		CU_ASSERT(!_cookie_exists(cookies[1]));
+		_cookie_destroy(cookies[0]);
+		_cookie_destroy(cookies[1]);
+	} else
+		CU_ASSERT(ready[0]);
+}
+
+CU_TestInfo udev_list[] = {
+	{ (char*)"wait_cookies", _test_wait_cookies },
+	{ (char*)"wait_cookies_timeout", _test_wait_cookies_timeout },
+	CU_TEST_INFO_NULL
+};
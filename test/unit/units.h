@@ -29,6 +29,8 @@ DECL(dmlist);
 DECL(dmstatus);
 DECL(regex);
 DECL(percent);
+DECL(stats);
 DECL(string);
+DECL(udev);
 
 #endif
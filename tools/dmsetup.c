@@ -186,6 +186,7 @@ enum {
 	LENGTH_ARG,
 	MANGLENAME_ARG,
 	MAJOR_ARG,
+	MAX_REGIONS_ARG,
 	REGIONS_ARG,
 	MINOR_ARG,
 	MODE_ARG,
@@ -1820,15 +1821,40 @@ static int _udevcreatecookie(CMD_ARGS)
 
 static int _udevreleasecookie(CMD_ARGS)
 {
-	if (argv[0] && !(_udev_cookie = _get_cookie_value(argv[0])))
-		return_0;
+	uint32_t *cookies;
+	int *ready;
+	int i, r = 0;
 
-	if (!_udev_cookie) {
-		log_error("No udev transaction cookie given.");
+	if (argc <= 1) {
+		if (argv[0] && !(_udev_cookie = _get_cookie_value(argv[0])))
+			return_0;
+
+		if (!_udev_cookie) {
+			log_error("No udev transaction cookie given.");
+			return 0;
+		}
+
+		return dm_udev_wait(_udev_cookie);
+	}
+
+	/* Wait for all given cookies at once */
+	if (!(cookies = dm_malloc(argc * sizeof(*cookies))) ||
+	    !(ready = dm_malloc(argc * sizeof(*ready)))) {
+		log_error("Failed to allocate udev cookie list.");
+		dm_free(cookies);
 		return 0;
 	}
 
-	return dm_udev_wait(_udev_cookie);
+	for (i = 0; i < argc; i++)
+		if (!(cookies[i] = _get_cookie_value(argv[i])))
+			goto_out;
+
+	r = dm_udev_wait_cookies(cookies, ready, (unsigned) argc, -1);
+out:
+	dm_free(ready);
+	dm_free(cookies);
+
+	return r;
 }
 
 __attribute__((format(printf, 1, 2)))
@@ -5336,6 +5362,31 @@ static dm_filemapd_mode_t _stats_get_filemapd_mode(void)
 	return dm_filemapd_mode_from_string(_string_args[FOLLOW_ARG]);
 }
 
+/*
+ * Apply --maxregions to the handle and export it to the environment
+ * of any dmfilemapd started from here, so that the daemon's updates
+ * of the group keep to the same limit.
+ */
+static int _stats_set_max_file_regions(struct dm_stats *dms)
+{
+	char max_str[16];
+
+	if (!_switches[MAX_REGIONS_ARG])
+		return 1;
+
+	dm_stats_set_max_file_regions(dms, (uint64_t) _int_args[MAX_REGIONS_ARG]);
+
+	if ((dm_snprintf(max_str, sizeof(max_str), "%d",
+			 _int_args[MAX_REGIONS_ARG]) < 0) ||
+	    setenv(DM_STATS_MAX_FILE_REGIONS_ENV_VAR_NAME, max_str, 1)) {
+		log_error("Could not set " DM_STATS_MAX_FILE_REGIONS_ENV_VAR_NAME
+			  " environment variable.");
+		return 0;
+	}
+
+	return 1;
+}
+
 static int _stats_create_file(CMD_ARGS)
 {
 	const char *alias, *program_id = DM_STATS_PROGRAM_ID;
@@ -5421,6 +5472,9 @@ static int _stats_create_file(CMD_ARGS)
 		/* force creation of a region with no id */
 		dm_stats_set_program_id(dms, 1, NULL);
 
+	if (!_stats_set_max_file_regions(dms))
+		goto_bad;
+
 	if (group && !_switches[ALIAS_ARG])
 		alias = dm_basename(abspath);
 	else if (group)
@@ -5523,6 +5577,11 @@ static int _stats_create(CMD_ARGS)
 		return _stats_create_file(cmd, subcommand, argc, argv,
 					  names, multiple_devices);
 
+	if (_switches[MAX_REGIONS_ARG]) {
+		log_error("--maxregions requires --filemap.");
+		return 0;
+	}
+
 	if (names)
 		name = names->name;
 	else {
@@ -6034,6 +6093,9 @@ static int _stats_update_file(CMD_ARGS)
 		/* force creation of a region with no id */
 		dm_stats_set_program_id(dms, 1, NULL);
 
+	if (!_stats_set_max_file_regions(dms))
+		goto_bad;
+
 	/*
 	 * Start dmfilemapd - it will test the file descriptor to determine
 	 * whether it is necessary to call dm_stats_update_regions_from_fd().
@@ -6109,6 +6171,7 @@ static int _stats_help(CMD_ARGS);
  *       [--bounds histogram_boundaries] [--precise]
  *       [--alldevices|<device>...]
  *   create --filemap [--nogroup] [--nomonitor] [--follow=mode]
+ *       [--maxregions <nr_regions>]
  *       [--programid <id>] [--userdata <data> ]
  *       [--bounds histogram_boundaries] [--precise] [<file_path>]
  *   delete [--allprograms|--programid id]
@@ -6141,6 +6204,7 @@ static int _stats_help(CMD_ARGS);
 #define SEGMENTS_OPT "[--segments] "
 #define EXTRA_OPTS HIST_OPTS PRECISE_OPTS
 #define FILE_MONITOR_OPTS "[--nomonitor] [--follow mode]"
+#define MAX_REGIONS_OPT "[--maxregions <nr_regions>] "
 #define GROUP_ID_OPT "--groupid <id> "
 #define ALL_PROGS_OPT "[--allprograms|--programid id] "
 #define ALL_REGIONS_OPT "[--allregions|--regionid id] "
@@ -6152,13 +6216,13 @@ static int _stats_help(CMD_ARGS);
 
 /* command options */
 #define CREATE_OPTS REGION_OPTS INDENT ID_OPTS INDENT EXTRA_OPTS INDENT SEGMENTS_OPT
-#define FILEMAP_OPTS "--filemap [--nogroup] " FILE_MONITOR_OPTS INDENT ID_OPTS INDENT EXTRA_OPTS
+#define FILEMAP_OPTS "--filemap [--nogroup] " FILE_MONITOR_OPTS INDENT MAX_REGIONS_OPT ID_OPTS INDENT EXTRA_OPTS
 #define PRINT_OPTS "[--clear] " ALL_PROGS_REGIONS_DEVICES
 #define REPORT_OPTS "[--interval <seconds>] [--count <cnt>]" INDENT \
 "[--units <u>] " SELECT_OPTS INDENT DM_REPORT_OPTS INDENT ALL_PROGS_OPT
 #define GROUP_OPTS "[--alias NAME] --regions <regions>" INDENT ALL_PROGS_OPT ALL_DEVICES_OPT
 #define UNGROUP_OPTS GROUP_ID_OPT ALL_PROGS_OPT INDENT ALL_DEVICES_OPT
-#define UPDATE_OPTS GROUP_ID_OPT INDENT FILE_MONITOR_OPTS " <file_path>"
+#define UPDATE_OPTS GROUP_ID_OPT INDENT FILE_MONITOR_OPTS INDENT MAX_REGIONS_OPT "<file_path>"
 
 /*
  * The 'create' command has two entries in the table, to allow for the
@@ -6234,7 +6298,7 @@ static struct command _dmsetup_commands[] = {
 	{"mknodes", "[<device>...]", 0, -1, 1, 0, _mknodes},
 	{"mangle", "[<device>...]", 0, -1, 1, 0, _mangle},
 	{"udevcreatecookie", "", 0, 0, 0, 0, _udevcreatecookie},
-	{"udevreleasecookie", "[<cookie>]", 0, 1, 0, 0, _udevreleasecookie},
+	{"udevreleasecookie", "[<cookie>...]", 0, -1, 0, 0, _udevreleasecookie},
 	{"udevflags", "<cookie>", 1, 1, 0, 0, _udevflags},
 	{"udevcomplete", "<cookie>", 1, 1, 0, 0, _udevcomplete},
 	{"udevcomplete_all", "[<age_in_minutes>]", 0, 1, 0, 0, _udevcomplete_all},
@@ -6822,6 +6886,7 @@ static int _process_switches(int *argcp, char ***argvp, const char *dev_dir)
 		{"length", 1, &ind, LENGTH_ARG},
 		{"manglename", 1, &ind, MANGLENAME_ARG},
 		{"major", 1, &ind, MAJOR_ARG},
+		{"maxregions", 1, &ind, MAX_REGIONS_ARG},
 		{"minor", 1, &ind, MINOR_ARG},
 		{"mode", 1, &ind, MODE_ARG},
 		{"nameprefixes", 0, &ind, NAMEPREFIXES_ARG},
@@ -7127,6 +7192,15 @@ static int _process_switches(int *argcp, char ***argvp, const char *dev_dir)
 			_switches[SEGMENTS_ARG]++;
 		if (ind == INACTIVE_ARG)
 		       _switches[INACTIVE_ARG]++;
+		if (ind == MAX_REGIONS_ARG) {
+			_switches[MAX_REGIONS_ARG]++;
+			_int_args[MAX_REGIONS_ARG] = atoi(optarg);
+			if (_int_args[MAX_REGIONS_ARG] <= 0) {
+				log_error("Maximum number of regions must be a "
+					  "positive integer.");
+				return 0;
+			}
+		}
 		if (ind == INTERVAL_ARG) {
 			_switches[INTERVAL_ARG]++;
 			_int_args[INTERVAL_ARG] = atoi(optarg);
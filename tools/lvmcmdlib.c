@@ -87,6 +87,15 @@ int lvm2_run(void *handle, const char *cmdline)
 	else if (!strcmp(cmdline, "_dmeventd_thin_command")) {
 		if (setenv(cmdline, find_config_tree_str(cmd, dmeventd_thin_command_CFG, NULL), 1))
 			ret = ECMD_FAILED;
+	} else if (!strcmp(cmdline, "_dmeventd_thin_autoextend")) {
+		char buf[32];
+
+		(void) dm_snprintf(buf, sizeof(buf), "%d %d %d",
+				   find_config_tree_int(cmd, activation_thin_pool_autoextend_lead_time_CFG, NULL),
+				   find_config_tree_int(cmd, activation_thin_pool_autoextend_history_CFG, NULL),
+				   find_config_tree_int(cmd, activation_thin_pool_autoextend_threshold_CFG, NULL));
+		if (setenv(cmdline, buf, 1))
+			ret = ECMD_FAILED;
 	} else
 		ret = lvm_run_command(cmd, argc, argv);
 
@@ -18,6 +18,9 @@
 #include "lvmetad.h"
 #include "lvmcache.h"
 
+#include <dirent.h>
+#include <sys/file.h>
+
 struct pvscan_params {
 	int new_pvs_found;
 	int pvs_found;
@@ -140,6 +143,220 @@ static int _lvmetad_clear_dev(dev_t devno, int32_t major, int32_t minor)
 	return 1;
 }
 
+/*
+ * Scan the device for lvmetad, or drop it from lvmetad when it is gone.
+ */
+static void _pvscan_cache_devno(struct cmd_context *cmd, int32_t major, int32_t minor,
+				struct dm_list *found_vgnames, struct pvscan_aa_params *pp,
+				int *add_errors, int *remove_errors)
+{
+	dev_t devno = MKDEV((dev_t)major, (dev_t)minor);
+	struct device *dev;
+
+	if (!(dev = dev_cache_get_by_devt(devno, cmd->lvmetad_filter))) {
+		/* Remove major:minor from lvmetad. */
+		log_debug("Removing dev %d:%d from lvmetad cache.", major, minor);
+		if (!_lvmetad_clear_dev(devno, major, minor))
+			(*remove_errors)++;
+	} else {
+		/* Add major:minor to lvmetad. */
+		log_debug("Scanning dev %d:%d for lvmetad cache.", major, minor);
+		if (!lvmetad_pvscan_single(cmd, dev, found_vgnames, &pp->changed_vgnames))
+			(*add_errors)++;
+	}
+}
+
+/*
+ * Coalescing of udev events (global/lvmetad_pvscan_coalesce_time).
+ *
+ * Each pvscan --cache leaves the numbers of its devices in the spool
+ * directory and tries to take the spool lock.  The one getting it waits
+ * for the coalesce time so that devices appearing meanwhile are spooled
+ * too, then scans and removes all spooled devices, sending them to
+ * lvmetad in batches.  The dev cache is rescanned before each pass, as
+ * the spooled devices may have appeared after this pvscan started.  The others return at once leaving their devices
+ * to it.  After dropping the lock, the scanning pvscan looks at the spool
+ * again and takes the lock once more if devices were left there while it
+ * was held, so no device is missed.
+ */
+#define PVSCAN_SPOOL_DIR DEFAULT_RUN_DIR "/pvscan"
+#define PVSCAN_SPOOL_LOCK PVSCAN_SPOOL_DIR "/.lock"
+
+static int _pvscan_spool_devno(int32_t major, int32_t minor)
+{
+	char path[PATH_MAX];
+	int fd;
+
+	if (dm_snprintf(path, sizeof(path), PVSCAN_SPOOL_DIR "/%d:%d", major, minor) < 0)
+		return_0;
+
+	if ((fd = open(path, O_WRONLY | O_CREAT, 0600)) < 0) {
+		log_sys_error("open", path);
+		return 0;
+	}
+
+	if (close(fd))
+		log_sys_debug("close", path);
+
+	return 1;
+}
+
+/*
+ * Spool the devices given on the command line.
+ */
+static int _pvscan_spool_args(struct cmd_context *cmd, int argc, char **argv, int devno_args)
+{
+	struct arg_value_group_list *current_group;
+	struct device *dev;
+	const char *pv_name;
+	int32_t major = -1;
+	int32_t minor = -1;
+	int r = 1;
+
+	if (!dm_create_dir(PVSCAN_SPOOL_DIR))
+		return_0;
+
+	while (argc--) {
+		pv_name = *argv++;
+		if (pv_name[0] == '/') {
+			if (!(dev = dev_cache_get(pv_name, NULL))) {
+				log_error("Physical Volume %s not found.", pv_name);
+				r = 0;
+				continue;
+			}
+			major = (int32_t) MAJOR(dev->dev);
+			minor = (int32_t) MINOR(dev->dev);
+		} else if (sscanf(pv_name, "%d:%d", &major, &minor) != 2) {
+			log_warn("WARNING: Failed to parse major:minor from %s, skipping.", pv_name);
+			continue;
+		}
+
+		if (!_pvscan_spool_devno(major, minor))
+			return_0;
+	}
+
+	if (!devno_args)
+		return r;
+
+	dm_list_iterate_items(current_group, &cmd->arg_value_groups) {
+		major = grouped_arg_int_value(current_group->arg_values, major_ARG, major);
+		minor = grouped_arg_int_value(current_group->arg_values, minor_ARG, minor);
+
+		if (major < 0 || minor < 0)
+			continue;
+
+		if (!_pvscan_spool_devno(major, minor))
+			return_0;
+	}
+
+	return r;
+}
+
+/*
+ * Returns the number of spooled devices.  When scan is set, the devices
+ * are removed from the spool and scanned, and only those removed are
+ * counted.
+ */
+static int _pvscan_spooled(struct cmd_context *cmd, int scan,
+			   struct dm_list *found_vgnames, struct pvscan_aa_params *pp,
+			   int *add_errors, int *remove_errors)
+{
+	char path[PATH_MAX];
+	struct dirent *dirent;
+	int32_t major, minor;
+	int count = 0;
+	DIR *d;
+
+	if (!(d = opendir(PVSCAN_SPOOL_DIR))) {
+		log_sys_error("opendir", PVSCAN_SPOOL_DIR);
+		return 0;
+	}
+
+	while ((dirent = readdir(d))) {
+		if (sscanf(dirent->d_name, "%d:%d", &major, &minor) != 2)
+			continue;
+
+		if (!scan) {
+			count++;
+			continue;
+		}
+
+		/* Removed first, so a new event for the device spools it again. */
+		if (dm_snprintf(path, sizeof(path), PVSCAN_SPOOL_DIR "/%s", dirent->d_name) < 0 ||
+		    unlink(path)) {
+			log_sys_error("unlink", dirent->d_name);
+			continue;
+		}
+
+		count++;
+
+		_pvscan_cache_devno(cmd, major, minor, found_vgnames, pp, add_errors, remove_errors);
+
+		if (sigint_caught())
+			break;
+	}
+
+	if (closedir(d))
+		log_sys_debug("closedir", PVSCAN_SPOOL_DIR);
+
+	return count;
+}
+
+/*
+ * Returns 1 when this pvscan scanned the spooled devices, 0 when they are
+ * left to another one and -1 on error.
+ */
+static int _pvscan_coalesce(struct cmd_context *cmd, int coalesce_time,
+			    struct dm_list *found_vgnames, struct pvscan_aa_params *pp,
+			    int *add_errors, int *remove_errors)
+{
+	int stuck = 0;
+	int r = 0;
+	int fd;
+
+	if ((fd = open(PVSCAN_SPOOL_LOCK, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) < 0) {
+		log_sys_error("open", PVSCAN_SPOOL_LOCK);
+		return -1;
+	}
+
+	do {
+		if (flock(fd, LOCK_EX | LOCK_NB)) {
+			if (errno != EWOULDBLOCK) {
+				log_sys_error("flock", PVSCAN_SPOOL_LOCK);
+				r = -1;
+			}
+			break;
+		}
+
+		log_verbose("Waiting %d ms for more devices to scan.", coalesce_time);
+		usleep(coalesce_time * 1000);
+		r = 1;
+
+		while (!sigint_caught() && _pvscan_spooled(cmd, 0, NULL, NULL, NULL, NULL)) {
+			/* Devices spooled meanwhile may be missing from the dev cache. */
+			dev_cache_full_scan(cmd->lvmetad_filter);
+
+			/* Nothing could be removed from the spool, give up. */
+			if (!_pvscan_spooled(cmd, 1, found_vgnames, pp, add_errors, remove_errors)) {
+				stuck = 1;
+				break;
+			}
+		}
+
+		if (flock(fd, LOCK_UN))
+			log_sys_debug("flock", PVSCAN_SPOOL_LOCK);
+	} while (!sigint_caught() && !stuck &&
+		 _pvscan_spooled(cmd, 0, NULL, NULL, NULL, NULL));
+
+	if (close(fd))
+		log_sys_debug("close", PVSCAN_SPOOL_LOCK);
+
+	if (!r)
+		log_verbose("Devices are left to the pvscan scanning the spooled devices.");
+
+	return r;
+}
+
 /*
  * pvscan --cache does not perform any lvmlockd locking, and
  * pvscan --cache -aay skips autoactivation in lockd VGs.
@@ -308,7 +525,7 @@ static int _pvscan_cache(struct cmd_context *cmd, int argc, char **argv)
 	int32_t minor = -1;
 	int devno_args = 0;
 	struct arg_value_group_list *current_group;
-	dev_t devno;
+	int coalesce_time;
 	int do_activate;
 	int all_vgs = 0;
 	int remove_errors = 0;
@@ -434,6 +651,29 @@ static int _pvscan_cache(struct cmd_context *cmd, int argc, char **argv)
 	 *  to drop any devices that have left.)
 	 */
 
+	/*
+	 * Devices found are sent to lvmetad in batches, which also lets
+	 * lvmetad check each VG for completeness only once.
+	 */
+	lvmetad_pv_found_batch_begin(cmd, &found_vgnames, &pp.changed_vgnames);
+
+	coalesce_time = find_config_tree_int(cmd, global_lvmetad_pvscan_coalesce_time_CFG, NULL);
+
+	if (coalesce_time > 0) {
+		if (!_pvscan_spool_args(cmd, argc, argv, devno_args))
+			ret = ECMD_FAILED;
+
+		switch (_pvscan_coalesce(cmd, coalesce_time, &found_vgnames, &pp,
+					 &add_errors, &remove_errors)) {
+		case 1:
+			goto scanned;
+		case 0:
+			/* Autoactivation is done by the pvscan scanning the devices. */
+			goto out;
+		}
+		/* Scan the devices here when the spool cannot be used. */
+	}
+
 	if (argc || devno_args)
 		log_verbose("Scanning devices on command line.");
 
@@ -461,19 +701,9 @@ static int _pvscan_cache(struct cmd_context *cmd, int argc, char **argv)
 				log_warn("WARNING: Failed to parse major:minor from %s, skipping.", pv_name);
 				continue;
 			}
-			devno = MKDEV((dev_t)major, (dev_t)minor);
 
-			if (!(dev = dev_cache_get_by_devt(devno, cmd->lvmetad_filter))) {
-				/* Remove major:minor from lvmetad. */
-				log_debug("Removing dev %d:%d from lvmetad cache.", major, minor);
-				if (!_lvmetad_clear_dev(devno, major, minor))
-					remove_errors++;
-			} else {
-				/* Add major:minor to lvmetad. */
-				log_debug("Scanning dev %d:%d for lvmetad cache.", major, minor);
-				if (!lvmetad_pvscan_single(cmd, dev, &found_vgnames, &pp.changed_vgnames))
-					add_errors++;
-			}
+			_pvscan_cache_devno(cmd, major, minor, &found_vgnames, &pp,
+					    &add_errors, &remove_errors);
 		}
 
 		if (sigint_caught()) {
@@ -483,7 +713,7 @@ static int _pvscan_cache(struct cmd_context *cmd, int argc, char **argv)
 	}
 
 	if (!devno_args)
-		goto activate;
+		goto scanned;
 
 	/* Process any grouped --major --minor args */
 	dm_list_iterate_items(current_group, &cmd->arg_value_groups) {
@@ -493,19 +723,8 @@ static int _pvscan_cache(struct cmd_context *cmd, int argc, char **argv)
 		if (major < 0 || minor < 0)
 			continue;
 
-		devno = MKDEV((dev_t)major, (dev_t)minor);
-
-		if (!(dev = dev_cache_get_by_devt(devno, cmd->lvmetad_filter))) {
-			/* Remove major:minor from lvmetad. */
-			log_debug("Removing dev %d:%d from lvmetad cache.", major, minor);
-			if (!_lvmetad_clear_dev(devno, major, minor))
-				remove_errors++;
-		} else {
-			/* Add major:minor to lvmetad. */
-			log_debug("Scanning dev %d:%d for lvmetad cache.", major, minor);
-			if (!lvmetad_pvscan_single(cmd, dev, &found_vgnames, &pp.changed_vgnames))
-				add_errors++;
-		}
+		_pvscan_cache_devno(cmd, major, minor, &found_vgnames, &pp,
+				    &add_errors, &remove_errors);
 
 		if (sigint_caught()) {
 			ret = ECMD_FAILED;
@@ -513,6 +732,10 @@ static int _pvscan_cache(struct cmd_context *cmd, int argc, char **argv)
 		}
 	}
 
+scanned:
+	if (!lvmetad_pv_found_batch_end())
+		add_errors++;
+
 	/*
 	 * In the process of scanning devices, lvmetad may have become
 	 * disabled.  If so, revert to scanning for the autoactivation step.
@@ -534,6 +757,10 @@ activate:
 		ret = _pvscan_autoactivate(cmd, &pp, all_vgs, &found_vgnames);
 
 out:
+	/* Only queued PVs of an interrupted scan are left to send. */
+	if (!lvmetad_pv_found_batch_end())
+		add_errors++;
+
 	if (remove_errors || add_errors || pp.activate_errors)
 		ret = ECMD_FAILED;
 
@@ -1087,6 +1087,127 @@ int lv_change_activate(struct cmd_context *cmd, struct logical_volume *lv,
 	return r;
 }
 
+/*
+ * Take activation locks for all LVs (struct lv_list) from the list.
+ * The VG-wide activation lock covers LV types that already need it
+ * and serialises with other commands activating them.
+ */
+static int _lvs_activation_lock(struct cmd_context *cmd, struct volume_group *vg,
+				struct dm_list *lvs, int lock)
+{
+	uint32_t flags = lock ? LCK_ACTIVATE_LOCK : LCK_ACTIVATE_UNLOCK;
+	struct dm_list *lvh;
+	struct lv_list *lvl;
+	int r = 1;
+
+	if (vg_write_lock_held())
+		return 1;
+
+	if (lock && !lock_vol(cmd, vg->name, flags, NULL))
+		return_0;
+
+	dm_list_iterate_items(lvl, lvs) {
+		if (lv_type_requires_activation_lock(lvl->lv))
+			continue;
+		if (!lock_vol(cmd, lvl->lv->lvid.s, flags, lvl->lv)) {
+			stack;
+			r = 0;
+			if (!lock)
+				continue;
+			/* Release already taken locks */
+			dm_list_uniterate(lvh, lvs, &lvl->list) {
+				lvl = dm_list_item(lvh, struct lv_list);
+				if (!lv_type_requires_activation_lock(lvl->lv) &&
+				    !lock_vol(cmd, lvl->lv->lvid.s, LCK_ACTIVATE_UNLOCK, lvl->lv))
+					stack;
+			}
+			lock = 0;
+			break;
+		}
+	}
+
+	if (!lock && !lock_vol(cmd, vg->name, LCK_ACTIVATE_UNLOCK, NULL)) {
+		stack;
+		r = 0;
+	}
+
+	return r;
+}
+
+/*
+ * Change activation of all LVs (struct lv_list) of one local VG
+ * with a single dependency tree.  Only plain local (de)activation is
+ * handled here, so callers need to check lvs_change_activate_supported()
+ * and are expected to retry with lv_change_activate() for each LV
+ * when this fails.  LVs that failed on their own, already reported,
+ * are added to the failed list and are not to be retried.
+ */
+int lvs_change_activate(struct cmd_context *cmd, struct volume_group *vg,
+			struct dm_list *lvs, activation_change_t activate,
+			struct dm_list *failed)
+{
+	int r;
+
+	if (dm_list_empty(lvs))
+		return 1;
+
+	if (is_change_activating(activate) &&
+	    lvmcache_found_duplicate_pvs() &&
+	    vg_has_duplicate_pvs(vg)) {
+		log_debug_activation("Skipping bulk activation of VG %s with duplicate PVs.",
+				     vg->name);
+		return 0;
+	}
+
+	log_verbose("%s %d logical volumes in volume group %s at once.",
+		    is_change_activating(activate) ? "Activating" : "Deactivating",
+		    dm_list_size(lvs), vg->name);
+
+	if (!_lvs_activation_lock(cmd, vg, lvs, 1))
+		return_0;
+
+	if (is_change_activating(activate))
+		r = lvs_activate(cmd, lvs, (activate == CHANGE_AEY) ? 1 : 0, failed);
+	else
+		r = lvs_deactivate(cmd, lvs);
+
+	if (!_lvs_activation_lock(cmd, vg, lvs, 0))
+		stack;
+
+	if (!r)
+		return_0;
+
+	set_lv_notify(vg->cmd);
+
+	return 1;
+}
+
+/*
+ * Bulk activation bypasses the locking layer, so it is usable only
+ * when the activation would be done locally by this command anyway.
+ */
+int lvs_change_activate_supported(struct cmd_context *cmd, struct volume_group *vg,
+				  activation_change_t activate)
+{
+	if (!find_config_tree_bool(cmd, activation_bulk_activation_CFG, NULL))
+		return 0;
+
+	if (locking_is_clustered() || vg_is_clustered(vg) || is_lockd_type(vg->lock_type))
+		return 0;
+
+	switch (activate) {
+	case CHANGE_AY:
+	case CHANGE_AAY:
+	case CHANGE_ALY:
+	case CHANGE_AEY:
+	case CHANGE_AN:
+	case CHANGE_ALN:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
 int lv_refresh(struct cmd_context *cmd, struct logical_volume *lv)
 {
 	struct logical_volume *snapshot_lv;
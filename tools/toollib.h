@@ -199,6 +199,11 @@ int vgcreate_params_set_from_args(struct cmd_context *cmd,
 				  struct vgcreate_params *vp_def);
 int lv_change_activate(struct cmd_context *cmd, struct logical_volume *lv,
 		       activation_change_t activate);
+int lvs_change_activate(struct cmd_context *cmd, struct volume_group *vg,
+			struct dm_list *lvs, activation_change_t activate,
+			struct dm_list *failed);
+int lvs_change_activate_supported(struct cmd_context *cmd, struct volume_group *vg,
+				  activation_change_t activate);
 int lv_refresh(struct cmd_context *cmd, struct logical_volume *lv);
 int vg_refresh_visible(struct cmd_context *cmd, struct volume_group *vg);
 void lv_spawn_background_polling(struct cmd_context *cmd,
@@ -78,44 +78,103 @@ static int _poll_lvs_in_vg(struct cmd_context *cmd,
 	return count;
 }
 
-static int _activate_lvs_in_vg(struct cmd_context *cmd, struct volume_group *vg,
-			       activation_change_t activate)
+/* Returns the LV to (de)activate for an LV of the VG, or NULL to skip it. */
+static struct logical_volume *_lv_to_change(struct cmd_context *cmd, struct logical_volume *lv,
+					    activation_change_t activate)
+{
+	if (!lv_is_visible(lv))
+		return NULL;
+
+	/* If LV is sparse, activate origin instead */
+	if (lv_is_cow(lv) && lv_is_virtual_origin(origin_from_cow(lv)))
+		lv = origin_from_cow(lv);
+
+	/* Only request activation of snapshot origin devices */
+	if (lv_is_snapshot(lv) || lv_is_cow(lv))
+		return NULL;
+
+	/* Only request activation of mirror LV */
+	if (lv_is_mirror_image(lv) || lv_is_mirror_log(lv))
+		return NULL;
+
+	if (lv_activation_skip(lv, activate, arg_is_set(cmd, ignoreactivationskip_ARG)))
+		return NULL;
+
+	if ((activate == CHANGE_AAY) &&
+	    !lv_passes_auto_activation_filter(cmd, lv))
+		return NULL;
+
+	return lv;
+}
+
+/*
+ * With lvmlockd, the locks of all the LVs to activate are sent in
+ * one request before the activation, and the unlocks of the
+ * deactivated LVs are sent together afterwards.
+ */
+static int _lock_lvs_in_vg(struct cmd_context *cmd, struct volume_group *vg,
+			   activation_change_t activate)
 {
 	struct lv_list *lvl;
 	struct logical_volume *lv;
-	int count = 0, expected_count = 0, r = 1;
 
-	sigint_allow();
-	dm_list_iterate_items(lvl, &vg->lvs) {
-		if (sigint_caught())
-			return_0;
+	if (!lockd_lv_batch_begin(cmd, vg, !is_change_activating(activate)))
+		return 0;
 
-		lv = lvl->lv;
+	if (!is_change_activating(activate))
+		return 1;
 
-		if (!lv_is_visible(lv))
-			continue;
+	/* Failed locks are reported when the LV is activated. */
+	dm_list_iterate_items(lvl, &vg->lvs)
+		if ((lv = _lv_to_change(cmd, lvl->lv, activate)) && !lv_is_cache_pool(lv))
+			(void) lv_active_change_lock(cmd, lv, activate);
 
-		/* If LV is sparse, activate origin instead */
-		if (lv_is_cow(lv) && lv_is_virtual_origin(origin_from_cow(lv)))
-			lv = origin_from_cow(lv);
+	(void) lockd_lv_batch_send(cmd);
 
-		/* Only request activation of snapshot origin devices */
-		if (lv_is_snapshot(lv) || lv_is_cow(lv))
-			continue;
+	return 1;
+}
 
-		/* Only request activation of mirror LV */
-		if (lv_is_mirror_image(lv) || lv_is_mirror_log(lv))
-			continue;
+static int _activate_lvs_in_vg(struct cmd_context *cmd, struct volume_group *vg,
+			       activation_change_t activate)
+{
+	struct lv_list *lvl, *bulk_lvl;
+	struct logical_volume *lv;
+	struct dm_list bulk_lvs, failed_lvs;
+	int bulk = lvs_change_activate_supported(cmd, vg, activate);
+	int lock_batch = 0;
+	int count = 0, expected_count = 0, r = 1;
 
-		if (lv_activation_skip(lv, activate, arg_is_set(cmd, ignoreactivationskip_ARG)))
-			continue;
+	dm_list_init(&bulk_lvs);
+	dm_list_init(&failed_lvs);
+
+	if (is_lockd_type(vg->lock_type))
+		lock_batch = _lock_lvs_in_vg(cmd, vg, activate);
+
+	sigint_allow();
+	dm_list_iterate_items(lvl, &vg->lvs) {
+		if (sigint_caught()) {
+			r = 0;
+			stack;
+			goto out;
+		}
 
-		if ((activate == CHANGE_AAY) &&
-		    !lv_passes_auto_activation_filter(cmd, lv))
+		if (!(lv = _lv_to_change(cmd, lvl->lv, activate)))
 			continue;
 
 		expected_count++;
 
+		/* Collect simple cases for (de)activation with a single tree */
+		if (bulk && !lv_is_cache_pool(lv) && !lv_is_merging_origin(lv)) {
+			if (!(bulk_lvl = dm_pool_alloc(cmd->mem, sizeof(*bulk_lvl)))) {
+				log_error("Failed to allocate bulk activation list.");
+				r = 0;
+				goto out;
+			}
+			bulk_lvl->lv = lv;
+			dm_list_add(&bulk_lvs, &bulk_lvl->list);
+			continue;
+		}
+
 		if (!lv_change_activate(cmd, lv, activate)) {
 			if (!lv_is_active_exclusive_remotely(lv))
 				stack;
@@ -134,8 +193,45 @@ static int _activate_lvs_in_vg(struct cmd_context *cmd, struct volume_group *vg,
 		count++;
 	}
 
+	if (!dm_list_empty(&bulk_lvs)) {
+		if (lvs_change_activate(cmd, vg, &bulk_lvs, activate, &failed_lvs))
+			count += dm_list_size(&bulk_lvs) - dm_list_size(&failed_lvs);
+		else {
+			log_verbose("Retrying %s of logical volumes in volume group %s one by one.",
+				    is_change_activating(activate) ? "activation" : "deactivation",
+				    vg->name);
+			dm_list_iterate_items(bulk_lvl, &bulk_lvs) {
+				if (sigint_caught()) {
+					r = 0;
+					stack;
+					goto out;
+				}
+
+				/* Already reported by the bulk activation */
+				if (find_lv_in_lv_list(&failed_lvs, bulk_lvl->lv))
+					continue;
+
+				if (!lv_change_activate(cmd, bulk_lvl->lv, activate)) {
+					stack;
+					continue;
+				}
+
+				count++;
+			}
+		}
+	}
+
+out:
 	sigint_restore();
 
+	if (lock_batch) {
+		(void) lockd_lv_batch_send(cmd);
+		lockd_lv_batch_end(cmd);
+	}
+
+	if (!r)
+		return 0;
+
 	/* Wait until devices are available */
 	if (!sync_local_dev_names(vg->cmd)) {
 		log_error("Failed to sync local devices for VG %s.", vg->name);
@@ -157,7 +253,11 @@ static int _vgchange_monitoring(struct cmd_context *cmd, struct volume_group *vg
 
 	if (lvs_in_vg_activated(vg) &&
 	    dmeventd_monitor_mode() != DMEVENTD_MONITOR_IGNORE) {
-		if (!_monitor_lvs_in_vg(cmd, vg, dmeventd_monitor_mode(), &monitored))
+		/* Nothing is deactivated, so unmonitoring can be batched too. */
+		if (!monitor_dev_for_events_batch(cmd, 1) ||
+		    !_monitor_lvs_in_vg(cmd, vg, dmeventd_monitor_mode(), &monitored))
+			r = 0;
+		if (!monitor_dev_for_events_flush(cmd))
 			r = 0;
 		log_print_unless_silent("%d logical volume(s) in volume group "
 					"\"%s\" %smonitored",
@@ -223,6 +323,10 @@ int vgchange_activate(struct cmd_context *cmd, struct volume_group *vg,
 	if (do_activate)
 		check_current_backup(vg);
 
+	/* Register all activated LVs with dmeventd at once. */
+	if (!monitor_dev_for_events_batch(cmd, 0))
+		r = 0;
+
 	if (do_activate && (active = lvs_in_vg_activated(vg))) {
 		log_verbose("%d logical volume(s) in volume group \"%s\" "
 			    "already active", active, vg->name);
@@ -241,6 +345,11 @@ int vgchange_activate(struct cmd_context *cmd, struct volume_group *vg,
 		r = 0;
 	}
 
+	if (!monitor_dev_for_events_flush(cmd)) {
+		stack;
+		r = 0;
+	}
+
 	/* Print message only if there was not found a missing VG */
 	log_print_unless_silent("%d logical volume(s) in volume group \"%s\" now active",
 				lvs_in_vg_activated(vg), vg->name);